@@ -0,0 +1,103 @@
+const express = require('express');
+const http = require('http');
+const Redis = require('ioredis');
+require('dotenv').config();
+
+// Device ingress listener: device telemetry, heartbeats and alarms on their
+// own port/process, without the dashboard middleware stack (access logging,
+// 50mb parsers, IP rate limiting, audit interception, license checks).
+// Point firmware or a reverse-proxy rule for
+// /api/devices/*/(telemetry|heartbeat|alarm) at DEVICE_INGRESS_PORT.
+const TelemetryProcessor = require('./src/services/telemetryProcessor');
+const DeviceIngressService = require('./src/services/deviceIngressService');
+const BroadcastRelay = require('./src/services/broadcastRelay');
+const livenessService = require('./src/services/livenessService');
+const deviceQuotaService = require('./src/services/deviceQuotaService');
+const deviceConfigService = require('./src/services/deviceConfigService');
+const createDeviceIngressRouter = require('./src/routes/deviceIngress');
+const logger = require('./src/utils/logger');
+
+const app = express();
+const server = http.createServer(app);
+
+const redis = new Redis({
+    host: process.env.REDIS_HOST || 'localhost',
+    port: process.env.REDIS_PORT || 6379,
+    password: process.env.REDIS_PASSWORD,
+    retryDelayOnFailover: 100,
+    enableOfflineQueue: false,
+});
+
+// Broadcasts are relayed to the API server's socket.io over Redis
+const broadcastRelay = new BroadcastRelay(redis);
+const telemetryProcessor = new TelemetryProcessor(redis, broadcastRelay);
+const deviceIngress = new DeviceIngressService(telemetryProcessor);
+
+const PORT = process.env.DEVICE_INGRESS_PORT || 3002;
+
+app.set('trust proxy', 1);
+app.disable('x-powered-by');
+
+app.use('/api/devices', createDeviceIngressRouter(deviceIngress));
+
+app.get('/health', (req, res) => {
+    res.json({
+        status: 'OK',
+        timestamp: new Date().toISOString(),
+        uptime: process.uptime(),
+        services: {
+            ingress: deviceIngress.getStatus(),
+            relay: broadcastRelay.getConnectionStats().relay,
+            liveness: livenessService.getStatus(),
+            deviceConfig: deviceConfigService.getStatus()
+        }
+    });
+});
+
+app.use((req, res) => {
+    res.status(404).json({ error: 'Not found' });
+});
+
+// Body parser errors (oversized or malformed payloads) keep their status
+app.use((err, req, res, next) => {
+    if (err.status && err.status < 500) {
+        return res.status(err.status).json({ error: err.type === 'entity.too.large' ? 'Payload too large' : 'Malformed body' });
+    }
+    logger.error('Device ingress error:', err);
+    res.status(500).json({ error: 'Something went wrong!' });
+});
+
+process.on('SIGTERM', async () => {
+    logger.info('SIGTERM received, draining device ingress');
+    server.close();
+    await deviceIngress.shutdown();
+    await telemetryProcessor.shutdown();
+    await livenessService.shutdown();
+    await deviceQuotaService.shutdown();
+    await deviceConfigService.shutdown();
+    redis.disconnect();
+    process.exit(0);
+});
+
+server.listen(PORT, async () => {
+    logger.info(`Device ingress listening on port ${PORT}`);
+
+    // Device quotas are shared with the API server through Redis
+    deviceQuotaService.start({ redis });
+
+    // Heartbeat config snapshots are invalidated together with the API server
+    deviceConfigService.start({ redis }).catch((error) => {
+        logger.error('Device config invalidation failed to start:', error);
+    });
+
+    // Schema and migrations are owned by the API server
+    try {
+        await livenessService.start({ websocketService: broadcastRelay });
+    } catch (error) {
+        logger.error('Liveness tracking failed to start:', error);
+    }
+
+    deviceIngress.start();
+});
+
+module.exports = { app, server };
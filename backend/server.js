@@ -42,6 +42,11 @@ const WebSocketService = require('./src/services/websocketService');
 const AlertEscalationService = require('./src/services/alertEscalationService');
 const TelemetryProcessor = require('./src/services/telemetryProcessor');
 const MQTTService = require('./src/services/mqttService');
+const livenessService = require('./src/services/livenessService');
+const deviceQuotaService = require('./src/services/deviceQuotaService');
+const notificationDispatchService = require('./src/services/notificationDispatchService');
+const deviceConfigService = require('./src/services/deviceConfigService');
+const BroadcastRelay = require('./src/services/broadcastRelay');
 const licenseService = require('./src/services/licenseService');
 const UserRateLimiter = require('./src/middleware/userRateLimit');
 const { auditLogger } = require('./src/middleware/auditMiddleware');
@@ -91,15 +96,29 @@ app.use(morgan('combined'));
 app.use(express.json({ limit: '50mb' }));
 app.use(express.urlencoded({ extended: true, limit: '50mb' }));
 
-// IP-based rate limiting - generous limits for development
+// IP-based rate limiting - generous limits for development.
+// Device routes are limited per device id (deviceQuotaService) under a much
+// higher per-IP ceiling: devices on one site usually share a NAT address,
+// but the routes are unauthenticated and the id is chosen by the caller, so
+// the ceiling is what stops one client cycling through made-up ids.
 const limiter = rateLimit({
     windowMs: 15 * 60 * 1000, // 15 minutes
     max: 5000, // Increased from 1000 to 5000 requests per window
     message: 'Too many requests from this IP',
     standardHeaders: true,
     legacyHeaders: false,
+    skip: (req) => deviceQuotaService.isDeviceRoute(req.path),
+});
+const deviceRouteLimiter = rateLimit({
+    windowMs: 15 * 60 * 1000,
+    max: parseInt(process.env.DEVICE_ROUTE_IP_MAX_REQUESTS, 10) || 30000,
+    message: 'Too many device requests from this IP',
+    standardHeaders: true,
+    legacyHeaders: false,
+    skip: (req) => !deviceQuotaService.isDeviceRoute(req.path),
 });
 app.use('/api/', limiter);
+app.use('/api/', deviceRouteLimiter);
 
 // Audit logging middleware - logs all API actions for security and compliance
 app.use(auditLogger({
@@ -127,8 +146,12 @@ app.use('/api/license', licenseRoutes);
 app.use(addLicenseHeaders);
 
 // Apply user-based rate limiting to all other API routes
-// This comes after auth and license routes to avoid blocking license activation
-app.use('/api/', userRateLimiter.middleware());
+// This comes after auth and license routes to avoid blocking license activation.
+// Device routes have no user; they are covered by deviceRouteLimiter above.
+const userRateLimit = userRateLimiter.middleware();
+app.use('/api/', (req, res, next) => (
+    deviceQuotaService.isDeviceRoute(req.path) ? next() : userRateLimit(req, res, next)
+));
 
 // Routes that require a valid license
 const protectedRoutes = [
@@ -178,6 +201,11 @@ io.on('connection', (socket) => {
     websocketService.handleConnection(socket);
 });
 
+// Replay broadcasts from the standalone device ingress (device-ingress.js)
+BroadcastRelay.subscribe(redis, websocketService).catch((error) => {
+    logger.warn('Device ingress broadcast relay unavailable:', error.message);
+});
+
 // Scheduled tasks
 // Alert escalation check every minute
 cron.schedule('* * * * *', async () => {
@@ -188,21 +216,22 @@ cron.schedule('* * * * *', async () => {
     }
 });
 
-// Device offline check every 5 minutes
-cron.schedule('*/5 * * * *', async () => {
+// Cleanup old telemetry data daily at 2 AM
+cron.schedule('0 2 * * *', async () => {
     try {
-        await telemetryProcessor.checkOfflineDevices();
+        await telemetryProcessor.cleanupOldTelemetry();
     } catch (error) {
-        logger.error('Offline device check error:', error);
+        logger.error('Telemetry cleanup error:', error);
     }
 });
 
-// Cleanup old telemetry data daily at 2 AM
-cron.schedule('0 2 * * *', async () => {
+// Drop week-old sent and failed notifications daily at 2:30 AM
+cron.schedule('30 2 * * *', async () => {
     try {
-        await telemetryProcessor.cleanupOldTelemetry();
+        const removed = await notificationDispatchService.cleanup();
+        logger.info(`Notification queue cleanup removed ${removed} rows`);
     } catch (error) {
-        logger.error('Telemetry cleanup error:', error);
+        logger.error('Notification queue cleanup error:', error);
     }
 });
 
@@ -214,7 +243,12 @@ app.get('/health', (req, res) => {
         version: '2.0.0',
         uptime: process.uptime(),
         services: {
-            mqtt: mqttService.getStatus()
+            mqtt: mqttService.getStatus(),
+            websocket: websocketService.getConnectionStats().telemetry,
+            liveness: livenessService.getStatus(),
+            deviceQuota: deviceQuotaService.getStatus(),
+            notifications: notificationDispatchService.getStatus(),
+            deviceConfig: deviceConfigService.getStatus()
         }
     });
 });
@@ -229,6 +263,12 @@ app.use((err, req, res, next) => {
 process.on('SIGTERM', async () => {
     logger.info('SIGTERM received, shutting down gracefully');
     await mqttService.shutdown();
+    websocketService.shutdown();
+    await telemetryProcessor.shutdown();
+    await livenessService.shutdown();
+    await deviceQuotaService.shutdown();
+    await notificationDispatchService.shutdown();
+    await deviceConfigService.shutdown();
     server.close(() => {
         redis.disconnect();
         process.exit(0);
@@ -246,6 +286,29 @@ server.listen(PORT, async () => {
         logger.error('Database initialization failed:', error);
     }
 
+    deviceQuotaService.start({ redis });
+    // Digest windows are shared with other API processes through Redis
+    notificationDispatchService.start({ redis });
+
+    // Heartbeat config snapshots are invalidated together with ingress workers
+    deviceConfigService.start({ redis }).catch((error) => {
+        logger.error('Device config invalidation failed to start:', error);
+    });
+
+    // Arm device liveness timers (replaces the periodic offline scan)
+    try {
+        await livenessService.start({ websocketService });
+    } catch (error) {
+        logger.error('Liveness tracking failed to start:', error);
+    }
+
+    // Make sure upcoming daily telemetry partitions exist
+    try {
+        await telemetryProcessor.ensureTelemetryPartitions();
+    } catch (error) {
+        logger.error('Telemetry partition maintenance failed:', error);
+    }
+
     // Initialize license service (validation, grace period timers)
     try {
         await licenseService.initialize();
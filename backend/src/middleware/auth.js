@@ -1,6 +1,7 @@
 const jwt = require('jsonwebtoken');
 const db = require('../models/database');
 const logger = require('../utils/logger');
+const livenessService = require('../services/livenessService');
 
 // Middleware to verify JWT token
 const authenticateToken = async (req, res, next) => {
@@ -126,11 +127,8 @@ const authenticateDevice = async (req, res, next) => {
 
         req.device = result.rows[0];
 
-        // Update last heartbeat
-        await db.query(
-            'UPDATE devices SET last_heartbeat = NOW(), ip_address = $2 WHERE id = $1',
-            [deviceId, req.ip]
-        );
+        // Re-arm liveness; last_heartbeat is persisted in batches
+        livenessService.touch(deviceId, req.ip);
 
         next();
     } catch (error) {
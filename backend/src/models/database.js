@@ -74,6 +74,27 @@ const transaction = async (callback) => {
     }
 };
 
+// Stream a query's rows through a server-side cursor in batches. onRows is
+// awaited before the next FETCH, so slow consumers apply backpressure and
+// memory stays bounded to one batch. Returning false from onRows stops early.
+const cursorQuery = async (text, params, onRows, { batchSize = 5000 } = {}) => {
+    return transaction(async (client) => {
+        await client.query(`DECLARE stream_cursor NO SCROLL CURSOR FOR ${text}`, params);
+
+        let total = 0;
+        while (true) {
+            const batch = await client.query(`FETCH FORWARD ${batchSize} FROM stream_cursor`);
+            if (batch.rows.length === 0) break;
+
+            total += batch.rows.length;
+            if (await onRows(batch.rows) === false || batch.rows.length < batchSize) break;
+        }
+
+        await client.query('CLOSE stream_cursor');
+        return total;
+    });
+};
+
 // Database health check
 const healthCheck = async () => {
     try {
@@ -919,6 +940,361 @@ const runMigrations = async () => {
                 END;
                 $$ LANGUAGE plpgsql;
             `
+        },
+        {
+            name: '007_partition_telemetry_and_rollups',
+            sql: `
+                -- Create (or attach) the daily telemetry partition for one day.
+                -- Rows that already landed in the default partition for that
+                -- day are moved into the new partition before it is attached.
+                CREATE OR REPLACE FUNCTION ensure_telemetry_partition(day DATE)
+                RETURNS TEXT AS $$
+                DECLARE
+                    partition_name TEXT := 'telemetry_p' || TO_CHAR(day, 'YYYYMMDD');
+                BEGIN
+                    IF to_regclass(partition_name) IS NOT NULL THEN
+                        RETURN partition_name;
+                    END IF;
+
+                    EXECUTE format('CREATE TABLE %I (LIKE telemetry INCLUDING DEFAULTS)', partition_name);
+
+                    IF to_regclass('telemetry_default') IS NOT NULL THEN
+                        EXECUTE format(
+                            'WITH moved AS (DELETE FROM telemetry_default WHERE timestamp >= %L AND timestamp < %L RETURNING *)
+                             INSERT INTO %I SELECT * FROM moved',
+                            day, day + 1, partition_name
+                        );
+                    END IF;
+
+                    EXECUTE format(
+                        'ALTER TABLE telemetry ATTACH PARTITION %I FOR VALUES FROM (%L) TO (%L)',
+                        partition_name, day, day + 1
+                    );
+
+                    RETURN partition_name;
+                END;
+                $$ LANGUAGE plpgsql;
+
+                -- Convert the heap table to a partitioned one, copying existing rows
+                DO $$
+                DECLARE
+                    partition_day DATE;
+                BEGIN
+                    IF (SELECT relkind FROM pg_class WHERE oid = 'telemetry'::regclass) = 'p' THEN
+                        RETURN;
+                    END IF;
+
+                    ALTER TABLE telemetry RENAME TO telemetry_unpartitioned;
+                    ALTER SEQUENCE IF EXISTS telemetry_id_seq RENAME TO telemetry_unpartitioned_id_seq;
+
+                    CREATE TABLE telemetry (
+                        id BIGSERIAL,
+                        device_id VARCHAR(50) REFERENCES devices(id),
+                        device_sensor_id INTEGER REFERENCES device_sensors(id),
+                        raw_value DECIMAL(10, 4) NOT NULL,
+                        processed_value DECIMAL(10, 4) NOT NULL,
+                        timestamp TIMESTAMP NOT NULL DEFAULT CURRENT_TIMESTAMP,
+                        metadata JSONB,
+                        PRIMARY KEY (id, timestamp)
+                    ) PARTITION BY RANGE (timestamp);
+
+                    CREATE TABLE telemetry_default PARTITION OF telemetry DEFAULT;
+
+                    FOR partition_day IN
+                        SELECT DISTINCT DATE_TRUNC('day', timestamp)::date FROM telemetry_unpartitioned
+                        WHERE timestamp IS NOT NULL
+                    LOOP
+                        PERFORM ensure_telemetry_partition(partition_day);
+                    END LOOP;
+
+                    INSERT INTO telemetry (id, device_id, device_sensor_id, raw_value, processed_value, timestamp, metadata)
+                    SELECT id, device_id, device_sensor_id, raw_value, processed_value,
+                           COALESCE(timestamp, CURRENT_TIMESTAMP), metadata
+                    FROM telemetry_unpartitioned;
+
+                    PERFORM setval('telemetry_id_seq', COALESCE((SELECT MAX(id) FROM telemetry), 0) + 1, false);
+
+                    DROP TABLE telemetry_unpartitioned;
+
+                    CREATE INDEX IF NOT EXISTS idx_telemetry_device_sensor_time ON telemetry(device_id, device_sensor_id, timestamp DESC);
+                    CREATE INDEX IF NOT EXISTS idx_telemetry_timestamp ON telemetry(timestamp DESC);
+                END $$;
+
+                SELECT ensure_telemetry_partition((CURRENT_DATE + offset_days)::date)
+                FROM generate_series(0, 3) AS offset_days;
+
+                -- Rollup tiers maintained at ingest. Sums (not averages) are
+                -- stored so buckets can be merged and re-aggregated exactly.
+                CREATE TABLE IF NOT EXISTS telemetry_rollup_1m (
+                    device_sensor_id INTEGER NOT NULL REFERENCES device_sensors(id) ON DELETE CASCADE,
+                    bucket TIMESTAMP NOT NULL,
+                    device_id VARCHAR(50) NOT NULL REFERENCES devices(id) ON DELETE CASCADE,
+                    sample_count INTEGER NOT NULL,
+                    sum_value DOUBLE PRECISION NOT NULL,
+                    sum_squares DOUBLE PRECISION NOT NULL,
+                    min_value DOUBLE PRECISION NOT NULL,
+                    max_value DOUBLE PRECISION NOT NULL,
+                    PRIMARY KEY (device_sensor_id, bucket)
+                );
+                CREATE TABLE IF NOT EXISTS telemetry_rollup_1h (LIKE telemetry_rollup_1m INCLUDING ALL);
+                CREATE TABLE IF NOT EXISTS telemetry_rollup_1d (LIKE telemetry_rollup_1m INCLUDING ALL);
+
+                CREATE INDEX IF NOT EXISTS idx_telemetry_rollup_1m_device ON telemetry_rollup_1m(device_id, bucket);
+                CREATE INDEX IF NOT EXISTS idx_telemetry_rollup_1h_device ON telemetry_rollup_1h(device_id, bucket);
+                CREATE INDEX IF NOT EXISTS idx_telemetry_rollup_1d_device ON telemetry_rollup_1d(device_id, bucket);
+
+                -- Backfill tiers from raw history
+                INSERT INTO telemetry_rollup_1m
+                SELECT device_sensor_id, DATE_TRUNC('minute', timestamp), device_id, COUNT(*),
+                       SUM(processed_value), SUM(processed_value * processed_value),
+                       MIN(processed_value), MAX(processed_value)
+                FROM telemetry
+                WHERE device_sensor_id IS NOT NULL AND timestamp > NOW() - INTERVAL '7 days'
+                GROUP BY device_sensor_id, DATE_TRUNC('minute', timestamp), device_id
+                ON CONFLICT DO NOTHING;
+
+                INSERT INTO telemetry_rollup_1h
+                SELECT device_sensor_id, DATE_TRUNC('hour', timestamp), device_id, COUNT(*),
+                       SUM(processed_value), SUM(processed_value * processed_value),
+                       MIN(processed_value), MAX(processed_value)
+                FROM telemetry
+                WHERE device_sensor_id IS NOT NULL
+                GROUP BY device_sensor_id, DATE_TRUNC('hour', timestamp), device_id
+                ON CONFLICT DO NOTHING;
+
+                -- Older hourly aggregates (mean only, so variance is approximated as zero within the hour)
+                DO $$
+                BEGIN
+                    IF to_regclass('telemetry_hourly_aggregates') IS NOT NULL THEN
+                        INSERT INTO telemetry_rollup_1h
+                        SELECT device_sensor_id, hour_timestamp, device_id, sample_count,
+                               avg_value * sample_count, avg_value * avg_value * sample_count,
+                               min_value, max_value
+                        FROM telemetry_hourly_aggregates
+                        WHERE device_sensor_id IS NOT NULL AND sample_count > 0
+                        ON CONFLICT DO NOTHING;
+                    END IF;
+                END $$;
+
+                INSERT INTO telemetry_rollup_1d
+                SELECT device_sensor_id, DATE_TRUNC('day', bucket), device_id, SUM(sample_count),
+                       SUM(sum_value), SUM(sum_squares), MIN(min_value), MAX(max_value)
+                FROM telemetry_rollup_1h
+                GROUP BY device_sensor_id, DATE_TRUNC('day', bucket), device_id
+                ON CONFLICT DO NOTHING;
+            `
+        },
+        {
+            name: '008_add_rollup_sketches',
+            sql: `
+                -- Log-bucketed value histograms (relative accuracy ~1%) kept on
+                -- the 1h and 1d tiers. Keys are 'z' for ~0, 'p<k>'/'n<k>' for
+                -- +/-gamma^k; sketches merge by summing counts per key, so
+                -- percentiles over any range come from the rollups alone.
+                CREATE OR REPLACE FUNCTION telemetry_sketch_key(v DOUBLE PRECISION)
+                RETURNS TEXT AS $$
+                    SELECT CASE
+                        WHEN v IS NULL THEN NULL
+                        WHEN ABS(v) < 1e-9 THEN 'z'
+                        WHEN v > 0 THEN 'p' || CEIL(LN(v) / LN(1.02))::int
+                        ELSE 'n' || CEIL(LN(-v) / LN(1.02))::int
+                    END
+                $$ LANGUAGE sql IMMUTABLE;
+
+                CREATE OR REPLACE FUNCTION telemetry_sketch_merge(a JSONB, b JSONB)
+                RETURNS JSONB AS $$
+                    SELECT COALESCE(jsonb_object_agg(key, total), '{}'::jsonb)
+                    FROM (
+                        SELECT key, SUM(value::bigint) AS total
+                        FROM (
+                            SELECT * FROM jsonb_each_text(COALESCE(a, '{}'::jsonb))
+                            UNION ALL
+                            SELECT * FROM jsonb_each_text(COALESCE(b, '{}'::jsonb))
+                        ) entries
+                        GROUP BY key
+                    ) merged
+                $$ LANGUAGE sql IMMUTABLE;
+
+                DROP AGGREGATE IF EXISTS telemetry_sketch_agg(JSONB);
+                CREATE AGGREGATE telemetry_sketch_agg(JSONB) (
+                    SFUNC = telemetry_sketch_merge,
+                    STYPE = JSONB,
+                    INITCOND = '{}'
+                );
+
+                ALTER TABLE telemetry_rollup_1h ADD COLUMN IF NOT EXISTS sketch JSONB;
+                ALTER TABLE telemetry_rollup_1d ADD COLUMN IF NOT EXISTS sketch JSONB;
+
+                -- Backfill from the raw history still in retention
+                UPDATE telemetry_rollup_1h r
+                SET sketch = s.sketch
+                FROM (
+                    SELECT device_sensor_id, bucket, jsonb_object_agg(sketch_key, n) AS sketch
+                    FROM (
+                        SELECT device_sensor_id, DATE_TRUNC('hour', timestamp) AS bucket,
+                               telemetry_sketch_key(processed_value::float8) AS sketch_key, COUNT(*) AS n
+                        FROM telemetry
+                        WHERE device_sensor_id IS NOT NULL
+                        GROUP BY 1, 2, 3
+                    ) keyed
+                    GROUP BY device_sensor_id, bucket
+                ) s
+                WHERE r.device_sensor_id = s.device_sensor_id AND r.bucket = s.bucket;
+
+                UPDATE telemetry_rollup_1d r
+                SET sketch = s.sketch
+                FROM (
+                    SELECT device_sensor_id, DATE_TRUNC('day', bucket) AS bucket,
+                           telemetry_sketch_agg(sketch) AS sketch
+                    FROM telemetry_rollup_1h
+                    WHERE sketch IS NOT NULL
+                    GROUP BY 1, 2
+                ) s
+                WHERE r.device_sensor_id = s.device_sensor_id AND r.bucket = s.bucket;
+            `
+        },
+        {
+            name: '009_add_device_boot_timings',
+            sql: `
+                -- Boot-phase timings (ms since reset) from the first heartbeat
+                -- after each boot
+                ALTER TABLE IF EXISTS devices
+                    ADD COLUMN IF NOT EXISTS boot_timings JSONB,
+                    ADD COLUMN IF NOT EXISTS last_boot_at TIMESTAMP;
+            `
+        },
+        {
+            name: '010_add_firmware_signatures',
+            sql: `
+                -- Base64 DER signature over the image's SHA-256, made with
+                -- OTA_SIGNING_KEY at upload time
+                ALTER TABLE IF EXISTS firmware_versions
+                    ADD COLUMN IF NOT EXISTS signature TEXT;
+            `
+        },
+        {
+            name: '011_create_alert_captures',
+            sql: `
+                -- High-rate sample windows around a threshold crossing,
+                -- uploaded by firmware and attached to the alert
+                CREATE TABLE IF NOT EXISTS alert_captures (
+                    id SERIAL PRIMARY KEY,
+                    alert_id INTEGER NOT NULL REFERENCES alerts(id) ON DELETE CASCADE,
+                    device_id VARCHAR(50) REFERENCES devices(id) ON DELETE CASCADE,
+                    sensor_pin VARCHAR(10) NOT NULL,
+                    sample_rate_hz INTEGER NOT NULL,
+                    pre_samples INTEGER NOT NULL,
+                    post_samples INTEGER NOT NULL,
+                    triggered_at TIMESTAMP NOT NULL,
+                    data BYTEA NOT NULL,
+                    created_at TIMESTAMP DEFAULT CURRENT_TIMESTAMP,
+                    UNIQUE (alert_id, sensor_pin)
+                );
+            `
+        },
+        {
+            name: '012_create_history_backfill',
+            sql: `
+                -- Requests for full-resolution history from a device's
+                -- on-flash store, answered through the heartbeat channel
+                CREATE TABLE IF NOT EXISTS history_requests (
+                    id SERIAL PRIMARY KEY,
+                    device_id VARCHAR(50) NOT NULL REFERENCES devices(id) ON DELETE CASCADE,
+                    sensor_pin VARCHAR(10) NOT NULL,
+                    start_time TIMESTAMP NOT NULL,
+                    end_time TIMESTAMP NOT NULL,
+                    status VARCHAR(20) NOT NULL DEFAULT 'pending',
+                    requested_by INTEGER REFERENCES users(id) ON DELETE SET NULL,
+                    chunks_received INTEGER NOT NULL DEFAULT 0,
+                    samples_received INTEGER NOT NULL DEFAULT 0,
+                    created_at TIMESTAMP DEFAULT CURRENT_TIMESTAMP,
+                    sent_at TIMESTAMP,
+                    completed_at TIMESTAMP
+                );
+                CREATE INDEX IF NOT EXISTS idx_history_requests_device_status
+                    ON history_requests(device_id, status);
+
+                CREATE TABLE IF NOT EXISTS history_samples (
+                    request_id INTEGER NOT NULL REFERENCES history_requests(id) ON DELETE CASCADE,
+                    sampled_at TIMESTAMP NOT NULL,
+                    value DOUBLE PRECISION NOT NULL,
+                    PRIMARY KEY (request_id, sampled_at)
+                );
+            `
+        },
+        {
+            name: '013_add_device_wifi_stats',
+            sql: `
+                -- Latest roaming state and per-AP statistics from the heartbeat
+                ALTER TABLE devices
+                    ADD COLUMN IF NOT EXISTS wifi_stats JSONB,
+                    ADD COLUMN IF NOT EXISTS wifi_stats_at TIMESTAMP;
+            `
+        },
+        {
+            name: '014_create_modbus_points',
+            sql: `
+                -- Modbus RTU register map per device, pushed to firmware in
+                -- the heartbeat response; each point is also a device_sensors
+                -- row under its pin name ("H1.100")
+                CREATE TABLE IF NOT EXISTS modbus_points (
+                    id SERIAL PRIMARY KEY,
+                    device_id VARCHAR(50) NOT NULL REFERENCES devices(id) ON DELETE CASCADE,
+                    slave_id SMALLINT NOT NULL CHECK (slave_id BETWEEN 1 AND 247),
+                    function_code SMALLINT NOT NULL CHECK (function_code IN (3, 4)),
+                    register_address INTEGER NOT NULL CHECK (register_address BETWEEN 0 AND 65535),
+                    data_type VARCHAR(4) NOT NULL,
+                    scale DOUBLE PRECISION NOT NULL DEFAULT 1,
+                    sensor_type VARCHAR(100) NOT NULL,
+                    name VARCHAR(100),
+                    threshold_min DECIMAL(10, 4),
+                    threshold_max DECIMAL(10, 4),
+                    updated_at TIMESTAMP DEFAULT CURRENT_TIMESTAMP,
+                    UNIQUE (device_id, slave_id, function_code, register_address)
+                );
+            `
+        },
+        {
+            name: '015_add_pulse_sensor_types',
+            sql: `
+                -- Pulse-output meters report three sensors per input; "units"
+                -- are whatever the meter constant counts (kWh, m³, L)
+                INSERT INTO sensor_types (name, unit, min_value, max_value, description, icon) VALUES
+                ('Pulse Count', 'pulses', 0, 100000, 'Meter pulses per reporting interval', 'hash'),
+                ('Pulse Rate', 'units/h', 0, 100000, 'Meter rate from pulse counting', 'gauge'),
+                ('Pulse Total', 'units', 0, 999999, 'Totalized meter reading from pulse counting', 'sigma')
+                ON CONFLICT (name) DO NOTHING;
+            `
+        },
+        {
+            name: '016_create_notification_queue',
+            sql: `
+                -- Outgoing alert notifications, one row per channel and
+                -- recipient; sent by notificationDispatchService, which
+                -- merges rows for the same recipient into digests
+                CREATE TABLE IF NOT EXISTS notification_queue (
+                    id BIGSERIAL PRIMARY KEY,
+                    channel VARCHAR(20) NOT NULL CHECK (channel IN ('email', 'sms', 'telegram', 'webhook')),
+                    recipient VARCHAR(500) NOT NULL,
+                    alert_id INTEGER REFERENCES alerts(id) ON DELETE SET NULL,
+                    summary TEXT NOT NULL,
+                    message JSONB NOT NULL,
+                    status VARCHAR(10) NOT NULL DEFAULT 'pending'
+                        CHECK (status IN ('pending', 'sending', 'sent', 'failed')),
+                    attempts SMALLINT NOT NULL DEFAULT 0,
+                    next_attempt_at TIMESTAMP NOT NULL DEFAULT CURRENT_TIMESTAMP,
+                    claimed_at TIMESTAMP,
+                    last_error TEXT,
+                    digest_size SMALLINT,
+                    created_at TIMESTAMP DEFAULT CURRENT_TIMESTAMP,
+                    sent_at TIMESTAMP
+                );
+
+                CREATE INDEX IF NOT EXISTS idx_notification_queue_due
+                    ON notification_queue(channel, next_attempt_at)
+                    WHERE status IN ('pending', 'sending');
+                CREATE INDEX IF NOT EXISTS idx_notification_queue_created_at ON notification_queue(created_at);
+            `
         }
     ];
 
@@ -969,6 +1345,7 @@ const getClient = async () => {
 module.exports = {
     query,
     transaction,
+    cursorQuery,
     healthCheck,
     initialize,
     gracefulShutdown,
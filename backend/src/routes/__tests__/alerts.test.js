@@ -151,6 +151,58 @@ describe('Alert Routes', () => {
         });
     });
 
+    describe('GET /api/alerts/:id/capture', () => {
+        // 2 pre + 2 post samples at 50 Hz on A0, calibration x0.5 + 1
+        const captureBlob = () => {
+            const blob = Buffer.alloc(28 + 4 * 2);
+            blob.write('SCAP', 0, 'latin1');
+            blob.writeUInt8(1, 4);
+            blob.writeUInt8(1, 5);
+            blob.writeUInt16LE(50, 6);
+            blob.writeUInt16LE(2, 8);
+            blob.writeUInt16LE(2, 10);
+            blob.writeFloatLE(0.5, 12);
+            blob.writeFloatLE(1, 16);
+            blob.writeUInt8(17, 20);
+            blob.writeUInt32LE(1500, 24);
+            [100, 200, 900, 950].forEach((sample, i) => blob.writeInt16LE(sample, 28 + i * 2));
+            return blob;
+        };
+
+        it('should decode the capture window around the trigger', async () => {
+            db.query.mockResolvedValue({
+                rows: [{
+                    id: 3,
+                    alert_id: 1,
+                    device_id: 'dev-1',
+                    sensor_pin: 'A0',
+                    sample_rate_hz: 50,
+                    pre_samples: 2,
+                    post_samples: 2,
+                    triggered_at: new Date(),
+                    data: captureBlob()
+                }]
+            });
+
+            const response = await request(app)
+                .get('/api/alerts/1/capture')
+                .expect(200);
+
+            const [capture] = response.body.captures;
+            expect(capture.sensor_pin).toBe('A0');
+            expect(capture.samples.map(sample => sample.offset_ms)).toEqual([-40, -20, 0, 20]);
+            expect(capture.samples[2]).toEqual({ offset_ms: 0, raw: 900, value: 451 });
+        });
+
+        it('should return 404 when the alert has no capture', async () => {
+            db.query.mockResolvedValue({ rows: [] });
+
+            await request(app)
+                .get('/api/alerts/1/capture')
+                .expect(404);
+        });
+    });
+
     describe('POST /api/alerts/:id/acknowledge', () => {
         it('should acknowledge alert successfully', async () => {
             db.query.mockResolvedValue({
@@ -402,6 +402,235 @@ describe('Device Routes', () => {
         });
     });
 
+    describe('POST /api/devices/:id/history-requests', () => {
+        it('should reject ranges longer than the device keeps', async () => {
+            const end = new Date();
+            const start = new Date(end.getTime() - 25 * 60 * 60 * 1000);
+
+            const response = await request(app)
+                .post('/api/devices/TEST-001/history-requests')
+                .send({ sensor_pin: '34', start: start.toISOString(), end: end.toISOString() })
+                .expect(400);
+
+            expect(db.query).not.toHaveBeenCalled();
+            expect(response.body.error).toMatch(/24 hours/);
+        });
+    });
+
+    describe('POST /api/devices/:id/history/:requestId', () => {
+        const chunk = () => {
+            // Two samples one second apart: 21.5 then 21.25 (scale 1000)
+            const header = Buffer.alloc(20);
+            header.write('SHIS', 0, 'latin1');
+            header.writeUInt8(1, 4);
+            header.writeUInt16LE(1000, 6);
+            header.writeUInt32LE(1700000000, 8);
+            header.writeUInt16LE(0, 12);
+            header.writeUInt16LE(2, 14);
+            header.writeInt32LE(21500, 16);
+            // (0 ms, +0) then (1000 ms, -250 zigzagged to 499)
+            return Buffer.concat([header, Buffer.from([0x00, 0x00, 0xe8, 0x07, 0xf3, 0x03])]);
+        };
+
+        it('should store decoded samples and complete on the final chunk', async () => {
+            db.query
+                .mockResolvedValueOnce({
+                    rows: [{ id: 7, start_time: new Date(1699999000000), end_time: new Date(1700001000000) }]
+                })
+                .mockResolvedValueOnce({ rowCount: 2 })
+                .mockResolvedValueOnce({ rows: [{ status: 'complete', samples_received: 2 }] });
+
+            const response = await request(app)
+                .post('/api/devices/TEST-001/history/7')
+                .set('Content-Type', 'application/octet-stream')
+                .set('X-History-Final', '1')
+                .send(chunk())
+                .expect(200);
+
+            expect(response.body.status).toBe('complete');
+            const [, params] = db.query.mock.calls[1];
+            expect(params[1].map(date => date.getTime())).toEqual([1700000000000, 1700000001000]);
+            expect(params[2]).toEqual([21.5, 21.25]);
+        });
+
+        it('should reject malformed chunks', async () => {
+            await request(app)
+                .post('/api/devices/TEST-001/history/7')
+                .set('Content-Type', 'application/octet-stream')
+                .send(chunk().subarray(0, 22))
+                .expect(400);
+
+            expect(db.query).not.toHaveBeenCalled();
+        });
+    });
+
+    describe('PUT /api/devices/:id/modbus', () => {
+        const meter = [
+            { slave_id: 1, function_code: 3, register_address: 100, data_type: 'f32', sensor_type: 'pressure' },
+            { slave_id: 1, function_code: 4, register_address: 0, data_type: 'u16', scale: 0.1, sensor_type: 'Temperature' }
+        ];
+
+        it('should store the map and a sensor per point under its pin name', async () => {
+            const clientQuery = jest.fn().mockResolvedValue({ rows: [] });
+            clientQuery
+                .mockResolvedValueOnce({})
+                .mockResolvedValueOnce({ rows: [{ slave_id: 1, function_code: 3, register_address: 100, data_type: 'f32', scale: 1, sensor_type: 'Pressure' }] })
+                .mockResolvedValueOnce({})
+                .mockResolvedValueOnce({ rows: [{ slave_id: 1, function_code: 4, register_address: 0, data_type: 'u16', scale: 0.1, sensor_type: 'Temperature' }] })
+                .mockResolvedValueOnce({});
+            db.transaction.mockImplementation(callback => callback({ query: clientQuery }));
+            db.query
+                .mockResolvedValueOnce({ rows: [{ id: 'TEST-001' }] })
+                .mockResolvedValueOnce({ rows: [{ id: 6, name: 'Pressure' }, { id: 2, name: 'Temperature' }] })
+                .mockResolvedValueOnce({ rows: [] });
+
+            const response = await request(app)
+                .put('/api/devices/TEST-001/modbus')
+                .send({ points: meter })
+                .expect(200);
+
+            expect(response.body.points).toHaveLength(2);
+            expect(response.body.version).toBeGreaterThan(0);
+            const sensorInserts = clientQuery.mock.calls.filter(([sql]) => sql.includes('INSERT INTO device_sensors'));
+            expect(sensorInserts.map(([, params]) => [params[1], params[2]])).toEqual([[6, 'H1.100'], [2, 'I1.0']]);
+        });
+
+        it('should reject points that read the same register twice', async () => {
+            const response = await request(app)
+                .put('/api/devices/TEST-001/modbus')
+                .send({ points: [meter[0], { ...meter[0], data_type: 'u16' }] })
+                .expect(400);
+
+            expect(db.query).not.toHaveBeenCalled();
+            expect(response.body.error).toMatch(/same register/);
+        });
+    });
+
+    describe('POST /api/devices/:id/heartbeat', () => {
+        const deviceConfigService = require('../../services/deviceConfigService');
+        const pointRow = { slave_id: 2, function_code: 3, register_address: 10, data_type: 'i32s', scale: 1, sensor_type: 'Pressure', threshold_min: '0.0000', threshold_max: '10.0000' };
+        const sensorRow = { pin: 'A0', name: 'Light', enabled: true, calibration_offset: 0, calibration_multiplier: 1, threshold_min: 100, threshold_max: 900, sensor_type: 'Photodiode' };
+
+        const mockDatabase = ({ sensors = [sensorRow], points = [pointRow], history = [], historyClaimAt = history.length > 0 ? new Date(0) : null, known = true } = {}) => {
+            db.query.mockImplementation(async (sql) => {
+                if (sql.includes('FROM device_sensors')) return { rows: sensors };
+                if (sql.includes('FROM modbus_points')) return { rows: points };
+                if (sql.includes('history_claim_at')) return { rows: [{ history_claim_at: historyClaimAt, known }] };
+                if (sql.includes('UPDATE history_requests')) return { rows: history };
+                return { rows: [], rowCount: 1 };
+            });
+        };
+
+        const heartbeat = (body) => request(app)
+            .post('/api/devices/TEST-001/heartbeat')
+            .send({ firmware_version: '2.1.0', ...body })
+            .expect(200);
+
+        const selects = () => db.query.mock.calls.filter(([sql]) => /^\s*SELECT/.test(sql));
+
+        beforeEach(() => {
+            deviceConfigService.invalidate();
+            mockDatabase();
+        });
+
+        afterEach(() => {
+            db.query.mockReset();
+        });
+
+        it('should send the Modbus map to a device running another version', async () => {
+            const response = await heartbeat({ modbus: { version: 0, requests: 0 } });
+
+            expect(response.body.config.modbus.points).toEqual([{
+                pin: 'H2.10', slave: 2, function: 3, address: 10, type: 'i32s', scale: 1,
+                sensor_type: 'pressure', threshold_min: 0, threshold_max: 10
+            }]);
+        });
+
+        it('should send only the version once the device runs the current map', async () => {
+            const first = await heartbeat({ modbus: { version: 0 } });
+            const response = await heartbeat({ modbus: { version: first.body.config.modbus.version } });
+
+            expect(response.body.config.modbus).toEqual({ version: first.body.config.modbus.version });
+        });
+
+        it('should record contact through the liveness service', async () => {
+            const livenessService = require('../../services/livenessService');
+            const touch = jest.spyOn(livenessService, 'touch').mockImplementation(() => {});
+
+            await heartbeat({ ip_address: '192.168.1.50' });
+
+            expect(touch).toHaveBeenCalledWith('TEST-001', '192.168.1.50');
+            expect(db.query.mock.calls.filter(([sql]) => sql.includes('UPDATE devices'))).toHaveLength(1);
+            touch.mockRestore();
+        });
+
+        it('should leave the map out for firmware without Modbus support', async () => {
+            const response = await heartbeat({});
+
+            expect(response.body.config.modbus).toBeUndefined();
+        });
+
+        it('should answer a device on the current sensor version from the snapshot', async () => {
+            const first = await heartbeat({});
+            expect(first.body.config.sensors).toEqual([{
+                pin: 'A0', type: 'Photodiode', name: 'Light', enabled: true,
+                calibration_offset: 0, calibration_multiplier: 1, threshold_min: 100, threshold_max: 900
+            }]);
+            expect(first.body.config.sensors_version).toBeGreaterThan(0);
+
+            db.query.mockClear();
+            const response = await heartbeat({ sensor_config_version: first.body.config.sensors_version });
+
+            expect(response.body.config.sensors).toBeUndefined();
+            expect(response.body.config.sensors_unchanged).toBe(true);
+            expect(response.body.config.sensors_version).toBe(first.body.config.sensors_version);
+            expect(selects()).toHaveLength(0);
+        });
+
+        it('should rebuild the snapshot after an invalidation', async () => {
+            const first = await heartbeat({});
+
+            deviceConfigService.invalidate('TEST-001');
+            mockDatabase({ sensors: [{ ...sensorRow, threshold_max: 800 }] });
+            const response = await heartbeat({ sensor_config_version: first.body.config.sensors_version });
+
+            expect(response.body.config.sensors_version).not.toBe(first.body.config.sensors_version);
+            expect(response.body.config.sensors[0].threshold_max).toBe(800);
+        });
+
+        it('should only claim history requests when some are outstanding', async () => {
+            await heartbeat({});
+            expect(db.query.mock.calls.some(([sql]) => sql.includes('UPDATE history_requests'))).toBe(false);
+
+            deviceConfigService.invalidate('TEST-001');
+            mockDatabase({ history: [{ id: 7, sensor_pin: 'A0', start_time: '2026-01-01T00:00:00Z', end_time: '2026-01-01T01:00:00Z' }] });
+            const response = await heartbeat({});
+
+            expect(response.body.config.history_requests).toEqual([
+                { id: 7, pin: 'A0', from: Date.parse('2026-01-01T00:00:00Z'), to: Date.parse('2026-01-01T01:00:00Z') }
+            ]);
+        });
+
+        it('should not claim history again before a sent request is due for resend', async () => {
+            mockDatabase({ historyClaimAt: new Date(Date.now() + 60 * 1000) });
+            await heartbeat({});
+            await heartbeat({});
+
+            expect(db.query.mock.calls.some(([sql]) => sql.includes('UPDATE history_requests'))).toBe(false);
+        });
+
+        it('should keep snapshots for unknown device ids only briefly', async () => {
+            mockDatabase({ sensors: [], points: [], known: false });
+            await heartbeat({});
+
+            const snapshot = deviceConfigService.snapshots.get('TEST-001');
+            expect(snapshot.expiresAt - Date.now()).toBeLessThanOrEqual(10 * 1000);
+
+            deviceConfigService.sweep(snapshot.expiresAt);
+            expect(deviceConfigService.snapshots.has('TEST-001')).toBe(false);
+        });
+    });
+
     describe('POST /api/devices/:id/ota', () => {
         it('should trigger OTA update', async () => {
             const otaService = require('../../services/otaService');
@@ -442,6 +671,40 @@ describe('Device Routes', () => {
         });
     });
 
+    describe('POST /api/devices/:id/ota-status', () => {
+        it('should record an image waiting for its reboot as installing', async () => {
+            const otaService = require('../../services/otaService');
+            otaService.updateOTAStatus = jest.fn().mockResolvedValue({
+                id: 7, status: 'installing', progress_percent: 100, version: '2.1.0'
+            });
+
+            const response = await request(app)
+                .post('/api/devices/ESP-001/ota-status')
+                .send({ status: 'installing', progress: 100 })
+                .expect(200);
+
+            expect(otaService.updateOTAStatus).toHaveBeenCalledWith('ESP-001', 'installing', 100, null);
+            expect(response.body.ota.status).toBe('installing');
+        });
+
+        it('should accept firmware download progress and error_message', async () => {
+            const otaService = require('../../services/otaService');
+            otaService.updateOTAStatus = jest.fn().mockResolvedValue({ id: 7, status: 'failed' });
+
+            await request(app)
+                .post('/api/devices/ESP-001/ota-status')
+                .send({ status: 'downloading', progress: 40 })
+                .expect(200);
+            await request(app)
+                .post('/api/devices/ESP-001/ota-status')
+                .send({ status: 'failed', progress: 0, error_message: 'Checksum mismatch' })
+                .expect(200);
+
+            expect(otaService.updateOTAStatus).toHaveBeenNthCalledWith(1, 'ESP-001', 'downloading', 40, null);
+            expect(otaService.updateOTAStatus).toHaveBeenNthCalledWith(2, 'ESP-001', 'failed', 0, 'Checksum mismatch');
+        });
+    });
+
     describe('Device Status Updates', () => {
         describe('POST /api/devices/heartbeat', () => {
             it('should update device status on heartbeat', async () => {
@@ -3,6 +3,7 @@ const { body, param, query, validationResult } = require('express-validator');
 const db = require('../models/database');
 const logger = require('../utils/logger');
 const { authenticateToken, requireAdmin } = require('../middleware/auth');
+const { parseCapture, captureSeries } = require('../utils/alertCapture');
 
 const router = express.Router();
 
@@ -160,6 +161,65 @@ router.get('/:id', [
     }
 });
 
+// GET /api/alerts/:id/capture - High-rate sample windows around the trigger
+router.get('/:id/capture', [
+    param('id').isInt({ min: 1 }),
+    query('format').optional().isIn(['json', 'binary']),
+    query('sensor_pin').optional().notEmpty()
+], authenticateToken, async (req, res) => {
+    try {
+        const errors = validationResult(req);
+        if (!errors.isEmpty()) {
+            return res.status(400).json({ errors: errors.array() });
+        }
+
+        const { id } = req.params;
+        const { format = 'json', sensor_pin } = req.query;
+
+        const params = [id];
+        let filter = '';
+        if (sensor_pin) {
+            params.push(sensor_pin);
+            filter = 'AND sensor_pin = $2';
+        }
+
+        const result = await db.query(`
+            SELECT id, alert_id, device_id, sensor_pin, sample_rate_hz,
+                   pre_samples, post_samples, triggered_at, data
+            FROM alert_captures
+            WHERE alert_id = $1 ${filter}
+            ORDER BY sensor_pin
+        `, params);
+
+        if (result.rows.length === 0) {
+            return res.status(404).json({ error: 'No capture for this alert' });
+        }
+
+        // Raw blob as uploaded by the device (first sensor unless one is picked)
+        if (format === 'binary') {
+            const row = result.rows[0];
+            res.setHeader('Content-Type', 'application/octet-stream');
+            res.setHeader('Content-Disposition', `attachment; filename="alert_${id}_pin_${row.sensor_pin}.scap"`);
+            return res.send(row.data);
+        }
+
+        const captures = result.rows.map(row => ({
+            id: row.id,
+            sensor_pin: row.sensor_pin,
+            sample_rate_hz: row.sample_rate_hz,
+            pre_samples: row.pre_samples,
+            post_samples: row.post_samples,
+            triggered_at: row.triggered_at,
+            samples: captureSeries(parseCapture(row.data))
+        }));
+
+        res.json({ alert_id: Number(id), captures });
+    } catch (error) {
+        logger.error('Get alert capture error:', error);
+        res.status(500).json({ error: 'Failed to get alert capture' });
+    }
+});
+
 // POST /api/alerts - Create new alert
 router.post('/', [
     body('device_id').notEmpty(),
@@ -0,0 +1,112 @@
+const express = require('express');
+const logger = require('../utils/logger');
+const deviceQuotaService = require('../services/deviceQuotaService');
+const deviceConfigService = require('../services/deviceConfigService');
+const { sampleTimeFromRequest, sampleTimeFromPayload } = require('../utils/deviceTiming');
+
+/**
+ * Device-facing routes served by the ingress listener (device-ingress.js).
+ * Paths match the API server so firmware only needs a different base URL
+ * (or a reverse-proxy rule). Bodies are size-bounded; JSON and NDJSON
+ * (one telemetry payload per line, for buffered uploads) are accepted, and
+ * gzip/deflate request bodies are inflated by the parsers.
+ */
+function createDeviceIngressRouter(ingress) {
+    const router = express.Router();
+    const bodyLimit = process.env.DEVICE_INGRESS_BODY_LIMIT || '64kb';
+
+    router.use(express.json({ limit: bodyLimit }));
+    router.use(express.text({ type: 'application/x-ndjson', limit: bodyLimit }));
+
+    const authenticate = ingress.authenticate();
+
+    // One telemetry token per buffered payload
+    const payloadCount = (req) => {
+        if (typeof req.body === 'string') {
+            return req.body.split('\n').filter(line => line.trim()).length;
+        }
+        return Array.isArray(req.body) ? req.body.length : 1;
+    };
+
+    // Payloads in a request body: a JSON object, a JSON array, or NDJSON lines
+    const payloadsOf = (req) => {
+        if (typeof req.body === 'string') {
+            return req.body.split('\n').filter(line => line.trim()).map(line => JSON.parse(line));
+        }
+        return Array.isArray(req.body) ? req.body : [req.body];
+    };
+
+    const clientIp = (req) => {
+        const ip = req.body?.ip_address || req.ip;
+        return ip && ip.startsWith('::ffff:') ? ip.substring(7) : ip;
+    };
+
+    const respondAccepted = (res, accepted, total) => {
+        if (accepted < total) {
+            // Queue full: ask the device to retry instead of dropping silently
+            res.set('Retry-After', '5');
+            return res.status(503).json({ error: 'Ingest queue full', accepted });
+        }
+        res.json({ message: 'Telemetry received successfully', accepted });
+    };
+
+    // POST /api/devices/:id/telemetry
+    router.post('/:id/telemetry', authenticate, deviceQuotaService.limit('telemetry', { cost: payloadCount }), (req, res) => {
+        let payloads;
+        try {
+            payloads = payloadsOf(req);
+        } catch (error) {
+            ingress.recordInvalid();
+            return res.status(400).json({ error: 'Malformed NDJSON body' });
+        }
+
+        const decoded = payloads.map(payload => ingress.decodeTelemetry(payload));
+        if (decoded.some(sensors => sensors === null)) {
+            ingress.recordInvalid();
+            return res.status(400).json({ error: 'sensors array required' });
+        }
+
+        // Replayed rows carry their own sample_age_ms
+        const requestSampledAt = sampleTimeFromRequest(req);
+        const readings = [];
+        const sampledAt = [];
+        decoded.forEach((sensors, index) => {
+            if (sensors.length === 0) return;
+            readings.push(sensors);
+            sampledAt.push(sampleTimeFromPayload(payloads[index], requestSampledAt));
+        });
+        respondAccepted(res, ingress.accept(req.params.id, 'telemetry', readings, sampledAt), readings.length);
+    });
+
+    // POST /api/devices/:id/alarm
+    router.post('/:id/alarm', authenticate, deviceQuotaService.limit('alerts'), (req, res) => {
+        const { alarm_type, message } = req.body || {};
+        if (!alarm_type) {
+            ingress.recordInvalid();
+            return res.status(400).json({ error: 'alarm_type required' });
+        }
+
+        const accepted = ingress.accept(req.params.id, 'alarm', [{ alarm_type, message }]);
+        if (accepted === 0) {
+            res.set('Retry-After', '5');
+            return res.status(503).json({ error: 'Ingest queue full' });
+        }
+        // Stored and turned into an alert by the batch writer
+        res.status(202).json({ message: 'Alarm queued' });
+    });
+
+    // POST /api/devices/:id/heartbeat
+    router.post('/:id/heartbeat', authenticate, deviceQuotaService.limit('control'), async (req, res) => {
+        try {
+            await ingress.handleHeartbeat(req.params.id, req.body || {}, clientIp(req));
+            res.type('application/json').send(await deviceConfigService.heartbeatResponse(req.params.id, req.body || {}));
+        } catch (error) {
+            logger.error('Ingress heartbeat error:', error);
+            res.status(500).json({ error: 'Failed to process heartbeat' });
+        }
+    });
+
+    return router;
+}
+
+module.exports = createDeviceIngressRouter;
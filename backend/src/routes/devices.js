@@ -5,6 +5,19 @@ const logger = require('../utils/logger');
 const { authenticateToken, authenticateDevice, requireAdmin } = require('../middleware/auth');
 const { requireFeature } = require('../middleware/licenseMiddleware');
 const otaService = require('../services/otaService');
+const livenessService = require('../services/livenessService');
+const deviceQuotaService = require('../services/deviceQuotaService');
+const { DOWNSAMPLE_METHODS } = require('../utils/downsample');
+const { streamQueryExport } = require('../utils/streamExport');
+const { sampleTimeFromRequest, sampleTimeFromPayload } = require('../utils/deviceTiming');
+const { recordHeartbeat } = require('../utils/deviceHeartbeat');
+const { registerSensors } = require('../utils/sensorRegistration');
+const { parseCapture } = require('../utils/alertCapture');
+const { parseHistoryChunk } = require('../utils/historyChunk');
+const historyBackfillService = require('../services/historyBackfillService');
+const modbusConfigService = require('../services/modbusConfigService');
+const deviceConfigService = require('../services/deviceConfigService');
+const { validateModbusPoints } = require('../utils/modbusMap');
 
 const router = express.Router();
 
@@ -202,6 +215,35 @@ router.get('/', authenticateToken, async (req, res) => {
     }
 });
 
+// GET /api/devices/access-points - Which APs serve the fleet, from heartbeat Wi-Fi stats
+router.get('/access-points', authenticateToken, async (req, res) => {
+    try {
+        const result = await db.query(`
+            SELECT
+                ap->>'bssid' AS bssid,
+                MAX(ap->>'ssid') AS ssid,
+                COUNT(*) FILTER (WHERE d.wifi_stats->>'bssid' = ap->>'bssid') AS connected_devices,
+                COUNT(*) AS devices_seen,
+                SUM((ap->>'associations')::int) AS associations,
+                SUM((ap->>'failures')::int) AS failures,
+                ROUND(SUM((ap->>'avg_connect_ms')::numeric * (ap->>'associations')::int)
+                      / NULLIF(SUM((ap->>'associations')::int), 0)) AS avg_connect_ms,
+                SUM((ap->>'connected_s')::bigint) AS connected_s,
+                ROUND(AVG((ap->>'rssi')::numeric)) AS avg_rssi
+            FROM devices d
+            CROSS JOIN LATERAL jsonb_array_elements(d.wifi_stats->'aps') ap
+            WHERE d.wifi_stats IS NOT NULL
+            GROUP BY ap->>'bssid'
+            ORDER BY connected_devices DESC, connected_s DESC
+        `);
+
+        res.json({ access_points: result.rows });
+    } catch (error) {
+        logger.error('Get access points error:', error);
+        res.status(500).json({ error: 'Failed to fetch access point statistics' });
+    }
+});
+
 // GET /api/devices/:id - Get device by ID
 router.get('/:id', [
     param('id').notEmpty()
@@ -386,6 +428,10 @@ router.put('/:id/config', [
             RETURNING *
         `, [id, ota_enabled, armed, heartbeat_interval, debug_mode]);
 
+        if (heartbeat_interval !== undefined) {
+            livenessService.setHeartbeatInterval(id, result.rows[0].heartbeat_interval);
+        }
+
         logger.info(`Device config updated: ${id} by ${req.user.email}`);
         res.json({
             message: 'Device configuration updated successfully. Changes will apply on next heartbeat.',
@@ -435,6 +481,8 @@ router.delete('/:id', [
             }
 
             await db.query('COMMIT');
+            livenessService.forget(id);
+            deviceConfigService.invalidate(id);
             logger.info(`Device deleted: ${id} by ${req.user.email}`);
             res.json({ message: 'Device deleted successfully' });
         } catch (error) {
@@ -448,7 +496,7 @@ router.delete('/:id', [
 });
 
 // POST /api/devices/:id/telemetry - Receive telemetry data from device
-router.post('/:id/telemetry', [
+router.post('/:id/telemetry', deviceQuotaService.limit('telemetry'), [
     param('id').notEmpty(),
     body('sensors').isArray(),
     body('uptime').optional().isInt({ min: 0 }),
@@ -520,28 +568,27 @@ router.post('/:id/telemetry', [
             }
         }
 
-        // Update device last heartbeat and health metrics
+        // Update device health metrics; last_heartbeat, status and IP go
+        // through the liveness service's batched flush
         const updateResult = await db.query(`
             UPDATE devices
-            SET last_heartbeat = CURRENT_TIMESTAMP,
-                status = 'online',
-                current_status = 'online',
+            SET current_status = 'online',
                 uptime_seconds = COALESCE($1, uptime_seconds),
                 last_uptime_seconds = COALESCE($1, last_uptime_seconds),
-                total_runtime_seconds = $8,
-                ip_address = $2,
-                free_heap_bytes = COALESCE($3, free_heap_bytes),
-                wifi_signal_strength = COALESCE($4, wifi_signal_strength),
-                memory_usage_percent = COALESCE($5, memory_usage_percent),
-                wifi_quality_percent = COALESCE($6, wifi_quality_percent)
-            WHERE id = $7
-        `, [uptime, telemetryIp, free_heap, wifi_rssi, memoryUsagePercent, wifiQualityPercent, id, totalRuntimeUpdate]);
+                total_runtime_seconds = $7,
+                free_heap_bytes = COALESCE($2, free_heap_bytes),
+                wifi_signal_strength = COALESCE($3, wifi_signal_strength),
+                memory_usage_percent = COALESCE($4, memory_usage_percent),
+                wifi_quality_percent = COALESCE($5, wifi_quality_percent)
+            WHERE id = $6
+        `, [uptime, free_heap, wifi_rssi, memoryUsagePercent, wifiQualityPercent, id, totalRuntimeUpdate]);
 
         // Check if device exists
         if (updateResult.rowCount === 0) {
             logger.error(`Device not found: ${id}`);
             return res.status(404).json({ error: 'Device not found', device_id: id });
         }
+        livenessService.touch(id, telemetryIp);
 
         // Process telemetry data using TelemetryProcessor service from request
         const telemetryProcessor = req.telemetryProcessor;
@@ -550,10 +597,6 @@ router.post('/:id/telemetry', [
             return res.status(500).json({ error: 'Telemetry processor unavailable' });
         }
 
-        const SENSOR_TYPE_ALIASES = {
-            light: 'Photodiode'
-        };
-
         // ESP8266 pin mapping - pin 17 is actually A0 (analog input)
         const mapESP8266Pin = (pin) => {
             if (pin === 17 || pin === '17') {
@@ -562,6 +605,9 @@ router.post('/:id/telemetry', [
             return String(pin);
         };
 
+        // Readings buffered on the device before its link came up carry their age
+        const sampledAt = new Date(sampleTimeFromPayload(req.body, sampleTimeFromRequest(req))).toISOString();
+
         for (const sensorData of sensors) {
             try {
                 // Map pin for ESP8266 compatibility
@@ -576,27 +622,17 @@ router.post('/:id/telemetry', [
                 `, [id, mappedPin]);
 
                 if (deviceSensor.rows.length === 0) {
-                    const sensorTypeName = SENSOR_TYPE_ALIASES[sensorData.type] || sensorData.type;
                     // Auto-create device sensor if it doesn't exist (enabled by default)
                     // Sensors sending telemetry are assumed to be configured in firmware
-                    const sensorType = await db.query(
-                        'SELECT id FROM sensor_types WHERE LOWER(name) = LOWER($1)',
-                        [sensorTypeName]
-                    );
-
-                    if (sensorType.rows.length > 0) {
-                        const newSensor = await db.query(`
-                            INSERT INTO device_sensors (device_id, sensor_type_id, pin, name, enabled)
-                            VALUES ($1, $2, $3, $4, true)
-                            RETURNING *
-                        `, [id, sensorType.rows[0].id, mappedPin, sensorData.name || `${sensorData.type} Sensor`]);
-
-                        deviceSensor.rows = [{ ...newSensor.rows[0], sensor_type_name: sensorData.type }];
-                        logger.info(`Auto-created enabled sensor: ${sensorData.type} on pin ${mappedPin} for device ${id}`);
-                    } else {
+                    const [created] = await registerSensors([
+                        { deviceId: id, pin: mappedPin, type: sensorData.type, name: sensorData.name }
+                    ]);
+
+                    if (!created) {
                         logger.warn(`Unknown sensor type: ${sensorData.type} for device ${id}`);
                         continue;
                     }
+                    deviceSensor.rows = [{ ...created, name: sensorData.name || `${sensorData.type} Sensor`, sensor_type_name: created.type }];
                 }
 
                 const sensor = deviceSensor.rows[0];
@@ -607,8 +643,8 @@ router.post('/:id/telemetry', [
 
                 // Insert telemetry data
                 await db.query(`
-                    INSERT INTO telemetry (device_id, device_sensor_id, raw_value, processed_value, metadata)
-                    VALUES ($1, $2, $3, $4, $5)
+                    INSERT INTO telemetry (device_id, device_sensor_id, raw_value, processed_value, metadata, timestamp)
+                    VALUES ($1, $2, $3, $4, $5, $6)
                 `, [
                     id,
                     sensor.id,
@@ -619,7 +655,8 @@ router.post('/:id/telemetry', [
                         pin: mappedPin,
                         sensor_type: sensorData.type,
                         unit: sensor.unit
-                    })
+                    }),
+                    sampledAt
                 ]);
 
                 // Process sensor rules for alerts using the telemetry processor
@@ -676,12 +713,12 @@ router.post('/:id/telemetry', [
 });
 
 // POST /api/devices/:id/heartbeat - Device heartbeat endpoint
-router.post('/:id/heartbeat', [
+router.post('/:id/heartbeat', deviceQuotaService.limit('control'), [
     param('id').notEmpty()
 ], async (req, res) => {
     try {
         const { id } = req.params;
-        const { firmware_version, uptime, free_heap, wifi_rssi, ip_address } = req.body;
+        const { ip_address } = req.body;
 
         // Use IP from request body if provided, otherwise use req.ip
         // Extract IPv4 from IPv6-mapped address if needed
@@ -710,70 +747,16 @@ router.post('/:id/heartbeat', [
             }
         }
 
-        // Only update IP if we have a valid one
-        const updateQuery = deviceIp
-            ? `UPDATE devices
-               SET last_heartbeat = CURRENT_TIMESTAMP,
-                   status = 'online',
-                   firmware_version = COALESCE($1, firmware_version),
-                   uptime_seconds = COALESCE($2, uptime_seconds),
-                   ip_address = $3,
-                   wifi_signal_strength = $4
-               WHERE id = $5`
-            : `UPDATE devices
-               SET last_heartbeat = CURRENT_TIMESTAMP,
-                   status = 'online',
-                   firmware_version = COALESCE($1, firmware_version),
-                   uptime_seconds = COALESCE($2, uptime_seconds),
-                   wifi_signal_strength = $3
-               WHERE id = $4`;
-
-        const params = deviceIp
-            ? [firmware_version, uptime, deviceIp, wifi_rssi, id]
-            : [firmware_version, uptime, wifi_rssi, id];
-
-        await db.query(updateQuery, params);
-
-        // Get sensor configuration for this device
-        const sensorsResult = await db.query(`
-            SELECT
-                ds.id as sensor_id,
-                ds.pin,
-                ds.name,
-                ds.enabled,
-                ds.calibration_offset,
-                ds.calibration_multiplier,
-                ds.threshold_min,
-                ds.threshold_max,
-                st.name as sensor_type
-            FROM device_sensors ds
-            JOIN sensor_types st ON ds.sensor_type_id = st.id
-            WHERE ds.device_id = $1
-            ORDER BY ds.pin
-        `, [id]);
-
-        // Build sensor configuration array with thresholds
-        // Thresholds are now stored directly on device_sensors table
-        const sensorConfig = sensorsResult.rows.map(sensor => {
-            return {
-                pin: sensor.pin,
-                type: sensor.sensor_type,
-                name: sensor.name,
-                enabled: sensor.enabled,
-                calibration_offset: sensor.calibration_offset || 0,
-                calibration_multiplier: sensor.calibration_multiplier || 1,
-                threshold_min: sensor.threshold_min != null ? sensor.threshold_min : 0,
-                threshold_max: sensor.threshold_max != null ? sensor.threshold_max : 0
-            };
-        });
+        // last_heartbeat, status and IP (kept when we have no valid one) go
+        // through the liveness service's batched flush, as on the ingress;
+        // unknown ids are not tracked
+        if (await recordHeartbeat(id, req.body)) {
+            livenessService.touch(id, deviceIp);
+        }
 
-        res.json({
-            message: 'Heartbeat received',
-            timestamp: new Date().toISOString(),
-            config: {
-                sensors: sensorConfig
-            }
-        });
+        // Sensor config, Modbus map and backfill requests come from the
+        // device's config snapshot, already serialized
+        res.type('application/json').send(await deviceConfigService.heartbeatResponse(id, req.body));
     } catch (error) {
         logger.error('Heartbeat error:', error);
         res.status(500).json({ error: 'Failed to process heartbeat' });
@@ -781,7 +764,7 @@ router.post('/:id/heartbeat', [
 });
 
 // POST /api/devices/:id/alarm - Device alarm endpoint
-router.post('/:id/alarm', [
+router.post('/:id/alarm', deviceQuotaService.limit('alerts'), [
     param('id').notEmpty(),
     body('alarm_type').notEmpty(),
     body('message').optional()
@@ -810,7 +793,7 @@ router.post('/:id/alarm', [
 });
 
 // POST /api/devices/:id/threshold-alert - Immediate threshold crossing alert
-router.post('/:id/threshold-alert', [
+router.post('/:id/threshold-alert', deviceQuotaService.limit('alerts'), [
     param('id').notEmpty(),
     body('sensor_pin').notEmpty(),
     body('sensor_name').notEmpty(),
@@ -860,6 +843,7 @@ router.post('/:id/threshold-alert', [
                         VALUES ($1, $2, $3, $4, true)
                         ON CONFLICT (device_id, pin) DO NOTHING
                     `, [id, sensorTypeData.id, sensor_pin, sensor_name || `${sensorTypeName} Sensor`]);
+                    deviceConfigService.invalidate(id);
 
                     logger.info(`Auto-created sensor: ${sensor_name} on pin ${sensor_pin} for device ${id}`);
                 } else {
@@ -1011,6 +995,130 @@ router.post('/:id/threshold-alert', [
     }
 });
 
+// POST /api/devices/:id/alerts/:alertId/capture - Pre/post-trigger sample window for an alert
+router.post('/:id/alerts/:alertId/capture', deviceQuotaService.limit('alerts'),
+    express.raw({ type: 'application/octet-stream', limit: process.env.ALERT_CAPTURE_MAX_BYTES || '64kb' }), [
+    param('id').notEmpty(),
+    param('alertId').isInt({ min: 1 })
+], async (req, res) => {
+    try {
+        const errors = validationResult(req);
+        if (!errors.isEmpty()) {
+            return res.status(400).json({ errors: errors.array() });
+        }
+
+        const { id, alertId } = req.params;
+
+        let capture;
+        try {
+            capture = parseCapture(req.body);
+        } catch (parseError) {
+            return res.status(400).json({ error: parseError.message });
+        }
+
+        const alertResult = await db.query(
+            'SELECT id FROM alerts WHERE id = $1 AND device_id = $2',
+            [alertId, id]
+        );
+        if (alertResult.rows.length === 0) {
+            return res.status(404).json({ error: 'Alert not found' });
+        }
+
+        // The trigger happened trigger_age_ms before the upload
+        const result = await db.query(`
+            INSERT INTO alert_captures (
+                alert_id, device_id, sensor_pin, sample_rate_hz,
+                pre_samples, post_samples, triggered_at, data
+            )
+            VALUES ($1, $2, $3, $4, $5, $6, CURRENT_TIMESTAMP - make_interval(secs => $7), $8)
+            ON CONFLICT (alert_id, sensor_pin) DO UPDATE
+            SET sample_rate_hz = EXCLUDED.sample_rate_hz,
+                pre_samples = EXCLUDED.pre_samples,
+                post_samples = EXCLUDED.post_samples,
+                triggered_at = EXCLUDED.triggered_at,
+                data = EXCLUDED.data
+            RETURNING id
+        `, [
+            alertId,
+            id,
+            capture.pin,
+            capture.sampleRateHz,
+            capture.preSamples,
+            capture.postSamples,
+            capture.triggerAgeMs / 1000,
+            req.body
+        ]);
+
+        logger.logDeviceActivity(id, 'alert_capture', {
+            alert_id: Number(alertId),
+            sensor_pin: capture.pin,
+            samples: capture.samples.length,
+            sample_rate_hz: capture.sampleRateHz
+        });
+
+        if (req.websocketService) {
+            req.websocketService.broadcastDeviceUpdate(id, {
+                alert_capture: { alert_id: Number(alertId), sensor_pin: capture.pin }
+            });
+        }
+
+        res.status(201).json({
+            message: 'Capture stored',
+            capture_id: result.rows[0].id
+        });
+    } catch (error) {
+        logger.error('Alert capture error:', error);
+        res.status(500).json({ error: 'Failed to store alert capture' });
+    }
+});
+
+// POST /api/devices/:id/history/:requestId - Full-resolution history chunk for a backfill request
+router.post('/:id/history/:requestId', deviceQuotaService.limit('telemetry'),
+    express.raw({ type: 'application/octet-stream', limit: process.env.HISTORY_CHUNK_MAX_BYTES || '64kb' }), [
+    param('id').notEmpty(),
+    param('requestId').isInt({ min: 1 })
+], async (req, res) => {
+    try {
+        const errors = validationResult(req);
+        if (!errors.isEmpty()) {
+            return res.status(400).json({ errors: errors.array() });
+        }
+
+        const { id, requestId } = req.params;
+        const final = req.headers['x-history-final'] === '1';
+
+        let chunk;
+        try {
+            chunk = parseHistoryChunk(req.body);
+        } catch (parseError) {
+            return res.status(400).json({ error: parseError.message });
+        }
+
+        const stored = await historyBackfillService.storeChunk(id, requestId, chunk, final);
+        if (!stored) {
+            return res.status(404).json({ error: 'History request not found' });
+        }
+
+        if (final) {
+            deviceConfigService.invalidate(id);
+        }
+        if (final && req.websocketService) {
+            req.websocketService.broadcastDeviceUpdate(id, {
+                history_backfill: { request_id: Number(requestId), status: stored.status }
+            });
+        }
+
+        res.json({
+            message: 'History chunk stored',
+            inserted: stored.inserted,
+            status: stored.status
+        });
+    } catch (error) {
+        logger.error('History chunk error:', error);
+        res.status(500).json({ error: 'Failed to store history chunk' });
+    }
+});
+
 // GET /api/devices/:id/status - Get device status
 router.get('/:id/status', [
     param('id').notEmpty()
@@ -1054,11 +1162,12 @@ router.get('/:id/status', [
 });
 
 // POST /api/devices/:id/ota-status - OTA update status from device
-router.post('/:id/ota-status', [
+router.post('/:id/ota-status', deviceQuotaService.limit('control'), [
     param('id').notEmpty(),
-    body('status').isIn(['started', 'progress', 'completed', 'failed']),
+    body('status').isIn(['started', 'progress', 'downloading', 'installing', 'completed', 'failed']),
     body('progress').optional().isInt({ min: 0, max: 100 }),
-    body('error').optional()
+    body('error').optional(),
+    body('error_message').optional()
 ], async (req, res) => {
     try {
         const errors = validationResult(req);
@@ -1067,7 +1176,9 @@ router.post('/:id/ota-status', [
         }
 
         const { id } = req.params;
-        const { status, progress, error } = req.body;
+        const { status, progress, verification } = req.body;
+        // Firmware sends error_message
+        const error = req.body.error || req.body.error_message;
 
         let progressPercent = progress !== undefined ? parseInt(progress, 10) : 0;
         if (!Number.isFinite(progressPercent)) {
@@ -1082,8 +1193,14 @@ router.post('/:id/ota-status', [
                 progressPercent = 0;
                 break;
             case 'progress':
+            case 'downloading':
                 statusForUpdate = 'downloading';
                 break;
+            case 'installing':
+                // Image written and verified; the device reboots into it
+                // once no alarm or upload is in flight
+                statusForUpdate = 'installing';
+                break;
             case 'completed':
                 statusForUpdate = 'completed';
                 if (progress === undefined) {
@@ -1116,6 +1233,12 @@ router.post('/:id/ota-status', [
             version: otaUpdate.version
         };
 
+        // Image hash/signature check and TLS timings reported by the device
+        if (verification && typeof verification === 'object') {
+            payload.verification = verification;
+            logger.logOTAEvent(id, 'image_verified', verification);
+        }
+
         if (req.websocketService && typeof req.websocketService.broadcastOTAStatus === 'function') {
             req.websocketService.broadcastOTAStatus(id, payload);
         }
@@ -1130,7 +1253,7 @@ router.post('/:id/ota-status', [
 });
 
 // POST /api/devices/:id/ota-check - Check for available firmware updates
-router.post('/:id/ota-check', [
+router.post('/:id/ota-check', deviceQuotaService.limit('control'), [
     param('id').isString().notEmpty()
 ], async (req, res) => {
     try {
@@ -1165,15 +1288,23 @@ router.post('/:id/ota-check', [
         const latestFirmware = firmwareResult.rows[0];
         const updateAvailable = latestFirmware.version !== current_version;
 
-        if (updateAvailable) {
+        const image = updateAvailable
+            ? await deviceFirmwareImage(deviceId, latestFirmware.version)
+            : null;
+
+        if (image) {
             res.json({
                 update_available: true,
-                firmware_url: `${process.env.OTA_BASE_URL || 'http://localhost:3000'}/firmware/${latestFirmware.id}`,
+                ...image,
                 version: latestFirmware.version,
-                checksum: latestFirmware.checksum,
-                file_size: latestFirmware.file_size,
                 release_notes: latestFirmware.release_notes
             });
+        } else if (updateAvailable) {
+            res.json({
+                update_available: false,
+                current_version,
+                message: 'Firmware image not available'
+            });
         } else {
             res.json({
                 update_available: false,
@@ -1195,7 +1326,7 @@ router.post('/:id/ota-check', [
 });
 
 // GET /api/devices/:id/ota-pending - Check for pending OTA updates
-router.get('/:id/ota-pending', [
+router.get('/:id/ota-pending', deviceQuotaService.limit('control'), [
     param('id').isString().notEmpty()
 ], async (req, res) => {
     try {
@@ -1208,7 +1339,7 @@ router.get('/:id/ota-pending', [
 
         // Check for pending OTA updates in database
         const otaResult = await db.query(`
-            SELECT ou.*, fv.version, fv.binary_url, fv.checksum, fv.file_size
+            SELECT ou.*, fv.version, fv.binary_url, fv.checksum, fv.signature, fv.file_size
             FROM ota_updates ou
             JOIN firmware_versions fv ON ou.firmware_version_id = fv.id
             WHERE ou.device_id = $1 AND ou.status IN ('pending', 'downloading')
@@ -1223,13 +1354,16 @@ router.get('/:id/ota-pending', [
         }
 
         const pendingUpdate = otaResult.rows[0];
+        const image = await deviceFirmwareImage(deviceId, pendingUpdate.version);
+
+        if (!image) {
+            return res.status(404).json({ error: 'Firmware image not available' });
+        }
 
         res.json({
             pending_update: true,
-            firmware_url: `${process.env.OTA_BASE_URL || 'http://localhost:3000'}/firmware/${pendingUpdate.firmware_version_id}`,
+            ...image,
             version: pendingUpdate.version,
-            checksum: pendingUpdate.checksum,
-            file_size: pendingUpdate.file_size,
             update_id: pendingUpdate.id
         });
 
@@ -1403,6 +1537,7 @@ router.post('/:id/ota-rebuild', [
 
 // POST /api/devices/:id/health - Update device health data (from device)
 router.post('/:id/health',
+    deviceQuotaService.limit('control'),
     authenticateDevice,
     [
         body('memory_usage_percent').optional().isFloat({ min: 0, max: 100 }),
@@ -1607,6 +1742,25 @@ router.get('/:id/health/history',
 
 // Helper Functions
 
+// Download URL, hash and signature of this device's own image (the base
+// image with its config block spliced in). Null if the base file is missing.
+async function deviceFirmwareImage(deviceId, version) {
+    try {
+        const image = await otaService.generateFirmwareBinary(deviceId, version);
+        return {
+            firmware_url: `${process.env.OTA_BASE_URL || 'http://localhost:3000'}${image.binaryUrl}`,
+            checksum: image.checksum,
+            signature: image.signature,
+            file_size: image.fileSize
+        };
+    } catch (error) {
+        if (error.code === 'ENOENT') {
+            return null;
+        }
+        throw error;
+    }
+}
+
 function calculateHealthStatus(device) {
     if (!device) return 'unknown';
 
@@ -1823,6 +1977,7 @@ router.post('/:id/sensors', authenticateToken, async (req, res) => {
                 updated_at = CURRENT_TIMESTAMP
             RETURNING *
         `, [deviceId, sensorTypeId, pin, name, calibration_offset || 0, calibration_multiplier || 1, enabled !== false]);
+        deviceConfigService.invalidate(deviceId);
 
         res.json({ sensor: result.rows[0] });
     } catch (error) {
@@ -1857,6 +2012,7 @@ router.put('/:deviceId/sensors/:sensorId', authenticateToken, async (req, res) =
         }
 
         const updatedSensor = result.rows[0];
+        deviceConfigService.invalidate(deviceId);
 
         // If OTA is requested, queue a firmware rebuild with updated sensor config
         if (trigger_ota !== false) {
@@ -1907,13 +2063,14 @@ router.put('/:deviceId/sensors/:sensorId', authenticateToken, async (req, res) =
 // DELETE /api/devices/:deviceId/sensors/:sensorId - Delete sensor
 router.delete('/:deviceId/sensors/:sensorId', authenticateToken, async (req, res) => {
     try {
-        const { sensorId } = req.params;
+        const { deviceId, sensorId } = req.params;
 
         const result = await db.query('DELETE FROM device_sensors WHERE id = $1 RETURNING id', [sensorId]);
 
         if (result.rows.length === 0) {
             return res.status(404).json({ error: 'Sensor not found' });
         }
+        deviceConfigService.invalidate(deviceId);
 
         res.json({ message: 'Sensor deleted successfully' });
     } catch (error) {
@@ -1957,7 +2114,15 @@ router.get('/:id/telemetry/history', authenticateToken, async (req, res) => {
     try {
         const deviceId = req.params.id;
         let { sensor_pin: sensorPin } = req.query;
-        const { start_date, end_date, aggregation = 'raw' } = req.query;
+        const { start_date, end_date, aggregation = 'raw', downsample = 'lttb' } = req.query;
+        const maxPoints = req.query.max_points !== undefined ? parseInt(req.query.max_points, 10) : null;
+
+        if (maxPoints !== null && (!Number.isInteger(maxPoints) || maxPoints < 3 || maxPoints > 20000)) {
+            return res.status(400).json({ error: 'max_points must be an integer between 3 and 20000' });
+        }
+        if (!DOWNSAMPLE_METHODS.includes(downsample)) {
+            return res.status(400).json({ error: `downsample must be one of: ${DOWNSAMPLE_METHODS.join(', ')}` });
+        }
 
         const telemetryProcessor = req.telemetryProcessor;
         if (!telemetryProcessor || typeof telemetryProcessor.getHistoricalTelemetry !== 'function') {
@@ -1988,7 +2153,8 @@ router.get('/:id/telemetry/history', authenticateToken, async (req, res) => {
             sensorPin,
             safeStart,
             safeEnd,
-            aggregation
+            aggregation,
+            { maxPoints, downsample }
         );
 
         res.json({
@@ -1996,7 +2162,10 @@ router.get('/:id/telemetry/history', authenticateToken, async (req, res) => {
             sensor_pin: sensorPin,
             start: safeStart.toISOString(),
             end: safeEnd.toISOString(),
-            aggregation
+            aggregation,
+            resolution: telemetryProcessor.selectTelemetryTier(safeStart, safeEnd, aggregation, maxPoints).name,
+            max_points: maxPoints,
+            downsample: maxPoints ? downsample : null
         });
     } catch (error) {
         logger.error('Get historical telemetry error:', error);
@@ -2057,6 +2226,130 @@ router.get('/:id/alerts', authenticateToken, async (req, res) => {
     }
 });
 
+// POST /api/devices/:id/history-requests - Ask a device for full-resolution history
+router.post('/:id/history-requests', authenticateToken, [
+    param('id').notEmpty(),
+    body('sensor_pin').notEmpty().isLength({ max: 10 }),
+    body('start').isISO8601(),
+    body('end').isISO8601()
+], async (req, res) => {
+    try {
+        const errors = validationResult(req);
+        if (!errors.isEmpty()) {
+            return res.status(400).json({ errors: errors.array() });
+        }
+
+        const { id } = req.params;
+        const { sensor_pin, start, end } = req.body;
+        const startMs = new Date(start).getTime();
+        const endMs = new Date(end).getTime();
+
+        const rangeError = historyBackfillService.validateRange(startMs, endMs);
+        if (rangeError) {
+            return res.status(400).json({ error: rangeError });
+        }
+
+        const sensorResult = await db.query(
+            'SELECT id FROM device_sensors WHERE device_id = $1 AND pin = $2',
+            [id, String(sensor_pin)]
+        );
+        if (sensorResult.rows.length === 0) {
+            return res.status(404).json({ error: 'Sensor not found' });
+        }
+
+        const request = await historyBackfillService.createRequest(id, sensor_pin, startMs, endMs, req.user.userId);
+        deviceConfigService.invalidate(id);
+        res.status(201).json({
+            message: 'History requested; the device will upload it after its next heartbeat',
+            request
+        });
+    } catch (error) {
+        logger.error('Create history request error:', error);
+        res.status(500).json({ error: 'Failed to create history request' });
+    }
+});
+
+// GET /api/devices/:id/history-requests - Backfill requests for a device
+router.get('/:id/history-requests', authenticateToken, async (req, res) => {
+    try {
+        const requests = await historyBackfillService.listRequests(req.params.id);
+        res.json({ requests });
+    } catch (error) {
+        logger.error('Get history requests error:', error);
+        res.status(500).json({ error: 'Failed to fetch history requests' });
+    }
+});
+
+// GET /api/devices/:id/history-requests/:requestId - Samples received for a backfill request
+router.get('/:id/history-requests/:requestId', authenticateToken, [
+    param('requestId').isInt({ min: 1 })
+], async (req, res) => {
+    try {
+        const errors = validationResult(req);
+        if (!errors.isEmpty()) {
+            return res.status(400).json({ errors: errors.array() });
+        }
+
+        const result = await historyBackfillService.getSamples(req.params.id, req.params.requestId);
+        if (!result) {
+            return res.status(404).json({ error: 'History request not found' });
+        }
+        res.json(result);
+    } catch (error) {
+        logger.error('Get history samples error:', error);
+        res.status(500).json({ error: 'Failed to fetch history samples' });
+    }
+});
+
+// GET /api/devices/:id/modbus - Modbus RTU register map
+router.get('/:id/modbus', authenticateToken, async (req, res) => {
+    try {
+        const points = await modbusConfigService.getPoints(req.params.id);
+        res.json({ points });
+    } catch (error) {
+        logger.error('Get Modbus map error:', error);
+        res.status(500).json({ error: 'Failed to fetch Modbus map' });
+    }
+});
+
+// PUT /api/devices/:id/modbus - Replace the Modbus RTU register map
+router.put('/:id/modbus', authenticateToken, [
+    param('id').notEmpty(),
+    body('points').isArray()
+], async (req, res) => {
+    try {
+        const errors = validationResult(req);
+        if (!errors.isEmpty()) {
+            return res.status(400).json({ errors: errors.array() });
+        }
+
+        const { points } = req.body;
+        const mapError = validateModbusPoints(points);
+        if (mapError) {
+            return res.status(400).json({ error: mapError });
+        }
+
+        const deviceResult = await db.query('SELECT id FROM devices WHERE id = $1', [req.params.id]);
+        if (deviceResult.rows.length === 0) {
+            return res.status(404).json({ error: 'Device not found' });
+        }
+
+        const result = await modbusConfigService.replacePoints(req.params.id, points);
+        if (result.error) {
+            return res.status(400).json({ error: result.error });
+        }
+        deviceConfigService.invalidate(req.params.id);
+
+        res.json({
+            message: 'Modbus map saved; the device will pick it up on its next heartbeat',
+            ...result
+        });
+    } catch (error) {
+        logger.error('Update Modbus map error:', error);
+        res.status(500).json({ error: 'Failed to save Modbus map' });
+    }
+});
+
 // GET /api/devices/:id/stats - Get device statistics
 router.get('/:id/stats', authenticateToken, async (req, res) => {
     try {
@@ -2422,89 +2715,45 @@ router.get('/export', authenticateToken, async (req, res) => {
 
         query += ' ORDER BY d.name';
 
-        const result = await db.query(query, params);
-
-        // Convert to CSV
-        if (result.rows.length === 0) {
-            return res.status(404).json({ error: 'No devices found' });
-        }
-
-        // Build CSV header
-        const headers = [
-            'Device ID',
-            'Name',
-            'Type',
-            'Status',
-            'Location',
-            'Firmware Version',
-            'Hardware Version',
-            'IP Address',
-            'Last Heartbeat',
-            'Uptime (seconds)',
-            'WiFi SSID',
-            'Memory Usage (%)',
-            'WiFi Signal (dBm)',
-            'Battery Level (%)',
-            'CPU Temperature (°C)',
-            'Created At',
-            'Updated At'
-        ];
-
-        // Build CSV rows
-        const csvRows = [headers.join(',')];
-
-        result.rows.forEach(device => {
-            const row = [
-                escapeCsvValue(device.id),
-                escapeCsvValue(device.name),
-                escapeCsvValue(device.device_type),
-                escapeCsvValue(device.status),
-                escapeCsvValue(device.location_name || ''),
-                escapeCsvValue(device.firmware_version || ''),
-                escapeCsvValue(device.hardware_version || ''),
-                escapeCsvValue(device.ip_address || ''),
-                escapeCsvValue(device.last_heartbeat ? new Date(device.last_heartbeat).toISOString() : ''),
-                escapeCsvValue(device.uptime_seconds || ''),
-                escapeCsvValue(device.wifi_ssid || ''),
-                escapeCsvValue(device.memory_usage_percent || ''),
-                escapeCsvValue(device.wifi_signal_strength || ''),
-                escapeCsvValue(device.battery_level || ''),
-                escapeCsvValue(device.cpu_temperature || ''),
-                escapeCsvValue(device.created_at ? new Date(device.created_at).toISOString() : ''),
-                escapeCsvValue(device.updated_at ? new Date(device.updated_at).toISOString() : '')
-            ];
-            csvRows.push(row.join(','));
+        const isoDate = key => device => (device[key] ? new Date(device[key]).toISOString() : '');
+        const orEmpty = key => device => device[key] || '';
+
+        const rowCount = await streamQueryExport(res, {
+            sql: query,
+            params,
+            columns: [
+                { key: 'id', header: 'Device ID' },
+                { key: 'name', header: 'Name' },
+                { key: 'device_type', header: 'Type' },
+                { key: 'status', header: 'Status' },
+                { key: 'location_name', header: 'Location', value: orEmpty('location_name') },
+                { key: 'firmware_version', header: 'Firmware Version', value: orEmpty('firmware_version') },
+                { key: 'hardware_version', header: 'Hardware Version', value: orEmpty('hardware_version') },
+                { key: 'ip_address', header: 'IP Address', value: orEmpty('ip_address') },
+                { key: 'last_heartbeat', header: 'Last Heartbeat', value: isoDate('last_heartbeat') },
+                { key: 'uptime_seconds', header: 'Uptime (seconds)', value: orEmpty('uptime_seconds') },
+                { key: 'wifi_ssid', header: 'WiFi SSID', value: orEmpty('wifi_ssid') },
+                { key: 'memory_usage_percent', header: 'Memory Usage (%)', value: orEmpty('memory_usage_percent') },
+                { key: 'wifi_signal_strength', header: 'WiFi Signal (dBm)', value: orEmpty('wifi_signal_strength') },
+                { key: 'battery_level', header: 'Battery Level (%)', value: orEmpty('battery_level') },
+                { key: 'cpu_temperature', header: 'CPU Temperature (°C)', value: orEmpty('cpu_temperature') },
+                { key: 'created_at', header: 'Created At', value: isoDate('created_at') },
+                { key: 'updated_at', header: 'Updated At', value: isoDate('updated_at') }
+            ],
+            format: 'csv',
+            filename: `devices_export_${new Date().toISOString().split('T')[0]}`,
+            onEmpty: (response) => response.status(404).json({ error: 'No devices found' })
         });
 
-        const csv = csvRows.join('\n');
-
-        // Set headers for file download
-        res.setHeader('Content-Type', 'text/csv');
-        res.setHeader('Content-Disposition', `attachment; filename="devices_export_${new Date().toISOString().split('T')[0]}.csv"`);
-
-        logger.info(`Devices exported to CSV by ${req.user.email}: ${result.rows.length} devices`);
-
-        res.send(csv);
+        if (rowCount > 0) {
+            logger.info(`Devices exported to CSV by ${req.user.email}: ${rowCount} devices`);
+        }
     } catch (error) {
         logger.error('Export devices error:', error);
-        res.status(500).json({ error: 'Failed to export devices' });
+        if (!res.headersSent) {
+            res.status(500).json({ error: 'Failed to export devices' });
+        }
     }
 });
 
-// Helper function to escape CSV values
-function escapeCsvValue(value) {
-    if (value === null || value === undefined) {
-        return '';
-    }
-
-    const stringValue = String(value);
-
-    // If the value contains comma, quote, or newline, wrap it in quotes and escape quotes
-    if (stringValue.includes(',') || stringValue.includes('"') || stringValue.includes('\n')) {
-        return `"${stringValue.replace(/"/g, '""')}"`;
-    }
-
-    return stringValue;
-}
-
 module.exports = router;
@@ -3,10 +3,12 @@ const multer = require('multer');
 const path = require('path');
 const fs = require('fs').promises;
 const crypto = require('crypto');
+const { pipeline } = require('stream');
 const { body, param, query, validationResult } = require('express-validator');
 const db = require('../models/database');
 const logger = require('../utils/logger');
 const { authenticateToken, requireRole } = require('../middleware/auth');
+const otaService = require('../services/otaService');
 
 const router = express.Router();
 
@@ -152,6 +154,7 @@ router.post('/upload', authenticateToken, requireOperator, upload.single('firmwa
         // Calculate checksum
         const fileBuffer = await fs.readFile(req.file.path);
         const checksum = crypto.createHash('sha256').update(fileBuffer).digest('hex');
+        const signature = otaService.signFirmware(fileBuffer);
 
         // Move file to firmware directory
         const firmwareDir = process.env.FIRMWARE_DIR || './firmware';
@@ -164,16 +167,17 @@ router.post('/upload', authenticateToken, requireOperator, upload.single('firmwa
         // Store in database
         const result = await db.query(`
             INSERT INTO firmware_versions (
-                version, device_type, binary_url, checksum, file_size,
+                version, device_type, binary_url, checksum, signature, file_size,
                 release_notes, is_stable, is_active
             )
-            VALUES ($1, $2, $3, $4, $5, $6, $7, true)
+            VALUES ($1, $2, $3, $4, $5, $6, $7, $8, true)
             RETURNING *
         `, [
             version,
             device_type,
             `/api/firmware/download/${fileName}`,
             checksum,
+            signature,
             fileBuffer.length,
             release_notes,
             is_stable
@@ -238,6 +242,112 @@ router.get('/download/:filename', async (req, res) => {
     }
 });
 
+// Parse a single "bytes=" range against a known size.
+// Returns null when no usable Range header is present, false when unsatisfiable.
+function parseByteRange(header, size) {
+    const match = /^bytes=(\d*)-(\d*)$/.exec((header || '').trim());
+    if (!match || (match[1] === '' && match[2] === '')) {
+        return null;
+    }
+
+    let start;
+    let end;
+    if (match[1] === '') {
+        // Suffix range: last N bytes
+        const suffix = parseInt(match[2], 10);
+        if (suffix === 0) {
+            return false;
+        }
+        start = Math.max(0, size - suffix);
+        end = size - 1;
+    } else {
+        start = parseInt(match[1], 10);
+        end = match[2] === '' ? size - 1 : Math.min(parseInt(match[2], 10), size - 1);
+    }
+
+    if (start >= size || start > end) {
+        return false;
+    }
+    return { start, end };
+}
+
+// GET /api/firmware/download/device/:deviceId/:version - Device-specific OTA image
+// Streams the base image with the device config spliced in; supports Range so
+// devices on flaky links can resume instead of restarting the download.
+router.get('/download/device/:deviceId/:version', [
+    param('deviceId').matches(/^[\w-]+$/),
+    param('version').matches(/^[\w.-]+$/),
+    query('token').isString()
+], async (req, res) => {
+    try {
+        const errors = validationResult(req);
+        if (!errors.isEmpty()) {
+            return res.status(400).json({ errors: errors.array() });
+        }
+
+        const { deviceId, version } = req.params;
+
+        if (!otaService.verifyDownloadToken(deviceId, version, req.query.token)) {
+            return res.status(403).json({ error: 'Invalid or expired download token' });
+        }
+
+        let image;
+        try {
+            image = await otaService.openDeviceFirmware(deviceId, version);
+        } catch (error) {
+            if (error.code === 'ENOENT') {
+                return res.status(404).json({ error: 'Firmware file not found' });
+            }
+            throw error;
+        }
+
+        res.setHeader('Content-Type', 'application/octet-stream');
+        res.setHeader('Content-Disposition', `attachment; filename="firmware_${version}.bin"`);
+        res.setHeader('Accept-Ranges', 'bytes');
+        res.setHeader('ETag', image.etag);
+        res.setHeader('X-Firmware-Version', version);
+
+        // A stale If-Range means the image changed; send the whole thing
+        const ifRange = req.headers['if-range'];
+        const range = ifRange && ifRange !== image.etag
+            ? null
+            : parseByteRange(req.headers.range, image.size);
+
+        if (range === false) {
+            res.setHeader('Content-Range', `bytes */${image.size}`);
+            return res.status(416).end();
+        }
+
+        const start = range ? range.start : 0;
+        const end = range ? range.end : image.size - 1;
+
+        if (range) {
+            res.status(206);
+            res.setHeader('Content-Range', `bytes ${start}-${end}/${image.size}`);
+        }
+        res.setHeader('Content-Length', end - start + 1);
+
+        if (req.method === 'HEAD') {
+            return res.end();
+        }
+
+        pipeline(otaService.createFirmwareStream(image, start, end), res, (error) => {
+            if (error && error.code !== 'ERR_STREAM_PREMATURE_CLOSE') {
+                logger.error(`Firmware stream error for device ${deviceId}:`, error);
+            }
+        });
+
+        logger.logOTAEvent(deviceId, 'firmware_download', {
+            version,
+            range: range ? `${start}-${end}` : 'full',
+            customized: image.region !== null
+        });
+    } catch (error) {
+        logger.error('Download device firmware error:', error);
+        res.status(500).json({ error: 'Failed to download firmware' });
+    }
+});
+
 // PUT /api/firmware/versions/:id/stable - Mark firmware as stable
 router.put('/versions/:id/stable', [
     param('id').isInt({ min: 1 })
@@ -664,6 +774,9 @@ router.get('/:id', [
             res.setHeader('Content-Length', firmware.file_size);
             res.setHeader('X-Firmware-Version', firmware.version);
             res.setHeader('X-Firmware-Checksum', firmware.checksum);
+            if (firmware.signature) {
+                res.setHeader('X-Firmware-Signature', firmware.signature);
+            }
 
             return res.send(firmware.binary_data);
         }
@@ -685,6 +798,9 @@ router.get('/:id', [
                 res.setHeader('Content-Disposition', `attachment; filename="firmware_${firmware.version}.bin"`);
                 res.setHeader('X-Firmware-Version', firmware.version);
                 res.setHeader('X-Firmware-Checksum', firmware.checksum);
+                if (firmware.signature) {
+                    res.setHeader('X-Firmware-Signature', firmware.signature);
+                }
 
                 const fs_sync = require('fs');
                 const fileStream = fs_sync.createReadStream(filePath);
@@ -7,6 +7,34 @@ const db = require('../models/database');
 const logger = require('../utils/logger');
 const { authenticateToken } = require('../middleware/auth');
 const firmwareCompiler = require('../services/firmwareCompiler');
+const DeviceIngressService = require('../services/deviceIngressService');
+const otaService = require('../services/otaService');
+const deviceConfigService = require('../services/deviceConfigService');
+
+// Per-device ingress token, baked in as SERVER_API_KEY when none is given
+function defaultDeviceToken(deviceId) {
+    return process.env.DEVICE_TOKEN_SECRET ? DeviceIngressService.deriveDeviceToken(deviceId) : '';
+}
+
+// OTA signing public key as a C string literal ("" when signing is off)
+function signingPublicKeyLiteral() {
+    const pem = otaService.getSigningPublicKey();
+    if (!pem) {
+        return '""';
+    }
+    return pem.trim().split('\n').map(line => `"${line}\\n"`).join(' \\\n    ');
+}
+
+// Roaming credentials as a C initializer list, the primary network first
+function wifiNetworksLiteral(config) {
+    const networks = [];
+    for (const network of [{ ssid: config.wifi_ssid, password: config.wifi_password }, ...(config.wifi_networks || [])]) {
+        if (network && network.ssid && !networks.some(known => known.ssid === network.ssid)) {
+            networks.push(network);
+        }
+    }
+    return `{ ${networks.map(network => `{ "${network.ssid}", "${network.password || ''}" }`).join(', ')} }`;
+}
 
 // Convert sensor array from frontend to object format expected by generateDeviceConfig
 function convertSensorArrayToObject(sensorsArray) {
@@ -40,6 +68,17 @@ function convertSensorArrayToObject(sensorsArray) {
                     sensorConfig.humidity_min = sensor.humidity_min || 20.0;
                     sensorConfig.humidity_max = sensor.humidity_max || 80.0;
                     break;
+                case 'temperature_probes':
+                    sensorConfig.temperature_min = sensor.temperature_min ?? -10.0;
+                    sensorConfig.temperature_max = sensor.temperature_max ?? 40.0;
+                    sensorConfig.resolution = sensor.resolution || 12;
+                    break;
+                case 'pulse_counter':
+                    sensorConfig.pulses_per_unit = sensor.pulses_per_unit || 1000;
+                    sensorConfig.filter_us = sensor.filter_us ?? 10;
+                    sensorConfig.rate_min = sensor.rate_min ?? 0;
+                    sensorConfig.rate_max = sensor.rate_max ?? 100000;
+                    break;
                 case 'motion':
                     sensorConfig.timeout = sensor.motion_timeout || 30000;
                     break;
@@ -49,6 +88,12 @@ function convertSensorArrayToObject(sensorsArray) {
                     sensorConfig.min_distance = sensor.min_distance || 2.0;
                     sensorConfig.max_distance = sensor.max_distance || 200.0;
                     break;
+                case 'modbus':
+                    sensorConfig.rx_pin = sensor.rx_pin;
+                    sensorConfig.tx_pin = sensor.tx_pin;
+                    sensorConfig.de_pin = sensor.de_pin;
+                    sensorConfig.baud = sensor.baud || 9600;
+                    break;
             }
 
             sensorsObject[sensor.type] = sensorConfig;
@@ -135,6 +180,15 @@ async function registerDeviceInDatabase(config) {
         if (sensorsArray && Array.isArray(sensorsArray) && sensorsArray.length > 0) {
             for (const sensor of sensorsArray) {
                 if (!sensor.enabled) continue;
+                // Probes are found on the bus at boot and register themselves
+                // (pin "OW" + ROM serial) with their first telemetry
+                if (sensor.type === 'temperature_probes') continue;
+                // Modbus points come from the device's register map
+                // (PUT /api/devices/:id/modbus), not from the build
+                if (sensor.type === 'modbus') continue;
+                // Pulse channels ("P27.count", ".rate", ".total") register
+                // themselves with their first telemetry, like probes
+                if (sensor.type === 'pulse_counter') continue;
 
                 const sensorTypeName = sensorTypeMapping[sensor.type] || sensor.type;
 
@@ -186,6 +240,7 @@ async function registerDeviceInDatabase(config) {
 
                 logger.info(`Registered sensor: ${sensor.name || sensor.type} (${normalizedPin}) for device ${device_id}`);
             }
+            deviceConfigService.invalidate(device_id);
         }
 
         return { success: true, device_id };
@@ -210,6 +265,7 @@ router.post('/build', authenticateToken, async (req, res) => {
             wifi_ssid,
             wifi_password,
             open_wifi = false,
+            wifi_networks = [], // additional { ssid, password } for roaming (ESP32)
 
             // Server configuration
             server_url,
@@ -257,8 +313,9 @@ router.post('/build', authenticateToken, async (req, res) => {
             device_location: device_location || 'Unknown',
             wifi_ssid,
             wifi_password,
+            wifi_networks: Array.isArray(wifi_networks) ? wifi_networks : [],
             server_url,
-            api_key: api_key || '',
+            api_key: api_key || defaultDeviceToken(device_id),
             heartbeat_interval,
             sensor_read_interval,
             debug_mode,
@@ -317,6 +374,9 @@ router.post('/build', authenticateToken, async (req, res) => {
             // For Arduino/ESP, add header file
             zip.file('device_config.h', configContent);
             zip.file(mainFilename, mainFirmware);
+            if (platform !== 'arduino') {
+                zip.file('modbus_rtu.h', await fs.readFile(path.join(firmwarePath, 'modbus_rtu.h'), 'utf8'));
+            }
         }
 
         // Add installation instructions
@@ -428,7 +488,7 @@ router.post('/compile', authenticateToken, async (req, res) => {
             wifi_ssid,
             wifi_password,
             server_url,
-            api_key: api_key || '',
+            api_key: api_key || defaultDeviceToken(device_id),
             heartbeat_interval,
             sensor_read_interval,
             debug_mode,
@@ -624,6 +684,35 @@ router.get('/sensor-options', (req, res) => {
                 humidity_max: { default: 80, min: 0, max: 100 }
             }
         },
+        temperature_probes: {
+            name: 'Temperature Probes (DS18B20, 1-Wire)',
+            pin_type: 'digital',
+            recommended_pins: ['D1', 'D5', 'D6', 'D7'],
+            default_pin: 'D1',
+            description: 'Any number of waterproof temperature probes on one pin (cold rooms, racks); each probe becomes its own sensor',
+            required_libraries: ['OneWire'],
+            wiring_notes: 'All probes in parallel: VDD to 3.3V, GND to GND, DQ to the pin. One 4.7kΩ pull-up between DQ and 3.3V for the whole bus.',
+            thresholds: {
+                temperature_min: { default: -10, min: -55, max: 125 },
+                temperature_max: { default: 40, min: -55, max: 125 },
+                resolution: { default: 12, min: 9, max: 12 }
+            }
+        },
+        pulse_counter: {
+            name: 'Pulse Counter (Energy/Water/Gas Meter)',
+            pin_type: 'digital',
+            recommended_pins: ['D7', 'D1', 'D2', 'D5'],
+            default_pin: 'D7',
+            description: 'S0 or open-collector pulse output of a utility meter; reports pulses, rate (units/h) and total per interval. Counted in hardware on ESP32',
+            required_libraries: [],
+            wiring_notes: 'S0+ / collector to the pin (internal pull-up), S0- / emitter to GND. For reed-contact meters raise the filter to a few ms (ESP8266 only; the ESP32 counter filter tops out at 12 µs, add an RC filter there).',
+            thresholds: {
+                pulses_per_unit: { default: 1000, min: 1, max: 100000 },
+                filter_us: { default: 10, min: 0, max: 100000 },
+                rate_min: { default: 0, min: 0, max: 100000 },
+                rate_max: { default: 100000, min: 0, max: 100000 }
+            }
+        },
         light: {
             name: 'Light Sensor (LDR/Photodiode)',
             pin_type: 'analog',
@@ -664,6 +753,19 @@ router.get('/sensor-options', (req, res) => {
                 distance_max: { default: 200, min: 2, max: 400 }
             }
         },
+        modbus: {
+            name: 'Modbus RTU Meters (RS-485)',
+            pin_type: 'digital',
+            recommended_pins: ['D5,D6,D0', 'D1,D2,D3'],
+            default_pin: 'D5,D6,D0',
+            description: 'Energy meters, flow meters and PLC sensors on an RS-485 bus; registers to read are set per device from the dashboard',
+            required_libraries: [],
+            wiring_notes: 'MAX485-style transceiver: RO to the first pin, DI to the second, DE and /RE together to the third. 120Ω termination at both ends of the bus.',
+            pins_required: 3,
+            thresholds: {
+                baud: { default: 9600, min: 1200, max: 115200 }
+            }
+        },
         sound: {
             name: 'Sound Level Sensor',
             pin_type: 'analog',
@@ -773,6 +875,10 @@ function generateDeviceConfig(config) {
 #define WIFI_CONNECT_TIMEOUT_SEC 30
 #define WIFI_RECONNECT_ATTEMPTS 3
 #define WIFI_RECONNECT_DELAY_MS 5000
+#define WIFI_NETWORKS ${wifiNetworksLiteral(config)}
+#define WIFI_SCAN_INTERVAL_MS 600000
+#define WIFI_ROAM_RSSI_DBM -70
+#define WIFI_ROAM_HYSTERESIS_DB 8
 
 // SERVER CONFIGURATION
 #define SERVER_URL "${config.server_url}"
@@ -780,15 +886,25 @@ function generateDeviceConfig(config) {
 #define USE_HTTPS ${config.server_url.startsWith('https') ? 'true' : 'false'}
 #define SERVER_FINGERPRINT ""
 
+// OTA IMAGE VERIFICATION (SHA-256 + signature, ESP32)
+#define OTA_SIGNING_PUBLIC_KEY ${signingPublicKeyLiteral()}
+#define OTA_REQUIRE_SIGNATURE ${otaService.getSigningPublicKey() ? 'true' : 'false'}
+
 // DEVICE BEHAVIOR SETTINGS
 #define HEARTBEAT_INTERVAL_SEC ${config.heartbeat_interval}
 #define SENSOR_READ_INTERVAL_MS ${config.sensor_read_interval}
 #define TELEMETRY_BATCH_SIZE 5
 #define TELEMETRY_SEND_INTERVAL_MS 5000
 #define THRESHOLD_ALERT_ENABLED true
+#define CAPTURE_ENABLED true
+#define CAPTURE_RATE_HZ 50
+#define CAPTURE_PRE_MS 2000
+#define CAPTURE_POST_MS 2000
 #define DEVICE_ARMED ${config.device_armed ? 'true' : 'false'}
 #define DEBUG_MODE ${config.debug_mode ? 'true' : 'false'}
 #define OTA_ENABLED ${config.ota_enabled ? 'true' : 'false'}
+#define OTA_MAX_BYTES_PER_SEC 16384
+#define OTA_REBOOT_DEFER_MAX_MS 1800000
 
 // ========================================
 // SENSOR CONFIGURATION
@@ -804,8 +920,13 @@ ${generateSensorConfig(sensors)}
 #define USE_JSON_COMPRESSION false
 #define MAX_RETRY_ATTEMPTS 3
 #define HTTP_REQUEST_TIMEOUT_MS 10000
+#define TELEMETRY_DEADBAND_PCT 0
+#define HISTORY_STORE_ENABLED true
+#define HISTORY_RETENTION_HOURS 24
 #define DEEP_SLEEP_ENABLED false
 #define DEEP_SLEEP_DURATION_SEC 300
+#define ULP_WATCH_ENABLED false
+#define ULP_SAMPLE_PERIOD_MS 1000
 #define BATTERY_MONITORING_ENABLED false
 #define LOW_BATTERY_THRESHOLD_V 3.2
 
@@ -921,6 +1042,24 @@ function generateSensorConfig(sensors) {
 `;
     }
 
+    // Modbus RTU over RS-485
+    if (sensors.modbus?.enabled) {
+        const s = sensors.modbus;
+        config += `
+// Modbus RTU over RS-485 (register map from the server)
+#define MODBUS_ENABLED true
+#define MODBUS_RX_PIN ${s.rx_pin || 'D5'}
+#define MODBUS_TX_PIN ${s.tx_pin || 'D6'}
+#define MODBUS_DE_PIN ${s.de_pin || 'D0'}
+#define MODBUS_BAUD ${s.baud || 9600}
+`;
+    } else {
+        config += `
+// Modbus RTU over RS-485 - DISABLED
+#define MODBUS_ENABLED false
+`;
+    }
+
     // Sound Sensor
     if (sensors.sound?.enabled) {
         const s = sensors.sound;
@@ -981,6 +1120,49 @@ function generateSensorConfig(sensors) {
 `;
     }
 
+    // DS18B20 Temperature Probes
+    if (sensors.temperature_probes?.enabled) {
+        const s = sensors.temperature_probes;
+        config += `
+// DS18B20 Temperature Probes (1-Wire bus)
+#define SENSOR_ONEWIRE_ENABLED true
+#define SENSOR_ONEWIRE_PIN ${s.pin || 'D1'}
+#define ONEWIRE_RESOLUTION_BITS ${s.resolution || 12}
+#define PROBE_THRESHOLD_MIN ${s.temperature_min ?? -10.0}
+#define PROBE_THRESHOLD_MAX ${s.temperature_max ?? 40.0}
+`;
+    } else {
+        config += `
+// DS18B20 Temperature Probes (1-Wire bus) - DISABLED
+#define SENSOR_ONEWIRE_ENABLED false
+#define SENSOR_ONEWIRE_PIN D1
+#define ONEWIRE_RESOLUTION_BITS 12
+#define PROBE_THRESHOLD_MIN -10.0
+#define PROBE_THRESHOLD_MAX 40.0
+`;
+    }
+
+    // Pulse counter (utility meter S0 output)
+    if (sensors.pulse_counter?.enabled) {
+        const s = sensors.pulse_counter;
+        config += `
+// Pulse Counter (meter S0 output)
+#define SENSOR_PULSE_ENABLED true
+#define SENSOR_PULSE_PIN ${s.pin || 'D7'}
+#define PULSES_PER_UNIT ${Number(s.pulses_per_unit || 1000).toFixed(1)}
+#define PULSE_FILTER_US ${s.filter_us ?? 10}
+#define PULSE_RATE_THRESHOLD_MIN ${s.rate_min ?? 0}
+#define PULSE_RATE_THRESHOLD_MAX ${s.rate_max ?? 100000}
+`;
+    } else {
+        config += `
+// Pulse Counter (meter S0 output) - DISABLED
+#define SENSOR_PULSE_ENABLED false
+#define SENSOR_PULSE_PIN D7
+#define PULSES_PER_UNIT 1000.0
+`;
+    }
+
     // Gas Sensor
     if (sensors.gas?.enabled) {
         const s = sensors.gas;
@@ -1296,6 +1478,14 @@ function generateLibrariesList(platform, sensors) {
         libraries.add('Ultrasonic (by ErickSimoes) or NewPing');
     }
 
+    if (sensors.temperature_probes?.enabled) {
+        libraries.add('OneWire (by Paul Stoffregen)');
+    }
+
+    if (sensors.modbus?.enabled && platform !== 'esp32') {
+        libraries.add('EspSoftwareSerial (bundled with the ESP8266 core)');
+    }
+
     const platformName = platform === 'esp32' ? 'ESP32' : platform === 'arduino' ? 'Arduino' : 'ESP8266';
 
     return `Required Arduino Libraries for ${platformName} Firmware
@@ -1355,6 +1545,17 @@ DHT22 Temperature/Humidity Sensor:
 `;
     }
 
+    if (sensors.temperature_probes?.enabled) {
+        const pin = sensors.temperature_probes.pin || 'D1';
+        diagram += `
+DS18B20 Temperature Probes (any number, all in parallel):
+- VDD (red) → 3.3V
+- GND (black) → GND
+- DQ (yellow) → ${pin}
+- One 4.7kΩ pull-up resistor between DQ and 3.3V for the whole bus
+`;
+    }
+
     if (sensors.light?.enabled) {
         diagram += `
 Light Sensor (LDR):
@@ -1386,6 +1587,28 @@ HC-SR04 Ultrasonic Distance Sensor:
 `;
     }
 
+    if (sensors.pulse_counter?.enabled) {
+        const pin = sensors.pulse_counter.pin || 'D7';
+        diagram += `
+Pulse Counter (meter S0 / open-collector output):
+- S0+ (collector) → ${pin} (internal pull-up)
+- S0- (emitter) → GND
+`;
+    }
+
+    if (sensors.modbus?.enabled) {
+        const s = sensors.modbus;
+        diagram += `
+RS-485 Transceiver (MAX485 or similar) for Modbus RTU:
+- VCC → 3.3V (or 5V with a 3.3V-tolerant RO, e.g. via a divider)
+- GND → GND
+- RO → ${s.rx_pin || 'D5'}
+- DI → ${s.tx_pin || 'D6'}
+- DE and /RE (tied together) → ${s.de_pin || 'D0'}
+- A/B → bus A/B, 120Ω termination at both ends of the bus
+`;
+    }
+
     if (sensors.magnetic?.enabled) {
         const pin = sensors.magnetic.pin || 'D3';
         diagram += `
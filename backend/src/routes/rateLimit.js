@@ -6,6 +6,7 @@
 const express = require('express');
 const router = express.Router();
 const logger = require('../utils/logger');
+const deviceQuotaService = require('../services/deviceQuotaService');
 
 module.exports = (rateLimiter) => {
     /**
@@ -115,6 +116,26 @@ module.exports = (rateLimiter) => {
         }
     });
 
+    /**
+     * GET /api/rate-limits/devices/:deviceId
+     * Get per-device token bucket levels (telemetry, alerts, control)
+     */
+    router.get('/devices/:deviceId', (req, res) => {
+        try {
+            res.json({
+                success: true,
+                deviceId: req.params.deviceId,
+                buckets: deviceQuotaService.getDeviceStatus(req.params.deviceId)
+            });
+        } catch (error) {
+            logger.error('Error getting device quota status:', error);
+            res.status(500).json({
+                success: false,
+                error: 'Failed to get device quota status'
+            });
+        }
+    });
+
     /**
      * PUT /api/rate-limits/config/:role
      * Update rate limit configuration for a role (admin only)
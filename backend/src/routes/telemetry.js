@@ -3,6 +3,7 @@ const { body, param, query, validationResult } = require('express-validator');
 const db = require('../models/database');
 const logger = require('../utils/logger');
 const { authenticateToken, requireAdmin } = require('../middleware/auth');
+const { EXPORT_FORMATS, streamQueryExport } = require('../utils/streamExport');
 
 const router = express.Router();
 
@@ -98,63 +99,37 @@ router.get('/devices/:device_id', [
                 JOIN sensor_types st ON ds.sensor_type_id = st.id
                 ${whereClause}
             `;
-        } else if (aggregation === 'hourly') {
-            query = `
-                SELECT
-                    DATE_TRUNC('hour', t.timestamp) as timestamp,
-                    ds.pin as sensor_pin,
-                    ds.name as sensor_name,
-                    st.name as sensor_type,
-                    st.unit,
-                    AVG(t.processed_value) as avg_value,
-                    MIN(t.processed_value) as min_value,
-                    MAX(t.processed_value) as max_value,
-                    COUNT(*) as sample_count
-                FROM telemetry t
-                JOIN device_sensors ds ON t.device_sensor_id = ds.id
-                JOIN sensor_types st ON ds.sensor_type_id = st.id
-                ${whereClause}
-                GROUP BY DATE_TRUNC('hour', t.timestamp), ds.pin, ds.name, st.name, st.unit
-                ORDER BY timestamp DESC
-                LIMIT $${params.length + 1} OFFSET $${params.length + 2}
-            `;
-            params.push(limit, offset);
+        } else {
+            // Hourly/daily views read the rollup tier maintained at ingest
+            const rollupTable = aggregation === 'hourly' ? 'telemetry_rollup_1h' : 'telemetry_rollup_1d';
+            const rollupWhere = whereClause.replace(/t\.timestamp/g, 'r.bucket').replace(/\bt\./g, 'r.');
 
-            countQuery = `
-                SELECT COUNT(DISTINCT DATE_TRUNC('hour', t.timestamp)) as total
-                FROM telemetry t
-                JOIN device_sensors ds ON t.device_sensor_id = ds.id
-                JOIN sensor_types st ON ds.sensor_type_id = st.id
-                ${whereClause}
-            `;
-        } else if (aggregation === 'daily') {
             query = `
                 SELECT
-                    DATE_TRUNC('day', t.timestamp) as timestamp,
+                    r.bucket as timestamp,
                     ds.pin as sensor_pin,
                     ds.name as sensor_name,
                     st.name as sensor_type,
                     st.unit,
-                    AVG(t.processed_value) as avg_value,
-                    MIN(t.processed_value) as min_value,
-                    MAX(t.processed_value) as max_value,
-                    COUNT(*) as sample_count
-                FROM telemetry t
-                JOIN device_sensors ds ON t.device_sensor_id = ds.id
+                    r.sum_value / r.sample_count as avg_value,
+                    r.min_value,
+                    r.max_value,
+                    r.sample_count
+                FROM ${rollupTable} r
+                JOIN device_sensors ds ON r.device_sensor_id = ds.id
                 JOIN sensor_types st ON ds.sensor_type_id = st.id
-                ${whereClause}
-                GROUP BY DATE_TRUNC('day', t.timestamp), ds.pin, ds.name, st.name, st.unit
-                ORDER BY timestamp DESC
+                ${rollupWhere}
+                ORDER BY r.bucket DESC
                 LIMIT $${params.length + 1} OFFSET $${params.length + 2}
             `;
             params.push(limit, offset);
 
             countQuery = `
-                SELECT COUNT(DISTINCT DATE_TRUNC('day', t.timestamp)) as total
-                FROM telemetry t
-                JOIN device_sensors ds ON t.device_sensor_id = ds.id
+                SELECT COUNT(DISTINCT r.bucket) as total
+                FROM ${rollupTable} r
+                JOIN device_sensors ds ON r.device_sensor_id = ds.id
                 JOIN sensor_types st ON ds.sensor_type_id = st.id
-                ${whereClause}
+                ${rollupWhere}
             `;
         }
 
@@ -258,13 +233,14 @@ router.get('/devices/:device_id/sensors', [
     }
 });
 
-// GET /api/telemetry/devices/:device_id/export - Export telemetry data as CSV
+// GET /api/telemetry/devices/:device_id/export - Stream telemetry data as CSV/NDJSON/JSON
 router.get('/devices/:device_id/export', [
     param('device_id').notEmpty(),
     query('start_time').optional().isISO8601(),
     query('end_time').optional().isISO8601(),
     query('sensor_id').optional().isInt(),
-    query('format').optional().isIn(['csv', 'json'])
+    query('format').optional().isIn(EXPORT_FORMATS),
+    query('gzip').optional().isBoolean()
 ], authenticateToken, async (req, res) => {
     try {
         const errors = validationResult(req);
@@ -295,42 +271,44 @@ router.get('/devices/:device_id/export', [
 
         const whereClause = 'WHERE ' + conditions.join(' AND ');
 
-        const result = await db.query(`
-            SELECT
-                t.timestamp,
-                t.raw_value,
-                t.processed_value as value,
-                ds.pin as sensor_pin,
-                ds.name as sensor_name,
-                st.name as sensor_type,
-                st.unit
-            FROM telemetry t
-            JOIN device_sensors ds ON t.device_sensor_id = ds.id
-            JOIN sensor_types st ON ds.sensor_type_id = st.id
-            ${whereClause}
-            ORDER BY t.timestamp DESC
-        `, params);
-
-        if (format === 'json') {
-            const filename = `telemetry_${device_id}_${new Date().toISOString().split('T')[0]}.json`;
-            res.setHeader('Content-Type', 'application/json');
-            res.setHeader('Content-Disposition', `attachment; filename="${filename}"`);
-            res.json({ telemetry: result.rows });
-        } else {
-            // CSV format
-            const csvHeader = 'Timestamp,Raw Value,Processed Value,Sensor Pin,Sensor Name,Sensor Type,Unit\n';
-            const csvData = result.rows.map(row =>
-                `${row.timestamp},${row.raw_value},${row.value},${row.sensor_pin},"${row.sensor_name}","${row.sensor_type}",${row.unit}`
-            ).join('\n');
-
-            const filename = `telemetry_${device_id}_${new Date().toISOString().split('T')[0]}.csv`;
-            res.setHeader('Content-Type', 'text/csv');
-            res.setHeader('Content-Disposition', `attachment; filename="${filename}"`);
-            res.send(csvHeader + csvData);
-        }
+        const rowCount = await streamQueryExport(res, {
+            sql: `
+                SELECT
+                    t.timestamp,
+                    t.raw_value,
+                    t.processed_value as value,
+                    ds.pin as sensor_pin,
+                    ds.name as sensor_name,
+                    st.name as sensor_type,
+                    st.unit
+                FROM telemetry t
+                JOIN device_sensors ds ON t.device_sensor_id = ds.id
+                JOIN sensor_types st ON ds.sensor_type_id = st.id
+                ${whereClause}
+                ORDER BY t.timestamp DESC
+            `,
+            params,
+            columns: [
+                { key: 'timestamp', header: 'Timestamp' },
+                { key: 'raw_value', header: 'Raw Value' },
+                { key: 'value', header: 'Processed Value' },
+                { key: 'sensor_pin', header: 'Sensor Pin' },
+                { key: 'sensor_name', header: 'Sensor Name' },
+                { key: 'sensor_type', header: 'Sensor Type' },
+                { key: 'unit', header: 'Unit' }
+            ],
+            format,
+            gzip: req.query.gzip === 'true',
+            filename: `telemetry_${device_id}_${new Date().toISOString().split('T')[0]}`,
+            jsonKey: 'telemetry'
+        });
+
+        logger.info(`Telemetry for ${device_id} exported as ${format}: ${rowCount} rows`);
     } catch (error) {
         logger.error('Export telemetry error:', error);
-        res.status(500).json({ error: 'Failed to export telemetry data' });
+        if (!res.headersSent) {
+            res.status(500).json({ error: 'Failed to export telemetry data' });
+        }
     }
 });
 
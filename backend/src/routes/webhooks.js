@@ -303,7 +303,7 @@ router.post('/:id/test',
                     sendResult = await webhookService.sendSlackNotification(
                         webhook.webhook_url,
                         testMessage,
-                        { alert: testAlert }
+                        { alert: testAlert, queueRetry: false }
                     );
                     break;
 
@@ -311,7 +311,7 @@ router.post('/:id/test',
                     sendResult = await webhookService.sendDiscordNotification(
                         webhook.webhook_url,
                         testMessage,
-                        { alert: testAlert }
+                        { alert: testAlert, queueRetry: false }
                     );
                     break;
 
@@ -319,7 +319,7 @@ router.post('/:id/test',
                     sendResult = await webhookService.sendTeamsNotification(
                         webhook.webhook_url,
                         testMessage,
-                        { alert: testAlert }
+                        { alert: testAlert, queueRetry: false }
                     );
                     break;
 
@@ -328,7 +328,7 @@ router.post('/:id/test',
                         webhook.bot_token,
                         webhook.chat_id,
                         testMessage,
-                        { alert: testAlert }
+                        { alert: testAlert, queueRetry: false }
                     );
                     break;
 
@@ -342,7 +342,8 @@ router.post('/:id/test',
                     sendResult = await webhookService.sendCustomWebhook(
                         webhook.webhook_url,
                         customPayload,
-                        JSON.parse(webhook.custom_headers || '{}')
+                        JSON.parse(webhook.custom_headers || '{}'),
+                        { queueRetry: false }
                     );
                     break;
 
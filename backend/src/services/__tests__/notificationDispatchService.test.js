@@ -0,0 +1,212 @@
+const notificationDispatchService = require('../../services/notificationDispatchService');
+const db = require('../../models/database');
+const emailService = require('../../services/emailService');
+const smsService = require('../../services/smsService');
+const webhookNotificationService = require('../../services/webhookNotificationService');
+
+// Mock dependencies
+jest.mock('../../models/database');
+jest.mock('../../services/emailService');
+jest.mock('../../services/smsService');
+jest.mock('../../services/telegramService');
+jest.mock('../../services/webhookNotificationService', () => ({ sendWebhook: jest.fn() }));
+
+const row = (id, overrides = {}) => ({
+    id: String(id),
+    channel: 'email',
+    recipient: 'ops@example.com',
+    alert_id: id,
+    summary: `Alert #${id}`,
+    message: { subject: `Alert #${id}`, html: `<p>Alert #${id}</p>` },
+    attempts: 0,
+    ...overrides
+});
+
+describe('Notification Dispatch Service', () => {
+    beforeEach(() => {
+        jest.clearAllMocks();
+        notificationDispatchService.lastSentAt.clear();
+        for (const state of notificationDispatchService.state.values()) {
+            state.backlog = [];
+        }
+        db.query.mockResolvedValue({ rows: [], rowCount: 0 });
+    });
+
+    describe('enqueue', () => {
+        it('should insert all valid items in one statement', async () => {
+            const queued = await notificationDispatchService.enqueue([
+                { channel: 'email', recipient: 'a@example.com', summary: 'one', message: { subject: 's', html: 'h' } },
+                { channel: 'sms', recipient: '+15550100', summary: 'two', message: { text: 't' } },
+                { channel: 'pager', recipient: 'x', summary: 'unknown channel', message: {} }
+            ]);
+
+            expect(queued).toBe(2);
+            expect(db.query).toHaveBeenCalledTimes(1);
+            const params = db.query.mock.calls[0][1];
+            expect(params[0]).toEqual(['email', 'sms']);
+            expect(params[1]).toEqual(['a@example.com', '+15550100']);
+        });
+
+        it('should skip the query when nothing is valid', async () => {
+            expect(await notificationDispatchService.enqueue([])).toBe(0);
+            expect(db.query).not.toHaveBeenCalled();
+        });
+    });
+
+    describe('claim', () => {
+        it('should group claimed rows by recipient', async () => {
+            db.query.mockResolvedValueOnce({
+                rows: [row(1), row(2), row(3, { recipient: 'other@example.com' })]
+            });
+
+            await notificationDispatchService.claim('email');
+
+            const backlog = notificationDispatchService.state.get('email').backlog;
+            expect(backlog).toHaveLength(2);
+            expect(backlog[0].rows.map(r => r.id)).toEqual(['1', '2']);
+            expect(backlog[1].recipient).toBe('other@example.com');
+        });
+
+        it('should hold rows for a recipient inside its digest window', async () => {
+            notificationDispatchService.lastSentAt.set('email:ops@example.com', Date.now());
+            db.query.mockResolvedValueOnce({ rows: [row(1), row(2)] });
+
+            await notificationDispatchService.claim('email');
+
+            expect(notificationDispatchService.state.get('email').backlog).toHaveLength(0);
+            const [sql, params] = db.query.mock.calls[1];
+            expect(sql).toContain("status = 'pending'");
+            expect(params[0]).toEqual(['1', '2']);
+            expect(params[1].getTime()).toBeGreaterThan(Date.now());
+        });
+    });
+
+    describe('openWindow', () => {
+        const redisWith = (setResult, ttl) => ({
+            status: 'ready',
+            set: jest.fn().mockResolvedValue(setResult),
+            pttl: jest.fn().mockResolvedValue(ttl)
+        });
+
+        afterEach(() => {
+            notificationDispatchService.redis = null;
+        });
+
+        it('should open a window in Redis when none is open', async () => {
+            const redis = redisWith('OK', -2);
+            notificationDispatchService.redis = redis;
+
+            expect(await notificationDispatchService.openWindow('sms', '+15550100')).toBe(0);
+            expect(redis.set).toHaveBeenCalledWith(
+                'notify:window:sms:+15550100', expect.any(Number), 'PX', notificationDispatchService.digestWindowMs, 'NX'
+            );
+        });
+
+        it('should wait out a window opened by another process', async () => {
+            notificationDispatchService.redis = redisWith(null, 42000);
+
+            expect(await notificationDispatchService.openWindow('sms', '+15550100')).toBe(42000);
+            expect(notificationDispatchService.lastSentAt.size).toBe(0);
+        });
+    });
+
+    describe('sendGroup', () => {
+        it('should send a single row as it was queued', async () => {
+            emailService.sendEmail.mockResolvedValue(true);
+
+            await notificationDispatchService.sendGroup({
+                channel: 'email', recipient: 'ops@example.com', rows: [row(1)]
+            });
+
+            expect(emailService.sendEmail).toHaveBeenCalledWith('ops@example.com', 'Alert #1', '<p>Alert #1</p>');
+            expect(db.query.mock.calls[0][0]).toContain("status = 'sent'");
+        });
+
+        it('should combine several rows into one digest', async () => {
+            smsService.sendSMS.mockResolvedValue(true);
+            const rows = [1, 2, 3].map(id => row(id, {
+                channel: 'sms', recipient: '+15550100', message: { text: `Alert #${id}` }
+            }));
+
+            await notificationDispatchService.sendGroup({ channel: 'sms', recipient: '+15550100', rows });
+
+            expect(smsService.sendSMS).toHaveBeenCalledTimes(1);
+            const text = smsService.sendSMS.mock.calls[0][1];
+            expect(text).toContain('3 alert notifications');
+            expect(text).toContain('Alert #2');
+            expect(db.query.mock.calls[0][1]).toEqual([['1', '2', '3'], 3]);
+        });
+
+        it('should send provider webhooks one by one instead of as a digest', async () => {
+            webhookNotificationService.sendWebhook.mockResolvedValue({ success: true });
+            const url = 'https://hooks.slack.com/services/T000/B000/XXXX';
+            const rows = [1, 2].map(id => row(id, {
+                channel: 'webhook', recipient: url, message: { type: 'slack', body: { text: `Alert #${id}` } }
+            }));
+
+            await notificationDispatchService.sendGroup({ channel: 'webhook', recipient: url, rows });
+
+            expect(webhookNotificationService.sendWebhook).toHaveBeenCalledTimes(2);
+            expect(webhookNotificationService.sendWebhook.mock.calls[0]).toEqual(
+                [url, { text: 'Alert #1' }, 'slack', {}, { queueRetry: false }]
+            );
+            expect(webhookNotificationService.sendWebhook.mock.calls[1][1]).toEqual({ text: 'Alert #2' });
+            expect(db.query.mock.calls.map(([, params]) => params)).toEqual([[['1'], 1], [['2'], 1]]);
+        });
+
+        it('should reschedule a failed send with backoff', async () => {
+            emailService.sendEmail.mockResolvedValue(false);
+
+            await notificationDispatchService.sendGroup({
+                channel: 'email', recipient: 'ops@example.com', rows: [row(1, { attempts: 1 })]
+            });
+
+            const [sql, params] = db.query.mock.calls[0];
+            expect(sql).toContain("status = 'pending'");
+            // Second failure: 60 s plus up to 20% jitter
+            expect(params[2]).toBeGreaterThanOrEqual(60);
+            expect(params[2]).toBeLessThan(72);
+        });
+
+        it('should give up after the last attempt', async () => {
+            emailService.sendEmail.mockRejectedValue(new Error('SMTP down'));
+
+            await notificationDispatchService.sendGroup({
+                channel: 'email',
+                recipient: 'ops@example.com',
+                rows: [row(1, { attempts: notificationDispatchService.maxAttempts - 1 })]
+            });
+
+            const [sql, params] = db.query.mock.calls[0];
+            expect(sql).toContain("status = 'failed'");
+            expect(params[1]).toBe('SMTP down');
+        });
+    });
+
+    describe('buildDigest', () => {
+        it('should cut long digests off with a count of the rest', () => {
+            const rows = Array.from({ length: 30 }, (_, i) => row(i + 1, {
+                channel: 'telegram', message: { text: `Alert #${i + 1}` }
+            }));
+
+            const digest = notificationDispatchService.buildDigest('telegram', rows);
+
+            expect(digest.text).toContain('30 alert notifications');
+            expect(digest.text).toContain('and 5 more');
+            expect(digest.text).not.toContain('Alert #26');
+        });
+
+        it('should wrap webhook bodies in a digest event', () => {
+            const rows = [1, 2].map(id => row(id, {
+                channel: 'webhook', message: { body: { event: 'alert.escalated', id }, type: 'custom' }
+            }));
+
+            const digest = notificationDispatchService.buildDigest('webhook', rows);
+
+            expect(digest.body.event).toBe('alert.digest');
+            expect(digest.body.type).toBe('custom');
+            expect(digest.body.count).toBe(2);
+            expect(digest.body.data).toEqual([{ event: 'alert.escalated', id: 1 }, { event: 'alert.escalated', id: 2 }]);
+        });
+    });
+});
@@ -1,29 +1,58 @@
 const db = require('../models/database');
-const emailService = require('./emailService');
-const smsService = require('./smsService');
-const telegramService = require('./telegramService');
+const notificationDispatchService = require('./notificationDispatchService');
 const logger = require('../utils/logger');
 const { isInSilentMode } = require('../routes/silentMode');
 
 class AlertEscalationService {
     constructor() {
         this.escalationInProgress = new Set();
+        this.processing = false;
+        // Alerts escalated at once; notifications are only queued here, so
+        // this bounds database work, not provider traffic
+        this.concurrency = parseInt(process.env.ESCALATION_CONCURRENCY, 10) || 8;
     }
 
     async processEscalations() {
+        // A slow run must not overlap the next cron tick
+        if (this.processing) {
+            return;
+        }
+        this.processing = true;
+
         try {
             // Get alerts that need escalation
             const alertsToEscalate = await this.getAlertsForEscalation();
 
+            // An alert matching several rules comes back once per rule; its
+            // rows run in order, separate alerts run side by side
+            const byAlert = new Map();
             for (const alert of alertsToEscalate) {
                 if (!this.escalationInProgress.has(alert.id)) {
-                    this.escalationInProgress.add(alert.id);
-                    await this.escalateAlert(alert);
-                    this.escalationInProgress.delete(alert.id);
+                    if (!byAlert.has(alert.id)) {
+                        byAlert.set(alert.id, []);
+                    }
+                    byAlert.get(alert.id).push(alert);
                 }
             }
+
+            const groups = [...byAlert.values()];
+            for (let i = 0; i < groups.length; i += this.concurrency) {
+                await Promise.all(groups.slice(i, i + this.concurrency).map(async (rows) => {
+                    const alertId = rows[0].id;
+                    this.escalationInProgress.add(alertId);
+                    try {
+                        for (const alert of rows) {
+                            await this.escalateAlert(alert);
+                        }
+                    } finally {
+                        this.escalationInProgress.delete(alertId);
+                    }
+                }));
+            }
         } catch (error) {
             logger.error('Error processing escalations:', error);
+        } finally {
+            this.processing = false;
         }
     }
 
@@ -105,30 +134,46 @@ class AlertEscalationService {
             escalation_message: this.getEscalationMessage(escalationLevel)
         };
 
-        // Send notifications via each configured method
+        // Queue one message per method and recipient; delivery, retries and
+        // digesting happen in notificationDispatchService
+        const items = [];
         for (const method of notificationMethods) {
             try {
                 switch (method) {
                     case 'email':
-                        await this.sendEscalationEmail(escalatedAlert, recipients);
+                        items.push(...this.buildEscalationEmail(escalatedAlert, recipients));
                         break;
                     case 'sms':
-                        await this.sendEscalationSMS(escalatedAlert, recipients);
+                        items.push(...this.buildEscalationSMS(escalatedAlert, recipients));
                         break;
                     case 'telegram':
-                        await this.sendEscalationTelegram(escalatedAlert, recipients);
+                        items.push(...this.buildEscalationTelegram(escalatedAlert, recipients));
                         break;
                     case 'push':
                         await this.sendEscalationPush(escalatedAlert, recipients);
                         break;
                     case 'webhook':
-                        await this.sendEscalationWebhook(escalatedAlert, recipients);
+                        items.push(...this.buildEscalationWebhook(escalatedAlert, recipients));
                         break;
                 }
             } catch (error) {
-                logger.error(`Failed to send ${method} escalation for alert ${alert.id}:`, error);
+                logger.error(`Failed to build ${method} escalation for alert ${alert.id}:`, error);
             }
         }
+
+        if (items.length > 0) {
+            await notificationDispatchService.enqueue(items);
+        }
+    }
+
+    // One line per alert, used when several are combined into a digest
+    getEscalationSummary(alert) {
+        return `[L${alert.escalation_level}] ${alert.severity.toUpperCase()} ${alert.alert_type} at ${alert.device_name}` +
+            ` (${alert.location_name || 'Unknown'}) - alert #${alert.id}`;
+    }
+
+    recipientAddresses(recipients, type) {
+        return recipients.filter(r => r.type === type && r.address).map(r => r.address);
     }
 
     getEscalationMessage(level) {
@@ -140,7 +185,7 @@ class AlertEscalationService {
         return messages[level] || `Alert escalated to level ${level}`;
     }
 
-    async sendEscalationEmail(alert, recipients) {
+    buildEscalationEmail(alert, recipients) {
         const subject = `[ESCALATION Level ${alert.escalation_level}] ${alert.alert_type} - ${alert.device_name}`;
 
         const html = `
@@ -204,24 +249,28 @@ class AlertEscalationService {
             </div>
         `;
 
-        await emailService.sendEscalationEmail({
-            recipients: recipients.filter(r => r.type === 'email').map(r => r.address),
-            subject,
-            html
-        });
+        return this.recipientAddresses(recipients, 'email').map(address => ({
+            channel: 'email',
+            recipient: address,
+            alertId: alert.id,
+            summary: this.getEscalationSummary(alert),
+            message: { subject, html }
+        }));
     }
 
-    async sendEscalationSMS(alert, recipients) {
+    buildEscalationSMS(alert, recipients) {
         const message = `[ESCALATION L${alert.escalation_level}] ${alert.alert_type} at ${alert.device_name} (${alert.location_name}). ${alert.escalation_message}. Alert ID: ${alert.id}`;
 
-        const phoneNumbers = recipients.filter(r => r.type === 'sms').map(r => r.address);
-
-        for (const phone of phoneNumbers) {
-            await smsService.sendSMS(phone, message);
-        }
+        return this.recipientAddresses(recipients, 'sms').map(phone => ({
+            channel: 'sms',
+            recipient: phone,
+            alertId: alert.id,
+            summary: this.getEscalationSummary(alert),
+            message: { text: message }
+        }));
     }
 
-    async sendEscalationTelegram(alert, recipients) {
+    buildEscalationTelegram(alert, recipients) {
         const escalationEmoji = {
             1: '⚠️',
             2: '🚨',
@@ -251,21 +300,13 @@ ${alert.message}
 ⏰ <i>This alert has been escalated due to lack of acknowledgment. Please take immediate action!</i>
         `.trim();
 
-        // Get all Telegram recipients
-        const chatIds = recipients.filter(r => r.type === 'telegram').map(r => r.address);
-
-        for (const chatId of chatIds) {
-            const success = await telegramService.sendMessage(chatId, message);
-
-            // Log notification attempt
-            await db.query(`
-                INSERT INTO telegram_notifications (user_id, chat_id, message_text, notification_type, alert_id, device_id, success)
-                VALUES (
-                    (SELECT id FROM users WHERE telegram_chat_id = $1 LIMIT 1),
-                    $1, $2, 'escalation', $3, $4, $5
-                )
-            `, [chatId, message, alert.id, alert.device_id, success]);
-        }
+        return this.recipientAddresses(recipients, 'telegram').map(chatId => ({
+            channel: 'telegram',
+            recipient: chatId,
+            alertId: alert.id,
+            summary: this.getEscalationSummary(alert),
+            message: { text: message, notification_type: 'escalation', device_id: alert.device_id }
+        }));
     }
 
     async sendEscalationPush(alert, recipients) {
@@ -273,9 +314,31 @@ ${alert.message}
         logger.info(`Sending push notification escalation for alert ${alert.id}`);
     }
 
-    async sendEscalationWebhook(alert, recipients) {
-        // Implementation for webhook notifications
-        logger.info(`Sending webhook escalation for alert ${alert.id}`);
+    buildEscalationWebhook(alert, recipients) {
+        const body = {
+            event: 'alert.escalated',
+            timestamp: new Date().toISOString(),
+            data: {
+                alert_id: alert.id,
+                device_id: alert.device_id,
+                device_name: alert.device_name,
+                location: alert.location_name,
+                alert_type: alert.alert_type,
+                severity: alert.severity,
+                message: alert.message,
+                escalation_level: alert.escalation_level,
+                escalation_message: alert.escalation_message,
+                created_at: alert.created_at
+            }
+        };
+
+        return this.recipientAddresses(recipients, 'webhook').map(url => ({
+            channel: 'webhook',
+            recipient: url,
+            alertId: alert.id,
+            summary: this.getEscalationSummary(alert),
+            message: { body, type: 'custom' }
+        }));
     }
 
     getAlertDuration(createdAt) {
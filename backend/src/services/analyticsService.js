@@ -1,5 +1,9 @@
 const db = require('../models/database');
 const logger = require('../utils/logger');
+const telemetrySketch = require('../utils/telemetrySketch');
+
+// Algorithms that need the raw series; anything else goes through the sketch path
+const RAW_ANOMALY_ALGORITHMS = new Set(['isolation_forest', 'seasonal', 'change_point', 'rolling_statistics']);
 
 class AnalyticsService {
     constructor() {
@@ -34,54 +38,32 @@ class AnalyticsService {
                 default: startDate.setDate(endDate.getDate() - 30);
             }
 
-            const result = await db.query(`
-                SELECT
-                    t.processed_value,
-                    t.timestamp,
-                    ds.sensor_type_id,
-                    st.name as sensor_type,
-                    st.unit
-                FROM telemetry t
-                JOIN device_sensors ds ON t.device_sensor_id = ds.id
-                JOIN sensor_types st ON ds.sensor_type_id = st.id
-                WHERE ds.device_id = $1
-                AND ds.pin = $2
-                AND t.timestamp >= $3
-                AND t.timestamp <= $4
-                AND t.processed_value IS NOT NULL
-                ORDER BY t.timestamp DESC
-            `, [deviceId, sensorPin, startDate, endDate]);
+            const { sensorType, unit, stats } = await this.getSensorSketchSummary(deviceId, sensorPin, startDate, endDate);
+            const dataPoints = stats ? stats.count : 0;
 
-            if (result.rows.length < 50) { // Not enough data for reliable analysis
+            if (dataPoints < 50) { // Not enough data for reliable analysis
                 return {
                     hasEnoughData: false,
-                    dataPoints: result.rows.length,
+                    dataPoints,
                     minDataPoints: 50,
                     message: 'Not enough historical data for reliable threshold recommendations. At least 50 data points needed.',
-                    sensorType: result.rows[0]?.sensor_type,
-                    unit: result.rows[0]?.unit
+                    sensorType,
+                    unit
                 };
             }
 
-            const values = result.rows.map(row => parseFloat(row.processed_value));
-            const sensorType = result.rows[0].sensor_type;
-            const unit = result.rows[0].unit;
-
-            // Calculate statistical measures
-            const stats = this.calculateStatistics(values);
-
             // Generate recommendations based on sensor type and statistics
-            const recommendations = this.generateThresholdRecommendations(sensorType, stats, values);
+            const recommendations = this.generateThresholdRecommendations(sensorType, stats);
 
             const analysisResult = {
                 hasEnoughData: true,
-                dataPoints: values.length,
+                dataPoints,
                 timeRange,
                 sensorType,
                 unit,
                 statistics: stats,
                 recommendations,
-                dataQuality: this.assessDataQuality(values),
+                dataQuality: this.assessDataQuality(stats),
                 lastAnalyzed: new Date().toISOString()
             };
 
@@ -101,6 +83,51 @@ class AnalyticsService {
         }
     }
 
+    /**
+     * Statistics for a sensor over [startDate, endDate] merged from the rollup
+     * sketches instead of raw rows. Ranges over 30 days read the daily tier.
+     * Bucket granularity means the first partial hour/day is included.
+     */
+    async getSensorSketchSummary(deviceId, sensorPin, startDate, endDate) {
+        const daily = endDate - startDate > 30 * 24 * 60 * 60 * 1000;
+        const table = daily ? 'telemetry_rollup_1d' : 'telemetry_rollup_1h';
+        const unit = daily ? 'day' : 'hour';
+
+        const result = await db.query(`
+            SELECT
+                st.name AS sensor_type,
+                st.unit,
+                SUM(r.sample_count)::float AS sample_count,
+                SUM(r.sum_value) AS sum_value,
+                SUM(r.sum_squares) AS sum_squares,
+                MIN(r.min_value) AS min_value,
+                MAX(r.max_value) AS max_value,
+                telemetry_sketch_agg(r.sketch) AS sketch
+            FROM device_sensors ds
+            JOIN sensor_types st ON ds.sensor_type_id = st.id
+            LEFT JOIN ${table} r ON r.device_sensor_id = ds.id
+                AND r.bucket >= DATE_TRUNC('${unit}', $3::timestamp)
+                AND r.bucket <= $4
+            WHERE ds.device_id = $1 AND ds.pin = $2
+            GROUP BY st.name, st.unit
+        `, [deviceId, sensorPin, startDate, endDate]);
+
+        const row = result.rows[0];
+        if (!row) {
+            return { sensorType: undefined, unit: undefined, stats: null, sketch: null };
+        }
+
+        const stats = telemetrySketch.summarize(row.sketch, {
+            count: row.sample_count || 0,
+            sum: row.sum_value,
+            sumSquares: row.sum_squares,
+            min: row.min_value,
+            max: row.max_value
+        });
+
+        return { sensorType: row.sensor_type, unit: row.unit, stats, sketch: row.sketch };
+    }
+
     /**
      * Calculate comprehensive statistics for the dataset
      */
@@ -158,7 +185,7 @@ class AnalyticsService {
     /**
      * Generate threshold recommendations based on sensor type and statistical analysis
      */
-    generateThresholdRecommendations(sensorType, stats, values) {
+    generateThresholdRecommendations(sensorType, stats) {
         const recommendations = {
             method: 'statistical',
             confidence: 'medium',
@@ -432,8 +459,8 @@ class AnalyticsService {
     /**
      * Assess data quality based on various metrics
      */
-    assessDataQuality(values) {
-        if (!values || values.length === 0) {
+    assessDataQuality(stats) {
+        if (!stats || stats.count === 0) {
             return { score: 0, issues: ['No data available'] };
         }
 
@@ -441,22 +468,19 @@ class AnalyticsService {
         let score = 100;
 
         // Check for sufficient data points
-        if (values.length < 100) {
-            issues.push(`Limited data points (${values.length}). More data will improve accuracy.`);
+        if (stats.count < 100) {
+            issues.push(`Limited data points (${stats.count}). More data will improve accuracy.`);
             score -= 20;
         }
 
-        // Check for data variability
-        const uniqueValues = new Set(values).size;
-        const variabilityRatio = uniqueValues / values.length;
-
-        if (variabilityRatio < 0.1) {
+        // Check for data variability: a healthy sensor spreads over more than
+        // a couple of 2%-wide sketch buckets
+        if (stats.distinctBins !== undefined && stats.distinctBins < 3) {
             issues.push('Low data variability detected. Sensor might be stuck or have limited range.');
             score -= 15;
         }
 
         // Check for outliers
-        const stats = this.calculateStatistics(values);
         if (stats.outlierPercentage > 15) {
             issues.push(`High outlier percentage (${stats.outlierPercentage}%). Data might be noisy.`);
             score -= 10;
@@ -493,6 +517,10 @@ class AnalyticsService {
                 default: startDate.setDate(endDate.getDate() - 1);
             }
 
+            if (!RAW_ANOMALY_ALGORITHMS.has(algorithm)) {
+                return await this.detectSketchAnomalies(deviceId, sensorPin, startDate, endDate, timeRange, algorithm);
+            }
+
             const result = await db.query(`
                 SELECT processed_value, timestamp
                 FROM telemetry t
@@ -549,6 +577,84 @@ class AnalyticsService {
         }
     }
 
+    /**
+     * Statistical anomaly detection against the rollups: the baseline (mean,
+     * stdDev, median, MAD) comes from the merged sketch, and only 1-minute
+     * buckets whose min/max cross the z-score or modified z-score bounds are
+     * read back as anomalies. Same criteria as detectStatisticalAnomalies(),
+     * reported at minute resolution.
+     */
+    async detectSketchAnomalies(deviceId, sensorPin, startDate, endDate, timeRange, algorithm, threshold = 3) {
+        const { stats, sketch } = await this.getSensorSketchSummary(deviceId, sensorPin, startDate, endDate);
+
+        if (!stats || stats.count < 20) {
+            return { anomalies: [], message: 'Not enough recent data for anomaly detection' };
+        }
+
+        const median = stats.median;
+        const mad = telemetrySketch.medianAbsoluteDeviation(telemetrySketch.toBins(sketch), median) || 0;
+
+        let upper = stats.stdDev > 0 ? stats.mean + threshold * stats.stdDev : Infinity;
+        let lower = stats.stdDev > 0 ? stats.mean - threshold * stats.stdDev : -Infinity;
+        if (mad > 0) {
+            upper = Math.min(upper, median + 3.5 * mad / 0.6745);
+            lower = Math.max(lower, median - 3.5 * mad / 0.6745);
+        }
+
+        if (!Number.isFinite(upper) && !Number.isFinite(lower)) {
+            return {
+                anomalies: [],
+                algorithm,
+                analysisInfo: { statistics: stats, threshold, mad, method: 'z-score and modified z-score (sketch)' },
+                timeRange,
+                dataPoints: stats.count
+            };
+        }
+
+        const result = await db.query(`
+            SELECT r.bucket, r.min_value, r.max_value
+            FROM telemetry_rollup_1m r
+            JOIN device_sensors ds ON r.device_sensor_id = ds.id
+            WHERE ds.device_id = $1 AND ds.pin = $2
+                AND r.bucket >= DATE_TRUNC('minute', $3::timestamp) AND r.bucket <= $4
+                AND (r.max_value > $5 OR r.min_value < $6)
+            ORDER BY r.bucket ASC
+            LIMIT 200
+        `, [deviceId, sensorPin, startDate, endDate,
+            Number.isFinite(upper) ? upper : null, Number.isFinite(lower) ? lower : null]);
+
+        const anomalies = [];
+        for (const row of result.rows) {
+            for (const value of [row.max_value, row.min_value]) {
+                if (value <= upper && value >= lower) continue;
+                if (anomalies.length > 0 && anomalies[anomalies.length - 1].timestamp === row.bucket
+                    && anomalies[anomalies.length - 1].value === value) continue;
+
+                anomalies.push({
+                    value,
+                    timestamp: row.bucket,
+                    deviation: stats.stdDev > 0 ? Math.abs(value - stats.mean) / stats.stdDev : 0,
+                    type: value > stats.mean ? 'high' : 'low',
+                    algorithm: 'statistical'
+                });
+            }
+        }
+
+        return {
+            anomalies: anomalies.slice(0, 20),
+            algorithm,
+            analysisInfo: {
+                statistics: stats,
+                threshold,
+                mad,
+                bounds: { lower, upper },
+                method: 'z-score and modified z-score (sketch)'
+            },
+            timeRange,
+            dataPoints: stats.count
+        };
+    }
+
     /**
      * Statistical anomaly detection using z-score and modified z-score
      */
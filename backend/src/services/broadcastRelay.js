@@ -0,0 +1,84 @@
+const logger = require('../utils/logger');
+
+const RELAY_CHANNEL = 'websocket:relay';
+
+// WebSocketService methods a relay may invoke on the receiving side
+const RELAYED_METHODS = new Set([
+    'broadcastTelemetryUpdate',
+    'broadcastDeviceStatus',
+    'broadcastNewAlert',
+    'broadcastDeviceUpdate'
+]);
+
+/**
+ * Stand-in for WebSocketService in processes without socket.io (the device
+ * ingress). Broadcasts are published on a Redis channel; the API server
+ * subscribes with BroadcastRelay.subscribe() and replays them on its own
+ * WebSocketService, so dashboards see ingress traffic in real time.
+ */
+class BroadcastRelay {
+    constructor(redis) {
+        this.redis = redis;
+        this.published = 0;
+        this.failed = 0;
+    }
+
+    publish(method, args) {
+        this.redis.publish(RELAY_CHANNEL, JSON.stringify({ method, args }))
+            .then(() => { this.published++; })
+            .catch((error) => {
+                this.failed++;
+                logger.debug(`Broadcast relay publish failed: ${error.message}`);
+            });
+    }
+
+    broadcastTelemetryUpdate(deviceId, sensors) {
+        this.publish('broadcastTelemetryUpdate', [deviceId, sensors]);
+    }
+
+    broadcastDeviceStatus(deviceId, status) {
+        this.publish('broadcastDeviceStatus', [deviceId, status]);
+    }
+
+    broadcastNewAlert(alert) {
+        this.publish('broadcastNewAlert', [alert]);
+    }
+
+    broadcastDeviceUpdate(deviceId, data) {
+        this.publish('broadcastDeviceUpdate', [deviceId, data]);
+    }
+
+    getConnectionStats() {
+        return { relay: { channel: RELAY_CHANNEL, published: this.published, failed: this.failed } };
+    }
+
+    /**
+     * Replay relayed broadcasts on a local WebSocketService. Uses a dedicated
+     * connection because a subscribed ioredis client cannot issue commands.
+     */
+    static async subscribe(redis, websocketService) {
+        const subscriber = redis.duplicate();
+
+        subscriber.on('message', (channel, message) => {
+            if (channel !== RELAY_CHANNEL) return;
+            try {
+                const { method, args } = JSON.parse(message);
+                if (RELAYED_METHODS.has(method) && Array.isArray(args)) {
+                    websocketService[method](...args);
+                }
+            } catch (error) {
+                logger.warn('Ignoring malformed relayed broadcast:', error.message);
+            }
+        });
+
+        // The shared client disables the offline queue, so wait for the
+        // connection before subscribing (ioredis resubscribes on reconnect)
+        if (subscriber.status !== 'ready') {
+            await new Promise((resolve) => subscriber.once('ready', resolve));
+        }
+        await subscriber.subscribe(RELAY_CHANNEL);
+        return subscriber;
+    }
+}
+
+module.exports = BroadcastRelay;
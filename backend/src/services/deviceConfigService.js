@@ -0,0 +1,239 @@
+const db = require('../models/database');
+const logger = require('../utils/logger');
+const historyBackfillService = require('./historyBackfillService');
+const modbusConfigService = require('./modbusConfigService');
+const { contentVersion } = require('../utils/contentVersion');
+
+const INVALIDATE_CHANNEL = 'device-config:invalidate';
+const INVALIDATE_ALL = '*';
+// Ids with no device row are remembered briefly so repeats stay cheap
+const UNKNOWN_DEVICE_TTL_MS = 10 * 1000;
+const SWEEP_INTERVAL_MS = 60 * 1000;
+
+/**
+ * Per-device config snapshots for heartbeat responses.
+ *
+ * A snapshot holds the device's sensor list already serialized, its content
+ * version, the Modbus map and when a backfill request is next due.
+ * Heartbeats are answered from it without touching the database: devices
+ * report the sensor version they run (`sensor_config_version`) and get the
+ * list back only when it differs. Anything that changes a device's sensors,
+ * thresholds, Modbus map or backfill requests calls invalidate(); the
+ * invalidation is published over Redis so the API server and ingress
+ * workers drop their copies together. Snapshots also expire after
+ * `ttlMs` in case an invalidation is lost; expired ones are swept out.
+ */
+class DeviceConfigService {
+    constructor() {
+        this.ttlMs = parseInt(process.env.DEVICE_CONFIG_SNAPSHOT_TTL_MS, 10) || 10 * 60 * 1000;
+
+        this.snapshots = new Map();
+        this.building = new Map();      // deviceId -> promise of the snapshot being built
+        this.sweptAt = Date.now();
+        this.redis = null;
+        this.subscriber = null;
+        this.stats = { hits: 0, builds: 0, unchanged: 0, invalidations: 0 };
+    }
+
+    /**
+     * Share invalidations with the other processes through `redis`. Uses a
+     * dedicated connection for the subscription, like BroadcastRelay.
+     */
+    async start({ redis } = {}) {
+        if (!redis) return;
+        this.redis = redis;
+
+        const subscriber = redis.duplicate();
+        subscriber.on('message', (channel, deviceId) => {
+            if (channel === INVALIDATE_CHANNEL) {
+                this.drop(deviceId);
+            }
+        });
+
+        if (subscriber.status !== 'ready') {
+            await new Promise((resolve) => subscriber.once('ready', resolve));
+        }
+        await subscriber.subscribe(INVALIDATE_CHANNEL);
+        this.subscriber = subscriber;
+    }
+
+    async shutdown() {
+        if (this.subscriber) {
+            this.subscriber.disconnect();
+            this.subscriber = null;
+        }
+    }
+
+    /**
+     * Forget a device's snapshot here and in every other process. Pass no
+     * id to drop them all.
+     */
+    invalidate(deviceId = INVALIDATE_ALL) {
+        this.drop(String(deviceId));
+        this.stats.invalidations++;
+
+        if (this.redis && this.redis.status === 'ready') {
+            this.redis.publish(INVALIDATE_CHANNEL, String(deviceId)).catch((error) => {
+                logger.warn(`Device config invalidation publish failed: ${error.message}`);
+            });
+        }
+    }
+
+    drop(deviceId) {
+        if (deviceId === INVALIDATE_ALL) {
+            this.snapshots.clear();
+            this.building.clear();
+        } else {
+            this.snapshots.delete(deviceId);
+            this.building.delete(deviceId);
+        }
+    }
+
+    async getSnapshot(deviceId) {
+        const now = Date.now();
+        if (now - this.sweptAt >= SWEEP_INTERVAL_MS) {
+            this.sweep(now);
+        }
+
+        const cached = this.snapshots.get(deviceId);
+        if (cached && cached.expiresAt > now) {
+            this.stats.hits++;
+            return cached;
+        }
+
+        // Heartbeats arriving together share one build
+        if (this.building.has(deviceId)) {
+            return this.building.get(deviceId);
+        }
+
+        const build = this.buildSnapshot(deviceId).then((snapshot) => {
+            // An invalidation during the build leaves the result unstored
+            if (this.building.get(deviceId) === build) {
+                this.building.delete(deviceId);
+                this.snapshots.set(deviceId, snapshot);
+            }
+            return snapshot;
+        }, (error) => {
+            if (this.building.get(deviceId) === build) {
+                this.building.delete(deviceId);
+            }
+            throw error;
+        });
+        this.building.set(deviceId, build);
+        return build;
+    }
+
+    sweep(now = Date.now()) {
+        this.sweptAt = now;
+        for (const [deviceId, snapshot] of this.snapshots) {
+            if (snapshot.expiresAt <= now) {
+                this.snapshots.delete(deviceId);
+            }
+        }
+    }
+
+    async buildSnapshot(deviceId) {
+        this.stats.builds++;
+
+        const [sensorsResult, modbus, historyResult] = await Promise.all([
+            db.query(`
+                SELECT ds.pin, ds.name, ds.enabled, ds.calibration_offset, ds.calibration_multiplier,
+                       ds.threshold_min, ds.threshold_max, st.name as sensor_type
+                FROM device_sensors ds
+                JOIN sensor_types st ON ds.sensor_type_id = st.id
+                WHERE ds.device_id = $1
+                ORDER BY ds.pin
+            `, [deviceId]),
+            modbusConfigService.deviceMap(deviceId),
+            // When claimForHeartbeat() can next return a request: now for a
+            // pending one, resendAfterMs after the last send otherwise
+            db.query(`
+                SELECT (
+                    SELECT MIN(CASE WHEN status = 'pending' THEN CURRENT_TIMESTAMP
+                                    ELSE sent_at + make_interval(secs => $2) END)
+                    FROM history_requests
+                    WHERE device_id = $1
+                      AND status IN ('pending', 'sent', 'receiving')
+                      AND created_at > CURRENT_TIMESTAMP - INTERVAL '1 day'
+                ) AS history_claim_at,
+                EXISTS (SELECT 1 FROM devices WHERE id = $1) AS known
+            `, [deviceId, historyBackfillService.resendAfterMs / 1000])
+        ]);
+
+        // Thresholds are stored directly on device_sensors
+        const sensors = sensorsResult.rows.map(sensor => ({
+            pin: sensor.pin,
+            type: sensor.sensor_type,
+            name: sensor.name,
+            enabled: sensor.enabled,
+            calibration_offset: sensor.calibration_offset || 0,
+            calibration_multiplier: sensor.calibration_multiplier || 1,
+            threshold_min: sensor.threshold_min != null ? sensor.threshold_min : 0,
+            threshold_max: sensor.threshold_max != null ? sensor.threshold_max : 0
+        }));
+        const sensorsJson = JSON.stringify(sensors);
+
+        return {
+            version: contentVersion(sensorsJson),
+            sensorsJson,
+            modbus,
+            historyClaimAt: historyResult.rows[0].history_claim_at
+                ? new Date(historyResult.rows[0].history_claim_at).getTime()
+                : null,
+            expiresAt: Date.now() + (historyResult.rows[0].known ? this.ttlMs : UNKNOWN_DEVICE_TTL_MS)
+        };
+    }
+
+    /**
+     * The serialized heartbeat response. `payload` is the heartbeat body:
+     * the sensor list is included unless `sensor_config_version` matches,
+     * and the Modbus map only for firmware that reports a `modbus` object.
+     */
+    async heartbeatResponse(deviceId, payload = {}) {
+        const snapshot = await this.getSnapshot(deviceId);
+
+        const unchanged = Number(payload.sensor_config_version) === snapshot.version;
+        if (unchanged) {
+            this.stats.unchanged++;
+        }
+
+        // Pending backfill requests ride along with the config. Claiming
+        // moves the next due time, so the snapshot is rebuilt afterwards:
+        // everywhere when requests went out, here only when none did.
+        let historyRequests = [];
+        if (snapshot.historyClaimAt !== null && snapshot.historyClaimAt <= Date.now()) {
+            historyRequests = await historyBackfillService.claimForHeartbeat(deviceId).catch((error) => {
+                logger.error('History request lookup failed:', error);
+                return [];
+            });
+            if (historyRequests.length > 0) {
+                this.invalidate(deviceId);
+            } else {
+                this.drop(deviceId);
+            }
+        }
+
+        const modbusConfig = payload.modbus && typeof payload.modbus === 'object'
+            ? modbusConfigService.heartbeatConfigFor(snapshot.modbus, payload.modbus.version)
+            : null;
+
+        return '{"message":"Heartbeat received"' +
+            `,"timestamp":"${new Date().toISOString()}"` +
+            `,"server_time":${Date.now()}` +
+            `,"config":{"sensors_version":${snapshot.version}` +
+            (unchanged ? ',"sensors_unchanged":true' : `,"sensors":${snapshot.sensorsJson}`) +
+            `,"history_requests":${JSON.stringify(historyRequests)}` +
+            (modbusConfig ? `,"modbus":${JSON.stringify(modbusConfig)}` : '') +
+            '}}';
+    }
+
+    getStatus() {
+        return {
+            snapshots: this.snapshots.size,
+            sharedInvalidation: Boolean(this.subscriber),
+            ...this.stats
+        };
+    }
+}
+
+module.exports = new DeviceConfigService();
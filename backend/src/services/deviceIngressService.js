@@ -0,0 +1,232 @@
+const crypto = require('crypto');
+const db = require('../models/database');
+const logger = require('../utils/logger');
+const IngestQueue = require('./ingestQueue');
+const livenessService = require('./livenessService');
+const deviceQuotaService = require('./deviceQuotaService');
+const { recordHeartbeat } = require('../utils/deviceHeartbeat');
+const { sensorTypeName } = require('../utils/sensorRegistration');
+
+const DEVICE_CACHE_TTL_MS = 60 * 1000;
+const UNKNOWN_DEVICE_CACHE_TTL_MS = 10 * 1000;
+
+
+/**
+ * Device ingress: authentication and decoding for device
+ * traffic served by the standalone ingress listener (device-ingress.js).
+ * Telemetry and alarms are queued and written in batches through the same
+ * pipeline as MQTT; heartbeats are answered inline because firmware reads
+ * its sensor configuration from the response (see deviceConfigService).
+ */
+class DeviceIngressService {
+    constructor(telemetryProcessor) {
+        this.telemetryProcessor = telemetryProcessor;
+        this.tokenSecret = process.env.DEVICE_TOKEN_SECRET || null;
+
+        this.deviceCache = new Map();
+        this.rejected = { auth: 0, queueFull: 0 };
+
+        this.queue = new IngestQueue({
+            name: 'Device ingress',
+            maxQueueSize: parseInt(process.env.DEVICE_INGRESS_QUEUE_SIZE, 10) || 20000,
+            batchSize: parseInt(process.env.DEVICE_INGRESS_BATCH_SIZE, 10) || 500,
+            flushIntervalMs: parseInt(process.env.DEVICE_INGRESS_FLUSH_MS, 10) || 250,
+            lanes: parseInt(process.env.DEVICE_INGRESS_CONCURRENCY, 10) || 4,
+            processBatch: (batch) => this.processBatch(batch)
+        });
+    }
+
+    start() {
+        this.queue.start();
+    }
+
+    /**
+     * Per-device token: HMAC of the device id, baked into firmware as
+     * SERVER_API_KEY by the firmware builder when DEVICE_TOKEN_SECRET is set.
+     */
+    static deriveDeviceToken(deviceId, secret = process.env.DEVICE_TOKEN_SECRET) {
+        return crypto.createHmac('sha256', secret).update(String(deviceId)).digest('hex');
+    }
+
+    verifyDeviceToken(deviceId, token) {
+        if (!this.tokenSecret) return true;
+        if (typeof token !== 'string' || token.length === 0) return false;
+
+        const expected = Buffer.from(DeviceIngressService.deriveDeviceToken(deviceId, this.tokenSecret));
+        const provided = Buffer.from(token);
+        return expected.length === provided.length && crypto.timingSafeEqual(expected, provided);
+    }
+
+    async deviceExists(deviceId) {
+        const cached = this.deviceCache.get(deviceId);
+        if (cached && cached.expiresAt > Date.now()) {
+            return cached.exists;
+        }
+
+        const result = await db.query('SELECT 1 FROM devices WHERE id = $1', [deviceId]);
+        const exists = result.rows.length > 0;
+        this.deviceCache.set(deviceId, {
+            exists,
+            expiresAt: Date.now() + (exists ? DEVICE_CACHE_TTL_MS : UNKNOWN_DEVICE_CACHE_TTL_MS)
+        });
+        return exists;
+    }
+
+    /**
+     * Express middleware: device token and existence check, no DB hit for
+     * known devices within the cache TTL.
+     */
+    authenticate() {
+        return async (req, res, next) => {
+            const deviceId = req.params.id;
+            const token = req.headers['x-api-key'] || req.headers['authorization'];
+
+            if (!this.verifyDeviceToken(deviceId, token)) {
+                this.rejected.auth++;
+                return res.status(401).json({ error: 'Invalid device credentials' });
+            }
+
+            try {
+                if (!(await this.deviceExists(deviceId))) {
+                    this.rejected.auth++;
+                    return res.status(404).json({ error: 'Device not found', device_id: deviceId });
+                }
+            } catch (error) {
+                logger.error('Device ingress authentication error:', error);
+                return res.status(503).json({ error: 'Authentication unavailable' });
+            }
+
+            next();
+        };
+    }
+
+    /**
+     * Normalise firmware telemetry into pipeline sensor readings. Returns
+     * null for payloads without a sensors array.
+     */
+    decodeTelemetry(payload) {
+        if (!payload || !Array.isArray(payload.sensors)) {
+            return null;
+        }
+
+        const sensors = [];
+        for (const reading of payload.sensors) {
+            if (!reading || reading.pin === undefined || !reading.type) continue;
+
+            // ESP8266 reports A0 as pin 17
+            const pin = reading.pin === 17 || reading.pin === '17' ? 'A0' : String(reading.pin);
+            const rawValue = parseFloat(reading.raw_value ?? reading.processed_value ?? reading.value);
+            const processedValue = parseFloat(reading.processed_value ?? reading.value ?? reading.raw_value);
+            if (!Number.isFinite(rawValue) || !Number.isFinite(processedValue)) continue;
+
+            sensors.push({
+                pin,
+                type: sensorTypeName(reading.type),
+                name: reading.name,
+                raw_value: rawValue,
+                processed_value: processedValue,
+                wifi_rssi: payload.wifi_rssi,
+                timestamp: reading.timestamp
+            });
+        }
+        return sensors;
+    }
+
+    /**
+     * Queue decoded messages for one device. Returns the number accepted;
+     * fewer than given means the queue is full. `sampledAt` is when the
+     * device took buffered readings (defaults to now), either one time for
+     * the whole batch or an array with one entry per payload.
+     */
+    accept(deviceId, messageType, payloads, sampledAt = null) {
+        let accepted = 0;
+        for (const [index, payload] of payloads.entries()) {
+            const receivedAt = Date.now();
+            const payloadSampledAt = Array.isArray(sampledAt) ? sampledAt[index] : sampledAt;
+            if (!this.queue.enqueue({ deviceId, messageType, payload, receivedAt, sampledAt: payloadSampledAt || receivedAt })) {
+                this.rejected.queueFull++;
+                break;
+            }
+            accepted++;
+        }
+        if (accepted > 0) {
+            livenessService.touch(deviceId);
+        }
+        return accepted;
+    }
+
+    recordInvalid() {
+        this.queue.recordInvalid();
+    }
+
+    /**
+     * Consecutive telemetry goes through the bulk path together; alarms are
+     * written where they occur so per-device order is kept.
+     */
+    async processBatch(batch) {
+        let telemetry = [];
+
+        const flushTelemetry = async () => {
+            if (telemetry.length === 0) return;
+            const items = telemetry;
+            telemetry = [];
+            try {
+                await this.telemetryProcessor.processTelemetryBatch(items);
+            } catch (error) {
+                logger.error(`Error processing ingress telemetry batch of ${items.length} messages:`, error);
+            }
+        };
+
+        for (const message of batch) {
+            if (message.messageType === 'telemetry') {
+                telemetry.push({ deviceId: message.deviceId, sensors: message.payload, receivedAt: message.sampledAt });
+                continue;
+            }
+
+            await flushTelemetry();
+
+            if (message.messageType === 'alarm') {
+                try {
+                    await db.query(`
+                        INSERT INTO alerts (device_id, alert_type, severity, message, triggered_at)
+                        VALUES ($1, $2, 'high', $3, CURRENT_TIMESTAMP)
+                    `, [
+                        message.deviceId,
+                        message.payload.alarm_type,
+                        message.payload.message || `Device ${message.deviceId} triggered ${message.payload.alarm_type} alarm`
+                    ]);
+                    logger.warn(`Alarm received from device ${message.deviceId}: ${message.payload.alarm_type}`);
+                } catch (error) {
+                    logger.error(`Error storing alarm for device ${message.deviceId}:`, error);
+                }
+            }
+        }
+
+        await flushTelemetry();
+    }
+
+    /**
+     * Record a heartbeat. last_heartbeat/ip go through the liveness
+     * service's batched flush; the response comes from deviceConfigService.
+     */
+    async handleHeartbeat(deviceId, payload, ipAddress) {
+        livenessService.touch(deviceId, ipAddress);
+        await recordHeartbeat(deviceId, payload);
+    }
+
+    getStatus() {
+        return {
+            queue: this.queue.getMetrics(),
+            rejected: { ...this.rejected },
+            quota: deviceQuotaService.getStatus(),
+            cachedDevices: this.deviceCache.size,
+            tokenAuth: Boolean(this.tokenSecret)
+        };
+    }
+
+    async shutdown() {
+        await this.queue.shutdown();
+    }
+}
+
+module.exports = DeviceIngressService;
@@ -0,0 +1,262 @@
+const logger = require('../utils/logger');
+
+const REDIS_KEY_PREFIX = 'devquota';
+
+// Device-facing routes under /api, identified by device id rather than IP
+const DEVICE_ROUTE_PATTERN = /^\/devices\/[^/]+\/(telemetry|heartbeat|alarm|threshold-alert|alerts\/\d+\/capture|history\/\d+|ota-status|ota-check|ota-pending|health)\/?$/;
+
+const envNumber = (name, fallback) => {
+    const value = parseFloat(process.env[name]);
+    return Number.isFinite(value) && value > 0 ? value : fallback;
+};
+
+/**
+ * Per-device token buckets, one per message class.
+ *
+ * Buckets live in process memory so the request path never waits on Redis.
+ * Every sync interval each process adds what it consumed to a shared Redis
+ * counter per bucket and debits what other processes consumed since the last
+ * sync, so the API server and ingress listeners converge on one budget per
+ * device. Without Redis the buckets simply stay process-local.
+ *
+ * Responses carry backpressure hints for firmware: X-Device-Backoff-Ms is the
+ * request spacing the device should keep for that class, sent once a bucket
+ * is half drained; an empty bucket answers 429 with Retry-After as well.
+ */
+class DeviceQuotaService {
+    constructor() {
+        this.classes = {
+            telemetry: {
+                rate: envNumber('DEVICE_QUOTA_TELEMETRY_RATE', 2),
+                burst: envNumber('DEVICE_QUOTA_TELEMETRY_BURST', 30)
+            },
+            alerts: {
+                rate: envNumber('DEVICE_QUOTA_ALERTS_RATE', 0.5),
+                burst: envNumber('DEVICE_QUOTA_ALERTS_BURST', 20)
+            },
+            control: {
+                rate: envNumber('DEVICE_QUOTA_CONTROL_RATE', 1),
+                burst: envNumber('DEVICE_QUOTA_CONTROL_BURST', 10)
+            }
+        };
+        this.syncIntervalMs = envNumber('DEVICE_QUOTA_SYNC_MS', 1000);
+        this.idleEvictMs = 5 * 60 * 1000;
+
+        this.buckets = new Map();
+        this.redis = null;
+        this.syncTimer = null;
+        this.syncing = false;
+        this.stats = { allowed: 0, limited: 0, hinted: 0, syncs: 0, syncErrors: 0, remoteDebited: 0 };
+    }
+
+    start({ redis } = {}) {
+        this.redis = redis || null;
+        if (this.syncTimer) return;
+
+        this.syncTimer = setInterval(() => this.sync(), this.syncIntervalMs);
+        this.syncTimer.unref?.();
+    }
+
+    isDeviceRoute(path) {
+        return DEVICE_ROUTE_PATTERN.test(path);
+    }
+
+    bucketFor(deviceId, messageClass) {
+        const key = `${messageClass}:${deviceId}`;
+        let bucket = this.buckets.get(key);
+        if (!bucket) {
+            bucket = {
+                key,
+                messageClass,
+                tokens: this.classes[messageClass].burst,
+                refilledAt: Date.now(),
+                lastUsed: Date.now(),
+                pending: 0,
+                remoteTotal: null
+            };
+            this.buckets.set(key, bucket);
+        }
+        return bucket;
+    }
+
+    refill(bucket, now = Date.now()) {
+        const { rate, burst } = this.classes[bucket.messageClass];
+        bucket.tokens = Math.min(burst, bucket.tokens + ((now - bucket.refilledAt) / 1000) * rate);
+        bucket.refilledAt = now;
+    }
+
+    /**
+     * Take `cost` tokens from a device's bucket. Returns the decision with
+     * the hints to hand back to the device.
+     */
+    consume(deviceId, messageClass, cost = 1) {
+        const { rate, burst } = this.classes[messageClass];
+        const bucket = this.bucketFor(deviceId, messageClass);
+        const now = Date.now();
+        this.refill(bucket, now);
+        bucket.lastUsed = now;
+
+        // Spacing that keeps a device within the sustained rate
+        const backoffMs = Math.ceil((1000 * cost) / rate);
+
+        // Batches larger than the burst are admitted against a full bucket
+        const needed = Math.min(cost, burst);
+        if (bucket.tokens < needed) {
+            this.stats.limited++;
+            return {
+                allowed: false,
+                remaining: 0,
+                backoffMs,
+                retryAfterMs: Math.ceil(((needed - bucket.tokens) / rate) * 1000)
+            };
+        }
+
+        bucket.tokens -= cost;
+        bucket.pending += cost;
+        this.stats.allowed++;
+
+        return {
+            allowed: true,
+            remaining: Math.max(0, Math.floor(bucket.tokens)),
+            backoffMs: bucket.tokens < burst / 2 ? backoffMs : 0,
+            retryAfterMs: 0
+        };
+    }
+
+    /**
+     * Express middleware for a device route. `cost(req)` prices batched
+     * requests (e.g. one token per telemetry payload in an NDJSON upload).
+     */
+    limit(messageClass, { cost } = {}) {
+        if (!this.classes[messageClass]) {
+            throw new Error(`Unknown device message class: ${messageClass}`);
+        }
+
+        return (req, res, next) => {
+            const deviceId = req.params.id;
+            if (!deviceId) return next();
+
+            const decision = this.consume(deviceId, messageClass, cost ? Math.max(1, cost(req)) : 1);
+
+            res.setHeader('X-Device-Quota-Class', messageClass);
+            res.setHeader('X-Device-Quota-Remaining', decision.remaining);
+            if (decision.backoffMs > 0) {
+                this.stats.hinted++;
+                res.setHeader('X-Device-Backoff-Ms', decision.backoffMs);
+            }
+
+            if (!decision.allowed) {
+                res.setHeader('Retry-After', Math.ceil(decision.retryAfterMs / 1000));
+                return res.status(429).json({
+                    error: 'Device quota exceeded',
+                    class: messageClass,
+                    retry_after_ms: decision.retryAfterMs,
+                    backoff_ms: decision.backoffMs
+                });
+            }
+
+            next();
+        };
+    }
+
+    /**
+     * Push local consumption to Redis and debit what other processes spent.
+     * Counters expire once a bucket would have refilled, so an expired key
+     * (total below what we last saw) just restarts the baseline.
+     */
+    async sync() {
+        if (this.syncing) return;
+        this.syncing = true;
+
+        try {
+            const now = Date.now();
+            const active = [];
+            for (const bucket of this.buckets.values()) {
+                this.refill(bucket, now);
+                const { burst } = this.classes[bucket.messageClass];
+                if (bucket.pending === 0 && bucket.tokens >= burst && now - bucket.lastUsed > this.idleEvictMs) {
+                    this.buckets.delete(bucket.key);
+                    continue;
+                }
+                if (bucket.pending > 0 || bucket.remoteTotal !== null) {
+                    active.push(bucket);
+                }
+            }
+
+            if (!this.redis || this.redis.status !== 'ready' || active.length === 0) {
+                for (const bucket of active) bucket.pending = 0;
+                return;
+            }
+
+            const pipeline = this.redis.pipeline();
+            const sent = active.map((bucket) => {
+                const { rate, burst } = this.classes[bucket.messageClass];
+                const redisKey = `${REDIS_KEY_PREFIX}:${bucket.key}`;
+                pipeline.incrby(redisKey, Math.round(bucket.pending));
+                pipeline.expire(redisKey, Math.ceil(burst / rate) + 60);
+                const delta = Math.round(bucket.pending);
+                bucket.pending = 0;
+                return delta;
+            });
+
+            const results = await pipeline.exec();
+            active.forEach((bucket, index) => {
+                const [error, total] = results[index * 2];
+                if (error) return;
+
+                const delta = sent[index];
+                if (bucket.remoteTotal !== null && total >= bucket.remoteTotal + delta) {
+                    const remote = total - bucket.remoteTotal - delta;
+                    if (remote > 0) {
+                        bucket.tokens = Math.max(0, bucket.tokens - remote);
+                        this.stats.remoteDebited += remote;
+                    }
+                }
+                bucket.remoteTotal = total;
+            });
+            this.stats.syncs++;
+        } catch (error) {
+            this.stats.syncErrors++;
+            logger.debug(`Device quota sync failed: ${error.message}`);
+        } finally {
+            this.syncing = false;
+        }
+    }
+
+    /**
+     * Current bucket levels for one device
+     */
+    getDeviceStatus(deviceId) {
+        const now = Date.now();
+        const status = {};
+        for (const [messageClass, limits] of Object.entries(this.classes)) {
+            const bucket = this.buckets.get(`${messageClass}:${deviceId}`);
+            if (bucket) this.refill(bucket, now);
+            status[messageClass] = {
+                ...limits,
+                tokens: bucket ? Math.floor(bucket.tokens) : limits.burst
+            };
+        }
+        return status;
+    }
+
+    getStatus() {
+        return {
+            classes: this.classes,
+            buckets: this.buckets.size,
+            redisSync: Boolean(this.redis),
+            ...this.stats
+        };
+    }
+
+    async shutdown() {
+        if (this.syncTimer) {
+            clearInterval(this.syncTimer);
+            this.syncTimer = null;
+        }
+        await this.sync();
+    }
+}
+
+module.exports = new DeviceQuotaService();
+module.exports.DeviceQuotaService = DeviceQuotaService;
@@ -9,6 +9,7 @@ const execPromise = promisify(exec);
 class FirmwareCompiler {
     constructor() {
         this.tempDir = path.join(__dirname, '../../temp/builds');
+        this.firmwareDir = path.join(__dirname, '../../../firmware');
         this.arduinoCLI = 'arduino-cli';
         this.esp8266FQBN = 'esp8266:esp8266:nodemcuv2';
     }
@@ -40,6 +41,8 @@ class FirmwareCompiler {
 
             await fs.writeFile(inoPath, inoContent);
             await fs.writeFile(configPath, configContent);
+            // Shared headers the sketch includes next to device_config.h
+            await fs.copyFile(path.join(this.firmwareDir, 'modbus_rtu.h'), path.join(sketchDir, 'modbus_rtu.h'));
 
             logger.info(`Compiling firmware for device ${deviceId}...`);
 
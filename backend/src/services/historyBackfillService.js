@@ -0,0 +1,174 @@
+const db = require('../models/database');
+const logger = require('../utils/logger');
+
+// Devices keep this much full-resolution history on flash
+const MAX_RANGE_MS = 24 * 60 * 60 * 1000;
+
+/**
+ * On-demand backfill of full-resolution history from a device's on-flash
+ * store.
+ *
+ * Everyday telemetry is deadbanded on the device; when someone needs the
+ * detail, a request for one sensor and time range is queued here and handed
+ * to the device in its next heartbeat response (`config.history_requests`).
+ * The device streams the range back as compact chunks to
+ * POST /api/devices/:id/history/:requestId, marking the last one final.
+ * A request the device has not finished answering is handed out again
+ * after `resendAfterMs`; duplicate samples from a retried upload are
+ * ignored.
+ */
+class HistoryBackfillService {
+    constructor() {
+        this.resendAfterMs = parseInt(process.env.HISTORY_BACKFILL_RESEND_MS, 10) || 10 * 60 * 1000;
+        this.maxPerHeartbeat = 2;
+    }
+
+    validateRange(start, end, now = Date.now()) {
+        if (!(start < end)) {
+            return 'start must be before end';
+        }
+        if (end - start > MAX_RANGE_MS) {
+            return 'Range may not exceed 24 hours';
+        }
+        if (start < now - MAX_RANGE_MS) {
+            return 'Devices only keep the last 24 hours';
+        }
+        return null;
+    }
+
+    async createRequest(deviceId, sensorPin, start, end, requestedBy) {
+        const result = await db.query(`
+            INSERT INTO history_requests (device_id, sensor_pin, start_time, end_time, requested_by)
+            VALUES ($1, $2, $3, $4, $5)
+            RETURNING *
+        `, [deviceId, String(sensorPin), new Date(start), new Date(end), requestedBy || null]);
+
+        logger.logDeviceActivity(deviceId, 'history_requested', {
+            request_id: result.rows[0].id,
+            sensor_pin: String(sensorPin),
+            start: new Date(start).toISOString(),
+            end: new Date(end).toISOString()
+        });
+        return result.rows[0];
+    }
+
+    async listRequests(deviceId) {
+        const result = await db.query(`
+            SELECT id, sensor_pin, start_time, end_time, status, samples_received,
+                   chunks_received, created_at, sent_at, completed_at
+            FROM history_requests
+            WHERE device_id = $1
+            ORDER BY created_at DESC
+            LIMIT 50
+        `, [deviceId]);
+        return result.rows;
+    }
+
+    /**
+     * Requests to hand to a device with its heartbeat response, in the
+     * shape the firmware reads (epoch ms). Marks them sent.
+     */
+    async claimForHeartbeat(deviceId) {
+        const result = await db.query(`
+            UPDATE history_requests
+            SET status = 'sent', sent_at = CURRENT_TIMESTAMP
+            WHERE id IN (
+                SELECT id FROM history_requests
+                WHERE device_id = $1
+                  AND (status = 'pending'
+                       OR (status IN ('sent', 'receiving')
+                           AND sent_at < CURRENT_TIMESTAMP - make_interval(secs => $2)))
+                  AND created_at > CURRENT_TIMESTAMP - INTERVAL '1 day'
+                ORDER BY created_at
+                LIMIT $3
+            )
+            RETURNING id, sensor_pin, start_time, end_time
+        `, [deviceId, this.resendAfterMs / 1000, this.maxPerHeartbeat]);
+
+        return result.rows.map(row => ({
+            id: row.id,
+            pin: row.sensor_pin,
+            from: new Date(row.start_time).getTime(),
+            to: new Date(row.end_time).getTime()
+        }));
+    }
+
+    /**
+     * Store one decoded chunk (see utils/historyChunk). Samples outside the
+     * requested range are dropped. Returns null when the request does not
+     * belong to the device.
+     */
+    async storeChunk(deviceId, requestId, chunk, final) {
+        const requestResult = await db.query(
+            'SELECT id, start_time, end_time FROM history_requests WHERE id = $1 AND device_id = $2',
+            [requestId, deviceId]
+        );
+        if (requestResult.rows.length === 0) {
+            return null;
+        }
+
+        const request = requestResult.rows[0];
+        const start = new Date(request.start_time).getTime();
+        const end = new Date(request.end_time).getTime();
+        const timestamps = [];
+        const values = [];
+        for (let i = 0; i < chunk.count; i++) {
+            if (chunk.times[i] >= start && chunk.times[i] <= end) {
+                timestamps.push(new Date(chunk.times[i]));
+                values.push(chunk.values[i]);
+            }
+        }
+
+        let inserted = 0;
+        if (timestamps.length > 0) {
+            const insertResult = await db.query(`
+                INSERT INTO history_samples (request_id, sampled_at, value)
+                SELECT $1, t, v FROM UNNEST($2::timestamptz[], $3::float8[]) AS s(t, v)
+                ON CONFLICT (request_id, sampled_at) DO NOTHING
+            `, [requestId, timestamps, values]);
+            inserted = insertResult.rowCount || 0;
+        }
+
+        const updateResult = await db.query(`
+            UPDATE history_requests
+            SET status = CASE WHEN $2 THEN 'complete'
+                              WHEN status = 'complete' THEN status
+                              ELSE 'receiving' END,
+                chunks_received = chunks_received + 1,
+                samples_received = samples_received + $3,
+                completed_at = CASE WHEN $2 THEN CURRENT_TIMESTAMP ELSE completed_at END
+            WHERE id = $1
+            RETURNING status, samples_received
+        `, [requestId, Boolean(final), inserted]);
+
+        if (final) {
+            logger.logDeviceActivity(deviceId, 'history_backfilled', {
+                request_id: Number(requestId),
+                samples: updateResult.rows[0].samples_received
+            });
+        }
+        return { inserted, ...updateResult.rows[0] };
+    }
+
+    async getSamples(deviceId, requestId) {
+        const requestResult = await db.query(
+            'SELECT * FROM history_requests WHERE id = $1 AND device_id = $2',
+            [requestId, deviceId]
+        );
+        if (requestResult.rows.length === 0) {
+            return null;
+        }
+
+        const samplesResult = await db.query(`
+            SELECT sampled_at AS timestamp, value
+            FROM history_samples
+            WHERE request_id = $1
+            ORDER BY sampled_at
+        `, [requestId]);
+
+        return { request: requestResult.rows[0], samples: samplesResult.rows };
+    }
+}
+
+module.exports = new HistoryBackfillService();
+module.exports.MAX_RANGE_MS = MAX_RANGE_MS;
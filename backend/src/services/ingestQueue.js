@@ -0,0 +1,157 @@
+const logger = require('../utils/logger');
+
+/**
+ * Bounded, lane-partitioned ingest queue.
+ *
+ * Decoded device messages are hashed onto lanes by device id; each lane
+ * flushes serially in batches, so order is kept per device while lanes make
+ * progress independently. When the queue is full new messages are rejected
+ * rather than buffered without bound.
+ */
+class IngestQueue {
+    constructor({ name, maxQueueSize, batchSize, flushIntervalMs, lanes, processBatch }) {
+        this.name = name;
+        this.config = { maxQueueSize, batchSize, flushIntervalMs, lanes };
+        this.processBatch = processBatch;
+
+        this.lanes = Array.from({ length: lanes }, () => ({ queue: [], flushing: false }));
+        this.queuedMessages = 0;
+        this.flushTimer = null;
+        this.lastDropWarning = 0;
+        this.metrics = {
+            received: 0,
+            dropped: 0,
+            invalid: 0,
+            batches: 0,
+            flushedMessages: 0,
+            lastBatchSize: 0,
+            maxBatchSize: 0,
+            lastFlushDurationMs: 0,
+            lastLagMs: 0,
+            maxLagMs: 0
+        };
+    }
+
+    /**
+     * Queue a decoded message ({ deviceId, receivedAt, ... }). Returns false
+     * when the queue is full and the message was dropped.
+     */
+    enqueue(message) {
+        this.metrics.received++;
+
+        if (this.queuedMessages >= this.config.maxQueueSize) {
+            this.metrics.dropped++;
+            if (Date.now() - this.lastDropWarning > 10000) {
+                this.lastDropWarning = Date.now();
+                logger.warn(`${this.name} ingest queue full (${this.queuedMessages} messages), dropping messages`);
+            }
+            return false;
+        }
+
+        const lane = this.lanes[this.laneFor(message.deviceId)];
+        lane.queue.push(message);
+        this.queuedMessages++;
+
+        if (lane.queue.length >= this.config.batchSize) {
+            this.flushLane(lane);
+        }
+        return true;
+    }
+
+    recordInvalid() {
+        this.metrics.received++;
+        this.metrics.invalid++;
+    }
+
+    isFull() {
+        return this.queuedMessages >= this.config.maxQueueSize;
+    }
+
+    laneFor(deviceId) {
+        let hash = 0;
+        for (let i = 0; i < deviceId.length; i++) {
+            hash = (hash * 31 + deviceId.charCodeAt(i)) | 0;
+        }
+        return Math.abs(hash) % this.lanes.length;
+    }
+
+    start() {
+        if (this.flushTimer) return;
+        this.flushTimer = setInterval(() => {
+            for (const lane of this.lanes) {
+                this.flushLane(lane);
+            }
+        }, this.config.flushIntervalMs);
+    }
+
+    /**
+     * Drain one lane in batches. Only one flush runs per lane at a time,
+     * which is what keeps per-device ordering.
+     */
+    async flushLane(lane) {
+        if (lane.flushing || lane.queue.length === 0) {
+            return;
+        }
+
+        lane.flushing = true;
+        try {
+            while (lane.queue.length > 0) {
+                const batch = lane.queue.splice(0, this.config.batchSize);
+                this.queuedMessages -= batch.length;
+
+                const startedAt = Date.now();
+                const lagMs = startedAt - batch[0].receivedAt;
+
+                await this.processBatch(batch);
+
+                const metrics = this.metrics;
+                metrics.batches++;
+                metrics.flushedMessages += batch.length;
+                metrics.lastBatchSize = batch.length;
+                metrics.maxBatchSize = Math.max(metrics.maxBatchSize, batch.length);
+                metrics.lastFlushDurationMs = Date.now() - startedAt;
+                metrics.lastLagMs = lagMs;
+                metrics.maxLagMs = Math.max(metrics.maxLagMs, lagMs);
+            }
+        } finally {
+            lane.flushing = false;
+        }
+    }
+
+    /**
+     * Queue depth, lag and batch sizes
+     */
+    getMetrics() {
+        const now = Date.now();
+        let oldest = null;
+        for (const lane of this.lanes) {
+            if (lane.queue.length > 0 && (oldest === null || lane.queue[0].receivedAt < oldest)) {
+                oldest = lane.queue[0].receivedAt;
+            }
+        }
+
+        return {
+            ...this.metrics,
+            queued: this.queuedMessages,
+            maxQueueSize: this.config.maxQueueSize,
+            laneDepths: this.lanes.map((lane) => lane.queue.length),
+            queueLagMs: oldest === null ? 0 : now - oldest,
+            avgBatchSize: this.metrics.batches > 0
+                ? Math.round(this.metrics.flushedMessages / this.metrics.batches)
+                : 0
+        };
+    }
+
+    /**
+     * Stop the flush timer and drain everything already accepted
+     */
+    async shutdown() {
+        if (this.flushTimer) {
+            clearInterval(this.flushTimer);
+            this.flushTimer = null;
+        }
+        await Promise.all(this.lanes.map((lane) => this.flushLane(lane)));
+    }
+}
+
+module.exports = IngestQueue;
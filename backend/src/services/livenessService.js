@@ -0,0 +1,297 @@
+const db = require('../models/database');
+const logger = require('../utils/logger');
+
+const DEFAULT_HEARTBEAT_INTERVAL_SECONDS = 300;
+
+/**
+ * Device liveness tracking.
+ *
+ * Every device has a deadline in a hashed timer wheel (one slot per tick,
+ * entries further out than one rotation carry a round counter). Any device
+ * contact re-arms the deadline in O(1); each tick only looks at the devices
+ * due in that slot, so offline transitions fire on time without scanning the
+ * devices table. last_heartbeat writes are buffered and flushed in one
+ * statement per interval.
+ */
+class LivenessService {
+    constructor() {
+        this.tickMs = parseInt(process.env.LIVENESS_TICK_MS, 10) || 1000;
+        this.wheelSize = 4096;
+        this.missedHeartbeats = parseInt(process.env.LIVENESS_MISSED_HEARTBEATS, 10) || 2;
+        this.minTimeoutMs = 60 * 1000;
+        this.flushIntervalMs = parseInt(process.env.LIVENESS_FLUSH_MS, 10) || 5000;
+
+        this.wheel = Array.from({ length: this.wheelSize }, () => new Set());
+        this.cursor = 0;
+        this.entries = new Map();
+        this.pendingContacts = new Map();
+
+        this.websocketService = null;
+        this.tickTimer = null;
+        this.flushTimer = null;
+        this.flushing = null;
+        this.stats = { offlineTransitions: 0, flushedContacts: 0, lastFlushSize: 0 };
+    }
+
+    timeoutFor(heartbeatIntervalSeconds) {
+        const interval = heartbeatIntervalSeconds || DEFAULT_HEARTBEAT_INTERVAL_SECONDS;
+        return Math.max(this.minTimeoutMs, interval * 1000 * this.missedHeartbeats);
+    }
+
+    /**
+     * Arm timers for every known device from its last persisted heartbeat.
+     */
+    async start({ websocketService } = {}) {
+        this.websocketService = websocketService || null;
+
+        const result = await db.query(`
+            SELECT d.id, d.status, d.last_heartbeat, dc.heartbeat_interval
+            FROM devices d
+            LEFT JOIN device_configs dc ON dc.device_id = d.id
+        `);
+
+        const now = Date.now();
+        for (const device of result.rows) {
+            const timeoutMs = this.timeoutFor(device.heartbeat_interval);
+            const lastSeen = device.last_heartbeat ? new Date(device.last_heartbeat).getTime() : null;
+            const offline = device.status === 'offline' || lastSeen === null;
+
+            this.entries.set(device.id, {
+                deviceId: device.id,
+                timeoutMs,
+                deadline: null,
+                slot: null,
+                rounds: 0,
+                offline
+            });
+
+            if (!offline) {
+                // Overdue devices get the next tick
+                this.arm(device.id, Math.max(now, lastSeen + timeoutMs));
+            }
+        }
+
+        this.tickTimer = setInterval(() => this.tick(), this.tickMs);
+        this.flushTimer = setInterval(() => this.flush(), this.flushIntervalMs);
+        this.tickTimer.unref?.();
+        this.flushTimer.unref?.();
+
+        logger.info(`Liveness tracking started for ${this.entries.size} devices`);
+    }
+
+    arm(deviceId, deadline) {
+        const entry = this.entries.get(deviceId);
+        if (entry.slot !== null) {
+            this.wheel[entry.slot].delete(entry);
+        }
+
+        const ticksAway = Math.max(1, Math.ceil((deadline - Date.now()) / this.tickMs));
+        entry.deadline = deadline;
+        entry.slot = (this.cursor + ticksAway) % this.wheelSize;
+        entry.rounds = Math.floor((ticksAway - 1) / this.wheelSize);
+        this.wheel[entry.slot].add(entry);
+    }
+
+    /**
+     * Record device contact: re-arm its deadline and queue the heartbeat write.
+     */
+    touch(deviceId, ipAddress = null) {
+        const now = Date.now();
+        let entry = this.entries.get(deviceId);
+
+        if (!entry) {
+            entry = { deviceId, timeoutMs: this.timeoutFor(null), deadline: null, slot: null, rounds: 0, offline: true };
+            this.entries.set(deviceId, entry);
+            this.refreshTimeout(deviceId);
+        }
+
+        const cameOnline = entry.offline;
+        entry.offline = false;
+        this.arm(deviceId, now + entry.timeoutMs);
+
+        this.pendingContacts.set(deviceId, {
+            seenAt: new Date(now),
+            ipAddress: ipAddress || this.pendingContacts.get(deviceId)?.ipAddress || null,
+            cameOnline: cameOnline || this.pendingContacts.get(deviceId)?.cameOnline || false
+        });
+
+        if (cameOnline && this.websocketService) {
+            this.websocketService.broadcastDeviceStatus(deviceId, 'online');
+        }
+    }
+
+    /**
+     * Update a device's timeout after its heartbeat interval changes.
+     */
+    setHeartbeatInterval(deviceId, heartbeatIntervalSeconds) {
+        const entry = this.entries.get(deviceId);
+        if (!entry) return;
+
+        const previous = entry.timeoutMs;
+        entry.timeoutMs = this.timeoutFor(heartbeatIntervalSeconds);
+
+        if (!entry.offline && entry.deadline !== null) {
+            this.arm(deviceId, entry.deadline - previous + entry.timeoutMs);
+        }
+    }
+
+    async refreshTimeout(deviceId) {
+        try {
+            const result = await db.query(
+                'SELECT heartbeat_interval FROM device_configs WHERE device_id = $1',
+                [deviceId]
+            );
+            if (result.rows.length > 0) {
+                this.setHeartbeatInterval(deviceId, result.rows[0].heartbeat_interval);
+            }
+        } catch (error) {
+            logger.warn(`Failed to load heartbeat interval for ${deviceId}:`, error.message);
+        }
+    }
+
+    forget(deviceId) {
+        const entry = this.entries.get(deviceId);
+        if (entry && entry.slot !== null) {
+            this.wheel[entry.slot].delete(entry);
+        }
+        this.entries.delete(deviceId);
+        this.pendingContacts.delete(deviceId);
+    }
+
+    tick() {
+        this.cursor = (this.cursor + 1) % this.wheelSize;
+        const slot = this.wheel[this.cursor];
+        if (slot.size === 0) return;
+
+        const expired = [];
+        for (const entry of slot) {
+            if (entry.rounds > 0) {
+                entry.rounds--;
+                continue;
+            }
+            slot.delete(entry);
+            entry.slot = null;
+            entry.offline = true;
+            expired.push(entry);
+        }
+
+        if (expired.length > 0) {
+            this.markOffline(expired).catch((error) => {
+                logger.error('Error marking devices offline:', error);
+            });
+        }
+    }
+
+    async markOffline(expired) {
+        // Persist buffered contacts first so the guard below sees them
+        await this.flush();
+
+        const ids = expired.map(entry => entry.deviceId);
+        const cutoffs = expired.map(entry => new Date(entry.deadline - entry.timeoutMs));
+
+        // Another backend worker may have heard from the device; only flip
+        // rows whose persisted heartbeat is still older than our cutoff
+        const offlineDevices = await db.query(`
+            UPDATE devices d
+            SET status = 'offline'
+            FROM UNNEST($1::varchar[], $2::timestamptz[]) AS v(id, cutoff)
+            WHERE d.id = v.id
+                AND d.status != 'offline'
+                AND (d.last_heartbeat IS NULL OR d.last_heartbeat <= v.cutoff)
+            RETURNING d.id, d.name
+        `, [ids, cutoffs]);
+
+        if (offlineDevices.rows.length === 0) return;
+
+        await db.query(`
+            INSERT INTO alerts (device_id, alert_type, severity, message, status, created_at)
+            SELECT id, 'OFFLINE', 'medium', 'Device ' || name || ' has gone offline', 'active', NOW()
+            FROM UNNEST($1::varchar[], $2::text[]) AS v(id, name)
+        `, [offlineDevices.rows.map(device => device.id), offlineDevices.rows.map(device => device.name)]);
+
+        for (const device of offlineDevices.rows) {
+            if (this.websocketService) {
+                this.websocketService.broadcastDeviceStatus(device.id, 'offline');
+            }
+        }
+
+        this.stats.offlineTransitions += offlineDevices.rows.length;
+        logger.info(`Marked ${offlineDevices.rows.length} devices as offline`);
+    }
+
+    /**
+     * Write buffered contacts in one statement. Concurrent callers share the
+     * in-flight flush.
+     */
+    async flush() {
+        if (this.flushing) return this.flushing;
+        if (this.pendingContacts.size === 0) return;
+
+        const contacts = this.pendingContacts;
+        this.pendingContacts = new Map();
+
+        const ids = [];
+        const seenAt = [];
+        const ips = [];
+        const cameOnline = [];
+        for (const [deviceId, contact] of contacts) {
+            ids.push(deviceId);
+            seenAt.push(contact.seenAt);
+            ips.push(contact.ipAddress);
+            cameOnline.push(contact.cameOnline);
+        }
+
+        this.flushing = db.query(`
+            UPDATE devices d
+            SET last_heartbeat = GREATEST(d.last_heartbeat, v.seen_at::timestamp),
+                ip_address = COALESCE(v.ip::inet, d.ip_address),
+                status = CASE WHEN v.came_online AND d.status = 'offline' THEN 'online' ELSE d.status END
+            FROM UNNEST($1::varchar[], $2::timestamptz[], $3::text[], $4::boolean[])
+                AS v(id, seen_at, ip, came_online)
+            WHERE d.id = v.id
+        `, [ids, seenAt, ips, cameOnline])
+            .then(() => {
+                this.stats.flushedContacts += ids.length;
+                this.stats.lastFlushSize = ids.length;
+            })
+            .catch((error) => {
+                // Keep newer contacts that arrived meanwhile; requeue the rest
+                for (const [deviceId, contact] of contacts) {
+                    if (!this.pendingContacts.has(deviceId)) {
+                        this.pendingContacts.set(deviceId, contact);
+                    }
+                }
+                logger.error('Failed to persist device heartbeats:', error);
+            })
+            .finally(() => {
+                this.flushing = null;
+            });
+
+        return this.flushing;
+    }
+
+    getStatus() {
+        let armed = 0;
+        for (const entry of this.entries.values()) {
+            if (entry.slot !== null) armed++;
+        }
+
+        return {
+            trackedDevices: this.entries.size,
+            armed,
+            pendingContacts: this.pendingContacts.size,
+            ...this.stats
+        };
+    }
+
+    async shutdown() {
+        clearInterval(this.tickTimer);
+        clearInterval(this.flushTimer);
+        this.tickTimer = null;
+        this.flushTimer = null;
+        await this.flush();
+    }
+}
+
+module.exports = new LivenessService();
+module.exports.LivenessService = LivenessService;
@@ -0,0 +1,130 @@
+const db = require('../models/database');
+const logger = require('../utils/logger');
+const { modbusPinName, toDeviceFormat, modbusMapVersion } = require('../utils/modbusMap');
+
+/**
+ * Per-device Modbus RTU register maps.
+ *
+ * The map is edited as a whole through the API and stored one row per
+ * point; every point also gets a device_sensors row under its pin name so
+ * its readings, thresholds and alerts work like any other sensor. Devices
+ * report the version of the map they run in each heartbeat and get the
+ * points back (`config.modbus`) only when it is out of date.
+ */
+class ModbusConfigService {
+    async getPoints(deviceId) {
+        const result = await db.query(`
+            SELECT slave_id, function_code, register_address, data_type, scale,
+                   sensor_type, name, threshold_min, threshold_max, updated_at
+            FROM modbus_points
+            WHERE device_id = $1
+            ORDER BY slave_id, function_code, register_address
+        `, [deviceId]);
+        return result.rows;
+    }
+
+    /**
+     * Replace a device's map. Sensor types are resolved first; returns
+     * { error } naming an unknown one without touching anything. Points
+     * without thresholds take their sensor type's range.
+     */
+    async replacePoints(deviceId, points) {
+        const typeNames = [...new Set(points.map(point => point.sensor_type.toLowerCase()))];
+        const typeResult = await db.query(
+            'SELECT id, name, min_value, max_value FROM sensor_types WHERE LOWER(name) = ANY($1::text[])',
+            [typeNames]
+        );
+        const types = new Map(typeResult.rows.map(row => [row.name.toLowerCase(), row]));
+        const unknown = typeNames.find(name => !types.has(name));
+        if (unknown) {
+            return { error: `Unknown sensor type: ${unknown}` };
+        }
+
+        const previousPins = (await this.getPoints(deviceId)).map(modbusPinName);
+
+        const stored = await db.transaction(async (client) => {
+            await client.query('DELETE FROM modbus_points WHERE device_id = $1', [deviceId]);
+
+            const rows = [];
+            for (const point of points) {
+                const type = types.get(point.sensor_type.toLowerCase());
+                const pin = modbusPinName(point);
+                const name = point.name || `${type.name} ${pin}`;
+                const thresholdMin = point.threshold_min ?? type.min_value ?? null;
+                const thresholdMax = point.threshold_max ?? type.max_value ?? null;
+
+                const result = await client.query(`
+                    INSERT INTO modbus_points (
+                        device_id, slave_id, function_code, register_address, data_type,
+                        scale, sensor_type, name, threshold_min, threshold_max
+                    )
+                    VALUES ($1, $2, $3, $4, $5, $6, $7, $8, $9, $10)
+                    RETURNING slave_id, function_code, register_address, data_type, scale,
+                              sensor_type, name, threshold_min, threshold_max, updated_at
+                `, [
+                    deviceId, point.slave_id, point.function_code, point.register_address, point.data_type,
+                    point.scale ?? 1, type.name, name, thresholdMin, thresholdMax
+                ]);
+                rows.push(result.rows[0]);
+
+                await client.query(`
+                    INSERT INTO device_sensors (device_id, sensor_type_id, pin, name, threshold_min, threshold_max)
+                    VALUES ($1, $2, $3, $4, $5, $6)
+                    ON CONFLICT (device_id, pin) DO UPDATE
+                    SET sensor_type_id = EXCLUDED.sensor_type_id,
+                        name = EXCLUDED.name,
+                        threshold_min = COALESCE(EXCLUDED.threshold_min, device_sensors.threshold_min),
+                        threshold_max = COALESCE(EXCLUDED.threshold_max, device_sensors.threshold_max),
+                        enabled = true,
+                        updated_at = CURRENT_TIMESTAMP
+                `, [deviceId, type.id, pin, name, thresholdMin, thresholdMax]);
+            }
+
+            // Points dropped from the map stop reporting; their sensors and
+            // history stay, disabled
+            const currentPins = rows.map(modbusPinName);
+            const removedPins = previousPins.filter(pin => !currentPins.includes(pin));
+            if (removedPins.length > 0) {
+                await client.query(
+                    'UPDATE device_sensors SET enabled = false WHERE device_id = $1 AND pin = ANY($2::varchar[])',
+                    [deviceId, removedPins]
+                );
+            }
+            // Same order as getPoints(), which the version is taken over
+            return rows.sort((a, b) => a.slave_id - b.slave_id ||
+                a.function_code - b.function_code || a.register_address - b.register_address);
+        });
+
+        const version = modbusMapVersion(toDeviceFormat(stored));
+        logger.logDeviceActivity(deviceId, 'modbus_map_updated', { points: stored.length, version });
+        return { points: stored, version };
+    }
+
+    /**
+     * The device-format map and its version
+     */
+    async deviceMap(deviceId) {
+        const points = toDeviceFormat(await this.getPoints(deviceId));
+        return { version: modbusMapVersion(points), points };
+    }
+
+    /**
+     * The `config.modbus` object for a heartbeat response: always the
+     * current version, plus the points when the device reported a different
+     * one. Null for devices that have no map and never had one.
+     */
+    heartbeatConfigFor(map, reportedVersion) {
+        const reported = Number(reportedVersion) || 0;
+
+        if (map.version === 0 && reported === 0) {
+            return null;
+        }
+        return map.version === reported ? { version: map.version } : map;
+    }
+
+    async heartbeatConfig(deviceId, reportedVersion) {
+        return this.heartbeatConfigFor(await this.deviceMap(deviceId), reportedVersion);
+    }
+}
+
+module.exports = new ModbusConfigService();
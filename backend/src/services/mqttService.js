@@ -1,6 +1,8 @@
 const mqtt = require('mqtt');
 const logger = require('../utils/logger');
 const db = require('../models/database');
+const livenessService = require('./livenessService');
+const IngestQueue = require('./ingestQueue');
 
 class MQTTService {
     constructor(telemetryProcessor) {
@@ -10,6 +12,22 @@ class MQTTService {
         this.subscriptions = new Map();
         this.reconnectAttempts = 0;
         this.maxReconnectAttempts = 10;
+
+        // Shared subscription group: with several backend workers in the same
+        // group the broker spreads device topics across them. Use a sticky or
+        // topic-hash share strategy so each device stays on one worker.
+        this.sharedGroup = process.env.MQTT_SHARED_GROUP || null;
+
+        // Ingest queue: messages are decoded on arrival and flushed in batches,
+        // ordered per device (see IngestQueue)
+        this.ingestQueue = new IngestQueue({
+            name: 'MQTT',
+            maxQueueSize: parseInt(process.env.MQTT_INGEST_QUEUE_SIZE, 10) || 10000,
+            batchSize: parseInt(process.env.MQTT_INGEST_BATCH_SIZE, 10) || 500,
+            flushIntervalMs: parseInt(process.env.MQTT_INGEST_FLUSH_MS, 10) || 250,
+            lanes: parseInt(process.env.MQTT_INGEST_CONCURRENCY, 10) || 4,
+            processBatch: (batch) => this.processBatch(batch)
+        });
     }
 
     /**
@@ -19,7 +37,7 @@ class MQTTService {
         try {
             const brokerUrl = process.env.MQTT_BROKER_URL || 'mqtt://localhost:1883';
             const options = {
-                clientId: `iot-platform-${Date.now()}`,
+                clientId: `iot-platform-${process.pid}-${Date.now()}`,
                 clean: true,
                 reconnectPeriod: 5000,
                 connectTimeout: 30000,
@@ -35,6 +53,7 @@ class MQTTService {
             this.client = mqtt.connect(brokerUrl, options);
 
             this.setupEventHandlers();
+            this.ingestQueue.start();
 
             return new Promise((resolve, reject) => {
                 const timeout = setTimeout(() => {
@@ -89,12 +108,8 @@ class MQTTService {
             logger.error('MQTT client error:', error);
         });
 
-        this.client.on('message', async (topic, message) => {
-            try {
-                await this.handleMessage(topic, message);
-            } catch (error) {
-                logger.error(`Error handling MQTT message from topic ${topic}:`, error);
-            }
+        this.client.on('message', (topic, message) => {
+            this.enqueueMessage(topic, message);
         });
 
         this.client.on('close', () => {
@@ -156,6 +171,13 @@ class MQTTService {
         }
     }
 
+    /**
+     * Map a topic filter onto the shared subscription group, if configured
+     */
+    toSubscriptionTopic(topic) {
+        return this.sharedGroup ? `$share/${this.sharedGroup}/${topic}` : topic;
+    }
+
     /**
      * Subscribe to a specific topic
      */
@@ -165,7 +187,7 @@ class MQTTService {
                 return reject(new Error('MQTT client not connected'));
             }
 
-            this.client.subscribe(topic, { qos }, (error) => {
+            this.client.subscribe(this.toSubscriptionTopic(topic), { qos }, (error) => {
                 if (error) {
                     logger.error(`Failed to subscribe to topic ${topic}:`, error);
                     reject(error);
@@ -187,7 +209,7 @@ class MQTTService {
                 return reject(new Error('MQTT client not connected'));
             }
 
-            this.client.unsubscribe(topic, (error) => {
+            this.client.unsubscribe(this.toSubscriptionTopic(topic), (error) => {
                 if (error) {
                     logger.error(`Failed to unsubscribe from topic ${topic}:`, error);
                     reject(error);
@@ -201,74 +223,108 @@ class MQTTService {
     }
 
     /**
-     * Handle incoming MQTT message
+     * Decode an incoming MQTT message and queue it for batched processing
+     */
+    enqueueMessage(topic, message) {
+        const decoded = this.decodeMessage(topic, message);
+        if (!decoded) {
+            this.ingestQueue.recordInvalid();
+            return;
+        }
+
+        this.ingestQueue.enqueue(decoded);
+    }
+
+    /**
+     * Parse topic and payload; returns null for malformed messages
      */
-    async handleMessage(topic, message) {
+    decodeMessage(topic, message) {
+        const topicParts = topic.split('/');
+
+        // Extract device ID from topic (format: prefix/deviceId/type)
+        if (topicParts.length < 3) {
+            logger.warn(`Invalid topic format: ${topic}`);
+            return null;
+        }
+
+        let payload;
         try {
-            const payload = JSON.parse(message.toString());
-            const topicParts = topic.split('/');
+            payload = JSON.parse(message.toString());
+        } catch (error) {
+            logger.error(`Error parsing MQTT message from topic ${topic}:`, error);
+            return null;
+        }
+
+        const deviceId = topicParts[topicParts.length - 2];
+        const messageType = topicParts[topicParts.length - 1];
+
+        // Expected telemetry payload format:
+        // {
+        //   sensors: [
+        //     { pin: 'A0', type: 'temperature', raw_value: 512, processed_value: 25.3, name: 'Room Temp' },
+        //     ...
+        //   ]
+        // }
+        if (messageType === 'telemetry' && (!payload || !Array.isArray(payload.sensors))) {
+            logger.warn(`Invalid telemetry payload from device ${deviceId}`);
+            return null;
+        }
+
+        return { deviceId, messageType, payload, receivedAt: Date.now() };
+    }
+
+    /**
+     * Process a batch in order: consecutive telemetry goes through the bulk
+     * path together, other message types are handled where they occur.
+     */
+    async processBatch(batch) {
+        let telemetry = [];
 
-            // Extract device ID from topic (format: prefix/deviceId/type)
-            if (topicParts.length < 3) {
-                logger.warn(`Invalid topic format: ${topic}`);
-                return;
+        const flushTelemetry = async () => {
+            if (telemetry.length === 0) return;
+            const items = telemetry;
+            telemetry = [];
+            try {
+                await this.telemetryProcessor.processTelemetryBatch(items.map((message) => ({
+                    deviceId: message.deviceId,
+                    sensors: message.payload.sensors,
+                    receivedAt: message.receivedAt
+                })));
+                logger.debug(`Processed MQTT telemetry batch: ${items.length} messages`);
+            } catch (error) {
+                logger.error(`Error processing MQTT telemetry batch of ${items.length} messages:`, error);
             }
+        };
 
-            const deviceId = topicParts[topicParts.length - 2];
-            const messageType = topicParts[topicParts.length - 1];
+        for (const message of batch) {
+            if (message.messageType === 'telemetry') {
+                telemetry.push(message);
+                continue;
+            }
 
-            logger.debug(`Received MQTT message from device ${deviceId}, type: ${messageType}`);
+            await flushTelemetry();
 
-            switch (messageType) {
-                case 'telemetry':
-                    await this.handleTelemetryMessage(deviceId, payload);
-                    break;
+            logger.debug(`Received MQTT message from device ${message.deviceId}, type: ${message.messageType}`);
 
+            switch (message.messageType) {
                 case 'heartbeat':
-                    await this.handleHeartbeatMessage(deviceId, payload);
+                    await this.handleHeartbeatMessage(message.deviceId, message.payload);
                     break;
 
                 case 'alarm':
-                    await this.handleAlarmMessage(deviceId, payload);
+                    await this.handleAlarmMessage(message.deviceId, message.payload);
                     break;
 
                 case 'status':
-                    await this.handleStatusMessage(deviceId, payload);
+                    await this.handleStatusMessage(message.deviceId, message.payload);
                     break;
 
                 default:
-                    logger.warn(`Unknown message type: ${messageType}`);
+                    logger.warn(`Unknown message type: ${message.messageType}`);
             }
-        } catch (error) {
-            logger.error(`Error parsing MQTT message from topic ${topic}:`, error);
         }
-    }
 
-    /**
-     * Handle telemetry data from device
-     */
-    async handleTelemetryMessage(deviceId, payload) {
-        try {
-            // Expected payload format:
-            // {
-            //   sensors: [
-            //     { pin: 'A0', type: 'temperature', raw_value: 512, processed_value: 25.3, name: 'Room Temp' },
-            //     ...
-            //   ]
-            // }
-
-            if (!payload.sensors || !Array.isArray(payload.sensors)) {
-                logger.warn(`Invalid telemetry payload from device ${deviceId}`);
-                return;
-            }
-
-            // Process telemetry through existing processor
-            await this.telemetryProcessor.processTelemetryData(deviceId, payload.sensors);
-
-            logger.debug(`Processed telemetry from device ${deviceId}: ${payload.sensors.length} sensors`);
-        } catch (error) {
-            logger.error(`Error handling telemetry message for device ${deviceId}:`, error);
-        }
+        await flushTelemetry();
     }
 
     /**
@@ -286,13 +342,14 @@ class MQTTService {
 
             await db.query(`
                 UPDATE devices
-                SET last_heartbeat = CURRENT_TIMESTAMP,
-                    status = 'online',
+                SET status = 'online',
                     firmware_version = COALESCE($1, firmware_version),
                     uptime_seconds = COALESCE($2, uptime_seconds)
                 WHERE id = $3
             `, [payload.firmware_version, payload.uptime, deviceId]);
 
+            livenessService.touch(deviceId);
+
             logger.debug(`Heartbeat received from device ${deviceId} via MQTT`);
         } catch (error) {
             logger.error(`Error handling heartbeat for device ${deviceId}:`, error);
@@ -340,11 +397,12 @@ class MQTTService {
 
             await db.query(`
                 UPDATE devices
-                SET status = $1,
-                    last_heartbeat = CURRENT_TIMESTAMP
+                SET status = $1
                 WHERE id = $2
             `, [payload.status || 'online', deviceId]);
 
+            livenessService.touch(deviceId);
+
             logger.debug(`Status update received from device ${deviceId} via MQTT: ${payload.status}`);
         } catch (error) {
             logger.error(`Error handling status message for device ${deviceId}:`, error);
@@ -411,10 +469,19 @@ class MQTTService {
         return {
             connected: this.isConnected,
             subscriptions: Array.from(this.subscriptions.keys()),
-            reconnectAttempts: this.reconnectAttempts
+            sharedGroup: this.sharedGroup,
+            reconnectAttempts: this.reconnectAttempts,
+            ingest: this.getIngestMetrics()
         };
     }
 
+    /**
+     * Queue depth, lag and batch sizes for the ingest pipeline
+     */
+    getIngestMetrics() {
+        return this.ingestQueue.getMetrics();
+    }
+
     /**
      * Shutdown MQTT service
      */
@@ -424,6 +491,9 @@ class MQTTService {
             this.client.end(true);
             this.isConnected = false;
         }
+
+        // Drain whatever was already accepted from the broker
+        await this.ingestQueue.shutdown();
     }
 }
 
@@ -0,0 +1,481 @@
+const db = require('../models/database');
+const emailService = require('./emailService');
+const smsService = require('./smsService');
+const telegramService = require('./telegramService');
+const logger = require('../utils/logger');
+
+const envNumber = (name, fallback) => {
+    const value = parseFloat(process.env[name]);
+    return Number.isFinite(value) && value > 0 ? value : fallback;
+};
+
+// Lines listed in a digest before it is cut off with "and N more"
+const DIGEST_MAX_LINES = 25;
+const WINDOW_KEY_PREFIX = 'notify:window:';
+
+/**
+ * Durable notification dispatch.
+ *
+ * Callers queue one row per channel and recipient in notification_queue
+ * and return; a worker claims due rows each tick (FOR UPDATE SKIP LOCKED,
+ * so several API processes can share the table) and sends them with a
+ * per-channel concurrency limit and token bucket. Failed sends are
+ * rescheduled with exponential backoff rather than retried in place.
+ *
+ * Storms are digested per recipient: a recipient gets at most one message
+ * per digest window. The first notification goes out at once; whatever
+ * arrives for the same recipient during the window is held until it closes
+ * and then sent as a single digest. Windows live in Redis (one key per
+ * channel and recipient, expiring with the window) so every process sharing
+ * the queue honours them; without Redis they are tracked in memory.
+ */
+class NotificationDispatchService {
+    constructor() {
+        this.channels = {
+            email: {
+                concurrency: envNumber('NOTIFY_EMAIL_CONCURRENCY', 4),
+                ratePerMinute: envNumber('NOTIFY_EMAIL_RATE_PER_MIN', 120)
+            },
+            sms: {
+                concurrency: envNumber('NOTIFY_SMS_CONCURRENCY', 2),
+                ratePerMinute: envNumber('NOTIFY_SMS_RATE_PER_MIN', 30)
+            },
+            telegram: {
+                concurrency: envNumber('NOTIFY_TELEGRAM_CONCURRENCY', 4),
+                ratePerMinute: envNumber('NOTIFY_TELEGRAM_RATE_PER_MIN', 600)
+            },
+            webhook: {
+                concurrency: envNumber('NOTIFY_WEBHOOK_CONCURRENCY', 8),
+                ratePerMinute: envNumber('NOTIFY_WEBHOOK_RATE_PER_MIN', 600)
+            }
+        };
+        this.tickMs = envNumber('NOTIFY_TICK_MS', 1000);
+        this.digestWindowMs = envNumber('NOTIFY_DIGEST_WINDOW_MS', 60 * 1000);
+        this.maxAttempts = envNumber('NOTIFY_MAX_ATTEMPTS', 5);
+        this.retryBaseMs = 30 * 1000;
+        this.retryMaxMs = 30 * 60 * 1000;
+        this.claimBatchSize = 200;
+        // Rows left in 'sending' this long belong to a process that died
+        this.staleClaimMs = 10 * 60 * 1000;
+
+        this.state = new Map(Object.keys(this.channels).map(channel => [channel, {
+            backlog: [],            // claimed recipient groups waiting for a slot
+            inFlight: 0,
+            tokens: this.channels[channel].concurrency,
+            refilledAt: Date.now()
+        }]));
+        this.lastSentAt = new Map();    // `${channel}:${recipient}` -> ms, without Redis
+        this.redis = null;
+        this.tickTimer = null;
+        this.ticking = false;
+        this.stats = { queued: 0, sent: 0, digests: 0, digestedRows: 0, retried: 0, failed: 0, deferred: 0 };
+    }
+
+    start({ redis } = {}) {
+        this.redis = redis || null;
+        if (this.tickTimer) return;
+        this.tickTimer = setInterval(() => this.tick(), this.tickMs);
+        this.tickTimer.unref?.();
+        logger.info('Notification dispatch started');
+    }
+
+    /**
+     * Stop claiming and wait (up to `timeoutMs`) for sends in flight.
+     * Claimed rows not yet sent are handed back.
+     */
+    async shutdown(timeoutMs = 10000) {
+        clearInterval(this.tickTimer);
+        this.tickTimer = null;
+
+        const released = [];
+        for (const state of this.state.values()) {
+            for (const group of state.backlog.splice(0)) {
+                released.push(...group.rows.map(row => row.id));
+            }
+        }
+        if (released.length > 0) {
+            await db.query(
+                "UPDATE notification_queue SET status = 'pending', claimed_at = NULL WHERE id = ANY($1::bigint[])",
+                [released]
+            ).catch(error => logger.error('Failed to release claimed notifications:', error));
+        }
+
+        const deadline = Date.now() + timeoutMs;
+        while ([...this.state.values()].some(state => state.inFlight > 0) && Date.now() < deadline) {
+            await new Promise(resolve => setTimeout(resolve, 100));
+        }
+    }
+
+    /**
+     * Queue notifications. Each item is { channel, recipient, summary,
+     * message, alertId? }: `summary` is the one-line form used in digests,
+     * `message` the channel's full message ({ subject, html } for email,
+     * { text } for sms and telegram, { body, type?, headers? } for webhook).
+     */
+    async enqueue(items, { attempts = 0, delayMs = 0 } = {}) {
+        const valid = items.filter(item => this.channels[item.channel] && item.recipient);
+        if (valid.length === 0) {
+            return 0;
+        }
+
+        await db.query(`
+            INSERT INTO notification_queue (channel, recipient, alert_id, summary, message, attempts, next_attempt_at)
+            SELECT c, r, a, s, m, $6, NOW() + make_interval(secs => $7)
+            FROM UNNEST($1::varchar[], $2::varchar[], $3::integer[], $4::text[], $5::jsonb[]) AS t(c, r, a, s, m)
+        `, [
+            valid.map(item => item.channel),
+            valid.map(item => String(item.recipient)),
+            valid.map(item => item.alertId ?? null),
+            valid.map(item => item.summary),
+            valid.map(item => JSON.stringify(item.message)),
+            attempts,
+            delayMs / 1000
+        ]);
+
+        this.stats.queued += valid.length;
+        return valid.length;
+    }
+
+    async tick() {
+        if (this.ticking) return;
+        this.ticking = true;
+        try {
+            for (const [channel, state] of this.state) {
+                if (state.backlog.length === 0) {
+                    await this.claim(channel);
+                }
+                this.pump(channel);
+            }
+        } catch (error) {
+            logger.error('Notification dispatch tick failed:', error);
+        } finally {
+            this.ticking = false;
+        }
+    }
+
+    /**
+     * Claim due rows for a channel and turn them into per-recipient groups.
+     * Recipients still inside their digest window are handed back with the
+     * window's end as their next attempt.
+     */
+    async claim(channel) {
+        const result = await db.query(`
+            UPDATE notification_queue
+            SET status = 'sending', claimed_at = NOW()
+            WHERE id IN (
+                SELECT id FROM notification_queue
+                WHERE channel = $1
+                  AND ((status = 'pending' AND next_attempt_at <= NOW())
+                       OR (status = 'sending' AND claimed_at < NOW() - make_interval(secs => $2)))
+                ORDER BY id
+                LIMIT $3
+                FOR UPDATE SKIP LOCKED
+            )
+            RETURNING id, channel, recipient, alert_id, summary, message, attempts
+        `, [channel, this.staleClaimMs / 1000, this.claimBatchSize]);
+
+        if (result.rows.length === 0) {
+            return;
+        }
+
+        const groups = new Map();
+        for (const row of result.rows.sort((a, b) => Number(a.id) - Number(b.id))) {
+            if (!groups.has(row.recipient)) {
+                groups.set(row.recipient, { channel, recipient: row.recipient, rows: [] });
+            }
+            groups.get(row.recipient).rows.push(row);
+        }
+
+        const now = Date.now();
+        const state = this.state.get(channel);
+        for (const group of groups.values()) {
+            const waitMs = await this.openWindow(channel, group.recipient, now);
+            if (waitMs > 0) {
+                await this.defer(group.rows, now + waitMs);
+                this.stats.deferred += group.rows.length;
+            } else {
+                state.backlog.push(group);
+            }
+        }
+    }
+
+    /**
+     * Start the recipient's digest window if none is open. Returns 0 when
+     * this process now owns the window (and may send), otherwise the ms
+     * until the open one closes. SET NX makes the check and the claim one
+     * step across processes.
+     */
+    async openWindow(channel, recipient, now = Date.now()) {
+        const key = `${channel}:${recipient}`;
+
+        if (this.redis && this.redis.status === 'ready') {
+            try {
+                const opened = await this.redis.set(`${WINDOW_KEY_PREFIX}${key}`, now, 'PX', this.digestWindowMs, 'NX');
+                if (opened) {
+                    return 0;
+                }
+                // -2: expired since the SET; try again next tick
+                const remaining = await this.redis.pttl(`${WINDOW_KEY_PREFIX}${key}`);
+                return remaining > 0 ? remaining : 1;
+            } catch (error) {
+                logger.warn(`Digest window lookup failed, using local state: ${error.message}`);
+            }
+        }
+
+        for (const [entry, sentAt] of this.lastSentAt) {
+            if (sentAt + this.digestWindowMs <= now) {
+                this.lastSentAt.delete(entry);
+            }
+        }
+        const windowEndsAt = (this.lastSentAt.get(key) || 0) + this.digestWindowMs;
+        if (windowEndsAt > now) {
+            return windowEndsAt - now;
+        }
+        this.lastSentAt.set(key, now);
+        return 0;
+    }
+
+    // Restart an owned window when its message actually goes out
+    restartWindow(channel, recipient) {
+        const key = `${channel}:${recipient}`;
+        if (this.redis && this.redis.status === 'ready') {
+            this.redis.set(`${WINDOW_KEY_PREFIX}${key}`, Date.now(), 'PX', this.digestWindowMs).catch((error) => {
+                logger.warn(`Digest window update failed: ${error.message}`);
+            });
+        } else {
+            this.lastSentAt.set(key, Date.now());
+        }
+    }
+
+    async defer(rows, untilMs) {
+        await db.query(`
+            UPDATE notification_queue
+            SET status = 'pending', claimed_at = NULL, next_attempt_at = $2
+            WHERE id = ANY($1::bigint[])
+        `, [rows.map(row => row.id), new Date(untilMs)]);
+    }
+
+    refill(channel, state, now = Date.now()) {
+        const { ratePerMinute, concurrency } = this.channels[channel];
+        const burst = Math.max(1, concurrency);
+        state.tokens = Math.min(burst, state.tokens + ((now - state.refilledAt) / 60000) * ratePerMinute);
+        state.refilledAt = now;
+    }
+
+    /**
+     * Start as many groups as the channel's concurrency and rate allow
+     */
+    pump(channel) {
+        const state = this.state.get(channel);
+        this.refill(channel, state);
+
+        while (state.backlog.length > 0 && state.inFlight < this.channels[channel].concurrency && state.tokens >= 1) {
+            const group = state.backlog.shift();
+            state.tokens -= 1;
+            state.inFlight++;
+            // The window runs from when the message goes out, not when it lands
+            this.restartWindow(channel, group.recipient);
+
+            this.sendGroup(group)
+                .catch(error => logger.error(`Notification dispatch (${channel}) failed:`, error))
+                .finally(() => {
+                    state.inFlight--;
+                    this.pump(channel);
+                });
+        }
+    }
+
+    async sendGroup(group) {
+        const { channel, recipient, rows } = group;
+        if (rows.length > 1 && !this.canDigest(channel, rows)) {
+            // Still one claim per window, but each message goes out as queued
+            for (const row of rows) {
+                await this.sendGroup({ channel, recipient, rows: [row] });
+            }
+            return;
+        }
+
+        const message = rows.length === 1
+            ? rows[0].message
+            : this.buildDigest(channel, rows);
+
+        let error = null;
+        try {
+            const delivered = await this.deliver(channel, recipient, message, rows);
+            if (!delivered) {
+                error = 'Provider did not accept the message';
+            }
+        } catch (sendError) {
+            error = sendError.message;
+        }
+
+        const ids = rows.map(row => row.id);
+        if (error === null) {
+            await db.query(`
+                UPDATE notification_queue
+                SET status = 'sent', sent_at = NOW(), digest_size = $2, last_error = NULL
+                WHERE id = ANY($1::bigint[])
+            `, [ids, rows.length]);
+            this.stats.sent++;
+            if (rows.length > 1) {
+                this.stats.digests++;
+                this.stats.digestedRows += rows.length;
+                logger.info(`Sent ${channel} digest of ${rows.length} notifications`);
+            }
+            return;
+        }
+
+        // Each row keeps its own attempt count; the next claim regroups them
+        const attempts = Math.max(...rows.map(row => row.attempts)) + 1;
+        if (attempts >= this.maxAttempts) {
+            await db.query(`
+                UPDATE notification_queue
+                SET status = 'failed', attempts = attempts + 1, last_error = $2, claimed_at = NULL
+                WHERE id = ANY($1::bigint[])
+            `, [ids, error]);
+            this.stats.failed += rows.length;
+            logger.error(`Giving up on ${channel} notification after ${attempts} attempts: ${error}`);
+            return;
+        }
+
+        const backoffMs = Math.min(this.retryMaxMs, this.retryBaseMs * 2 ** (attempts - 1));
+        const jitterMs = Math.floor(Math.random() * backoffMs * 0.2);
+        await db.query(`
+            UPDATE notification_queue
+            SET status = 'pending', attempts = attempts + 1, last_error = $2, claimed_at = NULL,
+                next_attempt_at = NOW() + make_interval(secs => $3)
+            WHERE id = ANY($1::bigint[])
+        `, [ids, error, (backoffMs + jitterMs) / 1000]);
+        this.stats.retried += rows.length;
+        logger.warn(`${channel} notification failed (attempt ${attempts}), retrying in ${Math.round(backoffMs / 1000)}s: ${error}`);
+    }
+
+    /**
+     * One send through the channel's provider. Returns whether the provider
+     * accepted the message.
+     */
+    async deliver(channel, recipient, message, rows) {
+        switch (channel) {
+            case 'email':
+                return emailService.sendEmail(recipient, message.subject, message.html);
+
+            case 'sms':
+                return smsService.sendSMS(recipient, message.text);
+
+            case 'telegram': {
+                const success = await telegramService.sendMessage(recipient, message.text);
+                await db.query(`
+                    INSERT INTO telegram_notifications (user_id, chat_id, message_text, notification_type, alert_id, device_id, success)
+                    VALUES (
+                        (SELECT id FROM users WHERE telegram_chat_id = $1 LIMIT 1),
+                        $1, $2, $3, $4, $5, $6
+                    )
+                `, [
+                    recipient,
+                    message.text,
+                    rows.length > 1 ? 'digest' : (message.notification_type || 'alert'),
+                    rows.length > 1 ? null : rows[0].alert_id,
+                    rows.length > 1 ? null : (message.device_id || null),
+                    success
+                ]).catch(error => logger.warn('Failed to log Telegram notification:', error.message));
+                return success;
+            }
+
+            case 'webhook': {
+                // Required here: webhook retries are queued through this service
+                const webhookService = require('./webhookNotificationService');
+                const result = await webhookService.sendWebhook(
+                    recipient, message.body, message.type || 'custom', message.headers || {}, { queueRetry: false }
+                );
+                return result.success;
+            }
+
+            default:
+                throw new Error(`Unknown notification channel: ${channel}`);
+        }
+    }
+
+    /**
+     * Slack, Discord, Teams and Telegram webhooks only accept their own
+     * payload shapes, so only custom webhooks get the alert.digest body
+     */
+    canDigest(channel, rows) {
+        return channel !== 'webhook' || rows.every(row => (row.message.type || 'custom') === 'custom');
+    }
+
+    /**
+     * One message standing in for several queued ones, in the channel's shape
+     */
+    buildDigest(channel, rows) {
+        const lines = rows.slice(0, DIGEST_MAX_LINES).map(row => row.summary);
+        const more = rows.length - lines.length;
+        const title = `${rows.length} alert notifications`;
+        const footer = more > 0 ? `and ${more} more` : null;
+
+        switch (channel) {
+            case 'email':
+                return {
+                    subject: `[DIGEST] ${title}`,
+                    html: `
+                        <div style="font-family: Arial, sans-serif; max-width: 600px;">
+                            <h2 style="margin-top: 0;">${title}</h2>
+                            <p style="color: #6b7280;">Several alerts fired within ${Math.round(this.digestWindowMs / 1000)} seconds and were combined into this message.</p>
+                            <ul>${lines.map(line => `<li>${line}</li>`).join('')}</ul>
+                            ${footer ? `<p>${footer}</p>` : ''}
+                        </div>
+                    `
+                };
+
+            case 'sms': {
+                const text = `${title}: ${lines.join('; ')}${footer ? `; ${footer}` : ''}`;
+                return { text: text.length > 600 ? `${text.substring(0, 597)}...` : text };
+            }
+
+            case 'telegram':
+                return {
+                    text: [`📋 <b>${title}</b>`, '', ...lines.map(line => `• ${line}`), ...(footer ? [footer] : [])].join('\n')
+                };
+
+            case 'webhook':
+                return {
+                    type: rows[0].message.type || 'custom',
+                    headers: rows[0].message.headers || {},
+                    body: {
+                        event: 'alert.digest',
+                        type: rows[0].message.type || 'custom',
+                        timestamp: new Date().toISOString(),
+                        count: rows.length,
+                        data: rows.map(row => row.message.body)
+                    }
+                };
+
+            default:
+                throw new Error(`Unknown notification channel: ${channel}`);
+        }
+    }
+
+    /**
+     * Drop delivered and abandoned rows older than `days`
+     */
+    async cleanup(days = 7) {
+        const result = await db.query(`
+            DELETE FROM notification_queue
+            WHERE status IN ('sent', 'failed')
+              AND created_at < NOW() - make_interval(days => $1)
+        `, [days]);
+        return result.rowCount || 0;
+    }
+
+    getStatus() {
+        const channels = {};
+        for (const [channel, state] of this.state) {
+            channels[channel] = {
+                backlog: state.backlog.reduce((sum, group) => sum + group.rows.length, 0),
+                inFlight: state.inFlight
+            };
+        }
+        return { running: this.tickTimer !== null, channels, ...this.stats };
+    }
+}
+
+module.exports = new NotificationDispatchService();
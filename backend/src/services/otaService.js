@@ -1,12 +1,28 @@
 const db = require('../models/database');
 const crypto = require('crypto');
 const fs = require('fs').promises;
+const fsSync = require('fs');
 const path = require('path');
+const { Readable } = require('stream');
 const logger = require('../utils/logger');
 
+// Markers compiled into the firmware around the reserved config block
+const CONFIG_MARKER = Buffer.from('__CONFIG_START__', 'utf8');
+const CONFIG_END_MARKER = Buffer.from('__CONFIG_END__', 'utf8');
+const MARKER_SCAN_CHUNK_SIZE = 64 * 1024;
+
+// A resumable download issues many Range requests; reuse the config block
+const CONFIG_BLOCK_TTL_MS = 60 * 1000;
+const DOWNLOAD_TOKEN_TTL_SECONDS = 24 * 60 * 60;
+const IMAGE_DIGEST_CACHE_SIZE = 1000;
+
 class OTAService {
     constructor() {
         this.firmwareDirectory = process.env.FIRMWARE_DIR || './firmware';
+        this.configRegionCache = new Map();
+        this.configBlockCache = new Map();
+        this.imageDigestCache = new Map();  // etag -> { checksum, signature }
+        this.signingKey = undefined;
         this.ensureFirmwareDirectory();
     }
 
@@ -23,6 +39,7 @@ class OTAService {
             // Generate checksum
             const fileBuffer = await fs.readFile(file.path);
             const checksum = crypto.createHash('sha256').update(fileBuffer).digest('hex');
+            const signature = this.signFirmware(fileBuffer);
 
             // Store firmware file
             const fileName = `firmware_${deviceType}_${version}.bin`;
@@ -31,14 +48,15 @@ class OTAService {
 
             // Store in database
             const result = await db.query(`
-                INSERT INTO firmware_versions (version, device_type, binary_url, checksum, file_size, release_notes, is_stable, is_active)
-                VALUES ($1, $2, $3, $4, $5, $6, false, true)
+                INSERT INTO firmware_versions (version, device_type, binary_url, checksum, signature, file_size, release_notes, is_stable, is_active)
+                VALUES ($1, $2, $3, $4, $5, $6, $7, false, true)
                 RETURNING id
             `, [
                 version,
                 deviceType,
                 `/api/firmware/download/${fileName}`,
                 checksum,
+                signature,
                 fileBuffer.length,
                 releaseNotes
             ]);
@@ -53,6 +71,7 @@ class OTAService {
                 version,
                 deviceType,
                 checksum,
+                signed: signature !== null,
                 fileSize: fileBuffer.length
             };
 
@@ -271,108 +290,358 @@ class OTAService {
 
     async generateFirmwareBinary(deviceId, baseVersion) {
         /**
-         * Generate device-specific firmware binary with injected configuration
+         * Describe the device-specific firmware for an OTA update
          *
-         * This implementation uses a config injection approach:
-         * 1. Get device-specific configuration
-         * 2. Get protocol settings (HTTP/MQTT)
-         * 3. Inject configuration into firmware binary at reserved memory location
-         * 4. Return path to customized binary
+         * Nothing is written to disk: the download route streams the base
+         * image and splices this device's config block in at the cached
+         * marker offset (see openDeviceFirmware / createFirmwareStream).
          */
 
         try {
-            // Fetch device configuration with all related data
-            const deviceResult = await db.query(`
-                SELECT
-                    d.*,
-                    dc.*,
-                    l.timezone,
-                    l.name as location_name,
-                    ps.protocol,
-                    ps.mqtt_broker_host,
-                    ps.mqtt_broker_port,
-                    ps.mqtt_username,
-                    ps.mqtt_password,
-                    ps.mqtt_topic_prefix,
-                    ps.mqtt_qos,
-                    ps.http_endpoint,
-                    ps.heartbeat_interval as protocol_heartbeat_interval
-                FROM devices d
-                LEFT JOIN device_configs dc ON d.id = dc.device_id
-                LEFT JOIN locations l ON d.location_id = l.id
-                LEFT JOIN protocol_settings ps ON d.id = ps.device_id
-                WHERE d.id = $1
-            `, [deviceId]);
+            const image = await this.openDeviceFirmware(deviceId, baseVersion);
+            const { checksum, signature } = await this.getImageDigest(image);
 
-            if (deviceResult.rows.length === 0) {
-                throw new Error(`Device ${deviceId} not found`);
+            return {
+                binaryPath: image.firmwarePath,
+                binaryUrl: this.getDeviceFirmwareUrl(deviceId, baseVersion),
+                isCustomized: image.region !== null,
+                configData: image.configData,
+                checksum,
+                signature,
+                fileSize: image.size
+            };
+
+        } catch (error) {
+            if (error.code === 'ENOENT') {
+                logger.warn(`Base firmware ${baseVersion} not found for device ${deviceId}`);
             }
+            logger.error(`Error generating firmware for device ${deviceId}:`, error);
+            throw error;
+        }
+    }
 
-            const deviceConfig = deviceResult.rows[0];
+    async loadDeviceConfig(deviceId) {
+        // Fetch device configuration with all related data
+        const deviceResult = await db.query(`
+            SELECT
+                d.*,
+                dc.*,
+                l.timezone,
+                l.name as location_name,
+                ps.protocol,
+                ps.mqtt_broker_host,
+                ps.mqtt_broker_port,
+                ps.mqtt_username,
+                ps.mqtt_password,
+                ps.mqtt_topic_prefix,
+                ps.mqtt_qos,
+                ps.http_endpoint,
+                ps.heartbeat_interval as protocol_heartbeat_interval
+            FROM devices d
+            LEFT JOIN device_configs dc ON d.id = dc.device_id
+            LEFT JOIN locations l ON d.location_id = l.id
+            LEFT JOIN protocol_settings ps ON d.id = ps.device_id
+            WHERE d.id = $1
+        `, [deviceId]);
 
-            // Get device sensors
-            const sensorsResult = await db.query(`
-                SELECT ds.*, st.name as sensor_type, st.unit
-                FROM device_sensors ds
-                JOIN sensor_types st ON ds.sensor_type_id = st.id
-                WHERE ds.device_id = $1 AND ds.enabled = true
-                ORDER BY ds.pin
-            `, [deviceId]);
+        if (deviceResult.rows.length === 0) {
+            throw new Error(`Device ${deviceId} not found`);
+        }
 
-            deviceConfig.sensors = sensorsResult.rows;
+        const deviceConfig = deviceResult.rows[0];
 
-            // Generate device configuration blob
-            const configData = this.generateDeviceConfigData(deviceConfig);
+        // Get device sensors
+        const sensorsResult = await db.query(`
+            SELECT ds.*, st.name as sensor_type, st.unit
+            FROM device_sensors ds
+            JOIN sensor_types st ON ds.sensor_type_id = st.id
+            WHERE ds.device_id = $1 AND ds.enabled = true
+            ORDER BY ds.pin
+        `, [deviceId]);
 
-            // Get base firmware path
-            const baseFirmwarePath = path.join(
-                this.firmwareDirectory,
-                `firmware_esp8266_${baseVersion}.bin`
-            );
+        deviceConfig.sensors = sensorsResult.rows;
+        return deviceConfig;
+    }
+
+    /**
+     * Resolve everything needed to serve a device-specific image: the base
+     * file on disk, the cached config region and this device's config block.
+     * Throws ENOENT if the base image does not exist.
+     */
+    async openDeviceFirmware(deviceId, baseVersion) {
+        const cacheKey = `${deviceId}:${baseVersion}`;
+        const cached = this.configBlockCache.get(cacheKey);
+
+        let deviceType;
+        let configData;
+        if (cached && cached.expiresAt > Date.now()) {
+            ({ deviceType, configData } = cached);
+        } else {
+            const deviceConfig = await this.loadDeviceConfig(deviceId);
+            deviceType = (deviceConfig.device_type || 'esp8266').toLowerCase();
+            configData = this.generateDeviceConfigData(deviceConfig);
+        }
+
+        const firmwarePath = path.join(this.firmwareDirectory, `firmware_${deviceType}_${baseVersion}.bin`);
+        const { size, mtimeMs, region } = await this.getConfigRegion(firmwarePath);
+
+        let configBlock = null;
+        if (region) {
+            configBlock = cached && cached.expiresAt > Date.now() && cached.mtimeMs === mtimeMs
+                ? cached.configBlock
+                : this.buildConfigBlock(configData, region.end - region.start);
+        } else {
+            logger.warn('Config markers not found in firmware, serving unmodified binary');
+        }
+
+        this.configBlockCache.set(cacheKey, {
+            deviceType,
+            configData,
+            configBlock,
+            mtimeMs,
+            expiresAt: cached && cached.expiresAt > Date.now() ? cached.expiresAt : Date.now() + CONFIG_BLOCK_TTL_MS
+        });
+        this.pruneConfigBlockCache();
+
+        const etag = crypto.createHash('sha1')
+            .update(`${firmwarePath}:${size}:${mtimeMs}:`)
+            .update(configBlock || Buffer.alloc(0))
+            .digest('hex');
+
+        return {
+            firmwarePath,
+            size,
+            region,
+            configBlock,
+            configData,
+            version: baseVersion,
+            etag: `"${etag}"`
+        };
+    }
 
-            // Check if base firmware exists
-            try {
-                await fs.access(baseFirmwarePath);
-            } catch (error) {
-                logger.warn(`Base firmware ${baseVersion} not found, using generic firmware`);
-                // Return generic firmware path - will be caught by caller
-                return {
-                    binaryPath: baseFirmwarePath,
-                    isCustomized: false,
-                    configData: configData
-                };
+    pruneConfigBlockCache() {
+        const now = Date.now();
+        for (const [key, entry] of this.configBlockCache) {
+            if (entry.expiresAt <= now) {
+                this.configBlockCache.delete(key);
             }
+        }
+    }
+
+    /**
+     * Locate the reserved config region of a base image. The scan streams the
+     * file once and the result is cached per path until the file changes, so
+     * every device downloading the same version reuses the offsets.
+     */
+    async getConfigRegion(firmwarePath) {
+        const stats = await fs.stat(firmwarePath);
+        const cached = this.configRegionCache.get(firmwarePath);
+
+        if (cached && cached.size === stats.size && cached.mtimeMs === stats.mtimeMs) {
+            return cached;
+        }
+
+        const region = await this.scanForConfigRegion(firmwarePath);
+        const entry = { size: stats.size, mtimeMs: stats.mtimeMs, region };
+        this.configRegionCache.set(firmwarePath, entry);
 
-            // Create customized firmware filename
-            const customFirmwareName = `firmware_${deviceId}_${baseVersion}_${Date.now()}.bin`;
-            const customFirmwarePath = path.join(this.firmwareDirectory, customFirmwareName);
+        if (region) {
+            logger.info(`Config region in ${path.basename(firmwarePath)}: ${region.start}-${region.end} (${region.end - region.start} bytes)`);
+        }
+
+        return entry;
+    }
 
-            // Read base firmware
-            const baseFirmware = await fs.readFile(baseFirmwarePath);
+    async scanForConfigRegion(firmwarePath) {
+        const stream = fsSync.createReadStream(firmwarePath, { highWaterMark: MARKER_SCAN_CHUNK_SIZE });
+        const overlap = Math.max(CONFIG_MARKER.length, CONFIG_END_MARKER.length) - 1;
 
-            // Inject configuration into firmware binary
-            const customFirmware = await this.injectConfigIntoFirmware(
-                baseFirmware,
-                configData
+        let carry = Buffer.alloc(0);
+        let carryOffset = 0;
+        let markerOffset = -1;
+
+        for await (const chunk of stream) {
+            // Keep the tail of the previous chunk so markers split across reads are found
+            const window = carry.length > 0 ? Buffer.concat([carry, chunk]) : chunk;
+            const windowOffset = carryOffset;
+
+            if (markerOffset === -1) {
+                const index = window.indexOf(CONFIG_MARKER);
+                if (index !== -1) {
+                    markerOffset = windowOffset + index;
+                }
+            }
+
+            if (markerOffset !== -1) {
+                const searchFrom = Math.max(0, markerOffset + CONFIG_MARKER.length - windowOffset);
+                const endIndex = window.indexOf(CONFIG_END_MARKER, searchFrom);
+                if (endIndex !== -1) {
+                    return {
+                        start: markerOffset + CONFIG_MARKER.length,
+                        end: windowOffset + endIndex
+                    };
+                }
+            }
+
+            carry = window.subarray(Math.max(0, window.length - overlap));
+            carryOffset = windowOffset + window.length - carry.length;
+        }
+
+        return null;
+    }
+
+    buildConfigBlock(configData, configSpace) {
+        const configBuffer = Buffer.from(JSON.stringify(configData), 'utf8');
+
+        if (configBuffer.length > configSpace) {
+            throw new Error(
+                `Configuration too large: ${configBuffer.length} bytes ` +
+                `(max ${configSpace} bytes). Reduce sensor count or simplify config.`
             );
+        }
 
-            // Write customized firmware
-            await fs.writeFile(customFirmwarePath, customFirmware);
+        // Zero padding up to the end marker
+        const block = Buffer.alloc(configSpace);
+        configBuffer.copy(block);
+        return block;
+    }
 
-            logger.info(`Generated customized firmware for device ${deviceId}: ${customFirmwareName}`);
+    /**
+     * Stream bytes [start, end] (inclusive) of a device image: the base file
+     * is read from disk and the config block is spliced in over the reserved
+     * region, so no full-size buffer is ever allocated.
+     */
+    createFirmwareStream(image, start = 0, end = image.size - 1) {
+        const { firmwarePath, region, configBlock } = image;
+        const segments = region
+            ? [
+                { from: 0, to: region.start },
+                { from: region.start, to: region.end, block: configBlock },
+                { from: region.end, to: image.size }
+            ]
+            : [{ from: 0, to: image.size }];
+
+        async function* chunks() {
+            for (const segment of segments) {
+                const from = Math.max(start, segment.from);
+                const to = Math.min(end + 1, segment.to);
+                if (from >= to) {
+                    continue;
+                }
+
+                if (segment.block) {
+                    yield segment.block.subarray(from - segment.from, to - segment.from);
+                } else {
+                    yield* fsSync.createReadStream(firmwarePath, { start: from, end: to - 1 });
+                }
+            }
+        }
 
-            return {
-                binaryPath: customFirmwarePath,
-                binaryUrl: `/api/firmware/download/${customFirmwareName}`,
-                isCustomized: true,
-                configData: configData,
-                checksum: crypto.createHash('sha256').update(customFirmware).digest('hex'),
-                fileSize: customFirmware.length
-            };
+        return Readable.from(chunks(), { objectMode: false });
+    }
+
+    /**
+     * SHA-256 and signature of exactly the bytes a device will download, so
+     * the firmware's checks pass for its own image rather than the base one.
+     * Both come from one pass over the stream and are cached by etag, which
+     * changes whenever the base file or the config block does.
+     */
+    async getImageDigest(image) {
+        const cached = this.imageDigestCache.get(image.etag);
+        if (cached) {
+            return cached;
+        }
+
+        const key = this.getSigningKey();
+        const hash = crypto.createHash('sha256');
+        const signer = key ? crypto.createSign('sha256') : null;
+        for await (const chunk of this.createFirmwareStream(image)) {
+            hash.update(chunk);
+            if (signer) {
+                signer.update(chunk);
+            }
+        }
+
+        const digest = {
+            checksum: hash.digest('hex'),
+            signature: signer ? signer.sign(key, 'base64') : null
+        };
+
+        this.imageDigestCache.set(image.etag, digest);
+        if (this.imageDigestCache.size > IMAGE_DIGEST_CACHE_SIZE) {
+            this.imageDigestCache.delete(this.imageDigestCache.keys().next().value);
+        }
+        return digest;
+    }
+
+    /**
+     * Firmware signing key: PEM (EC or RSA) in OTA_SIGNING_KEY, or a file
+     * named by OTA_SIGNING_KEY_FILE. Null when signing is not configured.
+     */
+    getSigningKey() {
+        if (this.signingKey === undefined) {
+            let pem = process.env.OTA_SIGNING_KEY;
+            if (!pem && process.env.OTA_SIGNING_KEY_FILE) {
+                pem = fsSync.readFileSync(process.env.OTA_SIGNING_KEY_FILE, 'utf8');
+            }
+            // Single-line env values carry escaped newlines
+            this.signingKey = pem ? crypto.createPrivateKey(pem.replace(/\\n/g, '\n')) : null;
+        }
+        return this.signingKey;
+    }
+
+    // SPKI PEM of the signing key, baked into generated device configs
+    getSigningPublicKey() {
+        const key = this.getSigningKey();
+        return key ? crypto.createPublicKey(key).export({ type: 'spki', format: 'pem' }) : null;
+    }
+
+    /**
+     * Base64 DER signature over the SHA-256 of a firmware image (ECDSA or
+     * PKCS#1 v1.5), as firmware checks it with mbedtls_pk_verify. Null when
+     * no signing key is configured.
+     */
+    signFirmware(data) {
+        const key = this.getSigningKey();
+        if (!key) {
+            return null;
+        }
+        return crypto.sign('sha256', data, key).toString('base64');
+    }
+
+    getDeviceFirmwareUrl(deviceId, version) {
+        const token = this.createDownloadToken(deviceId, version);
+        return `/api/firmware/download/device/${encodeURIComponent(deviceId)}/${encodeURIComponent(version)}?token=${token}`;
+    }
+
+    signDownload(deviceId, version, expires) {
+        const secret = process.env.OTA_DOWNLOAD_SECRET || process.env.JWT_SECRET;
+        if (!secret) {
+            throw new Error('OTA_DOWNLOAD_SECRET or JWT_SECRET must be set to sign firmware downloads');
+        }
+        return crypto.createHmac('sha256', secret).update(`${deviceId}:${version}:${expires}`).digest('hex');
+    }
 
+    createDownloadToken(deviceId, version, ttlSeconds = DOWNLOAD_TOKEN_TTL_SECONDS) {
+        const expires = Math.floor(Date.now() / 1000) + ttlSeconds;
+        return `${expires}.${this.signDownload(deviceId, version, expires)}`;
+    }
+
+    verifyDownloadToken(deviceId, version, token) {
+        const [expiresPart, signature] = String(token || '').split('.');
+        const expires = parseInt(expiresPart, 10);
+
+        if (!signature || !Number.isFinite(expires) || expires < Date.now() / 1000) {
+            return false;
+        }
+
+        try {
+            const expected = Buffer.from(this.signDownload(deviceId, version, expires), 'hex');
+            const provided = Buffer.from(signature, 'hex');
+            return provided.length === expected.length && crypto.timingSafeEqual(provided, expected);
         } catch (error) {
-            logger.error(`Error generating firmware for device ${deviceId}:`, error);
-            throw error;
+            logger.error('Firmware download token verification failed:', error);
+            return false;
         }
     }
 
@@ -445,27 +714,17 @@ class OTAService {
 
     async injectConfigIntoFirmware(baseFirmware, configData) {
         /**
-         * Inject configuration into firmware binary
+         * Inject configuration into an in-memory firmware image
          *
-         * This uses a marker-based injection strategy:
-         * 1. Look for a magic marker in the firmware binary
-         * 2. Replace the marker section with actual configuration
-         * 3. Pad/truncate to fit the reserved space
-         *
-         * Note: The firmware must be compiled with a CONFIG_MARKER section
+         * Uses the same marker layout as the streaming download path; kept for
+         * callers that already hold the image. The result is a single copy of
+         * the base image with the config block written in place.
          */
 
-        const configJson = JSON.stringify(configData);
-        const configBuffer = Buffer.from(configJson, 'utf8');
-
-        // Magic marker that should exist in the compiled firmware
-        // This needs to be added to the Arduino firmware code as a placeholder
-        const MAGIC_MARKER = Buffer.from('__CONFIG_START__', 'utf8');
-        const MAGIC_END = Buffer.from('__CONFIG_END__', 'utf8');
-
-        // Find the magic marker in firmware
-        const markerIndex = baseFirmware.indexOf(MAGIC_MARKER);
-        const endMarkerIndex = baseFirmware.indexOf(MAGIC_END);
+        const markerIndex = baseFirmware.indexOf(CONFIG_MARKER);
+        const endMarkerIndex = markerIndex === -1
+            ? -1
+            : baseFirmware.indexOf(CONFIG_END_MARKER, markerIndex + CONFIG_MARKER.length);
 
         if (markerIndex === -1 || endMarkerIndex === -1) {
             logger.warn('Config markers not found in firmware, returning unmodified binary');
@@ -476,44 +735,13 @@ class OTAService {
             return baseFirmware;
         }
 
-        // Calculate available config space
-        const configSpace = endMarkerIndex - markerIndex - MAGIC_MARKER.length;
+        const configStart = markerIndex + CONFIG_MARKER.length;
+        const configBlock = this.buildConfigBlock(configData, endMarkerIndex - configStart);
 
-        if (configBuffer.length > configSpace) {
-            throw new Error(
-                `Configuration too large: ${configBuffer.length} bytes ` +
-                `(max ${configSpace} bytes). Reduce sensor count or simplify config.`
-            );
-        }
-
-        // Create new firmware buffer with injected config
-        const newFirmware = Buffer.alloc(baseFirmware.length);
-
-        // Copy everything before marker
-        baseFirmware.copy(newFirmware, 0, 0, markerIndex);
-
-        // Write magic marker
-        MAGIC_MARKER.copy(newFirmware, markerIndex);
-
-        // Write configuration
-        configBuffer.copy(newFirmware, markerIndex + MAGIC_MARKER.length);
-
-        // Pad remaining space with zeros
-        const paddingStart = markerIndex + MAGIC_MARKER.length + configBuffer.length;
-        const paddingEnd = endMarkerIndex;
-        newFirmware.fill(0, paddingStart, paddingEnd);
-
-        // Write end marker
-        MAGIC_END.copy(newFirmware, endMarkerIndex);
-
-        // Copy everything after end marker
-        baseFirmware.copy(
-            newFirmware,
-            endMarkerIndex + MAGIC_END.length,
-            endMarkerIndex + MAGIC_END.length
-        );
+        const newFirmware = Buffer.from(baseFirmware);
+        configBlock.copy(newFirmware, configStart);
 
-        logger.info(`Injected ${configBuffer.length} bytes of configuration into firmware`);
+        logger.info(`Injected ${configBlock.length} bytes of configuration into firmware`);
 
         return newFirmware;
     }
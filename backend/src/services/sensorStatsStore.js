@@ -0,0 +1,291 @@
+const db = require('../models/database');
+const logger = require('../utils/logger');
+
+const HOURS_PER_WEEK = 168;
+
+// EWMA smoothing roughly equivalent to the sample windows the history
+// queries used (last ~500 readings overall, ~100 per seasonal slot)
+const BASELINE_ALPHA = 2 / (500 + 1);
+const SEASONAL_ALPHA = 2 / (100 + 1);
+
+const CHECKPOINT_INTERVAL_MS = 60 * 1000;
+const CHECKPOINT_TTL_SECONDS = 7 * 24 * 60 * 60;
+const REBUILD_WINDOW_DAYS = 30;
+
+/**
+ * Incremental per-sensor statistics for anomaly rules.
+ *
+ * Each device sensor keeps an EWMA mean/variance, 168 hour-of-week seasonal
+ * baselines and exponentially weighted least-squares trend regressors. State
+ * is updated once per reading, checkpointed to Redis, and rebuilt from the
+ * hourly rollup tier when no checkpoint exists, so rule evaluation never has
+ * to scan raw telemetry.
+ */
+class SensorStatsStore {
+    constructor(redis) {
+        this.redis = redis;
+        this.states = new Map();
+        this.loading = new Map();
+        this.dirty = new Set();
+        this.checkpointTimer = null;
+    }
+
+    static emptyMoments() {
+        return { count: 0, mean: 0, variance: 0 };
+    }
+
+    static emptyState() {
+        return {
+            baseline: SensorStatsStore.emptyMoments(),
+            seasonal: Array.from({ length: HOURS_PER_WEEK }, () => SensorStatsStore.emptyMoments()),
+            trends: {},
+            lastValue: null,
+            lastTimestamp: null
+        };
+    }
+
+    static hourOfWeek(timestamp) {
+        const date = new Date(timestamp);
+        return date.getDay() * 24 + date.getHours();
+    }
+
+    /**
+     * Exponentially weighted mean/variance update. Early samples use 1/n so
+     * the first readings give a plain average instead of being swamped by
+     * the zero-initialised state.
+     */
+    static updateMoments(moments, value, alpha) {
+        moments.count++;
+        const weight = Math.max(alpha, 1 / moments.count);
+        const diff = value - moments.mean;
+        const increment = weight * diff;
+        moments.mean += increment;
+        moments.variance = (1 - weight) * (moments.variance + diff * increment);
+    }
+
+    /**
+     * Fold one reading into time-decayed regression sums. x is the sample
+     * index (as the old query-based regression used), re-centred so the
+     * newest sample is always x = 0 and the sums stay small.
+     */
+    static updateTrend(trend, value, timestamp) {
+        if (trend.lastTimestamp !== null) {
+            const elapsedMinutes = Math.max(0, (timestamp - trend.lastTimestamp) / 60000);
+            const decay = Math.exp(-elapsedMinutes / trend.windowMinutes);
+
+            // Shift every previous x by -1, then decay
+            trend.sxy = (trend.sxy - trend.sy) * decay;
+            trend.sxx = (trend.sxx - 2 * trend.sx + trend.sw) * decay;
+            trend.sx = (trend.sx - trend.sw) * decay;
+            trend.sy *= decay;
+            trend.sw *= decay;
+        }
+
+        // New point at x = 0 only contributes to sw and sy
+        trend.sw += 1;
+        trend.sy += value;
+        trend.lastTimestamp = timestamp;
+    }
+
+    static trendSlope(trend) {
+        const denominator = trend.sw * trend.sxx - trend.sx * trend.sx;
+        if (Math.abs(denominator) < 1e-12) return 0;
+        return (trend.sw * trend.sxy - trend.sx * trend.sy) / denominator;
+    }
+
+    /**
+     * Load (or rebuild) a sensor's state once; concurrent callers share the load.
+     */
+    async ensure(deviceSensorId) {
+        if (this.states.has(deviceSensorId)) {
+            return this.states.get(deviceSensorId);
+        }
+
+        if (!this.loading.has(deviceSensorId)) {
+            this.loading.set(deviceSensorId, this.load(deviceSensorId).then((state) => {
+                this.states.set(deviceSensorId, state);
+                this.loading.delete(deviceSensorId);
+                this.startCheckpointing();
+                return state;
+            }));
+        }
+
+        return this.loading.get(deviceSensorId);
+    }
+
+    async load(deviceSensorId) {
+        try {
+            const cached = this.redis ? await this.redis.get(this.checkpointKey(deviceSensorId)) : null;
+            if (cached) {
+                return JSON.parse(cached);
+            }
+        } catch (error) {
+            logger.warn(`Failed to load sensor stats checkpoint for ${deviceSensorId}:`, error.message);
+        }
+
+        try {
+            return await this.rebuild(deviceSensorId);
+        } catch (error) {
+            logger.error(`Failed to rebuild sensor stats for ${deviceSensorId}:`, error);
+            return SensorStatsStore.emptyState();
+        }
+    }
+
+    /**
+     * Seed baselines from the 1h rollups, grouped by hour of week. Runs once
+     * per sensor per process start when Redis has no checkpoint.
+     */
+    async rebuild(deviceSensorId) {
+        const result = await db.query(`
+            SELECT
+                (EXTRACT(DOW FROM bucket) * 24 + EXTRACT(HOUR FROM bucket))::int AS hour_of_week,
+                SUM(sample_count)::float AS sample_count,
+                SUM(sum_value)::float AS sum_value,
+                SUM(sum_squares)::float AS sum_squares
+            FROM telemetry_rollup_1h
+            WHERE device_sensor_id = $1
+                AND bucket > NOW() - INTERVAL '1 day' * $2
+            GROUP BY 1
+        `, [deviceSensorId, REBUILD_WINDOW_DAYS]);
+
+        const state = SensorStatsStore.emptyState();
+        let total = 0;
+        let sum = 0;
+        let sumSquares = 0;
+
+        for (const row of result.rows) {
+            if (row.sample_count <= 0) continue;
+
+            const mean = row.sum_value / row.sample_count;
+            state.seasonal[row.hour_of_week] = {
+                count: row.sample_count,
+                mean,
+                variance: Math.max(0, row.sum_squares / row.sample_count - mean * mean)
+            };
+            total += row.sample_count;
+            sum += row.sum_value;
+            sumSquares += row.sum_squares;
+        }
+
+        if (total > 0) {
+            const mean = sum / total;
+            state.baseline = {
+                count: total,
+                mean,
+                variance: Math.max(0, sumSquares / total - mean * mean)
+            };
+        }
+
+        logger.debug(`Rebuilt sensor stats for ${deviceSensorId} from ${total} readings`);
+        return state;
+    }
+
+    /**
+     * Apply one reading. trendWindows lists the windows (minutes) that rules
+     * on this sensor ask for; regressors are kept per window.
+     */
+    observe(deviceSensorId, value, timestamp = Date.now(), trendWindows = []) {
+        const state = this.states.get(deviceSensorId);
+        if (!state || !Number.isFinite(value)) return;
+
+        SensorStatsStore.updateMoments(state.baseline, value, BASELINE_ALPHA);
+        SensorStatsStore.updateMoments(state.seasonal[SensorStatsStore.hourOfWeek(timestamp)], value, SEASONAL_ALPHA);
+
+        for (const windowMinutes of trendWindows) {
+            if (!state.trends[windowMinutes]) {
+                state.trends[windowMinutes] = {
+                    windowMinutes, sw: 0, sx: 0, sy: 0, sxx: 0, sxy: 0, lastTimestamp: null
+                };
+            }
+            SensorStatsStore.updateTrend(state.trends[windowMinutes], value, timestamp);
+        }
+
+        state.lastValue = value;
+        state.lastTimestamp = timestamp;
+        this.dirty.add(deviceSensorId);
+    }
+
+    getBaseline(deviceSensorId) {
+        return this.states.get(deviceSensorId)?.baseline || null;
+    }
+
+    /**
+     * Seasonal baseline for the hour-of-week slot of `timestamp`, pooled with
+     * its neighbours (±1 hour, matching the old query window).
+     */
+    getSeasonalBaseline(deviceSensorId, timestamp = Date.now()) {
+        const state = this.states.get(deviceSensorId);
+        if (!state) return null;
+
+        const slot = SensorStatsStore.hourOfWeek(timestamp);
+        let count = 0;
+        let sum = 0;
+        let sumSquares = 0;
+
+        for (const offset of [-1, 0, 1]) {
+            const moments = state.seasonal[(slot + offset + HOURS_PER_WEEK) % HOURS_PER_WEEK];
+            count += moments.count;
+            sum += moments.mean * moments.count;
+            sumSquares += (moments.variance + moments.mean * moments.mean) * moments.count;
+        }
+
+        if (count === 0) return { count: 0, mean: 0, variance: 0 };
+
+        const mean = sum / count;
+        return { count, mean, variance: Math.max(0, sumSquares / count - mean * mean) };
+    }
+
+    /**
+     * Slope (per sample) over the decayed window, optionally including a
+     * reading that has not been observed yet.
+     */
+    getTrend(deviceSensorId, windowMinutes, pendingValue = null, timestamp = Date.now()) {
+        const trend = this.states.get(deviceSensorId)?.trends[windowMinutes];
+        if (!trend) return null;
+
+        const working = { ...trend };
+        if (pendingValue !== null && Number.isFinite(pendingValue)) {
+            SensorStatsStore.updateTrend(working, pendingValue, timestamp);
+        }
+
+        return { weight: working.sw, slope: SensorStatsStore.trendSlope(working) };
+    }
+
+    checkpointKey(deviceSensorId) {
+        return `sensorstats:${deviceSensorId}`;
+    }
+
+    startCheckpointing() {
+        if (this.checkpointTimer || !this.redis) return;
+        this.checkpointTimer = setInterval(() => this.checkpoint(), CHECKPOINT_INTERVAL_MS);
+        this.checkpointTimer.unref?.();
+    }
+
+    async checkpoint() {
+        if (!this.redis || this.dirty.size === 0) return;
+
+        const ids = Array.from(this.dirty);
+        this.dirty.clear();
+
+        try {
+            const pipeline = this.redis.pipeline();
+            for (const id of ids) {
+                pipeline.set(this.checkpointKey(id), JSON.stringify(this.states.get(id)), 'EX', CHECKPOINT_TTL_SECONDS);
+            }
+            await pipeline.exec();
+        } catch (error) {
+            ids.forEach((id) => this.dirty.add(id));
+            logger.error('Failed to checkpoint sensor stats:', error);
+        }
+    }
+
+    async shutdown() {
+        if (this.checkpointTimer) {
+            clearInterval(this.checkpointTimer);
+            this.checkpointTimer = null;
+        }
+        await this.checkpoint();
+    }
+}
+
+module.exports = SensorStatsStore;
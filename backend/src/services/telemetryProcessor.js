@@ -1,13 +1,44 @@
 const db = require('../models/database');
 const logger = require('../utils/logger');
 const analyticsService = require('./analyticsService');
+const SensorStatsStore = require('./sensorStatsStore');
+const livenessService = require('./livenessService');
+const { createDownsampler } = require('../utils/downsample');
+const { registerSensors } = require('../utils/sensorRegistration');
+
+const RULE_CACHE_TTL_MS = 5 * 60 * 1000;
+
+const DAY_MS = 24 * 60 * 60 * 1000;
+
+// Storage tiers, finest first. retentionMs is how far back each tier is kept
+// (see cleanupOldTelemetry); null means indefinitely.
+const TELEMETRY_TIERS = [
+    { name: 'raw', table: 'telemetry', bucketSeconds: 0, retentionMs: 30 * DAY_MS },
+    { name: '1m', table: 'telemetry_rollup_1m', bucketSeconds: 60, retentionMs: 7 * DAY_MS },
+    { name: '1h', table: 'telemetry_rollup_1h', bucketSeconds: 3600, retentionMs: 365 * DAY_MS },
+    { name: '1d', table: 'telemetry_rollup_1d', bucketSeconds: 86400, retentionMs: null }
+];
+
+// Requested resolution (seconds) for each aggregation name
+const AGGREGATION_RESOLUTION = {
+    raw: 0,
+    minute: 60,
+    hourly: 3600,
+    daily: 86400
+};
+
+// Target number of points when aggregation=auto
+const AUTO_AGGREGATION_POINTS = 1000;
+
+// Rule conditions served from the incremental per-sensor statistics
+const STATS_CONDITIONS = new Set(['statistical_anomaly', 'seasonal_anomaly', 'trend_detection']);
 
 class TelemetryProcessor {
     constructor(redis, websocketService) {
         this.redis = redis;
         this.websocketService = websocketService;
         this.ruleCache = new Map();
-        this.lastRuleCacheUpdate = 0;
+        this.sensorStats = new SensorStatsStore(redis);
     }
 
     async processTelemetryData(deviceId, sensorData) {
@@ -34,53 +65,197 @@ class TelemetryProcessor {
         }
     }
 
-    async storeTelemetryData(deviceId, sensorData) {
-        const client = await db.getClient();
+    /**
+     * Bulk ingestion path for queued telemetry (MQTT). `items` is an ordered
+     * list of { deviceId, sensors, receivedAt }; all readings are written with
+     * one sensor lookup and one multi-row insert, then rules, status and
+     * broadcasts run per device in arrival order.
+     */
+    async processTelemetryBatch(items) {
+        if (items.length === 0) {
+            return;
+        }
 
-        try {
-            await client.query('BEGIN');
+        await this.storeTelemetryBatch(items);
 
-            for (const sensor of sensorData) {
-                // Get device_sensor_id
-                const sensorResult = await client.query(`
-                    SELECT id FROM device_sensors
-                    WHERE device_id = $1 AND pin = $2 AND sensor_type_id = (
-                        SELECT id FROM sensor_types WHERE name = $3
-                    )
-                `, [deviceId, sensor.pin, sensor.type]);
-
-                if (sensorResult.rows.length > 0) {
-                    const deviceSensorId = sensorResult.rows[0].id;
-
-                    await client.query(`
-                        INSERT INTO telemetry (device_id, device_sensor_id, raw_value, processed_value, timestamp, metadata)
-                        VALUES ($1, $2, $3, $4, NOW(), $5)
-                    `, [
-                        deviceId,
-                        deviceSensorId,
-                        sensor.raw_value,
-                        sensor.processed_value,
-                        JSON.stringify({
-                            calibration_offset: sensor.calibration_offset || 0,
-                            calibration_multiplier: sensor.calibration_multiplier || 1,
-                            sensor_name: sensor.name,
-                            wifi_rssi: sensor.wifi_rssi
-                        })
-                    ]);
+        const byDevice = new Map();
+        for (const item of items) {
+            if (!byDevice.has(item.deviceId)) {
+                byDevice.set(item.deviceId, []);
+            }
+            byDevice.get(item.deviceId).push(item);
+        }
+
+        for (const [deviceId, deviceItems] of byDevice) {
+            try {
+                for (const item of deviceItems) {
+                    for (const sensor of item.sensors) {
+                        await this.processRulesForSensor(deviceId, sensor);
+                    }
                 }
+
+                // One status write per device per batch
+                await this.updateDeviceStatus(deviceId, 'online');
+
+                for (const item of deviceItems) {
+                    await this.websocketService.broadcastTelemetryUpdate(deviceId, item.sensors);
+                    await this.cacheRecentTelemetry(deviceId, item.sensors);
+                }
+            } catch (error) {
+                logger.error(`Error processing batched telemetry for device ${deviceId}:`, error);
+            }
+        }
+    }
+
+    async storeTelemetryBatch(items) {
+        const keys = { deviceIds: [], pins: [], types: [] };
+        for (const item of items) {
+            for (const sensor of item.sensors) {
+                keys.deviceIds.push(item.deviceId);
+                keys.pins.push(String(sensor.pin));
+                keys.types.push(String(sensor.type).toLowerCase());
             }
+        }
 
-            await client.query('COMMIT');
-        } catch (error) {
-            await client.query('ROLLBACK');
-            throw error;
-        } finally {
-            client.release();
+        const sensorResult = await db.query(`
+            SELECT ds.id, ds.device_id, ds.pin, st.name AS type
+            FROM device_sensors ds
+            JOIN sensor_types st ON ds.sensor_type_id = st.id
+            JOIN UNNEST($1::varchar[], $2::varchar[], $3::varchar[]) AS k(device_id, pin, type)
+              ON ds.device_id = k.device_id AND ds.pin = k.pin AND LOWER(st.name) = k.type
+        `, [keys.deviceIds, keys.pins, keys.types]);
+
+        // Firmware reports lower-case type names ('temperature' vs 'Temperature')
+        const sensorIds = new Map();
+        for (const row of sensorResult.rows) {
+            sensorIds.set(`${row.device_id}:${row.pin}:${row.type.toLowerCase()}`, row.id);
+        }
+
+        // Pins the server has not seen yet (new probes, new firmware
+        // sensors) are registered rather than dropped
+        const unknown = new Map();
+        for (const item of items) {
+            for (const sensor of item.sensors) {
+                const key = `${item.deviceId}:${sensor.pin}:${String(sensor.type).toLowerCase()}`;
+                if (!sensorIds.has(key) && !unknown.has(key)) {
+                    unknown.set(key, { deviceId: item.deviceId, pin: sensor.pin, type: sensor.type, name: sensor.name });
+                }
+            }
+        }
+        if (unknown.size > 0) {
+            try {
+                for (const row of await registerSensors([...unknown.values()])) {
+                    sensorIds.set(`${row.device_id}:${row.pin}:${row.type.toLowerCase()}`, row.id);
+                }
+            } catch (error) {
+                logger.error('Failed to auto-register sensors:', error);
+            }
+        }
+
+        const rows = {
+            deviceIds: [], sensorIds: [], rawValues: [], processedValues: [], timestamps: [], metadata: []
+        };
+        for (const item of items) {
+            const timestamp = new Date(item.receivedAt || Date.now()).toISOString();
+            for (const sensor of item.sensors) {
+                const deviceSensorId = sensorIds.get(`${item.deviceId}:${sensor.pin}:${String(sensor.type).toLowerCase()}`);
+                if (!deviceSensorId) continue;
+
+                rows.deviceIds.push(item.deviceId);
+                rows.sensorIds.push(deviceSensorId);
+                rows.rawValues.push(sensor.raw_value);
+                rows.processedValues.push(sensor.processed_value);
+                rows.timestamps.push(timestamp);
+                rows.metadata.push(JSON.stringify({
+                    calibration_offset: sensor.calibration_offset || 0,
+                    calibration_multiplier: sensor.calibration_multiplier || 1,
+                    sensor_name: sensor.name,
+                    wifi_rssi: sensor.wifi_rssi
+                }));
+            }
+        }
+
+        if (rows.deviceIds.length === 0) {
+            return 0;
+        }
+
+        // Raw insert and all three rollup tiers in one statement
+        await db.query(`
+            WITH inserted AS (
+                INSERT INTO telemetry (device_id, device_sensor_id, raw_value, processed_value, timestamp, metadata)
+                SELECT * FROM UNNEST(
+                    $1::varchar[], $2::int[], $3::numeric[], $4::numeric[], $5::timestamptz[], $6::jsonb[]
+                )
+                RETURNING device_id, device_sensor_id, timestamp, processed_value::float8 AS value
+            ),
+            rollup_1m AS (
+                ${this.rollupUpsert('telemetry_rollup_1m', 'minute')}
+            ),
+            rollup_1h AS (
+                ${this.rollupUpsert('telemetry_rollup_1h', 'hour', { sketch: true })}
+            )
+            ${this.rollupUpsert('telemetry_rollup_1d', 'day', { sketch: true })}
+        `, [rows.deviceIds, rows.sensorIds, rows.rawValues, rows.processedValues, rows.timestamps, rows.metadata]);
+
+        return rows.deviceIds.length;
+    }
+
+    async storeTelemetryData(deviceId, sensorData) {
+        await this.storeTelemetryBatch([{ deviceId, sensors: sensorData, receivedAt: Date.now() }]);
+    }
+
+    /**
+     * Upsert one rollup tier from the `inserted` CTE. With `sketch`, the
+     * bucket's value histogram is merged in as well (1h/1d tiers).
+     */
+    rollupUpsert(table, unit, { sketch = false } = {}) {
+        if (!sketch) {
+            return `
+            INSERT INTO ${table} AS r
+                (device_sensor_id, bucket, device_id, sample_count, sum_value, sum_squares, min_value, max_value)
+            SELECT device_sensor_id, DATE_TRUNC('${unit}', timestamp), device_id,
+                   COUNT(*), SUM(value), SUM(value * value), MIN(value), MAX(value)
+            FROM inserted
+            GROUP BY device_sensor_id, DATE_TRUNC('${unit}', timestamp), device_id
+            ON CONFLICT (device_sensor_id, bucket) DO UPDATE SET
+                sample_count = r.sample_count + EXCLUDED.sample_count,
+                sum_value = r.sum_value + EXCLUDED.sum_value,
+                sum_squares = r.sum_squares + EXCLUDED.sum_squares,
+                min_value = LEAST(r.min_value, EXCLUDED.min_value),
+                max_value = GREATEST(r.max_value, EXCLUDED.max_value)`;
         }
+
+        return `
+            INSERT INTO ${table} AS r
+                (device_sensor_id, bucket, device_id, sample_count, sum_value, sum_squares, min_value, max_value, sketch)
+            SELECT device_sensor_id, bucket, device_id,
+                   SUM(n), SUM(sum_value), SUM(sum_squares), MIN(min_value), MAX(max_value),
+                   jsonb_object_agg(sketch_key, n)
+            FROM (
+                SELECT device_sensor_id, DATE_TRUNC('${unit}', timestamp) AS bucket, device_id,
+                       telemetry_sketch_key(value) AS sketch_key, COUNT(*) AS n,
+                       SUM(value) AS sum_value, SUM(value * value) AS sum_squares,
+                       MIN(value) AS min_value, MAX(value) AS max_value
+                FROM inserted
+                GROUP BY 1, 2, 3, 4
+            ) keyed
+            GROUP BY device_sensor_id, bucket, device_id
+            ON CONFLICT (device_sensor_id, bucket) DO UPDATE SET
+                sample_count = r.sample_count + EXCLUDED.sample_count,
+                sum_value = r.sum_value + EXCLUDED.sum_value,
+                sum_squares = r.sum_squares + EXCLUDED.sum_squares,
+                min_value = LEAST(r.min_value, EXCLUDED.min_value),
+                max_value = GREATEST(r.max_value, EXCLUDED.max_value),
+                sketch = telemetry_sketch_merge(r.sketch, EXCLUDED.sketch)`;
     }
 
     async processRulesForSensor(deviceId, sensor) {
         const rules = await this.getSensorRules(deviceId, sensor.pin, sensor.type);
+        const statsRules = rules.filter(rule => rule.enabled && STATS_CONDITIONS.has(rule.condition));
+
+        if (statsRules.length > 0) {
+            await this.sensorStats.ensure(statsRules[0].device_sensor_id);
+        }
 
         for (const rule of rules) {
             if (!rule.enabled) continue;
@@ -91,6 +266,20 @@ class TelemetryProcessor {
                 await this.createAlert(deviceId, sensor, rule);
             }
         }
+
+        // Fold the reading in after evaluation so baselines exclude it
+        if (statsRules.length > 0) {
+            const trendWindows = statsRules
+                .filter(rule => rule.condition === 'trend_detection')
+                .map(rule => rule.time_window_minutes || 60);
+
+            this.sensorStats.observe(
+                statsRules[0].device_sensor_id,
+                parseFloat(sensor.processed_value),
+                Date.now(),
+                trendWindows
+            );
+        }
     }
 
     async getSensorRules(deviceId, pin, sensorType) {
@@ -101,10 +290,10 @@ class TelemetryProcessor {
         const normalizedSensorType = sensorTypeAliases[sensorType?.toLowerCase?.()] || sensorType;
         const cacheKey = `rules:${deviceId}:${pin}:${normalizedSensorType}`;
 
-        // Check cache first (refresh every 5 minutes)
-        if (this.ruleCache.has(cacheKey) &&
-            Date.now() - this.lastRuleCacheUpdate < 300000) {
-            return this.ruleCache.get(cacheKey);
+        // Check cache first (each entry refreshes every 5 minutes)
+        const cached = this.ruleCache.get(cacheKey);
+        if (cached && Date.now() - cached.fetchedAt < RULE_CACHE_TTL_MS) {
+            return cached.rules;
         }
 
         const result = await db.query(`
@@ -116,8 +305,7 @@ class TelemetryProcessor {
         `, [deviceId, pin, normalizedSensorType]);
 
         const rules = result.rows;
-        this.ruleCache.set(cacheKey, rules);
-        this.lastRuleCacheUpdate = Date.now();
+        this.ruleCache.set(cacheKey, { rules, fetchedAt: Date.now() });
 
         return rules;
     }
@@ -226,26 +414,13 @@ class TelemetryProcessor {
 
     async evaluateStatisticalAnomaly(rule, sensor) {
         try {
-            // Get recent historical data for baseline
-            const result = await db.query(`
-                SELECT processed_value, timestamp
-                FROM telemetry
-                WHERE device_sensor_id = $1
-                    AND timestamp > NOW() - INTERVAL '1 day' * $2
-                    AND timestamp < NOW() - INTERVAL '5 minutes'
-                ORDER BY timestamp DESC
-                LIMIT 500
-            `, [rule.device_sensor_id, rule.time_window_days || 7]);
-
-            if (result.rows.length < 20) return false;
+            // Baseline is the EWMA of previous readings for this sensor
+            const baseline = this.sensorStats.getBaseline(rule.device_sensor_id);
 
-            const historicalValues = result.rows.map(row => parseFloat(row.processed_value));
-            const stats = analyticsService.calculateStatistics(historicalValues);
-
-            if (!stats) return false;
+            if (!baseline || baseline.count < 20) return false;
 
             const value = sensor.processed_value;
-            const zScore = Math.abs((value - stats.mean) / stats.stdDev);
+            const zScore = Math.abs((value - baseline.mean) / Math.sqrt(baseline.variance));
 
             // Configurable sensitivity: higher values = less sensitive
             const sensitivity = rule.sensitivity || 3; // Default 3-sigma
@@ -260,35 +435,16 @@ class TelemetryProcessor {
 
     async evaluateSeasonalAnomaly(rule, sensor) {
         try {
-            // Get same time period from previous days/weeks for seasonal comparison
-            const now = new Date();
-            const dayOfWeek = now.getDay();
-            const hourOfDay = now.getHours();
-
-            const result = await db.query(`
-                SELECT processed_value
-                FROM telemetry
-                WHERE device_sensor_id = $1
-                    AND EXTRACT(DOW FROM timestamp) = $2
-                    AND EXTRACT(HOUR FROM timestamp) BETWEEN $3 AND $4
-                    AND timestamp > NOW() - INTERVAL '30 days'
-                    AND timestamp < NOW() - INTERVAL '1 day'
-                ORDER BY timestamp DESC
-                LIMIT 100
-            `, [rule.device_sensor_id, dayOfWeek, hourOfDay - 1, hourOfDay + 1]);
-
-            if (result.rows.length < 10) {
+            // Baseline for the same hour of the week (±1 hour)
+            const seasonal = this.sensorStats.getSeasonalBaseline(rule.device_sensor_id, Date.now());
+
+            if (!seasonal || seasonal.count < 10) {
                 // Fall back to general statistical anomaly if not enough seasonal data
                 return await this.evaluateStatisticalAnomaly(rule, sensor);
             }
 
-            const seasonalValues = result.rows.map(row => parseFloat(row.processed_value));
-            const stats = analyticsService.calculateStatistics(seasonalValues);
-
-            if (!stats) return false;
-
             const value = sensor.processed_value;
-            const zScore = Math.abs((value - stats.mean) / stats.stdDev);
+            const zScore = Math.abs((value - seasonal.mean) / Math.sqrt(seasonal.variance));
 
             const sensitivity = rule.sensitivity || 2.5; // Slightly more sensitive for seasonal
 
@@ -302,31 +458,15 @@ class TelemetryProcessor {
 
     async evaluateTrend(rule, sensor) {
         try {
-            // Get recent readings to analyze trend
+            // Regression over the rule's window, including the current reading
             const windowMinutes = rule.time_window_minutes || 60;
-            const result = await db.query(`
-                SELECT processed_value, timestamp
-                FROM telemetry
-                WHERE device_sensor_id = $1
-                    AND timestamp > NOW() - INTERVAL '1 minute' * $2
-                ORDER BY timestamp ASC
-            `, [rule.device_sensor_id, windowMinutes]);
-
-            if (result.rows.length < 10) return false;
-
-            const values = result.rows.map((row, index) => ({
-                x: index,
-                y: parseFloat(row.processed_value)
-            }));
-
-            // Calculate linear regression to determine trend
-            const n = values.length;
-            const sumX = values.reduce((sum, point) => sum + point.x, 0);
-            const sumY = values.reduce((sum, point) => sum + point.y, 0);
-            const sumXY = values.reduce((sum, point) => sum + (point.x * point.y), 0);
-            const sumXX = values.reduce((sum, point) => sum + (point.x * point.x), 0);
-
-            const slope = (n * sumXY - sumX * sumY) / (n * sumXX - sumX * sumX);
+            const trend = this.sensorStats.getTrend(
+                rule.device_sensor_id, windowMinutes, parseFloat(sensor.processed_value)
+            );
+
+            if (!trend || trend.weight < 10) return false;
+
+            const slope = trend.slope;
 
             // Determine trend direction and magnitude
             const trendThreshold = rule.threshold_max || 0.1; // Rate of change threshold
@@ -410,10 +550,12 @@ class TelemetryProcessor {
     async updateDeviceStatus(deviceId, status) {
         await db.query(`
             UPDATE devices
-            SET status = $2, last_heartbeat = NOW(), updated_at = NOW()
+            SET status = $2, updated_at = NOW()
             WHERE id = $1
         `, [deviceId, status]);
 
+        livenessService.touch(deviceId);
+
         // Broadcast status change
         await this.websocketService.broadcastDeviceStatus(deviceId, status);
     }
@@ -432,162 +574,147 @@ class TelemetryProcessor {
         }
     }
 
-    async checkOfflineDevices() {
-        try {
-            const offlineDevices = await db.query(`
-                UPDATE devices
-                SET status = 'offline'
-                WHERE last_heartbeat < NOW() - INTERVAL '10 minutes'
-                    AND status != 'offline'
-                RETURNING id, name
-            `);
-
-            for (const device of offlineDevices.rows) {
-                // Create offline alert
-                await db.query(`
-                    INSERT INTO alerts (device_id, alert_type, severity, message, status, created_at)
-                    VALUES ($1, 'OFFLINE', 'medium', $2, 'active', NOW())
-                `, [device.id, `Device ${device.name} has gone offline`]);
-
-                // Broadcast status change
-                await this.websocketService.broadcastDeviceStatus(device.id, 'offline');
-            }
-
-            if (offlineDevices.rows.length > 0) {
-                logger.info(`Marked ${offlineDevices.rows.length} devices as offline`);
-            }
+    async shutdown() {
+        await this.sensorStats.shutdown();
+    }
 
-        } catch (error) {
-            logger.error('Error checking offline devices:', error);
-        }
+    async ensureTelemetryPartitions(daysAhead = 3) {
+        await db.query(`
+            SELECT ensure_telemetry_partition((CURRENT_DATE + offset_days)::date)
+            FROM generate_series(0, $1::int) AS offset_days
+        `, [daysAhead]);
     }
 
     async cleanupOldTelemetry() {
         try {
-            // Keep detailed telemetry for 30 days
-            const detailedCutoff = new Date(Date.now() - 30 * 24 * 60 * 60 * 1000);
-
-            // Keep aggregated hourly data for 1 year
-            const aggregatedCutoff = new Date(Date.now() - 365 * 24 * 60 * 60 * 1000);
+            await this.ensureTelemetryPartitions();
+
+            // Raw telemetry: drop whole daily partitions past retention
+            const rawTier = TELEMETRY_TIERS[0];
+            const cutoffDay = new Date(Date.now() - rawTier.retentionMs).toISOString().slice(0, 10).replace(/-/g, '');
+
+            const partitions = await db.query(`
+                SELECT c.relname
+                FROM pg_inherits i
+                JOIN pg_class c ON c.oid = i.inhrelid
+                WHERE i.inhparent = 'telemetry'::regclass
+                    AND c.relname ~ '^telemetry_p[0-9]{8}$'
+                ORDER BY c.relname
+            `);
 
-            // Create aggregated data before deletion
-            await this.createHourlyAggregates(detailedCutoff);
+            let dropped = 0;
+            for (const { relname } of partitions.rows) {
+                if (relname.slice('telemetry_p'.length) >= cutoffDay) break;
 
-            // Delete old detailed telemetry
-            const deletedRows = await db.query(`
-                DELETE FROM telemetry
-                WHERE timestamp < $1
-            `, [detailedCutoff]);
+                await db.query(`ALTER TABLE telemetry DETACH PARTITION ${relname}`);
+                await db.query(`DROP TABLE ${relname}`);
+                dropped++;
+            }
 
-            // Delete very old aggregated data
-            await db.query(`
-                DELETE FROM telemetry_hourly_aggregates
-                WHERE hour_timestamp < $1
-            `, [aggregatedCutoff]);
+            // Rollup tiers are small enough to trim by bucket
+            for (const tier of TELEMETRY_TIERS.slice(1)) {
+                if (tier.retentionMs === null) continue;
+                await db.query(`DELETE FROM ${tier.table} WHERE bucket < $1`, [
+                    new Date(Date.now() - tier.retentionMs)
+                ]);
+            }
 
-            logger.info(`Cleaned up ${deletedRows.rowCount} old telemetry records`);
+            logger.info(`Dropped ${dropped} expired telemetry partitions`);
 
         } catch (error) {
             logger.error('Error cleaning up old telemetry:', error);
         }
     }
 
-    async createHourlyAggregates(cutoffDate) {
-        // Create aggregation table if it doesn't exist
-        await db.query(`
-            CREATE TABLE IF NOT EXISTS telemetry_hourly_aggregates (
-                id SERIAL PRIMARY KEY,
-                device_id VARCHAR(50) REFERENCES devices(id),
-                device_sensor_id INTEGER REFERENCES device_sensors(id),
-                hour_timestamp TIMESTAMP NOT NULL,
-                avg_value DECIMAL(10, 4),
-                min_value DECIMAL(10, 4),
-                max_value DECIMAL(10, 4),
-                sample_count INTEGER,
-                created_at TIMESTAMP DEFAULT CURRENT_TIMESTAMP,
-                UNIQUE(device_id, device_sensor_id, hour_timestamp)
-            )
-        `);
+    /**
+     * Pick the storage tier for a history query: the coarsest tier whose
+     * bucket is no wider than the requested resolution and which still holds
+     * data for startDate. If no such tier reaches back far enough, fall
+     * through to the finest coarser tier that does. With maxPoints, the
+     * resolution is coarsened to range / maxPoints so the chosen tier holds
+     * roughly as many rows as will be returned.
+     */
+    selectTelemetryTier(startDate, endDate, aggregation = 'raw', maxPoints = null) {
+        const rangeSeconds = Math.max(0, (endDate - startDate) / 1000);
+        let resolution = AGGREGATION_RESOLUTION[aggregation];
+        if (aggregation === 'auto' || resolution === undefined) {
+            resolution = rangeSeconds / AUTO_AGGREGATION_POINTS;
+        }
+        if (maxPoints) {
+            resolution = Math.max(resolution, rangeSeconds / maxPoints);
+        }
 
-        // Create hourly aggregates for data older than cutoff
-        await db.query(`
-            INSERT INTO telemetry_hourly_aggregates (device_id, device_sensor_id, hour_timestamp, avg_value, min_value, max_value, sample_count)
-            SELECT
-                device_id,
-                device_sensor_id,
-                DATE_TRUNC('hour', timestamp) as hour_timestamp,
-                AVG(processed_value) as avg_value,
-                MIN(processed_value) as min_value,
-                MAX(processed_value) as max_value,
-                COUNT(*) as sample_count
-            FROM telemetry
-            WHERE timestamp < $1
-            GROUP BY device_id, device_sensor_id, DATE_TRUNC('hour', timestamp)
-            ON CONFLICT (device_id, device_sensor_id, hour_timestamp) DO NOTHING
-        `, [cutoffDate]);
+        const age = Date.now() - startDate.getTime();
+        const covers = tier => tier.retentionMs === null || age <= tier.retentionMs;
+
+        const fitting = TELEMETRY_TIERS.filter(tier => tier.bucketSeconds <= resolution && covers(tier));
+        if (fitting.length > 0) {
+            return fitting[fitting.length - 1];
+        }
+
+        return TELEMETRY_TIERS.find(tier => tier.bucketSeconds > resolution && covers(tier))
+            || TELEMETRY_TIERS[TELEMETRY_TIERS.length - 1];
     }
 
     // Historical data analysis methods
-    async getHistoricalTelemetry(deviceId, sensorPin, startDate, endDate, aggregation = 'raw') {
-        let query;
-        let params = [deviceId, sensorPin, startDate, endDate];
+    async getHistoricalTelemetry(deviceId, sensorPin, startDate, endDate, aggregation = 'raw', options = {}) {
+        const { maxPoints = null, downsample = 'lttb' } = options;
+        const tier = this.selectTelemetryTier(startDate, endDate, aggregation, maxPoints);
+        const params = [deviceId, sensorPin, startDate, endDate];
 
-        if (aggregation === 'hourly') {
-            query = `
-                SELECT
-                    hour_timestamp as timestamp,
-                    avg_value as value,
-                    min_value,
-                    max_value,
-                    sample_count
-                FROM telemetry_hourly_aggregates tha
-                INNER JOIN device_sensors ds ON tha.device_sensor_id = ds.id
-                WHERE tha.device_id = $1 AND ds.pin = $2
-                    AND hour_timestamp BETWEEN $3 AND $4
-                ORDER BY hour_timestamp
-            `;
-        } else if (aggregation === 'daily') {
-            query = `
-                SELECT
-                    DATE_TRUNC('day', hour_timestamp) as timestamp,
-                    AVG(avg_value) as value,
-                    MIN(min_value) as min_value,
-                    MAX(max_value) as max_value,
-                    SUM(sample_count) as sample_count
-                FROM telemetry_hourly_aggregates tha
-                INNER JOIN device_sensors ds ON tha.device_sensor_id = ds.id
-                WHERE tha.device_id = $1 AND ds.pin = $2
-                    AND hour_timestamp BETWEEN $3 AND $4
-                GROUP BY DATE_TRUNC('day', hour_timestamp)
-                ORDER BY timestamp
-            `;
-        } else {
-            // Raw data
-            query = `
+        const sql = tier.name === 'raw'
+            ? `
                 SELECT timestamp, processed_value as value, raw_value, metadata
                 FROM telemetry t
                 INNER JOIN device_sensors ds ON t.device_sensor_id = ds.id
                 WHERE t.device_id = $1 AND ds.pin = $2
                     AND timestamp BETWEEN $3 AND $4
-                ORDER BY timestamp
-                LIMIT 10000
-            `;
+                ORDER BY timestamp`
+            : `
+                SELECT
+                    r.bucket as timestamp,
+                    r.sum_value / r.sample_count as value,
+                    r.min_value,
+                    r.max_value,
+                    r.sample_count
+                FROM ${tier.table} r
+                INNER JOIN device_sensors ds ON r.device_sensor_id = ds.id
+                WHERE r.device_id = $1 AND ds.pin = $2
+                    AND r.bucket BETWEEN $3 AND $4
+                ORDER BY r.bucket`;
+
+        if (!maxPoints) {
+            const result = await db.query(tier.name === 'raw' ? `${sql}\n                LIMIT 10000` : sql, params);
+            return result.rows;
         }
 
-        const result = await db.query(query, params);
-        return result.rows;
+        // Stream the tier through the downsampler so neither the query result
+        // nor the response grows with the range
+        const downsampler = createDownsampler(downsample, startDate, endDate, maxPoints);
+        await db.cursorQuery(sql, params, (rows) => {
+            for (const row of rows) {
+                downsampler.push(row);
+            }
+        });
+
+        return downsampler.finish();
     }
 
     async getDeviceStats(deviceId, timeRange = '24h') {
-        const intervals = {
-            '1h': '1 hour',
-            '6h': '6 hours',
-            '24h': '24 hours',
-            '7d': '7 days',
-            '30d': '30 days'
+        const ranges = {
+            '1h': 60 * 60 * 1000,
+            '6h': 6 * 60 * 60 * 1000,
+            '24h': DAY_MS,
+            '7d': 7 * DAY_MS,
+            '30d': 30 * DAY_MS
         };
 
-        const interval = intervals[timeRange] || '24 hours';
+        const rangeMs = ranges[timeRange] || DAY_MS;
+        const startDate = new Date(Date.now() - rangeMs);
+
+        // Summary stats need no resolution; short ranges use minute buckets so
+        // the partial bucket at the start stays small
+        const tier = rangeMs <= 6 * 60 * 60 * 1000 ? TELEMETRY_TIERS[1] : TELEMETRY_TIERS[2];
 
         const result = await db.query(`
             SELECT
@@ -595,19 +722,23 @@ class TelemetryProcessor {
                 ds.name as sensor_name,
                 st.name as sensor_type,
                 st.unit,
-                COUNT(t.id) as reading_count,
-                AVG(t.processed_value) as avg_value,
-                MIN(t.processed_value) as min_value,
-                MAX(t.processed_value) as max_value,
-                STDDEV(t.processed_value) as std_dev
+                COALESCE(SUM(r.sample_count), 0) as reading_count,
+                SUM(r.sum_value) / NULLIF(SUM(r.sample_count), 0) as avg_value,
+                MIN(r.min_value) as min_value,
+                MAX(r.max_value) as max_value,
+                SQRT(GREATEST(
+                    (SUM(r.sum_squares) - SUM(r.sum_value) * SUM(r.sum_value) / NULLIF(SUM(r.sample_count), 0))
+                        / NULLIF(SUM(r.sample_count) - 1, 0),
+                    0
+                )) as std_dev
             FROM device_sensors ds
             INNER JOIN sensor_types st ON ds.sensor_type_id = st.id
-            LEFT JOIN telemetry t ON ds.id = t.device_sensor_id
-                AND t.timestamp > NOW() - INTERVAL $2
+            LEFT JOIN ${tier.table} r ON ds.id = r.device_sensor_id
+                AND r.bucket >= DATE_TRUNC('${tier.name === '1m' ? 'minute' : 'hour'}', $2::timestamptz::timestamp)
             WHERE ds.device_id = $1 AND ds.enabled = true
             GROUP BY ds.id, ds.pin, ds.name, st.name, st.unit
             ORDER BY ds.pin
-        `, [deviceId, interval]);
+        `, [deviceId, startDate]);
 
         return result.rows;
     }
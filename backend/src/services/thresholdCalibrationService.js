@@ -1,5 +1,7 @@
 const db = require('../models/database');
 const logger = require('../utils/logger');
+const telemetrySketch = require('../utils/telemetrySketch');
+const deviceConfigService = require('./deviceConfigService');
 
 class ThresholdCalibrationService {
     constructor() {
@@ -46,11 +48,11 @@ class ThresholdCalibrationService {
 
             const sensor = sensorResult.rows[0];
 
-            // Get historical data
+            // Get historical distribution from the hourly rollup sketches
             const historicalData = await this.getHistoricalData(deviceId, sensorId, timeWindow);
 
-            if (historicalData.length < minDataPoints) {
-                logger.warn(`Insufficient historical data for sensor ${sensorId} (${historicalData.length} points). Using default thresholds.`);
+            if (historicalData.count < minDataPoints) {
+                logger.warn(`Insufficient historical data for sensor ${sensorId} (${historicalData.count} points). Using default thresholds.`);
                 return {
                     min_threshold: sensor.threshold_min,
                     max_threshold: sensor.threshold_max,
@@ -85,7 +87,7 @@ class ThresholdCalibrationService {
             thresholds.sensor_type = sensor.sensor_type;
             thresholds.unit = sensor.unit;
             thresholds.calculated_at = new Date();
-            thresholds.data_points = historicalData.length;
+            thresholds.data_points = historicalData.count;
             thresholds.time_window_hours = timeWindow;
 
             // Cache the result
@@ -105,56 +107,78 @@ class ThresholdCalibrationService {
     }
 
     /**
-     * Get historical telemetry data for threshold calculation
+     * Get the historical value distribution for threshold calculation, merged
+     * from the hourly rollup sketches and split by hour of day
      * @param {string} deviceId - Device ID
      * @param {number} sensorId - Sensor ID
      * @param {number} timeWindowHours - Time window in hours
-     * @returns {Promise<Array>} - Historical data points
+     * @returns {Promise<object>} - { count, sum, sumSquares, min, max, sketch, hourly }
      */
     async getHistoricalData(deviceId, sensorId, timeWindowHours) {
         const result = await db.query(`
             SELECT
-                processed_value as value,
-                timestamp,
-                EXTRACT(HOUR FROM timestamp) as hour_of_day,
-                EXTRACT(DOW FROM timestamp) as day_of_week
-            FROM telemetry
+                EXTRACT(HOUR FROM bucket)::int AS hour_of_day,
+                SUM(sample_count)::float AS sample_count,
+                SUM(sum_value) AS sum_value,
+                SUM(sum_squares) AS sum_squares,
+                MIN(min_value) AS min_value,
+                MAX(max_value) AS max_value,
+                telemetry_sketch_agg(sketch) AS sketch
+            FROM telemetry_rollup_1h
             WHERE device_id = $1
                 AND device_sensor_id = $2
-                AND timestamp >= NOW() - INTERVAL '${timeWindowHours} hours'
-                AND processed_value IS NOT NULL
-            ORDER BY timestamp ASC
-        `, [deviceId, sensorId]);
-
-        return result.rows.map(row => ({
-            value: parseFloat(row.value),
-            timestamp: row.timestamp,
-            hour: parseInt(row.hour_of_day),
-            day: parseInt(row.day_of_week)
-        }));
+                AND bucket >= DATE_TRUNC('hour', NOW() - INTERVAL '1 hour' * $3)
+            GROUP BY 1
+        `, [deviceId, sensorId, timeWindowHours]);
+
+        const data = { count: 0, sum: 0, sumSquares: 0, min: Infinity, max: -Infinity, sketch: {}, hourly: {} };
+
+        for (const row of result.rows) {
+            const hour = {
+                count: row.sample_count,
+                sum: row.sum_value,
+                sumSquares: row.sum_squares,
+                min: row.min_value,
+                max: row.max_value,
+                sketch: row.sketch || {}
+            };
+            data.hourly[row.hour_of_day] = hour;
+            data.count += hour.count;
+            data.sum += hour.sum;
+            data.sumSquares += hour.sumSquares;
+            data.min = Math.min(data.min, hour.min);
+            data.max = Math.max(data.max, hour.max);
+            data.sketch = telemetrySketch.merge(data.sketch, hour.sketch);
+        }
+
+        return data;
+    }
+
+    /**
+     * Percentile from a distribution's sketch, clamped to its exact range
+     * (falls back to the mean for buckets that predate sketches)
+     */
+    distributionPercentile(distribution, percentile) {
+        const value = telemetrySketch.quantile(telemetrySketch.toBins(distribution.sketch), percentile);
+        const fallback = distribution.sum / distribution.count;
+        return Math.min(distribution.max, Math.max(distribution.min, value === null ? fallback : value));
     }
 
     /**
      * Calculate statistical thresholds using percentiles
-     * @param {Array} data - Historical data points
+     * @param {object} data - Historical distribution
      * @param {number} percentileHigh - High percentile
      * @param {number} percentileLow - Low percentile
      * @param {number} smoothingFactor - Exponential smoothing factor
      * @returns {object} - Calculated thresholds
      */
     calculateStatisticalThresholds(data, percentileHigh, percentileLow, smoothingFactor) {
-        const values = data.map(d => d.value).sort((a, b) => a - b);
-
-        // Calculate percentiles
-        const highIndex = Math.ceil((percentileHigh / 100) * values.length) - 1;
-        const lowIndex = Math.floor((percentileLow / 100) * values.length);
-
-        const percentileMax = values[highIndex];
-        const percentileMin = values[lowIndex];
+        const percentileMax = this.distributionPercentile(data, percentileHigh);
+        const percentileMin = this.distributionPercentile(data, percentileLow);
 
-        // Calculate mean and standard deviation
-        const mean = values.reduce((sum, v) => sum + v, 0) / values.length;
-        const variance = values.reduce((sum, v) => sum + Math.pow(v - mean, 2), 0) / values.length;
+        // Mean and standard deviation from the exact rollup moments
+        const mean = data.sum / data.count;
+        const variance = Math.max(0, data.sumSquares / data.count - mean * mean);
         const stdDev = Math.sqrt(variance);
 
         // Apply exponential smoothing for stability
@@ -169,62 +193,40 @@ class ThresholdCalibrationService {
             percentile_high: percentileHigh,
             percentile_low: percentileLow,
             method: 'statistical',
-            confidence: this.assessConfidence(values.length, stdDev, mean)
+            confidence: this.assessConfidence(data.count, stdDev, mean)
         };
     }
 
     /**
      * Calculate time-based thresholds (for sensors with day/night patterns like light sensors)
-     * @param {Array} data - Historical data with time information
+     * @param {object} data - Historical distribution with per-hour breakdown
      * @param {number} percentileHigh - High percentile
      * @param {number} percentileLow - Low percentile
      * @returns {object} - Time-based threshold configuration
      */
     async calculateTimeBasedThresholds(data, percentileHigh, percentileLow) {
-        // Group data by hour of day
-        const hourlyData = {};
-        for (let hour = 0; hour < 24; hour++) {
-            hourlyData[hour] = [];
-        }
-
-        data.forEach(point => {
-            hourlyData[point.hour].push(point.value);
-        });
-
         // Calculate thresholds for each hour
         const hourlyThresholds = {};
-        const allValues = [];
 
         for (let hour = 0; hour < 24; hour++) {
-            const hourValues = hourlyData[hour];
-            if (hourValues.length > 0) {
-                hourValues.sort((a, b) => a - b);
-
-                const highIndex = Math.ceil((percentileHigh / 100) * hourValues.length) - 1;
-                const lowIndex = Math.floor((percentileLow / 100) * hourValues.length);
-
+            const hourData = data.hourly[hour];
+            if (hourData && hourData.count > 0) {
                 hourlyThresholds[hour] = {
-                    min: hourValues[lowIndex],
-                    max: hourValues[highIndex],
-                    avg: hourValues.reduce((sum, v) => sum + v, 0) / hourValues.length,
-                    samples: hourValues.length
+                    min: this.distributionPercentile(hourData, percentileLow),
+                    max: this.distributionPercentile(hourData, percentileHigh),
+                    avg: hourData.sum / hourData.count,
+                    samples: hourData.count
                 };
-
-                allValues.push(...hourValues);
             }
         }
 
         // Calculate overall fallback thresholds
-        allValues.sort((a, b) => a - b);
-        const overallHighIndex = Math.ceil((percentileHigh / 100) * allValues.length) - 1;
-        const overallLowIndex = Math.floor((percentileLow / 100) * allValues.length);
-
         return {
-            min_threshold: allValues[overallLowIndex],
-            max_threshold: allValues[overallHighIndex],
+            min_threshold: this.distributionPercentile(data, percentileLow),
+            max_threshold: this.distributionPercentile(data, percentileHigh),
             method: 'time_based',
             hourly_thresholds: hourlyThresholds,
-            confidence: this.assessConfidence(allValues.length, null, null)
+            confidence: this.assessConfidence(data.count, null, null)
         };
     }
 
@@ -280,6 +282,7 @@ class ThresholdCalibrationService {
                 sensorId,
                 deviceId
             ]);
+            deviceConfigService.invalidate(deviceId);
 
             logger.info(`Applied dynamic thresholds to sensor ${sensorId}: [${thresholds.min_threshold}, ${thresholds.max_threshold}]`);
             return true;
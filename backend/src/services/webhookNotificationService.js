@@ -9,8 +9,9 @@ const logger = require('../utils/logger');
 
 class WebhookNotificationService {
     constructor() {
-        this.retryAttempts = 3;
-        this.retryDelay = 1000; // 1 second
+        // First retry of a failed delivery; later ones back off in the
+        // notification queue
+        this.retryDelay = 30 * 1000;
     }
 
     // =====================================================
@@ -76,7 +77,7 @@ class WebhookNotificationService {
             }
         }
 
-        return this.sendWebhook(webhookUrl, payload, 'slack');
+        return this.sendWebhook(webhookUrl, payload, 'slack', {}, options);
     }
 
     // =====================================================
@@ -122,7 +123,7 @@ class WebhookNotificationService {
             }];
         }
 
-        return this.sendWebhook(webhookUrl, payload, 'discord');
+        return this.sendWebhook(webhookUrl, payload, 'discord', {}, options);
     }
 
     // =====================================================
@@ -182,7 +183,7 @@ class WebhookNotificationService {
             ];
         }
 
-        return this.sendWebhook(webhookUrl, payload, 'teams');
+        return this.sendWebhook(webhookUrl, payload, 'teams', {}, options);
     }
 
     // =====================================================
@@ -232,85 +233,93 @@ ${options.alert.message}
             };
         }
 
-        return this.sendWebhook(url, payload, 'telegram');
+        return this.sendWebhook(url, payload, 'telegram', {}, options);
     }
 
     // =====================================================
     // CUSTOM WEBHOOK
     // =====================================================
 
-    async sendCustomWebhook(webhookUrl, payload, headers = {}) {
-        return this.sendWebhook(webhookUrl, payload, 'custom', headers);
+    async sendCustomWebhook(webhookUrl, payload, headers = {}, options = {}) {
+        return this.sendWebhook(webhookUrl, payload, 'custom', headers, options);
     }
 
     // =====================================================
-    // GENERIC WEBHOOK SENDER WITH RETRY
+    // GENERIC WEBHOOK SENDER
     // =====================================================
 
-    async sendWebhook(url, payload, type = 'custom', customHeaders = {}) {
-        let lastError;
+    /**
+     * One delivery attempt. A failure that may succeed later (network
+     * error, 5xx, 429) is handed to the notification queue, which retries
+     * with backoff off the request path; pass `queueRetry: false` when the
+     * caller wants the result only (tests, the queue itself).
+     */
+    async sendWebhook(url, payload, type = 'custom', customHeaders = {}, { queueRetry = true } = {}) {
+        try {
+            const response = await axios.post(url, payload, {
+                headers: {
+                    'Content-Type': 'application/json',
+                    'User-Agent': 'Sensity-Platform/1.0',
+                    ...customHeaders
+                },
+                timeout: 10000 // 10 second timeout
+            });
 
-        for (let attempt = 1; attempt <= this.retryAttempts; attempt++) {
-            try {
-                const response = await axios.post(url, payload, {
-                    headers: {
-                        'Content-Type': 'application/json',
-                        'User-Agent': 'Sensity-Platform/1.0',
-                        ...customHeaders
-                    },
-                    timeout: 10000 // 10 second timeout
-                });
-
-                logger.info(`Webhook sent successfully (${type}):`, {
-                    url: url.substring(0, 50) + '...',
-                    status: response.status,
-                    attempt
-                });
-
-                // Log to database
-                await this.logWebhookDelivery(url, type, payload, 'success', response.status);
-
-                return {
-                    success: true,
-                    status: response.status,
-                    response: response.data
-                };
-            } catch (error) {
-                lastError = error;
-                logger.warn(`Webhook delivery failed (${type}), attempt ${attempt}/${this.retryAttempts}:`, {
-                    url: url.substring(0, 50) + '...',
-                    error: error.message,
-                    status: error.response?.status
-                });
-
-                // Wait before retry (exponential backoff)
-                if (attempt < this.retryAttempts) {
-                    await new Promise(resolve => setTimeout(resolve, this.retryDelay * attempt));
-                }
+            logger.info(`Webhook sent successfully (${type}):`, {
+                url: url.substring(0, 50) + '...',
+                status: response.status
+            });
+
+            // Log to database
+            await this.logWebhookDelivery(url, type, payload, 'success', response.status);
+
+            return {
+                success: true,
+                status: response.status,
+                response: response.data
+            };
+        } catch (error) {
+            const status = error.response?.status;
+            const retryable = status === undefined || status >= 500 || status === 429;
+
+            logger.warn(`Webhook delivery failed (${type}):`, {
+                url: url.substring(0, 50) + '...',
+                error: error.message,
+                status
+            });
+
+            // Log failure to database
+            await this.logWebhookDelivery(url, type, payload, 'failed', status, error.message);
+
+            let queued = false;
+            if (queueRetry && retryable) {
+                queued = await this.queueRetry(url, payload, type, customHeaders);
             }
+
+            return {
+                success: false,
+                error: error.message,
+                status,
+                queued
+            };
         }
+    }
 
-        // All retries failed
-        logger.error(`Webhook delivery failed after ${this.retryAttempts} attempts (${type}):`, {
-            url: url.substring(0, 50) + '...',
-            error: lastError.message
-        });
-
-        // Log failure to database
-        await this.logWebhookDelivery(
-            url,
-            type,
-            payload,
-            'failed',
-            lastError.response?.status,
-            lastError.message
-        );
-
-        return {
-            success: false,
-            error: lastError.message,
-            status: lastError.response?.status
-        };
+    async queueRetry(url, payload, type, customHeaders) {
+        try {
+            // Required here: the queue delivers webhooks through this service
+            const notificationDispatchService = require('./notificationDispatchService');
+            await notificationDispatchService.enqueue([{
+                channel: 'webhook',
+                recipient: url,
+                summary: payload.event || payload.text || `${type} webhook`,
+                message: { body: payload, type, headers: customHeaders }
+            }], { attempts: 1, delayMs: this.retryDelay });
+            return true;
+        } catch (error) {
+            logger.error('Failed to queue webhook retry:', error);
+            return false;
+        }
     }
 
     // =====================================================
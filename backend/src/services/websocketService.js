@@ -8,6 +8,20 @@ class WebSocketService {
         this.redis = redis;
         this.connections = new Map();
         this.userConnections = new Map();
+
+        // Telemetry is coalesced per device room and sent once per frame,
+        // carrying only the latest value per sensor
+        this.telemetryFrameMs = parseInt(process.env.WS_TELEMETRY_FRAME_MS, 10) || 250;
+        // Engine.io packets queued for a socket before it counts as slow
+        this.maxSocketBufferedPackets = parseInt(process.env.WS_MAX_BUFFERED_PACKETS, 10) || 64;
+        this.pendingTelemetry = new Map();
+        this.telemetryTimer = null;
+        this.telemetryStats = {
+            updatesReceived: 0,
+            framesSent: 0,
+            sensorsSent: 0,
+            droppedForSlowClients: 0
+        };
     }
 
     async authenticateSocket(socket, next) {
@@ -39,7 +53,8 @@ class WebSocketService {
         this.connections.set(connectionId, {
             socket: socket,
             userId: userId,
-            connectedAt: new Date()
+            connectedAt: new Date(),
+            droppedFrames: 0
         });
 
         // Track user connections
@@ -279,6 +294,14 @@ class WebSocketService {
         });
     }
 
+    broadcastDeviceStatus(deviceId, status) {
+        this.io.to(`device:${deviceId}`).emit('device_status_update', {
+            device_id: deviceId,
+            status,
+            timestamp: new Date().toISOString()
+        });
+    }
+
     broadcastTelemetryData(deviceId, telemetryData) {
         this.io.to(`device:${deviceId}`).emit('telemetry:data', {
             deviceId,
@@ -295,8 +318,14 @@ class WebSocketService {
         const payloadArray = Array.isArray(sensors) ? sensors : [sensors];
         const timestamp = new Date().toISOString();
 
+        if (!this.pendingTelemetry.has(deviceId)) {
+            this.pendingTelemetry.set(deviceId, new Map());
+        }
+        const pending = this.pendingTelemetry.get(deviceId);
+
         for (const sensor of payloadArray) {
-            this.io.to(`device:${deviceId}`).emit('telemetry_update', {
+            // Later readings for the same sensor replace earlier ones within a frame
+            pending.set(`${sensor.pin}:${sensor.type}`, {
                 device_id: deviceId,
                 pin: sensor.pin,
                 type: sensor.type,
@@ -307,6 +336,60 @@ class WebSocketService {
                 timestamp: sensor.timestamp || timestamp,
                 metadata: sensor.metadata || {}
             });
+            this.telemetryStats.updatesReceived++;
+        }
+
+        this.scheduleTelemetryFrame();
+    }
+
+    scheduleTelemetryFrame() {
+        if (this.telemetryTimer) return;
+        this.telemetryTimer = setTimeout(() => {
+            this.telemetryTimer = null;
+            this.flushTelemetryFrame();
+        }, this.telemetryFrameMs);
+        this.telemetryTimer.unref?.();
+    }
+
+    flushTelemetryFrame() {
+        const frame = this.pendingTelemetry;
+        this.pendingTelemetry = new Map();
+        const timestamp = new Date().toISOString();
+
+        for (const [deviceId, sensors] of frame) {
+            const room = `device:${deviceId}`;
+            const members = this.io.sockets.adapter.rooms.get(room);
+            if (!members || members.size === 0) {
+                continue;
+            }
+
+            // Skip subscribers whose transport is still draining earlier
+            // frames; they get the next frame instead of an ever-growing buffer
+            const slow = [];
+            for (const socketId of members) {
+                const socket = this.io.sockets.sockets.get(socketId);
+                const buffered = socket?.conn?.writeBuffer?.length || 0;
+                if (buffered > this.maxSocketBufferedPackets) {
+                    slow.push(socketId);
+                    const connection = this.connections.get(socketId);
+                    if (connection) connection.droppedFrames++;
+                }
+            }
+
+            this.telemetryStats.droppedForSlowClients += slow.length;
+            if (slow.length === members.size) {
+                continue;
+            }
+
+            const target = slow.length > 0 ? this.io.to(room).except(slow) : this.io.to(room);
+            target.emit('telemetry_batch', {
+                device_id: deviceId,
+                updates: Array.from(sensors.values()),
+                timestamp
+            });
+
+            this.telemetryStats.framesSent++;
+            this.telemetryStats.sensorsSent += sensors.size;
         }
     }
 
@@ -347,9 +430,22 @@ class WebSocketService {
             connectionsByUser: Array.from(this.userConnections.entries()).map(([userId, connections]) => ({
                 userId,
                 connectionCount: connections.size
-            }))
+            })),
+            telemetry: {
+                frameMs: this.telemetryFrameMs,
+                pendingDevices: this.pendingTelemetry.size,
+                ...this.telemetryStats
+            }
         };
     }
+
+    shutdown() {
+        if (this.telemetryTimer) {
+            clearTimeout(this.telemetryTimer);
+            this.telemetryTimer = null;
+        }
+        this.flushTelemetryFrame();
+    }
 }
 
 module.exports = WebSocketService;
@@ -0,0 +1,87 @@
+/**
+ * Pre/post-trigger capture windows uploaded by firmware after a threshold
+ * alert. A window is a fixed header followed by raw int16 samples taken at
+ * a rate well above telemetry; the trigger is sample `preSamples`.
+ *
+ * Layout (little-endian):
+ *   0  "SCAP"              4  version u8         5  flags u8 (bit 0 = analog)
+ *   6  rate_hz u16         8  pre_samples u16   10  post_samples u16
+ *  12  cal_multiplier f32 16  cal_offset f32
+ *  20  pin u8 (+3 reserved)                     24  trigger_age_ms u32
+ *  28  int16 samples, oldest first
+ */
+
+const CAPTURE_MAGIC = 'SCAP';
+const CAPTURE_HEADER_SIZE = 28;
+const CAPTURE_VERSION = 1;
+
+// ESP8266 reports A0 as pin 17
+const ESP8266_A0 = 17;
+
+/**
+ * Decode and validate a capture blob. Throws on anything malformed.
+ */
+function parseCapture(buffer) {
+    if (!Buffer.isBuffer(buffer) || buffer.length < CAPTURE_HEADER_SIZE) {
+        throw new Error('Capture too short');
+    }
+    if (buffer.toString('latin1', 0, 4) !== CAPTURE_MAGIC) {
+        throw new Error('Not a capture blob');
+    }
+
+    const version = buffer.readUInt8(4);
+    if (version !== CAPTURE_VERSION) {
+        throw new Error(`Unsupported capture version ${version}`);
+    }
+
+    const sampleRateHz = buffer.readUInt16LE(6);
+    const preSamples = buffer.readUInt16LE(8);
+    const postSamples = buffer.readUInt16LE(10);
+    const sampleCount = preSamples + postSamples;
+    if (sampleRateHz === 0 || buffer.length !== CAPTURE_HEADER_SIZE + sampleCount * 2) {
+        throw new Error('Capture length does not match its header');
+    }
+
+    const multiplier = buffer.readFloatLE(12);
+    const offset = buffer.readFloatLE(16);
+    const pin = buffer.readUInt8(20);
+
+    const samples = new Array(sampleCount);
+    for (let i = 0; i < sampleCount; i++) {
+        samples[i] = buffer.readInt16LE(CAPTURE_HEADER_SIZE + i * 2);
+    }
+
+    return {
+        version,
+        analog: (buffer.readUInt8(5) & 1) === 1,
+        sampleRateHz,
+        preSamples,
+        postSamples,
+        calibrationMultiplier: Number.isFinite(multiplier) ? multiplier : 1,
+        calibrationOffset: Number.isFinite(offset) ? offset : 0,
+        pin: pin === ESP8266_A0 ? 'A0' : String(pin),
+        triggerAgeMs: buffer.readUInt32LE(24),
+        samples
+    };
+}
+
+/**
+ * Series for charts: offsets in ms relative to the trigger, raw samples and
+ * calibrated values (analog channels only; digital samples are 0/1).
+ */
+function captureSeries(capture) {
+    const periodMs = 1000 / capture.sampleRateHz;
+    return capture.samples.map((raw, index) => ({
+        offset_ms: Math.round((index - capture.preSamples) * periodMs),
+        raw,
+        value: capture.analog
+            ? raw * capture.calibrationMultiplier + capture.calibrationOffset
+            : raw
+    }));
+}
+
+module.exports = {
+    CAPTURE_HEADER_SIZE,
+    parseCapture,
+    captureSeries
+};
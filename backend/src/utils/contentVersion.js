@@ -0,0 +1,16 @@
+/**
+ * Content version of a serialized config (FNV-1a over the text). Every
+ * process derives the same version from the same rows, so devices can
+ * report the version they run to any API or ingress worker. Never 0, which
+ * is what a device reports before it has received anything.
+ */
+function contentVersion(text) {
+    let hash = 0x811c9dc5;
+    for (let i = 0; i < text.length; i++) {
+        hash ^= text.charCodeAt(i);
+        hash = Math.imul(hash, 0x01000193) >>> 0;
+    }
+    return hash || 1;
+}
+
+module.exports = { contentVersion };
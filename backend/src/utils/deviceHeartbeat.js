@@ -0,0 +1,68 @@
+const db = require('../models/database');
+const logger = require('./logger');
+const { parseBootTimings } = require('./deviceTiming');
+const { parseWifiStats } = require('./wifiStats');
+
+/**
+ * Store what a heartbeat reports about the device: firmware version,
+ * uptime and RSSI, plus the optional diagnostics (buffer pools, TLS,
+ * Modbus counters, roaming stats, boot timings). Shared by the API
+ * server's heartbeat route and the device ingress so both record the
+ * same thing. Fields the device leaves out keep their stored values.
+ * last_heartbeat, status and IP are left to the caller (livenessService).
+ * Returns false when no such device exists.
+ */
+async function recordHeartbeat(deviceId, payload = {}) {
+    const result = await db.query(`
+        UPDATE devices
+        SET firmware_version = COALESCE($1, firmware_version),
+            uptime_seconds = COALESCE($2, uptime_seconds),
+            wifi_signal_strength = COALESCE($3, wifi_signal_strength)
+        WHERE id = $4
+    `, [payload.firmware_version, payload.uptime, payload.wifi_rssi, deviceId]);
+    if (result.rowCount === 0) {
+        return false;
+    }
+
+    // Firmware buffer pool occupancy/failure counters
+    if (Array.isArray(payload.buffer_pools)) {
+        logger.logDeviceActivity(deviceId, 'buffer_pools', {
+            buffer_pools: payload.buffer_pools,
+            pool_heap_fallbacks: payload.pool_heap_fallbacks
+        });
+    }
+
+    // TLS handshake timings and connection reuse
+    if (payload.tls && typeof payload.tls === 'object') {
+        logger.logDeviceActivity(deviceId, 'tls', payload.tls);
+    }
+
+    // Modbus bus counters; the map itself goes back in the response
+    if (payload.modbus && typeof payload.modbus === 'object') {
+        logger.logDeviceActivity(deviceId, 'modbus', payload.modbus);
+    }
+
+    // Roaming state and per-AP statistics
+    const wifiStats = parseWifiStats(payload.wifi);
+    if (wifiStats) {
+        await db.query(
+            'UPDATE devices SET wifi_stats = $1, wifi_stats_at = CURRENT_TIMESTAMP WHERE id = $2',
+            [JSON.stringify(wifiStats), deviceId]
+        );
+    }
+
+    // Boot-phase timings, sent in the first heartbeat after each boot
+    const bootTimings = parseBootTimings(payload.boot);
+    if (bootTimings) {
+        await db.query(`
+            UPDATE devices
+            SET boot_timings = $1,
+                last_boot_at = CURRENT_TIMESTAMP - make_interval(secs => COALESCE($2, 0))
+            WHERE id = $3
+        `, [JSON.stringify(bootTimings), payload.uptime, deviceId]);
+        logger.logDeviceActivity(deviceId, 'boot', bootTimings);
+    }
+    return true;
+}
+
+module.exports = { recordHeartbeat };
@@ -0,0 +1,67 @@
+// Readings buffered on a device longer than this are stamped on arrival
+const MAX_SAMPLE_AGE_MS = 24 * 60 * 60 * 1000;
+
+const BOOT_TIMING_FIELDS = [
+    'sensors_ready_ms',
+    'first_sample_ms',
+    'wifi_connected_ms',
+    'ota_checked_ms',
+    'first_heartbeat_ms'
+];
+
+/**
+ * Sample time of a telemetry request. Firmware that buffered readings while
+ * its link was down sends X-Sample-Age-Ms (time since sampling); without it
+ * the reading is taken to be current.
+ */
+function sampleTimeFromRequest(req, now = Date.now()) {
+    const age = parseInt(req.headers['x-sample-age-ms'], 10);
+    if (!Number.isFinite(age) || age <= 0 || age > MAX_SAMPLE_AGE_MS) {
+        return now;
+    }
+    return now - age;
+}
+
+/**
+ * Sample time of one payload in a batched upload. Readings replayed from a
+ * device-side ring (e.g. the ESP32 ULP watch) carry their own
+ * `sample_age_ms`, measured from when the request was sent; payloads
+ * without it fall back to the request's sample time.
+ */
+function sampleTimeFromPayload(payload, fallback, now = Date.now()) {
+    const age = Number(payload?.sample_age_ms);
+    if (!Number.isFinite(age) || age <= 0 || age > MAX_SAMPLE_AGE_MS) {
+        return fallback;
+    }
+    return now - age;
+}
+
+/**
+ * Boot-phase timings from a heartbeat's `boot` object (ms since reset),
+ * limited to the known fields. Returns null when there are none.
+ */
+function parseBootTimings(boot) {
+    if (!boot || typeof boot !== 'object') {
+        return null;
+    }
+
+    const timings = {};
+    for (const field of BOOT_TIMING_FIELDS) {
+        const value = Number(boot[field]);
+        if (Number.isFinite(value) && value >= 0) {
+            timings[field] = Math.round(value);
+        }
+    }
+    if (boot.reset_reason !== undefined) {
+        timings.reset_reason = String(boot.reset_reason).substring(0, 64);
+    }
+
+    return Object.keys(timings).length > 0 ? timings : null;
+}
+
+module.exports = {
+    MAX_SAMPLE_AGE_MS,
+    sampleTimeFromRequest,
+    sampleTimeFromPayload,
+    parseBootTimings
+};
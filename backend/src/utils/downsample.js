@@ -0,0 +1,178 @@
+/**
+ * Streaming downsamplers for chart series. Rows are pushed in timestamp
+ * order (e.g. straight from a DB cursor) and at most `maxPoints` rows come
+ * out of finish(); only the rows of the current time bucket are held.
+ *
+ * Buckets are fixed-width slices of [start, end] rather than equal-count
+ * slices, so the input length does not need to be known up front.
+ */
+
+const timeOf = row => new Date(row.timestamp).getTime();
+const valueOf = row => Number(row.value);
+
+/**
+ * Largest-Triangle-Three-Buckets. Keeps the first and last row and, for each
+ * bucket, the row forming the largest triangle with the previously kept row
+ * and the average of the next bucket. Needs one bucket of lookahead.
+ */
+class LttbDownsampler {
+    constructor(startDate, endDate, maxPoints) {
+        this.start = startDate.getTime();
+        this.bucketCount = Math.max(1, maxPoints - 2);
+        this.bucketWidth = Math.max(1, (endDate.getTime() - this.start) / this.bucketCount);
+
+        this.output = [];
+        this.anchor = null;     // last row kept
+        this.waiting = null;    // complete bucket awaiting the next bucket's average
+        this.current = [];
+        this.currentIndex = -1;
+        this.inputCount = 0;
+    }
+
+    bucketIndex(row) {
+        const index = Math.floor((timeOf(row) - this.start) / this.bucketWidth);
+        return Math.min(this.bucketCount - 1, Math.max(0, index));
+    }
+
+    push(row) {
+        this.inputCount++;
+
+        if (this.anchor === null) {
+            this.anchor = row;
+            this.output.push(row);
+            return;
+        }
+
+        const index = this.bucketIndex(row);
+        if (index !== this.currentIndex && this.current.length > 0) {
+            this.closeBucket();
+        }
+        this.currentIndex = index;
+        this.current.push(row);
+    }
+
+    closeBucket() {
+        if (this.waiting) {
+            this.select(this.waiting, LttbDownsampler.average(this.current));
+        }
+        this.waiting = this.current;
+        this.current = [];
+    }
+
+    static average(rows) {
+        let t = 0;
+        let v = 0;
+        for (const row of rows) {
+            t += timeOf(row);
+            v += valueOf(row);
+        }
+        return { t: t / rows.length, v: v / rows.length };
+    }
+
+    select(bucket, next) {
+        const at = timeOf(this.anchor);
+        const av = valueOf(this.anchor);
+        let best = bucket[0];
+        let bestArea = -1;
+
+        for (const row of bucket) {
+            const area = Math.abs((at - next.t) * (valueOf(row) - av) - (at - timeOf(row)) * (next.v - av));
+            if (area > bestArea) {
+                bestArea = area;
+                best = row;
+            }
+        }
+
+        this.output.push(best);
+        this.anchor = best;
+    }
+
+    finish() {
+        // The final row is always kept and acts as the last "next bucket"
+        const last = this.current.pop();
+        if (last === undefined) {
+            return this.output;
+        }
+
+        const lastPoint = { t: timeOf(last), v: valueOf(last) };
+        if (this.waiting) {
+            this.select(this.waiting, this.current.length > 0 ? LttbDownsampler.average(this.current) : lastPoint);
+        }
+        if (this.current.length > 0) {
+            this.select(this.current, lastPoint);
+        }
+        this.output.push(last);
+        return this.output;
+    }
+}
+
+/**
+ * Min/max per bucket: emits the lowest and highest row of each bucket in
+ * time order, so spikes survive regardless of zoom. Rollup rows contribute
+ * their min_value/max_value; the emitted row's value is set to that extreme.
+ */
+class MinMaxDownsampler {
+    constructor(startDate, endDate, maxPoints) {
+        this.start = startDate.getTime();
+        this.bucketCount = Math.max(1, Math.floor(maxPoints / 2));
+        this.bucketWidth = Math.max(1, (endDate.getTime() - this.start) / this.bucketCount);
+
+        this.output = [];
+        this.low = null;
+        this.high = null;
+        this.currentIndex = -1;
+        this.inputCount = 0;
+    }
+
+    push(row) {
+        this.inputCount++;
+
+        const index = Math.min(this.bucketCount - 1,
+            Math.max(0, Math.floor((timeOf(row) - this.start) / this.bucketWidth)));
+        if (index !== this.currentIndex) {
+            this.flushBucket();
+            this.currentIndex = index;
+        }
+
+        const min = row.min_value !== undefined && row.min_value !== null ? Number(row.min_value) : valueOf(row);
+        const max = row.max_value !== undefined && row.max_value !== null ? Number(row.max_value) : valueOf(row);
+
+        if (this.low === null || min < this.low.value) this.low = { row, value: min };
+        if (this.high === null || max > this.high.value) this.high = { row, value: max };
+    }
+
+    flushBucket() {
+        if (this.low === null) return;
+
+        const points = [this.low, this.high].sort((a, b) => timeOf(a.row) - timeOf(b.row));
+        this.output.push({ ...points[0].row, value: points[0].value });
+        if (points[0].row !== points[1].row || points[0].value !== points[1].value) {
+            this.output.push({ ...points[1].row, value: points[1].value });
+        }
+
+        this.low = null;
+        this.high = null;
+    }
+
+    finish() {
+        this.flushBucket();
+        return this.output;
+    }
+}
+
+const DOWNSAMPLERS = {
+    lttb: LttbDownsampler,
+    minmax: MinMaxDownsampler
+};
+
+function createDownsampler(method, startDate, endDate, maxPoints) {
+    const Downsampler = DOWNSAMPLERS[method] || LttbDownsampler;
+    return new Downsampler(startDate, endDate, maxPoints);
+}
+
+module.exports = {
+    LttbDownsampler,
+    MinMaxDownsampler,
+    DOWNSAMPLE_METHODS: Object.keys(DOWNSAMPLERS),
+    createDownsampler
+};
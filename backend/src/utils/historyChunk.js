@@ -0,0 +1,83 @@
+/**
+ * Full-resolution history uploaded by firmware in answer to a backfill
+ * request. A range is streamed as one or more self-contained chunks; each
+ * chunk holds one sensor's samples, delta-encoded as varints so a slowly
+ * changing series costs two or three bytes per sample.
+ *
+ * Layout (little-endian):
+ *   0  "SHIS"              4  version u8         5  reserved u8
+ *   6  value_scale u16     8  base_time_s u32   12  base_time_ms u16
+ *  14  count u16          16  base_value i32 (value * value_scale)
+ *  20  count x { varint time delta (ms), zigzag varint value delta }
+ *
+ * Deltas are taken from the previous sample; the first one is relative to
+ * the base, so a chunk decodes without any other chunk.
+ */
+
+const HISTORY_MAGIC = 'SHIS';
+const HISTORY_HEADER_SIZE = 20;
+const HISTORY_VERSION = 1;
+
+function readVarint(buffer, state) {
+    let result = 0;
+    let shift = 0;
+    while (state.offset < buffer.length) {
+        const byte = buffer[state.offset++];
+        result += (byte & 0x7f) * 2 ** shift;
+        if ((byte & 0x80) === 0) {
+            return result;
+        }
+        shift += 7;
+        if (shift > 49) break;
+    }
+    throw new Error('Truncated history chunk');
+}
+
+const unzigzag = (value) => (value % 2 === 0 ? value / 2 : -(value + 1) / 2);
+
+/**
+ * Decode and validate a history chunk. Sample times are epoch ms.
+ * Throws on anything malformed.
+ */
+function parseHistoryChunk(buffer) {
+    if (!Buffer.isBuffer(buffer) || buffer.length < HISTORY_HEADER_SIZE) {
+        throw new Error('History chunk too short');
+    }
+    if (buffer.toString('latin1', 0, 4) !== HISTORY_MAGIC) {
+        throw new Error('Not a history chunk');
+    }
+
+    const version = buffer.readUInt8(4);
+    if (version !== HISTORY_VERSION) {
+        throw new Error(`Unsupported history version ${version}`);
+    }
+
+    const scale = buffer.readUInt16LE(6);
+    if (scale === 0) {
+        throw new Error('History chunk has no value scale');
+    }
+
+    const count = buffer.readUInt16LE(14);
+    let time = buffer.readUInt32LE(8) * 1000 + buffer.readUInt16LE(12);
+    let scaled = buffer.readInt32LE(16);
+
+    const times = new Array(count);
+    const values = new Array(count);
+    const state = { offset: HISTORY_HEADER_SIZE };
+    for (let i = 0; i < count; i++) {
+        time += readVarint(buffer, state);
+        scaled += unzigzag(readVarint(buffer, state));
+        times[i] = time;
+        values[i] = scaled / scale;
+    }
+    if (state.offset !== buffer.length) {
+        throw new Error('History chunk length does not match its header');
+    }
+
+    return { version, scale, count, times, values };
+}
+
+module.exports = {
+    HISTORY_HEADER_SIZE,
+    parseHistoryChunk
+};
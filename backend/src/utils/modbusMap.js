@@ -0,0 +1,108 @@
+/**
+ * Modbus RTU register maps for firmware with an RS-485 bus.
+ *
+ * A map is a list of points (slave, function code, register address, data
+ * type, scale) each reported by the device as its own sensor. Firmware
+ * reads the map from the heartbeat response and coalesces neighbouring
+ * registers into single reads, so the map itself stays one entry per value.
+ */
+
+const { contentVersion } = require('./contentVersion');
+
+const DATA_TYPES = ['u16', 'i16', 'u32', 'i32', 'f32', 'u32s', 'i32s', 'f32s'];
+const FUNCTION_CODES = [3, 4];     // read holding / input registers
+const MAX_POINTS = 16;             // ESP32 firmware reads up to 16 (ESP8266: 8)
+
+const registerWords = (type) => (type === 'u16' || type === 'i16' ? 1 : 2);
+
+/**
+ * Pin name a point is reported under: "H" for holding registers, "I" for
+ * input registers, then slave and address ("H1.100"). At most 10
+ * characters, the width of device_sensors.pin.
+ */
+function modbusPinName(point) {
+    return `${point.function_code === 4 ? 'I' : 'H'}${point.slave_id}.${point.register_address}`;
+}
+
+/**
+ * Check a map submitted through the API. Returns an error message, or null
+ * when every point is usable.
+ */
+function validateModbusPoints(points) {
+    if (!Array.isArray(points)) {
+        return 'points must be an array';
+    }
+    if (points.length > MAX_POINTS) {
+        return `A device reads at most ${MAX_POINTS} Modbus points`;
+    }
+
+    const pins = new Set();
+    for (const [index, point] of points.entries()) {
+        const where = `points[${index}]`;
+        if (!Number.isInteger(point?.slave_id) || point.slave_id < 1 || point.slave_id > 247) {
+            return `${where}.slave_id must be 1-247`;
+        }
+        if (!FUNCTION_CODES.includes(point.function_code)) {
+            return `${where}.function_code must be 3 (holding) or 4 (input)`;
+        }
+        if (!DATA_TYPES.includes(point.data_type)) {
+            return `${where}.data_type must be one of ${DATA_TYPES.join(', ')}`;
+        }
+        if (!Number.isInteger(point.register_address) || point.register_address < 0 ||
+            point.register_address + registerWords(point.data_type) > 65536) {
+            return `${where}.register_address is out of range`;
+        }
+        if (point.scale !== undefined && (!Number.isFinite(point.scale) || point.scale === 0)) {
+            return `${where}.scale must be a non-zero number`;
+        }
+        if (typeof point.sensor_type !== 'string' || point.sensor_type.length === 0) {
+            return `${where}.sensor_type is required`;
+        }
+        if (point.threshold_min != null && point.threshold_max != null &&
+            !(Number(point.threshold_min) < Number(point.threshold_max))) {
+            return `${where}.threshold_min must be below threshold_max`;
+        }
+
+        const pin = modbusPinName(point);
+        if (pins.has(pin)) {
+            return `${where} reads the same register as an earlier point`;
+        }
+        pins.add(pin);
+    }
+    return null;
+}
+
+/**
+ * Stored rows in the shape firmware reads from `config.modbus.points`
+ */
+function toDeviceFormat(rows) {
+    return rows.map(row => ({
+        pin: modbusPinName(row),
+        slave: row.slave_id,
+        function: row.function_code,
+        address: row.register_address,
+        type: row.data_type,
+        scale: Number(row.scale),
+        sensor_type: String(row.sensor_type).toLowerCase(),
+        threshold_min: row.threshold_min != null ? Number(row.threshold_min) : 0,
+        threshold_max: row.threshold_max != null ? Number(row.threshold_max) : 0
+    }));
+}
+
+/**
+ * Content version of a device-format map. Devices report the version they
+ * run and only get the points when it differs; 0 is what a device without
+ * a map reports, so an empty map is 0 too.
+ */
+function modbusMapVersion(devicePoints) {
+    return devicePoints.length === 0 ? 0 : contentVersion(JSON.stringify(devicePoints));
+}
+
+module.exports = {
+    DATA_TYPES,
+    MAX_MODBUS_POINTS: MAX_POINTS,
+    modbusPinName,
+    validateModbusPoints,
+    toDeviceFormat,
+    modbusMapVersion
+};
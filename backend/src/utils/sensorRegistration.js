@@ -0,0 +1,67 @@
+const db = require('../models/database');
+const logger = require('./logger');
+const deviceConfigService = require('../services/deviceConfigService');
+
+// Firmware type names that differ from sensor_types.name
+const SENSOR_TYPE_ALIASES = {
+    light: 'Photodiode',
+    pulse_count: 'Pulse Count',
+    pulse_rate: 'Pulse Rate',
+    pulse_total: 'Pulse Total'
+};
+
+const sensorTypeName = (type) => SENSOR_TYPE_ALIASES[type] || type;
+
+/**
+ * Create device_sensors rows for readings on pins the server has not seen
+ * yet, e.g. DS18B20 probes found by the device's ROM search. `readings` is
+ * a list of { deviceId, pin, type, name }. Readings whose type is unknown,
+ * whose device does not exist or whose pin is already taken are skipped.
+ * Returns the created rows as { id, device_id, pin, type }, with `type`
+ * the sensor_types name.
+ */
+async function registerSensors(readings) {
+    if (readings.length === 0) {
+        return [];
+    }
+
+    const keys = { deviceIds: [], pins: [], types: [], names: [] };
+    for (const reading of readings) {
+        keys.deviceIds.push(reading.deviceId);
+        keys.pins.push(String(reading.pin));
+        keys.types.push(sensorTypeName(reading.type));
+        keys.names.push(String(reading.name || `${reading.type} Sensor`).slice(0, 100));
+    }
+
+    const result = await db.query(`
+        WITH created AS (
+            INSERT INTO device_sensors (device_id, sensor_type_id, pin, name, enabled)
+            SELECT DISTINCT ON (k.device_id, k.pin) k.device_id, st.id, k.pin, k.name, true
+            FROM UNNEST($1::varchar[], $2::varchar[], $3::varchar[], $4::varchar[]) AS k(device_id, pin, type, name)
+            JOIN sensor_types st ON LOWER(st.name) = LOWER(k.type)
+            JOIN devices d ON d.id = k.device_id
+            ON CONFLICT (device_id, pin) DO NOTHING
+            RETURNING id, device_id, pin, sensor_type_id
+        )
+        SELECT c.id, c.device_id, c.pin, st.name AS type
+        FROM created c
+        JOIN sensor_types st ON st.id = c.sensor_type_id
+    `, [keys.deviceIds, keys.pins, keys.types, keys.names]);
+
+    const devices = new Set();
+    for (const row of result.rows) {
+        devices.add(row.device_id);
+        logger.info(`Auto-created enabled sensor: ${row.type} on pin ${row.pin} for device ${row.device_id}`);
+    }
+    for (const deviceId of devices) {
+        deviceConfigService.invalidate(deviceId);
+    }
+
+    return result.rows;
+}
+
+module.exports = {
+    SENSOR_TYPE_ALIASES,
+    sensorTypeName,
+    registerSensors
+};
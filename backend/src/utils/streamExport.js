@@ -0,0 +1,172 @@
+const zlib = require('zlib');
+const db = require('../models/database');
+const logger = require('./logger');
+
+const EXPORT_FORMATS = ['csv', 'ndjson', 'json', 'columnar'];
+
+const CONTENT_TYPES = {
+    csv: 'text/csv',
+    ndjson: 'application/x-ndjson',
+    json: 'application/json',
+    columnar: 'application/x-ndjson'
+};
+
+const EXTENSIONS = {
+    csv: 'csv',
+    ndjson: 'ndjson',
+    json: 'json',
+    columnar: 'columnar.ndjson'
+};
+
+// Escape a value for CSV output
+function escapeCsvValue(value) {
+    if (value === null || value === undefined) {
+        return '';
+    }
+
+    const stringValue = value instanceof Date ? value.toISOString() : String(value);
+
+    // If the value contains comma, quote, or newline, wrap it in quotes and escape quotes
+    if (stringValue.includes(',') || stringValue.includes('"') || stringValue.includes('\n')) {
+        return `"${stringValue.replace(/"/g, '""')}"`;
+    }
+
+    return stringValue;
+}
+
+/**
+ * Serialise one cursor batch. `columns` is a list of { key, header, value? }
+ * where value(row) overrides row[key]. Returns the text to write.
+ */
+function formatBatch(format, columns, rows, isFirstBatch) {
+    const pick = (row, column) => (column.value ? column.value(row) : row[column.key]);
+
+    switch (format) {
+        case 'csv':
+            return rows.map(row => columns.map(column => escapeCsvValue(pick(row, column))).join(',')).join('\n') + '\n';
+
+        case 'ndjson':
+            return rows.map(row => {
+                const record = {};
+                for (const column of columns) record[column.key] = pick(row, column);
+                return JSON.stringify(record);
+            }).join('\n') + '\n';
+
+        case 'columnar': {
+            // One line per batch holding column arrays, so consumers can load
+            // chunks straight into columnar frames
+            const chunk = { rows: rows.length };
+            for (const column of columns) chunk[column.key] = rows.map(row => pick(row, column));
+            return JSON.stringify(chunk) + '\n';
+        }
+
+        default: {
+            const body = rows.map(row => {
+                const record = {};
+                for (const column of columns) record[column.key] = pick(row, column);
+                return JSON.stringify(record);
+            }).join(',');
+            return (isFirstBatch ? '' : ',') + body;
+        }
+    }
+}
+
+/**
+ * Stream a query to the response through a server-side cursor. Each batch is
+ * serialised and written as it arrives; the next FETCH waits for 'drain' when
+ * the socket (or gzip stream) is backed up, so memory stays at one batch
+ * regardless of export size. Headers are sent with the first batch, so an
+ * empty result can still be answered by onEmpty (e.g. a 404).
+ *
+ * @returns {Promise<number>} rows written
+ */
+async function streamQueryExport(res, {
+    sql,
+    params = [],
+    columns,
+    format = 'csv',
+    gzip = false,
+    filename,
+    jsonKey = 'data',
+    batchSize = 2000,
+    onEmpty = null
+}) {
+    let output = null;
+    let aborted = false;
+    let written = 0;
+
+    // Client went away: stop fetching and release any pending drain wait
+    res.on('close', () => {
+        if (!res.writableFinished) aborted = true;
+    });
+
+    const write = (chunk) => new Promise((resolve) => {
+        if (aborted || output.write(chunk)) return resolve();
+
+        const done = () => {
+            output.off('drain', done);
+            res.off('close', done);
+            resolve();
+        };
+        output.once('drain', done);
+        res.once('close', done);
+    });
+
+    const start = async () => {
+        res.setHeader('Content-Type', gzip ? 'application/gzip' : CONTENT_TYPES[format]);
+        res.setHeader('Content-Disposition',
+            `attachment; filename="${filename}.${EXTENSIONS[format]}${gzip ? '.gz' : ''}"`);
+
+        if (gzip) {
+            output = zlib.createGzip();
+            output.pipe(res);
+        } else {
+            output = res;
+        }
+
+        if (format === 'csv') {
+            await write(columns.map(column => escapeCsvValue(column.header || column.key)).join(',') + '\n');
+        } else if (format === 'json') {
+            await write(`{"${jsonKey}":[`);
+        }
+    };
+
+    try {
+        await db.cursorQuery(sql, params, async (rows) => {
+            if (aborted) return false;
+            if (!output) await start();
+
+            await write(formatBatch(format, columns, rows, written === 0));
+            written += rows.length;
+            return !aborted;
+        }, { batchSize });
+    } catch (error) {
+        if (!output) throw error;
+
+        // Headers are already out; the only signal left is a truncated stream
+        logger.error('Export stream failed mid-response:', error);
+        res.destroy(error);
+        return written;
+    }
+
+    if (!output) {
+        if (onEmpty) {
+            onEmpty(res);
+            return 0;
+        }
+        await start();
+    }
+
+    if (format === 'json') {
+        await write(']}');
+    }
+    output.end();
+
+    return written;
+}
+
+module.exports = {
+    EXPORT_FORMATS,
+    escapeCsvValue,
+    streamQueryExport
+};
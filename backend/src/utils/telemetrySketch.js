@@ -0,0 +1,137 @@
+/**
+ * Helpers for the log-bucketed value sketches stored on the 1h/1d rollup
+ * tiers (see migration 008). A sketch is a JSON object of key -> count where
+ * 'z' holds values near zero and 'p<k>' / 'n<k>' hold values in
+ * (gamma^(k-1), gamma^k] and its negative mirror. Every bucket's
+ * representative value is within ~1% of any reading that landed in it.
+ */
+
+const GAMMA = 1.02;
+
+function keyValue(key) {
+    if (key === 'z') return 0;
+    const magnitude = 2 * Math.pow(GAMMA, parseInt(key.slice(1), 10)) / (GAMMA + 1);
+    return key[0] === 'n' ? -magnitude : magnitude;
+}
+
+/**
+ * Sketch object -> [{ value, count }] sorted ascending, plus the total count.
+ */
+function toBins(sketch) {
+    const bins = [];
+    let total = 0;
+
+    for (const [key, rawCount] of Object.entries(sketch || {})) {
+        const count = Number(rawCount);
+        if (!(count > 0)) continue;
+        bins.push({ value: keyValue(key), count });
+        total += count;
+    }
+
+    bins.sort((a, b) => a.value - b.value);
+    return { bins, total };
+}
+
+function merge(...sketches) {
+    const merged = {};
+    for (const sketch of sketches) {
+        for (const [key, count] of Object.entries(sketch || {})) {
+            merged[key] = (merged[key] || 0) + Number(count);
+        }
+    }
+    return merged;
+}
+
+/**
+ * Value at percentile p (0-100), using the same rank interpolation as
+ * analyticsService.percentile() on a sorted array.
+ */
+function quantile({ bins, total }, p) {
+    if (total === 0) return null;
+
+    const valueAtRank = (rank) => {
+        let seen = 0;
+        for (const bin of bins) {
+            seen += bin.count;
+            if (rank < seen) return bin.value;
+        }
+        return bins[bins.length - 1].value;
+    };
+
+    const index = (p / 100) * (total - 1);
+    const lower = Math.floor(index);
+    const weight = index - lower;
+    const lowerValue = valueAtRank(lower);
+    if (weight === 0) return lowerValue;
+
+    return lowerValue * (1 - weight) + valueAtRank(lower + 1) * weight;
+}
+
+/**
+ * Median absolute deviation around `center`, from the bin representatives.
+ */
+function medianAbsoluteDeviation({ bins, total }, center) {
+    const deviations = bins
+        .map(bin => ({ value: Math.abs(bin.value - center), count: bin.count }))
+        .sort((a, b) => a.value - b.value);
+    return quantile({ bins: deviations, total }, 50);
+}
+
+function countOutside({ bins }, lower, upper) {
+    return bins.reduce((acc, bin) => acc + (bin.value < lower || bin.value > upper ? bin.count : 0), 0);
+}
+
+/**
+ * Summary in the shape of analyticsService.calculateStatistics(). Moments
+ * (count/sum/sum of squares/min/max) are exact from the rollups; percentiles
+ * come from the sketch and are clamped to the exact min/max.
+ */
+function summarize(sketch, { count, sum, sumSquares, min, max }) {
+    if (!count) return null;
+
+    const histogram = toBins(sketch);
+    const mean = sum / count;
+    const variance = Math.max(0, sumSquares / count - mean * mean);
+    const clamp = (value) => Math.min(max, Math.max(min, value === null ? mean : value));
+    const round = (value) => Math.round(value * 1000) / 1000;
+
+    const q1 = clamp(quantile(histogram, 25));
+    const median = clamp(quantile(histogram, 50));
+    const q3 = clamp(quantile(histogram, 75));
+    const iqr = q3 - q1;
+
+    // Outliers counted against the sketch; scaled in case some buckets
+    // predate the sketch column and only contribute to the moments
+    const outlierCount = histogram.total > 0
+        ? Math.round(countOutside(histogram, q1 - 1.5 * iqr, q3 + 1.5 * iqr) * count / histogram.total)
+        : 0;
+
+    return {
+        count,
+        min,
+        max,
+        mean: round(mean),
+        median: round(median),
+        stdDev: round(Math.sqrt(variance)),
+        variance: round(variance),
+        q1: round(q1),
+        q3: round(q3),
+        iqr: round(iqr),
+        p5: round(clamp(quantile(histogram, 5))),
+        p95: round(clamp(quantile(histogram, 95))),
+        p99: round(clamp(quantile(histogram, 99))),
+        outlierCount,
+        outlierPercentage: Math.round((outlierCount / count) * 100 * 10) / 10,
+        distinctBins: histogram.bins.length
+    };
+}
+
+module.exports = {
+    GAMMA,
+    keyValue,
+    toBins,
+    merge,
+    quantile,
+    medianAbsoluteDeviation,
+    summarize
+};
@@ -0,0 +1,50 @@
+const BSSID_PATTERN = /^[0-9A-F]{2}(:[0-9A-F]{2}){5}$/;
+const MAX_APS = 16;
+
+const count = (value) => {
+    const number = Number(value);
+    return Number.isFinite(number) && number >= 0 ? Math.round(number) : 0;
+};
+
+const bssidOf = (value) => {
+    const bssid = String(value || '').toUpperCase();
+    return BSSID_PATTERN.test(bssid) ? bssid : null;
+};
+
+/**
+ * Roaming state from a heartbeat's `wifi` object: the BSSID the device is
+ * on, roam/scan counters, and per-AP association counts, connect times and
+ * time served. Unknown fields are dropped. Returns null when absent.
+ */
+function parseWifiStats(wifi) {
+    if (!wifi || typeof wifi !== 'object') {
+        return null;
+    }
+
+    const aps = (Array.isArray(wifi.aps) ? wifi.aps : [])
+        .slice(0, MAX_APS)
+        .map(ap => ({
+            bssid: bssidOf(ap?.bssid),
+            ssid: String(ap?.ssid || '').substring(0, 64),
+            associations: count(ap?.associations),
+            failures: count(ap?.failures),
+            last_connect_ms: count(ap?.last_connect_ms),
+            avg_connect_ms: count(ap?.avg_connect_ms),
+            connected_s: count(ap?.connected_s),
+            rssi: Number.isFinite(Number(ap?.rssi)) ? Math.round(Number(ap.rssi)) : null
+        }))
+        .filter(ap => ap.bssid);
+
+    return {
+        ssid: String(wifi.ssid || '').substring(0, 64),
+        bssid: bssidOf(wifi.bssid),
+        channel: count(wifi.channel),
+        roams: count(wifi.roams),
+        scans: count(wifi.scans),
+        aps
+    };
+}
+
+module.exports = {
+    parseWifiStats
+};
@@ -1,6 +1,10 @@
 #include <ArduinoJson.h>
 #include <EEPROM.h>
 #include <DHT.h>
+#include <avr/interrupt.h>
+#include <avr/power.h>
+#include <avr/sleep.h>
+#include <util/atomic.h>
 #include "device_config.h"
 
 // Configuration structure
@@ -25,6 +29,31 @@ struct SensorConfig {
     bool enabled;
     float threshold_min;
     float threshold_max;
+    uint8_t source;
+};
+
+// How a sensor is sampled: digital sources are latched by the Timer1 ISR and
+// analog ones converted by the ADC-complete ISR it starts; slow ones (DHT
+// bit-banging, ultrasonic echo) are read by the main loop when it drains the
+// frame the ISRs produced.
+enum SampleSource : uint8_t {
+    SOURCE_NONE = 0,
+    SOURCE_ANALOG,
+    SOURCE_DIGITAL,
+    SOURCE_SLOW
+};
+
+#ifndef SAMPLE_RING_SIZE
+#define SAMPLE_RING_SIZE 4
+#endif
+
+#ifndef LOW_POWER_IDLE_ENABLED
+#define LOW_POWER_IDLE_ENABLED true
+#endif
+
+struct SampleFrame {
+    unsigned long timestamp;
+    uint16_t raw[MAX_SENSORS];
 };
 
 struct SensorFilter {
@@ -43,7 +72,18 @@ DeviceConfig config;
 SensorConfig sensors[MAX_SENSORS];
 int sensorCount = 0;
 unsigned long lastHeartbeat = 0;
-unsigned long lastSensorRead = 0;
+
+// Timer1-driven sampler state. The ISR is the only producer and loop() the
+// only consumer, so head/tail are single-byte and need no locking.
+volatile SampleFrame sampleRing[SAMPLE_RING_SIZE];
+volatile uint8_t sampleHead = 0;
+volatile uint8_t sampleTail = 0;
+volatile uint16_t sampleOverruns = 0;
+volatile uint16_t samplerTickCount = 0;
+uint16_t samplerTicksPerSample = 1;
+// sensors[] index the ADC is converting for the frame at sampleHead, -1
+// when idle. The frame is published once its last analog channel is in.
+volatile int8_t adcSensor = -1;
 
 // Hardware instances
 DHT* dht = nullptr;
@@ -65,6 +105,10 @@ void setup() {
     // Send initial status
     sendStatus();
 
+    // Start the hardware sample clock last so the first frame sees
+    // fully initialized sensors
+    setupSampleTimer();
+
     Serial.println(F("Setup complete. Waiting for commands..."));
 }
 
@@ -74,11 +118,10 @@ void loop() {
         processSerialCommand();
     }
 
-    // Read sensors at configured interval
-    if (config.armed && (millis() - lastSensorRead >= SENSOR_READ_INTERVAL_MS)) {
-        String sensorData = readAllSensors();
-        sendSensorData(sensorData);
-        lastSensorRead = millis();
+    // Drain frames latched by the Timer1 ISR
+    SampleFrame frame;
+    while (popSampleFrame(frame)) {
+        sendSensorData(readAllSensors(frame));
     }
 
     // Send heartbeat
@@ -87,7 +130,174 @@ void loop() {
         lastHeartbeat = millis();
     }
 
-    delay(10);
+    sleepUntilInterrupt();
+}
+
+// Configure Timer1 in CTC mode so the compare-match ISR fires at exactly
+// SENSOR_READ_INTERVAL_MS. Periods longer than the 16-bit counter allows
+// (~4.19 s at 16 MHz / 1024) are split into equal sub-ticks.
+void setupSampleTimer() {
+    uint32_t counts = (F_CPU / 1024UL) * (uint32_t)SENSOR_READ_INTERVAL_MS / 1000UL;
+    if (counts == 0) {
+        counts = 1;
+    }
+    samplerTicksPerSample = (counts + 65535UL) / 65536UL;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        TCCR1A = 0;
+        TCCR1B = 0;
+        TCNT1 = 0;
+        OCR1A = (uint16_t)(counts / samplerTicksPerSample - 1);
+        TCCR1B = _BV(WGM12) | _BV(CS12) | _BV(CS10); // CTC, clk/1024
+        TIMSK1 = _BV(OCIE1A);
+        samplerTickCount = 0;
+    }
+
+    #if LOW_POWER_IDLE_ENABLED
+    // Peripherals this sketch never uses; Timer0 (millis), Timer1, the ADC
+    // and USART0 stay powered so they can wake us from idle.
+    power_spi_disable();
+    power_twi_disable();
+    power_timer2_disable();
+    #endif
+
+    if (config.debug_mode) {
+        Serial.print(F("Sample timer: OCR1A="));
+        Serial.print(OCR1A);
+        Serial.print(F(" ticks/sample="));
+        Serial.println(samplerTicksPerSample);
+    }
+}
+
+// Next enabled analog sensor after sensors[] index `after`, or -1
+int8_t nextAnalogSensor(int8_t after) {
+    for (int8_t i = after + 1; i < sensorCount; i++) {
+        if (sensors[i].enabled && sensors[i].source == SOURCE_ANALOG) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Start a conversion on an analog pin (pin or channel number, as
+// analogRead() takes) with the ADC-complete interrupt enabled. AVcc
+// reference and the core's ADC prescaler, like analogRead().
+void adcStart(uint8_t pin) {
+    if (pin >= A0) {
+        pin -= A0;
+    }
+#if defined(analogPinToChannel)
+    pin = analogPinToChannel(pin);
+#endif
+#if defined(MUX5)
+    ADCSRB = (ADCSRB & ~_BV(MUX5)) | (((pin >> 3) & 0x01) << MUX5);
+#endif
+    ADMUX = _BV(REFS0) | (pin & 0x07);
+    ADCSRA |= _BV(ADIE) | _BV(ADSC);
+}
+
+// Digital sensors are latched here; analog ones are only started, so the
+// ISR stays a few microseconds instead of ~100 us per analogRead()
+ISR(TIMER1_COMPA_vect) {
+    if (++samplerTickCount < samplerTicksPerSample) {
+        return;
+    }
+    samplerTickCount = 0;
+
+    if (!config.armed) {
+        return;
+    }
+
+    uint8_t next = (sampleHead + 1) % SAMPLE_RING_SIZE;
+    if (next == sampleTail || adcSensor >= 0) {
+        // Consumer fell behind (e.g. a slow serial link), or the previous
+        // frame is still converting; keep the oldest frames and count the loss
+        sampleOverruns++;
+        return;
+    }
+
+    volatile SampleFrame& frame = sampleRing[sampleHead];
+    frame.timestamp = millis();
+    for (int i = 0; i < sensorCount; i++) {
+        if (sensors[i].enabled && sensors[i].source == SOURCE_DIGITAL) {
+            frame.raw[i] = digitalRead(sensors[i].pin);
+        }
+    }
+
+    int8_t first = nextAnalogSensor(-1);
+    if (first < 0) {
+        sampleHead = next;
+        return;
+    }
+    adcSensor = first;
+    adcStart(sensors[first].pin);
+}
+
+// One analog channel done: store it and start the next, or publish the frame
+ISR(ADC_vect) {
+    sampleRing[sampleHead].raw[adcSensor] = ADC;
+
+    int8_t next = nextAnalogSensor(adcSensor);
+    if (next >= 0) {
+        adcSensor = next;
+        adcStart(sensors[next].pin);
+        return;
+    }
+
+    ADCSRA &= ~_BV(ADIE);
+    adcSensor = -1;
+    sampleHead = (sampleHead + 1) % SAMPLE_RING_SIZE;
+}
+
+// On-demand frame for the "read" command. Pauses the sample clock and waits
+// out a conversion in flight so analogRead() has the ADC to itself.
+void readFrameNow(SampleFrame& frame) {
+    TIMSK1 &= ~_BV(OCIE1A);
+    while (adcSensor >= 0) {
+    }
+
+    frame.timestamp = millis();
+    for (int i = 0; i < sensorCount; i++) {
+        if (!sensors[i].enabled) continue;
+
+        if (sensors[i].source == SOURCE_ANALOG) {
+            frame.raw[i] = analogRead(sensors[i].pin);
+        } else if (sensors[i].source == SOURCE_DIGITAL) {
+            frame.raw[i] = digitalRead(sensors[i].pin);
+        }
+    }
+
+    TIMSK1 |= _BV(OCIE1A);
+}
+
+bool popSampleFrame(SampleFrame& out) {
+    if (sampleTail == sampleHead) {
+        return false;
+    }
+
+    out.timestamp = sampleRing[sampleTail].timestamp;
+    for (int i = 0; i < sensorCount; i++) {
+        out.raw[i] = sampleRing[sampleTail].raw[i];
+    }
+    sampleTail = (sampleTail + 1) % SAMPLE_RING_SIZE;
+    return true;
+}
+
+// Sleep in SLEEP_MODE_IDLE until any interrupt (Timer1 sample, ADC
+// complete, UART RX, Timer0 tick). The checks run with interrupts disabled and sei() takes
+// effect after sleep_cpu(), so a wake-up cannot slip in between.
+void sleepUntilInterrupt() {
+    #if LOW_POWER_IDLE_ENABLED
+    set_sleep_mode(SLEEP_MODE_IDLE);
+    cli();
+    if (sampleTail == sampleHead && Serial.available() == 0) {
+        sleep_enable();
+        sei();
+        sleep_cpu();
+        sleep_disable();
+    }
+    sei();
+    #endif
 }
 
 void loadConfiguration() {
@@ -154,11 +364,28 @@ void initializeSensors() {
     Serial.println(SENSOR_VIBRATION_PIN);
     #endif
 
+    for (int i = 0; i < sensorCount; i++) {
+        sensors[i].source = sampleSourceFor(sensors[i].type);
+    }
+
     Serial.print(F("Total sensors initialized: "));
     Serial.println(sensorCount);
 }
 
-String readAllSensors() {
+uint8_t sampleSourceFor(const String& type) {
+    if (type == "light") {
+        return SOURCE_ANALOG;
+    }
+    if (type == "motion" || type == "magnetic" || type == "vibration") {
+        return SOURCE_DIGITAL;
+    }
+    if (type == "temperature_humidity" || type == "distance") {
+        return SOURCE_SLOW;
+    }
+    return SOURCE_NONE;
+}
+
+String readAllSensors(const SampleFrame& frame) {
     DynamicJsonDocument doc(2048);
     JsonArray data = doc.createNestedArray("data");
 
@@ -168,7 +395,7 @@ String readAllSensors() {
         JsonObject reading = data.createNestedObject();
         reading["sensor_type"] = sensors[i].type;
         reading["sensor_name"] = sensors[i].name;
-        reading["timestamp"] = millis();
+        reading["timestamp"] = frame.timestamp;
 
         if (sensors[i].type == "temperature_humidity" && dht) {
             float temp = dht->readTemperature();
@@ -184,7 +411,7 @@ String readAllSensors() {
                 }
             }
         } else if (sensors[i].type == "light") {
-            int rawValue = analogRead(sensors[i].pin);
+            int rawValue = frame.raw[i];
             float calibrated = (rawValue + sensors[i].calibration_offset) * sensors[i].calibration_multiplier;
             reading["value"] = calibrated;
             reading["raw_value"] = rawValue;
@@ -193,7 +420,7 @@ String readAllSensors() {
                 reading["alert"] = "light_threshold";
             }
         } else if (sensors[i].type == "motion") {
-            int motionValue = digitalRead(sensors[i].pin);
+            int motionValue = frame.raw[i];
             reading["value"] = motionValue;
             if (motionValue == HIGH) {
                 reading["alert"] = "motion_detected";
@@ -206,11 +433,11 @@ String readAllSensors() {
                 reading["alert"] = "distance_threshold";
             }
         } else if (sensors[i].type == "magnetic") {
-            int magneticValue = digitalRead(sensors[i].pin);
+            int magneticValue = frame.raw[i];
             reading["value"] = magneticValue;
             reading["state"] = (magneticValue == LOW) ? "closed" : "open";
         } else if (sensors[i].type == "vibration") {
-            int vibrationValue = digitalRead(sensors[i].pin);
+            int vibrationValue = frame.raw[i];
             reading["value"] = vibrationValue;
             if (vibrationValue == HIGH) {
                 reading["alert"] = "vibration_detected";
@@ -262,6 +489,13 @@ void sendHeartbeat() {
     doc["sensor_count"] = sensorCount;
     doc["armed"] = config.armed;
 
+    uint16_t overruns;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        overruns = sampleOverruns;
+    }
+    doc["sample_interval_ms"] = SENSOR_READ_INTERVAL_MS;
+    doc["sample_overruns"] = overruns;
+
     serializeJson(doc, Serial);
     Serial.println(); // Newline delimiter
 
@@ -310,8 +544,9 @@ void processSerialCommand() {
     } else if (cmd == "status") {
         sendStatus();
     } else if (cmd == "read") {
-        String data = readAllSensors();
-        sendSensorData(data);
+        SampleFrame frame;
+        readFrameNow(frame);
+        sendSensorData(readAllSensors(frame));
     } else {
         Serial.print(F("{\"error\":\"Unknown command: "));
         Serial.print(cmd);
@@ -20,6 +20,12 @@
 #define WIFI_RECONNECT_ATTEMPTS 3
 #define WIFI_RECONNECT_DELAY_MS 5000
 
+// ESP32 roaming: all networks the device may join, strongest BSSID wins
+#define WIFI_NETWORKS { { WIFI_SSID, WIFI_PASSWORD } }
+#define WIFI_SCAN_INTERVAL_MS 600000  // Passive background scan period
+#define WIFI_ROAM_RSSI_DBM -70        // Look for a better AP below this signal
+#define WIFI_ROAM_HYSTERESIS_DB 8     // Roam only to an AP this much stronger
+
 // ========================================
 // SERVER CONFIGURATION
 // ========================================
@@ -36,9 +42,15 @@
 #define TELEMETRY_BATCH_SIZE 5          // Send data after collecting 5 readings
 #define TELEMETRY_SEND_INTERVAL_MS 5000 // Send batched data every 5 seconds
 #define THRESHOLD_ALERT_ENABLED true    // Enable immediate alerts on threshold crossing
+#define CAPTURE_ENABLED true            // Attach a high-rate sample window to threshold alerts
+#define CAPTURE_RATE_HZ 50              // Capture ring sampling rate
+#define CAPTURE_PRE_MS 2000             // Window kept before the trigger
+#define CAPTURE_POST_MS 2000            // Window recorded after the trigger
 #define DEVICE_ARMED true               // Enable alarm monitoring
 #define DEBUG_MODE false                // Enable serial debug output
 #define OTA_ENABLED true                // Enable over-the-air updates
+#define OTA_MAX_BYTES_PER_SEC 16384     // Background OTA download rate cap
+#define OTA_REBOOT_DEFER_MAX_MS 1800000 // Longest wait for a quiet moment to reboot
 
 // ========================================
 // SENSOR CONFIGURATION
@@ -94,6 +106,26 @@
 #define VIBRATION_THRESHOLD_MIN 0
 #define VIBRATION_THRESHOLD_MAX 1
 
+// DS18B20 Temperature Probes (1-Wire bus, any number on one pin)
+#define SENSOR_ONEWIRE_ENABLED false
+#define SENSOR_ONEWIRE_PIN D1
+#define ONEWIRE_RESOLUTION_BITS 12   // 9-12 bits: 94-750 ms per conversion
+#define PROBE_THRESHOLD_MIN -10.0
+#define PROBE_THRESHOLD_MAX 40.0
+
+// Pulse Counter (meter S0 output; PCNT on ESP32, interrupt on ESP8266)
+#define SENSOR_PULSE_ENABLED false
+#define SENSOR_PULSE_PIN D7
+#define PULSES_PER_UNIT 1000.0       // meter constant, e.g. 1000 imp/kWh
+#define PULSE_FILTER_US 10           // ignore edges closer than this
+
+// Modbus RTU over RS-485 (register map is set per device on the server)
+#define MODBUS_ENABLED false
+#define MODBUS_RX_PIN D5
+#define MODBUS_TX_PIN D6
+#define MODBUS_DE_PIN D0    // DE and /RE tied together
+#define MODBUS_BAUD 9600
+
 // Gas Sensor (MQ series)
 #define SENSOR_GAS_ENABLED false
 #define SENSOR_GAS_PIN A0
@@ -127,13 +159,23 @@
 #define USE_JSON_COMPRESSION false    // Enable gzip compression for JSON data
 #define MAX_RETRY_ATTEMPTS 3          // Max retry attempts for HTTP requests
 #define HTTP_REQUEST_TIMEOUT_MS 10000 // 10 second timeout for HTTP requests
+#define TELEMETRY_DEADBAND_PCT 0      // ESP32: skip readings within this % of the threshold range
+#define HISTORY_STORE_ENABLED true    // ESP32: keep full-resolution history on flash for backfill
+#define HISTORY_RETENTION_HOURS 24    // Hours of history kept on flash
 
 // Power management (for battery-powered devices)
 #define DEEP_SLEEP_ENABLED false    // Enable deep sleep mode
 #define DEEP_SLEEP_DURATION_SEC 300 // Sleep for 5 minutes between readings
+#define ULP_WATCH_ENABLED false     // ESP32: ULP samples/thresholds while main cores deep sleep
+#define ULP_SAMPLE_PERIOD_MS 1000   // ULP sampling period in deep sleep
 #define BATTERY_MONITORING_ENABLED false
 #define LOW_BATTERY_THRESHOLD_V 3.2 // Voltage threshold for low battery alert
 
+// AVR (Arduino Uno/Nano) sampling: Timer1 latches samples every
+// SENSOR_READ_INTERVAL_MS and the CPU idles between interrupts
+#define SAMPLE_RING_SIZE 4            // Frames buffered between ISR and serial output
+#define LOW_POWER_IDLE_ENABLED true   // Sleep in SLEEP_MODE_IDLE between samples
+
 // ========================================
 // DEVICE-SPECIFIC CONFIGURATIONS
 // ========================================
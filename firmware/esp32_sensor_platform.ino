@@ -2,16 +2,177 @@
 #include <HTTPClient.h>
 #include <Update.h>
 #include <ArduinoJson.h>
-#include <WiFiClientSecure.h>
 #include <EEPROM.h>
 #include <DHT.h>
 #include <cstring>
 #include <cstdio>
+#include <esp_heap_caps.h>
+#include <esp_system.h>
+#include <esp_random.h>
+#include <mbedtls/md.h>
+#include <mbedtls/pk.h>
+#include <mbedtls/base64.h>
+#include <mbedtls/ssl.h>
+#include <mbedtls/x509_crt.h>
+#include <mbedtls/net_sockets.h>
 #if SENSOR_DISTANCE_ENABLED
 #include <Ultrasonic.h>
 #endif
 #include "device_config.h"
 
+// Per-device token sent as X-API-Key (older config headers may omit it)
+#ifndef SERVER_API_KEY
+#define SERVER_API_KEY ""
+#endif
+
+// ULP threshold watch for battery nodes (see ULP THRESHOLD WATCH below)
+#ifndef ULP_WATCH_ENABLED
+#define ULP_WATCH_ENABLED false
+#endif
+#ifndef ULP_SAMPLE_PERIOD_MS
+#define ULP_SAMPLE_PERIOD_MS 1000
+#endif
+#ifndef ULP_BUFFER_ROWS
+#define ULP_BUFFER_ROWS 120
+#endif
+#ifndef ULP_MAX_CHANNELS
+#define ULP_MAX_CHANNELS 4
+#endif
+#ifndef ULP_UPLOAD_ROWS
+#define ULP_UPLOAD_ROWS 8
+#endif
+#ifndef ULP_MIN_AWAKE_MS
+#define ULP_MIN_AWAKE_MS 5000UL
+#endif
+#ifndef ULP_MAX_AWAKE_MS
+#define ULP_MAX_AWAKE_MS 60000UL
+#endif
+#ifndef DEEP_SLEEP_DURATION_SEC
+#define DEEP_SLEEP_DURATION_SEC 0
+#endif
+
+// On-flash history and server-requested backfill (see HISTORY STORE below)
+#ifndef HISTORY_STORE_ENABLED
+#define HISTORY_STORE_ENABLED false
+#endif
+#ifndef HISTORY_RETENTION_HOURS
+#define HISTORY_RETENTION_HOURS 24
+#endif
+#ifndef HISTORY_MIN_FREE_BYTES
+#define HISTORY_MIN_FREE_BYTES 65536
+#endif
+#ifndef HISTORY_FLUSH_RECORDS
+#define HISTORY_FLUSH_RECORDS 64
+#endif
+#ifndef HISTORY_FLUSH_INTERVAL_MS
+#define HISTORY_FLUSH_INTERVAL_MS 60000UL
+#endif
+#ifndef HISTORY_VALUE_SCALE
+#define HISTORY_VALUE_SCALE 1000
+#endif
+#if HISTORY_STORE_ENABLED
+#include <LittleFS.h>
+#include <sys/time.h>
+#endif
+
+// Upstream deadband: a reading is sent when it moves more than this percent
+// of the sensor's threshold range (of its last sent value without one), or
+// after TELEMETRY_MAX_SILENCE_MS regardless. 0 sends every reading.
+#ifndef TELEMETRY_DEADBAND_PCT
+#define TELEMETRY_DEADBAND_PCT 0
+#endif
+#ifndef TELEMETRY_MAX_SILENCE_MS
+#define TELEMETRY_MAX_SILENCE_MS 300000UL
+#endif
+
+// DS18B20 probes sharing one 1-Wire pin (see 1-WIRE TEMPERATURE PROBES below)
+#ifndef SENSOR_ONEWIRE_ENABLED
+#define SENSOR_ONEWIRE_ENABLED false
+#endif
+#ifndef SENSOR_ONEWIRE_PIN
+#define SENSOR_ONEWIRE_PIN 5
+#endif
+#ifndef ONEWIRE_MAX_PROBES
+#define ONEWIRE_MAX_PROBES 8
+#endif
+#ifndef ONEWIRE_RESOLUTION_BITS
+#define ONEWIRE_RESOLUTION_BITS 12
+#endif
+#ifndef PROBE_THRESHOLD_MIN
+#define PROBE_THRESHOLD_MIN -10.0
+#endif
+#ifndef PROBE_THRESHOLD_MAX
+#define PROBE_THRESHOLD_MAX 40.0
+#endif
+#if SENSOR_ONEWIRE_ENABLED
+#include <OneWire.h>
+#endif
+
+// Modbus RTU meters on an RS-485 bus (see MODBUS RTU below)
+#ifndef MODBUS_ENABLED
+#define MODBUS_ENABLED false
+#endif
+#ifndef MODBUS_RX_PIN
+#define MODBUS_RX_PIN 16
+#endif
+#ifndef MODBUS_TX_PIN
+#define MODBUS_TX_PIN 17
+#endif
+#ifndef MODBUS_DE_PIN
+#define MODBUS_DE_PIN 4
+#endif
+#ifndef MODBUS_BAUD
+#define MODBUS_BAUD 9600
+#endif
+#ifndef MODBUS_RESPONSE_TIMEOUT_MS
+#define MODBUS_RESPONSE_TIMEOUT_MS 200
+#endif
+#ifndef MODBUS_POLL_INTERVAL_MS
+#define MODBUS_POLL_INTERVAL_MS SENSOR_READ_INTERVAL_MS
+#endif
+#if MODBUS_ENABLED
+#include "modbus_rtu.h"
+#endif
+
+// Pulse-output meters counted in hardware (see PULSE COUNTER below)
+#ifndef SENSOR_PULSE_ENABLED
+#define SENSOR_PULSE_ENABLED false
+#endif
+#ifndef SENSOR_PULSE_PIN
+#define SENSOR_PULSE_PIN 27
+#endif
+#ifndef PULSES_PER_UNIT
+#define PULSES_PER_UNIT 1000.0
+#endif
+#ifndef PULSE_FILTER_US
+#define PULSE_FILTER_US 10
+#endif
+#ifndef PULSE_SAMPLE_MS
+#define PULSE_SAMPLE_MS 1000
+#endif
+#ifndef PULSE_SAVE_INTERVAL_MS
+#define PULSE_SAVE_INTERVAL_MS 600000UL
+#endif
+#ifndef PULSE_RATE_THRESHOLD_MIN
+#define PULSE_RATE_THRESHOLD_MIN 0
+#endif
+#ifndef PULSE_RATE_THRESHOLD_MAX
+#define PULSE_RATE_THRESHOLD_MAX 100000
+#endif
+#if SENSOR_PULSE_ENABLED
+#include <driver/pcnt.h>
+#include <esp_timer.h>
+#endif
+#if ULP_WATCH_ENABLED
+#include <esp_sleep.h>
+#include <esp32/ulp.h>
+#include <driver/adc.h>
+#include <driver/rtc_io.h>
+#include <soc/rtc_cntl_reg.h>
+#include <soc/rtc_io_reg.h>
+#include <soc/sens_reg.h>
+#endif
+
 #define OTA_CONFIG_CHUNK "~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~"
 #define OTA_CONFIG_BLOCK4 OTA_CONFIG_CHUNK OTA_CONFIG_CHUNK OTA_CONFIG_CHUNK OTA_CONFIG_CHUNK
 #define OTA_CONFIG_BLOCK8 OTA_CONFIG_BLOCK4 OTA_CONFIG_BLOCK4
@@ -43,7 +204,7 @@ struct DeviceConfig {
 };
 
 // Sensor definitions
-#define MAX_SENSORS 8
+#define MAX_SENSORS 16
 #define FILTER_WINDOW_SIZE 10
 
 struct SensorConfig {
@@ -55,6 +216,98 @@ struct SensorConfig {
     bool enabled;
     float threshold_min;
     float threshold_max;
+    const char* pinName;    // reported instead of pin when set (1-Wire probes, Modbus points, pulse channels)
+};
+
+// ========================================
+// 1-WIRE TEMPERATURE PROBES
+// ========================================
+// Every DS18B20 on SENSOR_ONEWIRE_PIN is found by a ROM search at boot and
+// becomes its own "temperature" sensor, reported under a pin name taken
+// from its ROM code ("OW" + 8 hex digits) so the server keeps one sensor
+// per probe. One skip-ROM Convert T starts all probes together; the sensor
+// task collects the scratchpads on a later pass once the conversion time
+// has passed, so N probes cost one conversion (750 ms at 12 bits) rather
+// than N, and the task never waits on the bus.
+#define ONEWIRE_PIN_PREFIX "OW"
+#define ONEWIRE_CONVERSION_MS (750UL >> (12 - ONEWIRE_RESOLUTION_BITS))
+#define DS18B20_FAMILY_CODE 0x28
+#define DS18B20_CONVERT_T 0x44
+#define DS18B20_READ_SCRATCHPAD 0xBE
+#define DS18B20_WRITE_SCRATCHPAD 0x4E
+
+struct OneWireProbe {
+    uint8_t rom[8];
+    char pinName[11];           // ONEWIRE_PIN_PREFIX + low four serial bytes in hex
+    int sensorIndex;
+    float celsius;
+    bool valid;
+};
+
+// ========================================
+// MODBUS RTU
+// ========================================
+// Meters and PLC sensors on an RS-485 bus, read by the non-blocking master
+// in modbus_rtu.h. The register map comes from the server with the
+// heartbeat response (config.modbus) whenever its version differs from the
+// one this device reported. Each point becomes a sensor after the native
+// ones, reported under a pin name ("H1.100": holding register 100 of slave
+// 1, "I" for input registers) and run through the same filter, threshold
+// and telemetry path. The master is polled from its own task every tick,
+// so inter-frame timing does not depend on how long a sensor pass takes;
+// the sensor task only picks up the latest decoded values.
+#define MODBUS_PIN_NAME_SIZE 11
+
+#if MODBUS_ENABLED
+struct ModbusMapEntry {
+    ModbusPoint point;
+    char pinName[MODBUS_PIN_NAME_SIZE];
+    char sensorType[16];
+    float thresholdMin;
+    float thresholdMax;
+};
+
+// UART2 plus a driver-enable GPIO (DE and /RE tied together)
+class UartModbusPort : public ModbusPort {
+public:
+    UartModbusPort(HardwareSerial& serial, int dePin) : serial(serial), dePin(dePin) {}
+
+    int available() override { return serial.available(); }
+    int read() override { return serial.read(); }
+    size_t write(const uint8_t* data, size_t length) override { return serial.write(data, length); }
+    void setTransmit(bool transmit) override { digitalWrite(dePin, transmit ? HIGH : LOW); }
+
+private:
+    HardwareSerial& serial;
+    int dePin;
+};
+#endif
+
+// ========================================
+// PULSE COUNTER
+// ========================================
+// S0 / open-collector outputs of energy, water and gas meters on
+// SENSOR_PULSE_PIN are counted by PCNT unit 0 on falling edges behind its
+// glitch filter, so the CPU never sees an individual pulse. The hardware
+// counter is 16 bits and wraps at PULSE_COUNTER_LIMIT; an esp_timer folds
+// it into a 64-bit total every PULSE_SAMPLE_MS, which keeps up with 32 kHz
+// at the default 1 s. Each sensor pass reports three sensors: pulses since
+// the last pass ("P27.count"), the rate over that pass in units per hour
+// (".rate") and the running total in units (".total"), a unit being
+// PULSES_PER_UNIT pulses (the meter constant, e.g. 1000 imp/kWh). The
+// total is kept in EEPROM next to the device config; it is written every
+// PULSE_SAVE_INTERVAL_MS while it changes and before a planned restart, so
+// a power cut loses at most that window.
+#define PULSE_PCNT_UNIT PCNT_UNIT_0
+#define PULSE_COUNTER_LIMIT 32767
+#define PULSE_FILTER_CYCLES (PULSE_FILTER_US * 80 > 1023 ? 1023 : PULSE_FILTER_US * 80)   // APB cycles, 10 bits
+#define PULSE_EEPROM_ADDR 512               // after DeviceConfig
+#define PULSE_STORE_MAGIC 0x504C5331        // "PLS1"
+#define PULSE_PIN_NAME_SIZE 11
+
+struct PulseStore {
+    uint32_t magic;
+    uint64_t pulses;
 };
 
 struct SensorFilter {
@@ -68,44 +321,1066 @@ struct SensorFilter {
 
 SensorFilter sensorFilters[MAX_SENSORS];
 
+// Last value sent upstream per sensor, for the telemetry deadband
+struct TelemetryDeadband {
+    float lastSent;
+    unsigned long sentAt;
+    bool sent;
+};
+
+TelemetryDeadband telemetryDeadbands[MAX_SENSORS];
+
 // Global variables
 DeviceConfig config;
 SensorConfig sensors[MAX_SENSORS];
 int sensorCount = 0;
+// Version of the server's sensor list last applied (config.sensors_version);
+// 0 makes the next heartbeat response carry the full list
+volatile uint32_t sensorConfigVersion = 0;
 unsigned long lastHeartbeat = 0;
 unsigned long lastSensorRead = 0;
 unsigned long lastWiFiCheck = 0;
 const unsigned long WIFI_RECONNECT_INTERVAL = 15000; // 15 seconds
 WiFiClient wifiClient;
-#if USE_HTTPS
-WiFiClientSecure secureClient;
-#endif
 
 // Hardware instances
 DHT* dht = nullptr;
 #if SENSOR_DISTANCE_ENABLED
 Ultrasonic* ultrasonic = nullptr;
 #endif
+#if SENSOR_ONEWIRE_ENABLED
+OneWire* oneWire = nullptr;
+OneWireProbe oneWireProbes[ONEWIRE_MAX_PROBES];
+uint8_t oneWireProbeCount = 0;
+unsigned long oneWireConvertStartedAt = 0;
+#endif
+#if MODBUS_ENABLED
+HardwareSerial modbusSerial(2);
+UartModbusPort modbusPort(modbusSerial, MODBUS_DE_PIN);
+ModbusMaster modbus(modbusPort);
+ModbusPoint modbusPoints[MODBUS_MAX_POINTS];
+char modbusPinNames[MODBUS_MAX_POINTS][MODBUS_PIN_NAME_SIZE];
+uint8_t modbusPointCount = 0;
+int modbusFirstSensor = 0;              // sensors[] index of the first point
+uint32_t modbusMapVersion = 0;          // 0 until the server sends a map
+unsigned long modbusCycleStartedAt = 0;
+// Map received by the network task, applied by the sensor task
+ModbusMapEntry modbusPending[MODBUS_MAX_POINTS];
+uint8_t modbusPendingCount = 0;
+uint32_t modbusPendingVersion = 0;
+bool modbusPendingReady = false;
+// Guards the master, its points and sensors[] while a map is applied
+SemaphoreHandle_t modbusLock = NULL;
+TaskHandle_t modbusTaskHandle = NULL;
+#endif
+
+#if SENSOR_PULSE_ENABLED
+portMUX_TYPE pulseMux = portMUX_INITIALIZER_UNLOCKED;
+esp_timer_handle_t pulseTimer = nullptr;
+uint64_t pulseTotal = 0;                // guarded by pulseMux
+int16_t pulseLastRaw = 0;               // guarded by pulseMux
+// Sensor task only
+char pulsePinNames[3][PULSE_PIN_NAME_SIZE];
+int pulseFirstSensor = 0;               // sensors[] index of the count sensor
+uint64_t pulseReportedTotal = 0;
+unsigned long pulseReportedAt = 0;
+uint64_t pulseSavedTotal = 0;
+unsigned long pulseSavedAt = 0;
+float pulseValues[3];                   // count, rate, total of the last pass
+bool pulseValid = false;
+#endif
 
 // Task handles for dual-core processing
 TaskHandle_t sensorTaskHandle = NULL;
 TaskHandle_t networkTaskHandle = NULL;
 
-// Queue for sensor data
+// Queue for sensor data (holds batch-pool buffers, see below). Readings
+// taken before the link is up wait here; the sample time goes with them so
+// the server can stamp them when they were taken, not when they arrived.
+struct TelemetrySample {
+    char* payload;
+    unsigned long sampledAt;
+};
 QueueHandle_t sensorDataQueue;
 
+// Boot-phase timings (ms since reset), reported once in the first heartbeat
+struct BootTimings {
+    unsigned long sensorsReadyMs;
+    unsigned long firstSampleMs;
+    unsigned long wifiConnectedMs;
+    unsigned long otaCheckedMs;
+    unsigned long firstHeartbeatMs;
+    bool reported;
+};
+BootTimings bootTimings = {0, 0, 0, 0, 0, false};
+bool networkBootDone = false;
+
+// ========================================
+// SERVER BACKPRESSURE
+// ========================================
+// The server keeps a token bucket per device and message class. Responses
+// carry X-Device-Backoff-Ms (the request spacing to keep for that class)
+// once a bucket runs low; 429/503 also carry Retry-After. Requests of a
+// class are spaced and held accordingly instead of retried blindly.
+#ifndef MAX_BACKOFF_MS
+#define MAX_BACKOFF_MS 300000UL
+#endif
+
+struct Backpressure {
+    unsigned long intervalMs;   // spacing requested by the server, 0 = none
+    unsigned long holdUntil;    // no requests of this class before this time
+    bool held;
+};
+
+Backpressure telemetryBackpressure = {0, 0, false};
+Backpressure alertBackpressure = {0, 0, false};
+Backpressure controlBackpressure = {0, 0, false};
+
+const char* BACKPRESSURE_HEADERS[] = {"X-Device-Backoff-Ms", "Retry-After"};
+
+// ========================================
+// WIFI ROAMING
+// ========================================
+// Credentials come from WIFI_NETWORKS, a brace list of {ssid, password}
+// pairs (just WIFI_SSID when unset). The network task runs a passive
+// background scan every WIFI_SCAN_INTERVAL_MS, or WIFI_ROAM_SCAN_INTERVAL_MS
+// while the signal is below WIFI_ROAM_RSSI_DBM, and caches the BSSIDs of
+// known networks. Connections go to the strongest cached BSSID rather than
+// whichever AP the SDK picks, and the link moves once another BSSID beats
+// the current one by WIFI_ROAM_HYSTERESIS_DB. The cache sits in RTC memory,
+// so wakes from deep sleep reconnect without scanning. Per-AP association
+// counts, connect times and time served go out in the heartbeat.
+#ifndef WIFI_NETWORKS
+#define WIFI_NETWORKS { { WIFI_SSID, WIFI_PASSWORD } }
+#endif
+#ifndef WIFI_SCAN_INTERVAL_MS
+#define WIFI_SCAN_INTERVAL_MS 600000UL
+#endif
+#ifndef WIFI_ROAM_SCAN_INTERVAL_MS
+#define WIFI_ROAM_SCAN_INTERVAL_MS 60000UL
+#endif
+#ifndef WIFI_ROAM_RSSI_DBM
+#define WIFI_ROAM_RSSI_DBM -70
+#endif
+#ifndef WIFI_ROAM_HYSTERESIS_DB
+#define WIFI_ROAM_HYSTERESIS_DB 8
+#endif
+#ifndef WIFI_SCAN_DWELL_MS
+#define WIFI_SCAN_DWELL_MS 120
+#endif
+#ifndef WIFI_SCAN_CACHE_MS
+#define WIFI_SCAN_CACHE_MS 1800000UL
+#endif
+#define WIFI_MAX_CANDIDATES 8
+#define WIFI_MAX_AP_STATS 8
+#define WIFI_FAILURE_PENALTY_DB 10
+
+struct WifiCredential {
+    const char* ssid;
+    const char* password;
+};
+
+struct WifiCandidate {
+    uint8_t bssid[6];
+    uint8_t channel;
+    int8_t network;             // index into wifiNetworks
+    int8_t rssi;
+    uint8_t failures;           // failed attempts since the last scan
+};
+
+struct WifiApStats {
+    uint8_t bssid[6];
+    int8_t network;
+    int8_t lastRssi;
+    uint32_t associations;
+    uint32_t failures;
+    unsigned long lastConnectMs;    // time to associate, latest connect
+    unsigned long totalConnectMs;
+    unsigned long servedMs;         // time connected, closed sessions
+};
+
+const WifiCredential wifiNetworks[] = WIFI_NETWORKS;
+const int wifiNetworkCount = sizeof(wifiNetworks) / sizeof(wifiNetworks[0]);
+
+RTC_DATA_ATTR WifiCandidate wifiCandidates[WIFI_MAX_CANDIDATES];
+RTC_DATA_ATTR uint8_t wifiCandidateCount = 0;
+WifiApStats wifiApStats[WIFI_MAX_AP_STATS];
+uint8_t wifiApStatsCount = 0;
+unsigned long wifiLastScan = 0;     // 0 = cache carried over from before boot
+unsigned long wifiNextScanAt = 0;
+bool wifiScanRunning = false;
+int8_t wifiTarget = -1;             // candidate being connected to, -1 = by SSID
+int8_t wifiNetworkCursor = 0;       // SSID to try without scan results
+unsigned long wifiConnectStarted = 0;
+unsigned long wifiLinkUpAt = 0;
+int8_t wifiLinkStats = -1;          // wifiApStats entry of the current link
+uint32_t wifiRoams = 0;
+uint32_t wifiScans = 0;
+
+// ========================================
+// TLS SESSIONS
+// ========================================
+// Device requests and OTA downloads run TLS through mbedtls directly so a
+// connection can resume a cached session. The first connection to a host
+// does the full certificate/ECDHE handshake; later ones from either task
+// (telemetry, heartbeat, alarms, OTA) resume it with an abbreviated
+// handshake. SHA, AES and bignum (RSA/ECC) work runs on the ESP32 crypto
+// accelerators through the platform's mbedtls build, and randomness comes
+// from the hardware RNG. Handshake times go out in the heartbeat.
+#ifndef SERVER_CA_CERT
+#define SERVER_CA_CERT ""
+#endif
+#ifndef TLS_SESSION_SLOTS
+#define TLS_SESSION_SLOTS 2
+#endif
+#ifndef HTTP_REQUEST_TIMEOUT_MS
+#define HTTP_REQUEST_TIMEOUT_MS 10000
+#endif
+
+#if USE_HTTPS
+struct TlsSessionSlot {
+    char host[64];
+    uint16_t port;
+    mbedtls_ssl_session session;
+    bool valid;
+    unsigned long lastUsed;
+};
+
+struct TlsStats {
+    uint32_t fullHandshakes;
+    uint32_t resumedHandshakes;
+    uint32_t failures;
+    unsigned long lastFullMs;
+    unsigned long lastResumedMs;
+};
+
+TlsSessionSlot tlsSessions[TLS_SESSION_SLOTS];
+TlsStats tlsStats = {0, 0, 0, 0, 0};
+SemaphoreHandle_t tlsSessionLock = NULL;
+mbedtls_x509_crt tlsCaChain;
+bool tlsCaLoaded = false;
+
+bool tlsLoadSession(const char* host, uint16_t port, mbedtls_ssl_context* ssl);
+void tlsStoreSession(const char* host, uint16_t port, mbedtls_ssl_context* ssl);
+void tlsForgetSession(const char* host, uint16_t port);
+void tlsRecordHandshake(bool resumed, bool ok, unsigned long elapsedMs);
+
+// WiFiClient that speaks TLS over its own TCP socket and offers the cached
+// session for its host on connect. Certificates are checked against
+// SERVER_CA_CERT, a pinned SERVER_FINGERPRINT (SHA-1 or SHA-256 of the
+// leaf), or not at all when neither is set, as setInsecure() did. A
+// SERVER_CA_CERT that does not parse rejects every certificate.
+class TlsSessionClient : public WiFiClient {
+public:
+    TlsSessionClient() : active(false), closed(false), certSeen(false), resumedSession(false), lastHandshakeMs(0), peeked(-1) {}
+    ~TlsSessionClient() { stop(); }
+
+    int connect(IPAddress ip, uint16_t port) { return connect(ip.toString().c_str(), port, HTTP_REQUEST_TIMEOUT_MS); }
+    int connect(IPAddress ip, uint16_t port, int32_t timeout) { return connect(ip.toString().c_str(), port, timeout); }
+    int connect(const char* host, uint16_t port) { return connect(host, port, HTTP_REQUEST_TIMEOUT_MS); }
+
+    int connect(const char* host, uint16_t port, int32_t timeout) {
+        stop();
+        if (!WiFiClient::connect(host, port, timeout)) {
+            tlsRecordHandshake(false, false, 0);
+            return 0;
+        }
+
+        mbedtls_ssl_init(&ssl);
+        mbedtls_ssl_config_init(&conf);
+        active = true;
+        certSeen = false;
+
+        int ret = mbedtls_ssl_config_defaults(&conf, MBEDTLS_SSL_IS_CLIENT, MBEDTLS_SSL_TRANSPORT_STREAM, MBEDTLS_SSL_PRESET_DEFAULT);
+        if (ret == 0) {
+            mbedtls_ssl_conf_authmode(&conf, MBEDTLS_SSL_VERIFY_OPTIONAL);
+            mbedtls_ssl_conf_verify(&conf, verifyCertificate, this);
+            mbedtls_ssl_conf_rng(&conf, hardwareRandom, nullptr);
+            if (tlsCaLoaded) {
+                mbedtls_ssl_conf_ca_chain(&conf, &tlsCaChain, nullptr);
+            }
+            ret = mbedtls_ssl_setup(&ssl, &conf);
+        }
+        if (ret == 0) {
+            ret = mbedtls_ssl_set_hostname(&ssl, host);
+        }
+        if (ret != 0) {
+            return fail(host, port, ret, false);
+        }
+        mbedtls_ssl_set_bio(&ssl, this, sendRaw, recvRaw, nullptr);
+
+        bool offered = tlsLoadSession(host, port, &ssl);
+        unsigned long started = millis();
+        while ((ret = mbedtls_ssl_handshake(&ssl)) != 0) {
+            if ((ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE) ||
+                millis() - started > HTTP_REQUEST_TIMEOUT_MS) {
+                return fail(host, port, ret, offered);
+            }
+            vTaskDelay(1);
+        }
+        lastHandshakeMs = millis() - started;
+
+        if (mbedtls_ssl_get_verify_result(&ssl) != 0) {
+            return fail(host, port, MBEDTLS_ERR_X509_CERT_VERIFY_FAILED, offered);
+        }
+
+        // No certificate on the wire means the server took the cached session
+        resumedSession = offered && !certSeen;
+        tlsRecordHandshake(resumedSession, true, lastHandshakeMs);
+        tlsStoreSession(host, port, &ssl);
+        return 1;
+    }
+
+    size_t write(uint8_t b) { return write(&b, 1); }
+
+    size_t write(const uint8_t* buf, size_t size) {
+        if (!active || closed) {
+            return 0;
+        }
+        size_t sent = 0;
+        unsigned long started = millis();
+        while (sent < size) {
+            int ret = mbedtls_ssl_write(&ssl, buf + sent, size - sent);
+            if (ret > 0) {
+                sent += ret;
+                continue;
+            }
+            if ((ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE) ||
+                millis() - started > HTTP_REQUEST_TIMEOUT_MS) {
+                closed = true;
+                break;
+            }
+            vTaskDelay(1);
+        }
+        return sent;
+    }
+
+    int available() {
+        if (!active) {
+            return 0;
+        }
+        if (!closed && mbedtls_ssl_get_bytes_avail(&ssl) == 0) {
+            // Zero-length read pulls the next record through the decryptor
+            int ret = mbedtls_ssl_read(&ssl, nullptr, 0);
+            if (ret < 0 && ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE) {
+                closed = true;
+            }
+        }
+        return (peeked >= 0 ? 1 : 0) + mbedtls_ssl_get_bytes_avail(&ssl);
+    }
+
+    int read() {
+        uint8_t b;
+        return read(&b, 1) > 0 ? b : -1;
+    }
+
+    int read(uint8_t* buf, size_t size) {
+        if (!active || size == 0) {
+            return -1;
+        }
+        size_t count = 0;
+        if (peeked >= 0) {
+            buf[count++] = (uint8_t)peeked;
+            peeked = -1;
+        }
+        if (count < size && available() > 0) {
+            int ret = mbedtls_ssl_read(&ssl, buf + count, size - count);
+            if (ret > 0) {
+                count += ret;
+            }
+        }
+        return count > 0 ? (int)count : -1;
+    }
+
+    int peek() {
+        if (peeked < 0 && available() > 0) {
+            uint8_t b;
+            if (mbedtls_ssl_read(&ssl, &b, 1) == 1) {
+                peeked = b;
+            }
+        }
+        return peeked;
+    }
+
+    void flush() {
+        uint8_t discard[64];
+        while (available() > 0 && read(discard, sizeof(discard)) > 0) {
+        }
+    }
+
+    void stop() {
+        if (active) {
+            if (!closed) {
+                mbedtls_ssl_close_notify(&ssl);
+            }
+            mbedtls_ssl_free(&ssl);
+            mbedtls_ssl_config_free(&conf);
+            active = false;
+        }
+        closed = false;
+        peeked = -1;
+        WiFiClient::stop();
+    }
+
+    uint8_t connected() {
+        if (!active) {
+            return 0;
+        }
+        return peeked >= 0 || mbedtls_ssl_get_bytes_avail(&ssl) > 0 || (!closed && WiFiClient::connected());
+    }
+
+    unsigned long handshakeMs() const { return lastHandshakeMs; }
+    bool resumed() const { return resumedSession; }
+
+private:
+    int fail(const char* host, uint16_t port, int ret, bool offered) {
+        Serial.printf("TLS handshake with %s failed: -0x%04x\n", host, -ret);
+        if (offered) {
+            // Don't keep offering a session the server refuses
+            tlsForgetSession(host, port);
+        }
+        tlsRecordHandshake(false, false, 0);
+        stop();
+        return 0;
+    }
+
+    static int hardwareRandom(void* ctx, unsigned char* out, size_t length) {
+        esp_fill_random(out, length);
+        return 0;
+    }
+
+    static int sendRaw(void* ctx, const unsigned char* buf, size_t length) {
+        TlsSessionClient* self = (TlsSessionClient*)ctx;
+        size_t sent = self->WiFiClient::write(buf, length);
+        if (sent > 0) {
+            return sent;
+        }
+        return self->WiFiClient::connected() ? MBEDTLS_ERR_SSL_WANT_WRITE : MBEDTLS_ERR_NET_SEND_FAILED;
+    }
+
+    static int recvRaw(void* ctx, unsigned char* buf, size_t length) {
+        TlsSessionClient* self = (TlsSessionClient*)ctx;
+        if (self->WiFiClient::available() <= 0) {
+            return self->WiFiClient::connected() ? MBEDTLS_ERR_SSL_WANT_READ : MBEDTLS_ERR_NET_CONN_RESET;
+        }
+        int received = self->WiFiClient::read(buf, length);
+        return received > 0 ? received : MBEDTLS_ERR_SSL_WANT_READ;
+    }
+
+    // Leaf fingerprint as hex (colons/spaces allowed): 20 bytes = SHA-1, 32 = SHA-256
+    static bool fingerprintMatches(const mbedtls_x509_crt* crt) {
+        unsigned char pinned[32];
+        size_t pinnedLength = 0;
+        for (const char* p = SERVER_FINGERPRINT; p[0] != '\0' && p[1] != '\0' && pinnedLength < sizeof(pinned); ) {
+            if (!isxdigit((unsigned char)p[0])) {
+                p++;
+                continue;
+            }
+            char byteHex[3] = {p[0], p[1], '\0'};
+            pinned[pinnedLength++] = (unsigned char)strtoul(byteHex, nullptr, 16);
+            p += 2;
+        }
+
+        mbedtls_md_type_t type = pinnedLength == 20 ? MBEDTLS_MD_SHA1 : MBEDTLS_MD_SHA256;
+        if (pinnedLength != 20 && pinnedLength != 32) {
+            return false;
+        }
+        unsigned char actual[32];
+        if (mbedtls_md(mbedtls_md_info_from_type(type), crt->raw.p, crt->raw.len, actual) != 0) {
+            return false;
+        }
+        return memcmp(actual, pinned, pinnedLength) == 0;
+    }
+
+    static int verifyCertificate(void* ctx, mbedtls_x509_crt* crt, int depth, uint32_t* flags) {
+        TlsSessionClient* self = (TlsSessionClient*)ctx;
+        self->certSeen = true;
+
+        bool pinned = strlen(SERVER_FINGERPRINT) > 0;
+        if (!pinned && strlen(SERVER_CA_CERT) > 0) {
+            // A CA that failed to parse must not fall back to no verification
+            if (!tlsCaLoaded) {
+                *flags |= MBEDTLS_X509_BADCERT_NOT_TRUSTED;
+            }
+            return 0;   // the CA chain decides
+        }
+        // Pinned leaf, or no verification configured: chain flags don't apply
+        *flags = 0;
+        if (pinned && depth == 0 && !fingerprintMatches(crt)) {
+            *flags = MBEDTLS_X509_BADCERT_NOT_TRUSTED;
+        }
+        return 0;
+    }
+
+    mbedtls_ssl_context ssl;
+    mbedtls_ssl_config conf;
+    bool active;
+    bool closed;
+    bool certSeen;
+    bool resumedSession;
+    unsigned long lastHandshakeMs;
+    int peeked;
+};
+
+// One connection per task, plus one held by a background OTA download;
+// all resume the same cached sessions
+TlsSessionClient networkTlsClient;
+TlsSessionClient sensorTlsClient;
+TlsSessionClient otaTlsClient;
+#endif
+
+// ========================================
+// OTA IMAGE VERIFICATION
+// ========================================
+// OTA images are hashed with SHA-256 while they stream into the update
+// partition and checked against the server's checksum. When the firmware
+// carries OTA_SIGNING_PUBLIC_KEY (EC or RSA PEM), the server's signature
+// over that digest has to verify as well. Update.end() only runs once both
+// checks pass, so a bad image never becomes bootable.
+#ifndef OTA_SIGNING_PUBLIC_KEY
+#define OTA_SIGNING_PUBLIC_KEY ""
+#endif
+#ifndef OTA_REQUIRE_SIGNATURE
+#define OTA_REQUIRE_SIGNATURE false
+#endif
+#define OTA_SIGNATURE_MAX 512
+
+struct OtaVerification {
+    bool digestChecked;
+    bool signatureChecked;
+    unsigned long downloadMs;
+    unsigned long hashMs;           // time spent inside SHA-256 updates
+    unsigned long signatureMs;
+    unsigned long tlsHandshakeMs;
+    bool tlsResumed;
+};
+
+// ========================================
+// BACKGROUND OTA
+// ========================================
+// The download runs as a job on the network task: each pass moves at most
+// OTA_SLICE_MS of the image into the update partition, capped at
+// OTA_MAX_BYTES_PER_SEC, on its own connection, so telemetry, heartbeats
+// and alarms (sensor task) carry on in between. Once verified the image is
+// marked bootable and the reboot waits for a quiet moment: no alarm for
+// OTA_QUIET_MS and nothing queued for upload, or OTA_REBOOT_DEFER_MAX_MS.
+#ifndef OTA_MAX_BYTES_PER_SEC
+#define OTA_MAX_BYTES_PER_SEC 32768
+#endif
+#ifndef OTA_SLICE_MS
+#define OTA_SLICE_MS 50
+#endif
+#ifndef OTA_QUIET_MS
+#define OTA_QUIET_MS 60000UL
+#endif
+#ifndef OTA_REBOOT_DEFER_MAX_MS
+#define OTA_REBOOT_DEFER_MAX_MS 1800000UL
+#endif
+
+enum OtaState {
+    OTA_IDLE,
+    OTA_DOWNLOADING,
+    OTA_VERIFYING,
+    OTA_READY
+};
+
+struct OtaJob {
+    OtaState state;
+    String checksum;
+    String signature;
+    bool checkSignature;
+    size_t contentLength;
+    size_t written;
+    int lastReported;
+    unsigned long hashUs;
+    unsigned long started;
+    unsigned long lastData;
+    unsigned long readyAt;
+    mbedtls_md_context_t sha;
+    OtaVerification verification;
+};
+
+OtaJob otaJob = {OTA_IDLE};
+HTTPClient otaHttp;
+#if !USE_HTTPS
+WiFiClient otaPlainClient;
+#endif
+volatile unsigned long lastAlarmAt = 0;
+
+// ========================================
+// BUFFER POOLS
+// ========================================
+// HTTP payloads, response bodies and JSON documents are carved out of
+// fixed slabs allocated once at boot instead of being created and freed
+// on every request. The large and batch tiers move to PSRAM on boards
+// that have it. Exhausted pools fall back to the heap and are counted.
+#ifndef POOL_SMALL_SLOT_SIZE
+#define POOL_SMALL_SLOT_SIZE 1024
+#endif
+#ifndef POOL_SMALL_SLOTS
+#define POOL_SMALL_SLOTS 6
+#endif
+#ifndef POOL_LARGE_SLOT_SIZE
+#define POOL_LARGE_SLOT_SIZE 4096
+#endif
+#ifndef POOL_LARGE_SLOTS
+#define POOL_LARGE_SLOTS 3
+#endif
+#ifndef POOL_BATCH_SLOT_SIZE
+#define POOL_BATCH_SLOT_SIZE 2048
+#endif
+#ifndef TELEMETRY_QUEUE_DEPTH
+#define TELEMETRY_QUEUE_DEPTH 10
+#endif
+#ifndef TELEMETRY_QUEUE_DEPTH_PSRAM
+#define TELEMETRY_QUEUE_DEPTH_PSRAM 30
+#endif
+#define POOL_MAX_SLOTS 32
+#define ENDPOINT_BUFFER_SIZE 224
+
+struct BufferPool {
+    const char* name;
+    uint8_t* slab;
+    size_t slotSize;
+    uint8_t slotCount;
+    uint32_t freeMask;      // bit i set = slot i free
+    uint8_t inUse;
+    uint8_t highWater;
+    uint32_t exhausted;     // acquisitions that found no free slot
+    bool psram;
+};
+
+BufferPool smallPool = {"small"};
+BufferPool largePool = {"large"};
+BufferPool batchPool = {"batch"};
+uint32_t poolHeapFallbacks = 0;
+portMUX_TYPE poolMux = portMUX_INITIALIZER_UNLOCKED;
+
+bool initBufferPool(BufferPool& pool, size_t slotSize, uint8_t slotCount, bool preferPsram) {
+    pool.slotSize = slotSize;
+    pool.slotCount = slotCount > POOL_MAX_SLOTS ? POOL_MAX_SLOTS : slotCount;
+    pool.slab = nullptr;
+    pool.psram = false;
+
+    size_t slabSize = pool.slotSize * pool.slotCount;
+    if (preferPsram && psramFound()) {
+        pool.slab = (uint8_t*)heap_caps_malloc(slabSize, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+        pool.psram = pool.slab != nullptr;
+    }
+    if (pool.slab == nullptr) {
+        pool.slab = (uint8_t*)heap_caps_malloc(slabSize, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    }
+
+    if (pool.slab == nullptr) {
+        Serial.printf("⚠️  Failed to allocate %s buffer pool (%u bytes)\n", pool.name, slabSize);
+        pool.slotCount = 0;
+        pool.freeMask = 0;
+        return false;
+    }
+
+    pool.freeMask = pool.slotCount == 32 ? 0xFFFFFFFFUL : ((1UL << pool.slotCount) - 1);
+    Serial.printf("Buffer pool %s: %u x %u bytes (%s)\n", pool.name, pool.slotCount, pool.slotSize,
+                  pool.psram ? "PSRAM" : "internal");
+    return true;
+}
+
+void initBufferPools() {
+    bool hasPsram = psramFound();
+    int queueDepth = hasPsram ? TELEMETRY_QUEUE_DEPTH_PSRAM : TELEMETRY_QUEUE_DEPTH;
+    if (queueDepth > POOL_MAX_SLOTS - 2) {
+        queueDepth = POOL_MAX_SLOTS - 2;
+    }
+
+    initBufferPool(smallPool, POOL_SMALL_SLOT_SIZE, POOL_SMALL_SLOTS, false);
+    initBufferPool(largePool, POOL_LARGE_SLOT_SIZE, POOL_LARGE_SLOTS, true);
+    // One slot per queued reading plus the one being sent and the one being filled
+    initBufferPool(batchPool, POOL_BATCH_SLOT_SIZE, queueDepth + 2, true);
+}
+
+void* poolAcquire(BufferPool& pool) {
+    void* slot = nullptr;
+    portENTER_CRITICAL(&poolMux);
+    if (pool.freeMask != 0) {
+        int index = __builtin_ctz(pool.freeMask);
+        pool.freeMask &= ~(1UL << index);
+        pool.inUse++;
+        if (pool.inUse > pool.highWater) {
+            pool.highWater = pool.inUse;
+        }
+        slot = pool.slab + (size_t)index * pool.slotSize;
+    } else {
+        pool.exhausted++;
+    }
+    portEXIT_CRITICAL(&poolMux);
+    return slot;
+}
+
+bool poolOwns(const BufferPool& pool, const void* ptr) {
+    const uint8_t* p = (const uint8_t*)ptr;
+    return pool.slab != nullptr && p >= pool.slab && p < pool.slab + pool.slotSize * pool.slotCount;
+}
+
+bool poolRelease(BufferPool& pool, void* ptr) {
+    if (!poolOwns(pool, ptr)) {
+        return false;
+    }
+    int index = ((uint8_t*)ptr - pool.slab) / pool.slotSize;
+    portENTER_CRITICAL(&poolMux);
+    pool.freeMask |= (1UL << index);
+    pool.inUse--;
+    portEXIT_CRITICAL(&poolMux);
+    return true;
+}
+
+void* heapFallback(size_t size) {
+    portENTER_CRITICAL(&poolMux);
+    poolHeapFallbacks++;
+    portEXIT_CRITICAL(&poolMux);
+    return malloc(size);
+}
+
+// Smallest general-purpose tier that fits, heap as a last resort
+void* bufferAcquire(size_t size) {
+    void* ptr = nullptr;
+    if (size <= smallPool.slotSize) {
+        ptr = poolAcquire(smallPool);
+    }
+    if (ptr == nullptr && size <= largePool.slotSize) {
+        ptr = poolAcquire(largePool);
+    }
+    return ptr != nullptr ? ptr : heapFallback(size);
+}
+
+void* batchAcquire(size_t size) {
+    void* ptr = size <= batchPool.slotSize ? poolAcquire(batchPool) : nullptr;
+    return ptr != nullptr ? ptr : heapFallback(size);
+}
+
+size_t bufferCapacity(const void* ptr) {
+    if (poolOwns(smallPool, ptr)) return smallPool.slotSize;
+    if (poolOwns(largePool, ptr)) return largePool.slotSize;
+    if (poolOwns(batchPool, ptr)) return batchPool.slotSize;
+    return 0;
+}
+
+void bufferRelease(void* ptr) {
+    if (ptr == nullptr) {
+        return;
+    }
+    if (!poolRelease(smallPool, ptr) && !poolRelease(largePool, ptr) && !poolRelease(batchPool, ptr)) {
+        free(ptr);
+    }
+}
+
+// ArduinoJson allocator so documents live in pool slots
+struct PoolJsonAllocator {
+    void* allocate(size_t size) {
+        return bufferAcquire(size);
+    }
+
+    void deallocate(void* ptr) {
+        bufferRelease(ptr);
+    }
+
+    void* reallocate(void* ptr, size_t newSize) {
+        size_t capacity = bufferCapacity(ptr);
+        if (capacity == 0) {
+            return realloc(ptr, newSize);
+        }
+        return newSize <= capacity ? ptr : nullptr;
+    }
+};
+
+typedef BasicJsonDocument<PoolJsonAllocator> PooledJsonDocument;
+
+// Scoped pool buffer, released when it goes out of scope
+class PoolBuffer {
+public:
+    PoolBuffer() : data(nullptr), capacity(0) {}
+    explicit PoolBuffer(size_t size) : PoolBuffer() { acquire(size); }
+    ~PoolBuffer() { bufferRelease(data); }
+
+    bool acquire(size_t size) {
+        bufferRelease(data);
+        data = (char*)bufferAcquire(size);
+        capacity = data != nullptr ? size : 0;
+        return data != nullptr;
+    }
+
+    char* data;
+    size_t capacity;
+
+private:
+    PoolBuffer(const PoolBuffer&);
+    PoolBuffer& operator=(const PoolBuffer&);
+};
+
+void reportBufferPool(JsonArray pools, const BufferPool& pool) {
+    JsonObject entry = pools.createNestedObject();
+    entry["name"] = pool.name;
+    entry["slot_size"] = pool.slotSize;
+    entry["slots"] = pool.slotCount;
+    entry["in_use"] = pool.inUse;
+    entry["high_water"] = pool.highWater;
+    entry["exhausted"] = pool.exhausted;
+    entry["psram"] = pool.psram;
+}
+
+bool backpressureHeld(Backpressure& bp) {
+    if (bp.held && (long)(millis() - bp.holdUntil) >= 0) {
+        bp.held = false;
+    }
+    return bp.held;
+}
+
+unsigned long backpressureInterval(unsigned long baseMs, const Backpressure& bp) {
+    return bp.intervalMs > baseMs ? bp.intervalMs : baseMs;
+}
+
+void applyBackpressure(HTTPClient& http, int httpCode, Backpressure& bp) {
+    long hintMs = http.header("X-Device-Backoff-Ms").toInt();
+    bp.intervalMs = hintMs > 0 ? (unsigned long)hintMs : 0;
+    if (bp.intervalMs > MAX_BACKOFF_MS) {
+        bp.intervalMs = MAX_BACKOFF_MS;
+    }
+
+    if (httpCode == 429 || httpCode == 503) {
+        unsigned long holdMs = (unsigned long)http.header("Retry-After").toInt() * 1000UL;
+        if (holdMs < bp.intervalMs) holdMs = bp.intervalMs;
+        if (holdMs < 1000UL) holdMs = 1000UL;
+        if (holdMs > MAX_BACKOFF_MS) holdMs = MAX_BACKOFF_MS;
+        bp.holdUntil = millis() + holdMs;
+        bp.held = true;
+        Serial.printf("Server backpressure: holding for %lu ms\n", holdMs);
+    }
+}
+
+#if USE_HTTPS
+void tlsInit() {
+    tlsSessionLock = xSemaphoreCreateMutex();
+    for (int i = 0; i < TLS_SESSION_SLOTS; i++) {
+        mbedtls_ssl_session_init(&tlsSessions[i].session);
+        tlsSessions[i].valid = false;
+    }
+
+    mbedtls_x509_crt_init(&tlsCaChain);
+    if (strlen(SERVER_CA_CERT) > 0) {
+        int ret = mbedtls_x509_crt_parse(&tlsCaChain, (const unsigned char*)SERVER_CA_CERT, strlen(SERVER_CA_CERT) + 1);
+        tlsCaLoaded = ret == 0;
+        if (!tlsCaLoaded) {
+            Serial.printf("SERVER_CA_CERT did not parse: -0x%04x, TLS connections will be refused\n", -ret);
+        }
+    }
+}
+
+// Offer the cached session for host:port to a connection about to handshake
+bool tlsLoadSession(const char* host, uint16_t port, mbedtls_ssl_context* ssl) {
+    bool offered = false;
+    xSemaphoreTake(tlsSessionLock, portMAX_DELAY);
+    for (int i = 0; i < TLS_SESSION_SLOTS; i++) {
+        TlsSessionSlot& slot = tlsSessions[i];
+        if (slot.valid && slot.port == port && strcmp(slot.host, host) == 0) {
+            offered = mbedtls_ssl_set_session(ssl, &slot.session) == 0;
+            slot.lastUsed = millis();
+            break;
+        }
+    }
+    xSemaphoreGive(tlsSessionLock);
+    return offered;
+}
+
+// Cache the session (or refreshed ticket) of a completed handshake
+void tlsStoreSession(const char* host, uint16_t port, mbedtls_ssl_context* ssl) {
+    xSemaphoreTake(tlsSessionLock, portMAX_DELAY);
+    TlsSessionSlot* target = nullptr;
+    for (int i = 0; i < TLS_SESSION_SLOTS && target == nullptr; i++) {
+        if (tlsSessions[i].valid && tlsSessions[i].port == port && strcmp(tlsSessions[i].host, host) == 0) {
+            target = &tlsSessions[i];
+        }
+    }
+    for (int i = 0; i < TLS_SESSION_SLOTS && target == nullptr; i++) {
+        if (!tlsSessions[i].valid) {
+            target = &tlsSessions[i];
+        }
+    }
+    if (target == nullptr) {
+        target = &tlsSessions[0];
+        for (int i = 1; i < TLS_SESSION_SLOTS; i++) {
+            if (tlsSessions[i].lastUsed < target->lastUsed) {
+                target = &tlsSessions[i];
+            }
+        }
+    }
+
+    mbedtls_ssl_session_free(&target->session);
+    mbedtls_ssl_session_init(&target->session);
+    target->valid = mbedtls_ssl_get_session(ssl, &target->session) == 0;
+    snprintf(target->host, sizeof(target->host), "%s", host);
+    target->port = port;
+    target->lastUsed = millis();
+    xSemaphoreGive(tlsSessionLock);
+}
+
+void tlsForgetSession(const char* host, uint16_t port) {
+    xSemaphoreTake(tlsSessionLock, portMAX_DELAY);
+    for (int i = 0; i < TLS_SESSION_SLOTS; i++) {
+        TlsSessionSlot& slot = tlsSessions[i];
+        if (slot.valid && slot.port == port && strcmp(slot.host, host) == 0) {
+            mbedtls_ssl_session_free(&slot.session);
+            mbedtls_ssl_session_init(&slot.session);
+            slot.valid = false;
+        }
+    }
+    xSemaphoreGive(tlsSessionLock);
+}
+
+void tlsRecordHandshake(bool resumed, bool ok, unsigned long elapsedMs) {
+    xSemaphoreTake(tlsSessionLock, portMAX_DELAY);
+    if (!ok) {
+        tlsStats.failures++;
+    } else if (resumed) {
+        tlsStats.resumedHandshakes++;
+        tlsStats.lastResumedMs = elapsedMs;
+    } else {
+        tlsStats.fullHandshakes++;
+        tlsStats.lastFullMs = elapsedMs;
+    }
+    xSemaphoreGive(tlsSessionLock);
+
+    if (ok && config.debug_mode) {
+        Serial.printf("TLS %s handshake: %lu ms\n", resumed ? "resumed" : "full", elapsedMs);
+    }
+}
+
+void reportTlsStats(JsonObject tls) {
+    tls["full_handshakes"] = tlsStats.fullHandshakes;
+    tls["resumed_handshakes"] = tlsStats.resumedHandshakes;
+    tls["failures"] = tlsStats.failures;
+    tls["last_full_ms"] = tlsStats.lastFullMs;
+    tls["last_resumed_ms"] = tlsStats.lastResumedMs;
+}
+#endif
+
+// Start a request to /api/devices/<id>/<path> without building String URLs
+bool beginDeviceRequest(HTTPClient& http, const char* path) {
+    char endpoint[ENDPOINT_BUFFER_SIZE];
+    snprintf(endpoint, sizeof(endpoint), "%s/api/devices/%s/%s", config.server_url, config.device_id, path);
+
+    if (config.debug_mode) {
+        Serial.print("Request: ");
+        Serial.println(endpoint);
+    }
+
+#if USE_HTTPS
+    TlsSessionClient& tlsClient = xTaskGetCurrentTaskHandle() == sensorTaskHandle ? sensorTlsClient : networkTlsClient;
+    bool started = http.begin(tlsClient, endpoint);
+#else
+    bool started = http.begin(wifiClient, endpoint);
+#endif
+    if (started) {
+        http.addHeader("Content-Type", "application/json");
+        if (strlen(SERVER_API_KEY) > 0) {
+            http.addHeader("X-API-Key", SERVER_API_KEY);
+        }
+        http.collectHeaders(BACKPRESSURE_HEADERS, 2);
+    }
+    return started;
+}
+
+int postJson(HTTPClient& http, const JsonDocument& doc) {
+    size_t length = measureJson(doc);
+    PoolBuffer payload(length + 1);
+    if (payload.data == nullptr) {
+        return HTTPC_ERROR_TOO_LESS_RAM;
+    }
+    serializeJson(doc, payload.data, payload.capacity);
+    return http.POST((uint8_t*)payload.data, length);
+}
+
+// Read the response body into a pool buffer. Express sends Content-Length
+// for JSON bodies; anything chunked goes through getString() instead.
+size_t readResponseBody(HTTPClient& http, PoolBuffer& body) {
+    int size = http.getSize();
+    if (size < 0) {
+        String response = http.getString();
+        if (!body.acquire(response.length() + 1)) {
+            return 0;
+        }
+        memcpy(body.data, response.c_str(), response.length() + 1);
+        return response.length();
+    }
+
+    if (!body.acquire(size + 1)) {
+        return 0;
+    }
+    size_t received = http.getStreamPtr()->readBytes(body.data, size);
+    body.data[received] = '\0';
+    return received;
+}
+
 // Forward declarations
 void saveConfiguration();
-void parseServerResponse(const String& response);
+void parseServerResponse(const char* response, size_t length);
 void updateSensorConfiguration(JsonArray sensorConfigs);
 void sendAlarmEvent(int sensorIndex, float value);
-void notifyOTAStatus(const String& status, int progress, const String& errorMessage = "");
+void notifyOTAStatus(const String& status, int progress, const String& errorMessage = "", const OtaVerification* verification = nullptr);
 void handleOTAUpdates();
-void performOTAUpdate(const String& firmwareUrl, const String& expectedChecksum = "");
+void performOTAUpdate(const String& firmwareUrl, const String& expectedChecksum = "", const String& signature = "");
+void otaStep();
+void otaFinish();
+void otaRebootWhenQuiet();
+void startWiFi();
+void onNetworkUp();
+void wifiBegin();
+void wifiScanNow();
+void wifiAttemptFailed();
+void wifiPoll();
+void reportWifiStats(JsonObject wifi);
+#if ULP_WATCH_ENABLED
+void ulpReleasePins();
+void ulpHandleBoot();
+void ulpPushThresholds();
+void ulpUploadBacklog();
+bool ulpReadyToSleep();
+void ulpEnterWatch();
+#endif
+int parsePinName(const String& pinStr);
+#if SENSOR_ONEWIRE_ENABLED
+void oneWireInit();
+void oneWirePoll();
+bool oneWireReading(int sensorIndex, float& celsius);
+#endif
+#if MODBUS_ENABLED
+void modbusInit();
+void modbusTask(void *parameter);
+void modbusQueueMap(JsonObject map);
+void modbusApplyPending();
+bool modbusReading(int sensorIndex, float& value);
+void reportModbusStats(JsonObject bus);
+#endif
+#if SENSOR_PULSE_ENABLED
+void pulseInit();
+uint64_t pulseFold();
+void pulseTake();
+bool pulseReading(int sensorIndex, float& value);
+void pulseSaveTotal(uint64_t pulses);
+#endif
+#if HISTORY_STORE_ENABLED
+void historyInit();
+void historySyncClock(uint64_t serverMs);
+void historyRecord(int pin, float value);
+void historyMaybeFlush();
+void historyFlushNow();
+bool historyUploadPending();
+void historyQueueRequests(JsonArray requests);
+void historyServeRequests();
+#endif
 
+// Sampling starts before the network: sensors and the sensor task come up
+// first, Wi-Fi connects in the background and the OTA check and first
+// heartbeat run on the network task once the link is up.
 void setup() {
     Serial.begin(115200);
-    delay(1000);
 
     Serial.println("Starting ESP32 Sensor Platform...");
     Serial.printf("Chip Model: %s\n", ESP.getChipModel());
@@ -113,20 +1388,34 @@ void setup() {
     Serial.printf("CPU Frequency: %d MHz\n", ESP.getCpuFreqMHz());
     Serial.printf("Flash Size: %d bytes\n", ESP.getFlashChipSize());
 
+    // Carve out network/JSON buffers before anything else touches the heap
+    initBufferPools();
+
+#if USE_HTTPS
+    tlsInit();
+#endif
+
     // Initialize EEPROM
     EEPROM.begin(1024);
 
     // Load configuration
     loadConfiguration();
 
+#if HISTORY_STORE_ENABLED
+    historyInit();
+#endif
+
     // Initialize sensors
+#if ULP_WATCH_ENABLED
+    ulpReleasePins();
+#endif
     initializeSensors();
+#if ULP_WATCH_ENABLED
+    ulpHandleBoot();
+#endif
 
-    // Create queue for sensor data
-    sensorDataQueue = xQueueCreate(10, sizeof(String));
-
-    // Connect to WiFi
-    connectToWiFi();
+    // Create queue for sensor data; one entry per batch-pool slot in flight
+    sensorDataQueue = xQueueCreate(batchPool.slotCount > 2 ? batchPool.slotCount - 2 : 1, sizeof(TelemetrySample));
 
     // Create tasks for dual-core processing
     xTaskCreatePinnedToCore(
@@ -138,6 +1427,15 @@ void setup() {
         &sensorTaskHandle,    // Task handle
         0                     // Core 0
     );
+    bootTimings.sensorsReadyMs = millis();
+
+#if MODBUS_ENABLED
+    // Above the sensor task so bus timing survives a slow sensor pass
+    xTaskCreatePinnedToCore(modbusTask, "ModbusTask", 4096, NULL, 2, &modbusTaskHandle, 0);
+#endif
+
+    // Connect to WiFi without waiting for it
+    startWiFi();
 
     xTaskCreatePinnedToCore(
         networkTask,          // Task function
@@ -148,14 +1446,6 @@ void setup() {
         &networkTaskHandle,   // Task handle
         1                     // Core 1
     );
-
-    // Check for firmware updates
-    if (config.ota_enabled) {
-        checkForFirmwareUpdate();
-    }
-
-    // Send initial heartbeat
-    sendHeartbeat();
 }
 
 void loop() {
@@ -166,11 +1456,26 @@ void loop() {
 // Sensor task running on Core 0
 void sensorTask(void *parameter) {
     while (true) {
-        if (millis() - lastSensorRead >= SENSOR_READ_INTERVAL_MS) {
-            String sensorData = readAllSensors();
-            xQueueSend(sensorDataQueue, &sensorData, portMAX_DELAY);
+        if (millis() - lastSensorRead >= backpressureInterval(SENSOR_READ_INTERVAL_MS, telemetryBackpressure)) {
+            TelemetrySample sample = { readAllSensors(), millis() };
+            if (bootTimings.firstSampleMs == 0) {
+                bootTimings.firstSampleMs = sample.sampledAt;
+            }
+            if (sample.payload != nullptr && xQueueSend(sensorDataQueue, &sample, 0) != pdTRUE) {
+                // Queue full (link down or server holding telemetry): keep the newest reading
+                TelemetrySample oldest;
+                if (xQueueReceive(sensorDataQueue, &oldest, 0) == pdTRUE) {
+                    bufferRelease(oldest.payload);
+                }
+                if (xQueueSend(sensorDataQueue, &sample, 0) != pdTRUE) {
+                    bufferRelease(sample.payload);
+                }
+            }
             lastSensorRead = millis();
         }
+#if HISTORY_STORE_ENABLED
+        historyMaybeFlush();
+#endif
         vTaskDelay(10 / portTICK_PERIOD_MS);
     }
 }
@@ -194,21 +1499,35 @@ void networkTask(void *parameter) {
             lastWiFiCheck = millis();
         }
 
+        wifiPoll();
+
         // Only perform network operations if WiFi is connected
         if (WiFi.status() == WL_CONNECTED) {
+            if (!networkBootDone) {
+                onNetworkUp();
+#if ULP_WATCH_ENABLED
+                ulpUploadBacklog();
+#endif
+            }
+
             // Process sensor data from queue
-            String sensorData;
-            if (xQueueReceive(sensorDataQueue, &sensorData, 0) == pdTRUE) {
-                if (sensorData.length() > 0) {
-                    sendTelemetryData(sensorData);
-                }
+            TelemetrySample sample;
+            if (!backpressureHeld(telemetryBackpressure) &&
+                xQueueReceive(sensorDataQueue, &sample, 0) == pdTRUE) {
+                sendTelemetryData(sample.payload, strlen(sample.payload), millis() - sample.sampledAt);
+                bufferRelease(sample.payload);
             }
 
             // Send heartbeat
-            if (millis() - lastHeartbeat >= HEARTBEAT_INTERVAL_SEC * 1000) {
+            if (millis() - lastHeartbeat >= backpressureInterval(HEARTBEAT_INTERVAL_SEC * 1000UL, controlBackpressure) &&
+                !backpressureHeld(controlBackpressure)) {
                 sendHeartbeat();
             }
 
+#if HISTORY_STORE_ENABLED
+            historyServeRequests();
+#endif
+
             if (config.ota_enabled) {
                 handleOTAUpdates();
             }
@@ -219,6 +1538,15 @@ void networkTask(void *parameter) {
             }
         }
 
+        // Background OTA download, or the reboot into a verified image
+        otaStep();
+
+#if ULP_WATCH_ENABLED
+        if (ulpReadyToSleep()) {
+            ulpEnterWatch();
+        }
+#endif
+
         vTaskDelay(100 / portTICK_PERIOD_MS);
     }
 }
@@ -288,75 +1616,430 @@ void initializeSensors() {
     if (config.debug_mode) {
         Serial.println("Light sensor initialized on pin " + String(SENSOR_LIGHT_PIN));
     }
-    #endif
+    #endif
+
+    // Motion Sensor (PIR)
+    #if SENSOR_MOTION_ENABLED
+    pinMode(SENSOR_MOTION_PIN, INPUT);
+    sensors[sensorCount] = {SENSOR_MOTION_PIN, "motion", "Motion Detector", 0, 1, true, MOTION_THRESHOLD_MIN, MOTION_THRESHOLD_MAX};
+    sensorCount++;
+
+    if (config.debug_mode) {
+        Serial.println("Motion sensor initialized on pin " + String(SENSOR_MOTION_PIN));
+    }
+    #endif
+
+    // Distance Sensor (Ultrasonic)
+    #if SENSOR_DISTANCE_ENABLED
+    ultrasonic = new Ultrasonic(SENSOR_DISTANCE_TRIGGER_PIN, SENSOR_DISTANCE_ECHO_PIN);
+    sensors[sensorCount] = {SENSOR_DISTANCE_TRIGGER_PIN, "distance", "Distance Sensor", 0, 1, true, DISTANCE_THRESHOLD_MIN, DISTANCE_THRESHOLD_MAX};
+    sensorCount++;
+
+    if (config.debug_mode) {
+        Serial.println("Ultrasonic sensor initialized - Trigger: " + String(SENSOR_DISTANCE_TRIGGER_PIN) + ", Echo: " + String(SENSOR_DISTANCE_ECHO_PIN));
+    }
+    #endif
+
+    // Sound Sensor
+    #if SENSOR_SOUND_ENABLED
+    sensors[sensorCount] = {SENSOR_SOUND_PIN, "sound", "Sound Level", 0, 1, true, SOUND_THRESHOLD_MIN, SOUND_THRESHOLD_MAX};
+    sensorCount++;
+
+    if (config.debug_mode) {
+        Serial.println("Sound sensor initialized on pin " + String(SENSOR_SOUND_PIN));
+    }
+    #endif
+
+    // Magnetic Door/Window Sensor
+    #if SENSOR_MAGNETIC_ENABLED
+    pinMode(SENSOR_MAGNETIC_PIN, INPUT_PULLUP);
+    sensors[sensorCount] = {SENSOR_MAGNETIC_PIN, "magnetic", "Door/Window Sensor", 0, 1, true, MAGNETIC_THRESHOLD_MIN, MAGNETIC_THRESHOLD_MAX};
+    sensorCount++;
+
+    if (config.debug_mode) {
+        Serial.println("Magnetic sensor initialized on pin " + String(SENSOR_MAGNETIC_PIN));
+    }
+    #endif
+
+    // Vibration Sensor
+    #if SENSOR_VIBRATION_ENABLED
+    pinMode(SENSOR_VIBRATION_PIN, INPUT);
+    sensors[sensorCount] = {SENSOR_VIBRATION_PIN, "vibration", "Vibration Sensor", 0, 1, true, VIBRATION_THRESHOLD_MIN, VIBRATION_THRESHOLD_MAX};
+    sensorCount++;
+
+    if (config.debug_mode) {
+        Serial.println("Vibration sensor initialized on pin " + String(SENSOR_VIBRATION_PIN));
+    }
+    #endif
+
+    // Gas Sensor
+    #if SENSOR_GAS_ENABLED
+    sensors[sensorCount] = {SENSOR_GAS_PIN, "gas", "Gas Sensor", 0, 1, true, GAS_THRESHOLD_MIN, GAS_THRESHOLD_MAX};
+    sensorCount++;
+
+    if (config.debug_mode) {
+        Serial.println("Gas sensor initialized on pin " + String(SENSOR_GAS_PIN));
+    }
+    #endif
+
+    // Pulse-output meter: count, rate and total
+    #if SENSOR_PULSE_ENABLED
+    pulseInit();
+    #endif
+
+    // DS18B20 probes on the 1-Wire bus, one sensor each
+    #if SENSOR_ONEWIRE_ENABLED
+    oneWireInit();
+    #endif
+
+    // Modbus points follow once the server sends a register map
+    #if MODBUS_ENABLED
+    modbusInit();
+    #endif
+
+    Serial.print("✅ Total sensors initialized: ");
+    Serial.println(sensorCount);
+    Serial.println("========================================");
+}
+
+#if SENSOR_ONEWIRE_ENABLED
+// Boot: find every DS18B20 on the bus, register each as a sensor and set
+// the resolution on all of them with one skip-ROM scratchpad write
+void oneWireInit() {
+    oneWire = new OneWire(SENSOR_ONEWIRE_PIN);
+    oneWireProbeCount = 0;
+
+    uint8_t rom[8];
+    oneWire->reset_search();
+    while (oneWireProbeCount < ONEWIRE_MAX_PROBES && sensorCount < MAX_SENSORS && oneWire->search(rom)) {
+        if (OneWire::crc8(rom, 7) != rom[7] || rom[0] != DS18B20_FAMILY_CODE) {
+            continue;
+        }
+
+        OneWireProbe& probe = oneWireProbes[oneWireProbeCount++];
+        memcpy(probe.rom, rom, sizeof(rom));
+        snprintf(probe.pinName, sizeof(probe.pinName), ONEWIRE_PIN_PREFIX "%02X%02X%02X%02X", rom[4], rom[3], rom[2], rom[1]);
+        probe.sensorIndex = sensorCount;
+        probe.valid = false;
+
+        sensors[sensorCount] = {SENSOR_ONEWIRE_PIN, "temperature", String("Probe ") + (probe.pinName + 2), 0, 1, true, PROBE_THRESHOLD_MIN, PROBE_THRESHOLD_MAX, probe.pinName};
+        sensorCount++;
+    }
+
+    if (oneWireProbeCount == 0) {
+        Serial.println("No DS18B20 probes found on pin " + String(SENSOR_ONEWIRE_PIN));
+        return;
+    }
+
+    // TH/TL alarm registers are unused; config byte holds R1:R0
+    oneWire->reset();
+    oneWire->skip();
+    oneWire->write(DS18B20_WRITE_SCRATCHPAD);
+    oneWire->write(0x7F);
+    oneWire->write(0x80);
+    oneWire->write(((ONEWIRE_RESOLUTION_BITS - 9) << 5) | 0x1F);
+
+    oneWire->reset();
+    oneWire->skip();
+    oneWire->write(DS18B20_CONVERT_T);
+    oneWireConvertStartedAt = millis();
+
+    Serial.printf("%u DS18B20 probe(s) on pin %d\n", oneWireProbeCount, SENSOR_ONEWIRE_PIN);
+}
+
+// Sensor task, every pass: once the running conversion has had its time,
+// read each probe's scratchpad and start the next conversion on all of them
+void oneWirePoll() {
+    if (oneWireProbeCount == 0 || millis() - oneWireConvertStartedAt < ONEWIRE_CONVERSION_MS) {
+        return;
+    }
+
+    for (uint8_t p = 0; p < oneWireProbeCount; p++) {
+        OneWireProbe& probe = oneWireProbes[p];
+        probe.valid = false;
+        if (!oneWire->reset()) {
+            continue;   // nothing answered the reset pulse
+        }
+        oneWire->select(probe.rom);
+        oneWire->write(DS18B20_READ_SCRATCHPAD);
+
+        uint8_t scratchpad[9];
+        oneWire->read_bytes(scratchpad, sizeof(scratchpad));
+        // A shorted bus reads all zeros, which passes the CRC; the config
+        // byte's low five bits always read back as ones
+        if (OneWire::crc8(scratchpad, 8) != scratchpad[8] || (scratchpad[4] & 0x1F) != 0x1F) {
+            continue;
+        }
+
+        // Bits below the configured resolution are undefined
+        int16_t raw = (int16_t)((scratchpad[1] << 8) | scratchpad[0]);
+        raw &= ~((1 << (12 - ONEWIRE_RESOLUTION_BITS)) - 1);
+        probe.celsius = raw / 16.0f;
+        probe.valid = true;
+    }
+
+    oneWire->reset();
+    oneWire->skip();
+    oneWire->write(DS18B20_CONVERT_T);
+    oneWireConvertStartedAt = millis();
+}
+
+// Latest completed conversion for a probe-backed sensor
+bool oneWireReading(int sensorIndex, float& celsius) {
+    for (uint8_t p = 0; p < oneWireProbeCount; p++) {
+        if (oneWireProbes[p].sensorIndex == sensorIndex) {
+            celsius = oneWireProbes[p].celsius;
+            return oneWireProbes[p].valid;
+        }
+    }
+    return false;
+}
+#endif
+
+#if MODBUS_ENABLED
+void modbusInit() {
+    modbusLock = xSemaphoreCreateMutex();
+    modbusFirstSensor = sensorCount;
+
+    pinMode(MODBUS_DE_PIN, OUTPUT);
+    digitalWrite(MODBUS_DE_PIN, LOW);
+    modbusSerial.begin(MODBUS_BAUD, SERIAL_8N1, MODBUS_RX_PIN, MODBUS_TX_PIN);
+    modbus.begin(MODBUS_BAUD, MODBUS_RESPONSE_TIMEOUT_MS * 1000UL);
+
+    Serial.printf("Modbus RTU on RX %d / TX %d at %d baud, waiting for a register map\n",
+                  MODBUS_RX_PIN, MODBUS_TX_PIN, MODBUS_BAUD);
+}
+
+// Starts a read of every batch each MODBUS_POLL_INTERVAL_MS and keeps the
+// bus moving; a poll only shuffles bytes, so the lock is never held long
+void modbusTask(void *parameter) {
+    while (true) {
+        xSemaphoreTake(modbusLock, portMAX_DELAY);
+        if (modbusPointCount > 0 && !modbus.busy() &&
+            millis() - modbusCycleStartedAt >= MODBUS_POLL_INTERVAL_MS) {
+            modbus.startCycle();
+            modbusCycleStartedAt = millis();
+        }
+        modbus.poll(micros());
+        bool busy = modbus.busy();
+        xSemaphoreGive(modbusLock);
+
+        vTaskDelay(busy ? 1 : 10 / portTICK_PERIOD_MS);
+    }
+}
+
+// Network task: keep a new map for the sensor task to apply
+void modbusQueueMap(JsonObject map) {
+    uint32_t version = map["version"] | 0UL;
+    if (version == modbusMapVersion || !map.containsKey("points")) {
+        return;
+    }
 
-    // Motion Sensor (PIR)
-    #if SENSOR_MOTION_ENABLED
-    pinMode(SENSOR_MOTION_PIN, INPUT);
-    sensors[sensorCount] = {SENSOR_MOTION_PIN, "motion", "Motion Detector", 0, 1, true, MOTION_THRESHOLD_MIN, MOTION_THRESHOLD_MAX};
-    sensorCount++;
+    xSemaphoreTake(modbusLock, portMAX_DELAY);
+    modbusPendingCount = 0;
+    for (JsonObject entry : map["points"].as<JsonArray>()) {
+        const char* pin = entry["pin"] | "";
+        int type = modbusParseType(entry["type"] | "");
+        if (modbusPendingCount >= MODBUS_MAX_POINTS || type < 0 ||
+            pin[0] == '\0' || strlen(pin) >= MODBUS_PIN_NAME_SIZE) {
+            continue;
+        }
 
-    if (config.debug_mode) {
-        Serial.println("Motion sensor initialized on pin " + String(SENSOR_MOTION_PIN));
+        ModbusMapEntry& pending = modbusPending[modbusPendingCount++];
+        pending.point.slave = entry["slave"] | 1;
+        pending.point.function = entry["function"] | MODBUS_READ_HOLDING_REGISTERS;
+        pending.point.address = entry["address"] | 0;
+        pending.point.type = type;
+        pending.point.scale = entry["scale"] | 1.0f;
+        snprintf(pending.pinName, sizeof(pending.pinName), "%s", pin);
+        snprintf(pending.sensorType, sizeof(pending.sensorType), "%s", entry["sensor_type"] | "pressure");
+        pending.thresholdMin = entry["threshold_min"] | 0.0f;
+        pending.thresholdMax = entry["threshold_max"] | 0.0f;
     }
-    #endif
-
-    // Distance Sensor (Ultrasonic)
-    #if SENSOR_DISTANCE_ENABLED
-    ultrasonic = new Ultrasonic(SENSOR_DISTANCE_TRIGGER_PIN, SENSOR_DISTANCE_ECHO_PIN);
-    sensors[sensorCount] = {SENSOR_DISTANCE_TRIGGER_PIN, "distance", "Distance Sensor", 0, 1, true, DISTANCE_THRESHOLD_MIN, DISTANCE_THRESHOLD_MAX};
-    sensorCount++;
+    modbusPendingVersion = version;
+    modbusPendingReady = true;
+    xSemaphoreGive(modbusLock);
+}
 
-    if (config.debug_mode) {
-        Serial.println("Ultrasonic sensor initialized - Trigger: " + String(SENSOR_DISTANCE_TRIGGER_PIN) + ", Echo: " + String(SENSOR_DISTANCE_ECHO_PIN));
+// Sensor task: swap the Modbus sensors for the pending map
+void modbusApplyPending() {
+    if (!modbusPendingReady) {
+        return;
     }
-    #endif
 
-    // Sound Sensor
-    #if SENSOR_SOUND_ENABLED
-    sensors[sensorCount] = {SENSOR_SOUND_PIN, "sound", "Sound Level", 0, 1, true, SOUND_THRESHOLD_MIN, SOUND_THRESHOLD_MAX};
-    sensorCount++;
+    xSemaphoreTake(modbusLock, portMAX_DELAY);
+    uint8_t room = MAX_SENSORS - modbusFirstSensor;
+    modbusPointCount = modbusPendingCount < room ? modbusPendingCount : room;
+    sensorCount = modbusFirstSensor;
+    for (uint8_t k = 0; k < modbusPointCount; k++) {
+        const ModbusMapEntry& entry = modbusPending[k];
+        modbusPoints[k] = entry.point;
+        memcpy(modbusPinNames[k], entry.pinName, MODBUS_PIN_NAME_SIZE);
+
+        sensors[sensorCount] = {-1, entry.sensorType, String("Modbus ") + entry.pinName, 0, 1, true,
+                                entry.thresholdMin, entry.thresholdMax, modbusPinNames[k]};
+        sensorFilters[sensorCount].initialized = false;
+        telemetryDeadbands[sensorCount].sent = false;
+        sensorCount++;
+    }
+    uint8_t requests = modbus.setPoints(modbusPoints, modbusPointCount);
+    modbusCycleStartedAt = millis() - MODBUS_POLL_INTERVAL_MS;
+    modbusMapVersion = modbusPendingVersion;
+    modbusPendingReady = false;
+    // The new points take their settings from the sensor list; fetch it again
+    sensorConfigVersion = 0;
+    xSemaphoreGive(modbusLock);
+
+    Serial.printf("Modbus map %lu: %u point(s), %u request(s) per cycle\n",
+                  (unsigned long)modbusMapVersion, modbusPointCount, requests);
+}
 
-    if (config.debug_mode) {
-        Serial.println("Sound sensor initialized on pin " + String(SENSOR_SOUND_PIN));
+// Last decoded value for a Modbus-backed sensor
+bool modbusReading(int sensorIndex, float& value) {
+    int k = sensorIndex - modbusFirstSensor;
+    if (k < 0 || k >= modbusPointCount) {
+        return false;
     }
-    #endif
 
-    // Magnetic Door/Window Sensor
-    #if SENSOR_MAGNETIC_ENABLED
-    pinMode(SENSOR_MAGNETIC_PIN, INPUT_PULLUP);
-    sensors[sensorCount] = {SENSOR_MAGNETIC_PIN, "magnetic", "Door/Window Sensor", 0, 1, true, MAGNETIC_THRESHOLD_MIN, MAGNETIC_THRESHOLD_MAX};
-    sensorCount++;
+    xSemaphoreTake(modbusLock, portMAX_DELAY);
+    value = modbusPoints[k].value;
+    bool valid = modbusPoints[k].valid;
+    xSemaphoreGive(modbusLock);
+    return valid;
+}
 
-    if (config.debug_mode) {
-        Serial.println("Magnetic sensor initialized on pin " + String(SENSOR_MAGNETIC_PIN));
-    }
-    #endif
+void reportModbusStats(JsonObject bus) {
+    const ModbusStats& stats = modbus.stats();
+    bus["version"] = modbusMapVersion;
+    bus["points"] = modbusPointCount;
+    bus["requests"] = stats.requests;
+    bus["responses"] = stats.responses;
+    bus["timeouts"] = stats.timeouts;
+    bus["crc_errors"] = stats.crcErrors;
+    bus["exceptions"] = stats.exceptions;
+}
+#endif
 
-    // Vibration Sensor
-    #if SENSOR_VIBRATION_ENABLED
-    pinMode(SENSOR_VIBRATION_PIN, INPUT);
-    sensors[sensorCount] = {SENSOR_VIBRATION_PIN, "vibration", "Vibration Sensor", 0, 1, true, VIBRATION_THRESHOLD_MIN, VIBRATION_THRESHOLD_MAX};
-    sensorCount++;
+#if SENSOR_PULSE_ENABLED
+// Boot: restore the saved total, start PCNT and the fold timer, and
+// register the three pulse sensors
+void pulseInit() {
+    PulseStore store;
+    EEPROM.get(PULSE_EEPROM_ADDR, store);
+    pulseTotal = store.magic == PULSE_STORE_MAGIC ? store.pulses : 0;
+    pulseReportedTotal = pulseTotal;
+    pulseSavedTotal = pulseTotal;
+    pulseReportedAt = millis();
+    pulseSavedAt = millis();
+
+    pinMode(SENSOR_PULSE_PIN, INPUT_PULLUP);
+
+    pcnt_config_t unit = {};
+    unit.pulse_gpio_num = SENSOR_PULSE_PIN;
+    unit.ctrl_gpio_num = PCNT_PIN_NOT_USED;
+    unit.channel = PCNT_CHANNEL_0;
+    unit.unit = PULSE_PCNT_UNIT;
+    unit.pos_mode = PCNT_COUNT_DIS;     // meter outputs pull the line low
+    unit.neg_mode = PCNT_COUNT_INC;
+    unit.lctrl_mode = PCNT_MODE_KEEP;
+    unit.hctrl_mode = PCNT_MODE_KEEP;
+    unit.counter_h_lim = PULSE_COUNTER_LIMIT;
+    unit.counter_l_lim = -PULSE_COUNTER_LIMIT;
+    if (pcnt_unit_config(&unit) != ESP_OK) {
+        Serial.println("PCNT setup failed on pin " + String(SENSOR_PULSE_PIN));
+        return;
+    }
+    pcnt_set_filter_value(PULSE_PCNT_UNIT, PULSE_FILTER_CYCLES);
+    pcnt_filter_enable(PULSE_PCNT_UNIT);
+    pcnt_counter_pause(PULSE_PCNT_UNIT);
+    pcnt_counter_clear(PULSE_PCNT_UNIT);
+    pcnt_counter_resume(PULSE_PCNT_UNIT);
+
+    esp_timer_create_args_t timerArgs = {};
+    timerArgs.callback = [](void*) { pulseFold(); };
+    timerArgs.name = "pulse";
+    esp_timer_create(&timerArgs, &pulseTimer);
+    esp_timer_start_periodic(pulseTimer, PULSE_SAMPLE_MS * 1000ULL);
+
+    snprintf(pulsePinNames[0], PULSE_PIN_NAME_SIZE, "P%d.count", SENSOR_PULSE_PIN);
+    snprintf(pulsePinNames[1], PULSE_PIN_NAME_SIZE, "P%d.rate", SENSOR_PULSE_PIN);
+    snprintf(pulsePinNames[2], PULSE_PIN_NAME_SIZE, "P%d.total", SENSOR_PULSE_PIN);
+    pulseFirstSensor = sensorCount;
+    sensors[sensorCount++] = {SENSOR_PULSE_PIN, "pulse_count", "Pulse Count", 0, 1, true, 0, 1e9, pulsePinNames[0]};
+    sensors[sensorCount++] = {SENSOR_PULSE_PIN, "pulse_rate", "Pulse Rate", 0, 1, true, PULSE_RATE_THRESHOLD_MIN, PULSE_RATE_THRESHOLD_MAX, pulsePinNames[1]};
+    sensors[sensorCount++] = {SENSOR_PULSE_PIN, "pulse_total", "Pulse Total", 0, 1, true, 0, 1e9, pulsePinNames[2]};
+
+    Serial.printf("Pulse counter on pin %d, total %.3f\n", SENSOR_PULSE_PIN, (double)(pulseTotal / PULSES_PER_UNIT));
+}
 
-    if (config.debug_mode) {
-        Serial.println("Vibration sensor initialized on pin " + String(SENSOR_VIBRATION_PIN));
+// Fold the hardware counter into the 64-bit total. Runs from the timer
+// often enough that the counter never wraps twice between calls.
+uint64_t pulseFold() {
+    int16_t raw = 0;
+    portENTER_CRITICAL(&pulseMux);
+    pcnt_get_counter_value(PULSE_PCNT_UNIT, &raw);
+    int32_t delta = raw - pulseLastRaw;
+    if (delta < 0) {
+        delta += PULSE_COUNTER_LIMIT;   // reset to 0 on reaching the limit
     }
-    #endif
+    pulseLastRaw = raw;
+    pulseTotal += delta;
+    uint64_t total = pulseTotal;
+    portEXIT_CRITICAL(&pulseMux);
+    return total;
+}
 
-    // Gas Sensor
-    #if SENSOR_GAS_ENABLED
-    sensors[sensorCount] = {SENSOR_GAS_PIN, "gas", "Gas Sensor", 0, 1, true, GAS_THRESHOLD_MIN, GAS_THRESHOLD_MAX};
-    sensorCount++;
+// Sensor task, every pass: close the interval and save the total when due
+void pulseTake() {
+    uint64_t total = pulseFold();
+    unsigned long now = millis();
+    uint64_t pulses = total - pulseReportedTotal;
+    float hours = (now - pulseReportedAt) / 3600000.0f;
+
+    pulseValues[0] = (float)pulses;
+    pulseValues[1] = hours > 0 ? (float)(pulses / PULSES_PER_UNIT / hours) : 0;
+    pulseValues[2] = (float)(total / PULSES_PER_UNIT);
+    pulseValid = true;
+    pulseReportedTotal = total;
+    pulseReportedAt = now;
+
+    if (total != pulseSavedTotal && now - pulseSavedAt >= PULSE_SAVE_INTERVAL_MS) {
+        pulseSaveTotal(total);
+    }
+}
 
-    if (config.debug_mode) {
-        Serial.println("Gas sensor initialized on pin " + String(SENSOR_GAS_PIN));
+bool pulseReading(int sensorIndex, float& value) {
+    int k = sensorIndex - pulseFirstSensor;
+    if (!pulseValid || k < 0 || k > 2) {
+        return false;
     }
-    #endif
+    value = pulseValues[k];
+    return true;
+}
 
-    Serial.print("✅ Total sensors initialized: ");
-    Serial.println(sensorCount);
-    Serial.println("========================================");
+void pulseSaveTotal(uint64_t pulses) {
+    PulseStore store = {PULSE_STORE_MAGIC, pulses};
+    EEPROM.put(PULSE_EEPROM_ADDR, store);
+    EEPROM.commit();
+    pulseSavedTotal = pulses;
+    pulseSavedAt = millis();
+}
+#endif
+
+// Latest value for a sensor read in the background over a bus (1-Wire
+// probe or Modbus point)
+bool busReading(int sensorIndex, float& value) {
+#if SENSOR_ONEWIRE_ENABLED
+    if (oneWireReading(sensorIndex, value)) {
+        return true;
+    }
+#endif
+#if MODBUS_ENABLED
+    if (modbusReading(sensorIndex, value)) {
+        return true;
+    }
+#endif
+    return false;
 }
 
 /**
@@ -425,10 +2108,40 @@ float applyMedianFilter(int pin, bool isAnalog) {
     return readings[2];
 }
 
+// Start connecting and return; the network task picks the link up when ready
+void startWiFi() {
+    WiFi.mode(WIFI_STA);
+    WiFi.setAutoReconnect(true);
+    wifiBegin();
+}
+
+// First link-up after boot: OTA check, then the heartbeat carrying the boot timings
+void onNetworkUp() {
+    networkBootDone = true;
+    bootTimings.wifiConnectedMs = millis();
+    Serial.printf("WiFi connected after %lu ms, IP Address: %s\n",
+                  bootTimings.wifiConnectedMs, WiFi.localIP().toString().c_str());
+
+    if (config.ota_enabled) {
+        checkForFirmwareUpdate();
+        bootTimings.otaCheckedMs = millis();
+    }
+
+    sendHeartbeat();
+}
+
 void connectToWiFi() {
-    Serial.printf("Connecting to WiFi: %s\n", config.wifi_ssid);
     WiFi.mode(WIFI_STA);
-    WiFi.begin(config.wifi_ssid, config.wifi_password);
+
+    // The last attempt (or the SDK's reconnect) didn't get through
+    if (wifiConnectStarted != 0) {
+        wifiAttemptFailed();
+    }
+    // Disconnected anyway, so a blocking scan costs nothing
+    if (wifiCandidateCount == 0 || wifiLastScan == 0 || millis() - wifiLastScan > WIFI_SCAN_CACHE_MS) {
+        wifiScanNow();
+    }
+    wifiBegin();
 
     int attempts = 0;
     while (WiFi.status() != WL_CONNECTED && attempts < WIFI_RECONNECT_ATTEMPTS) {
@@ -446,13 +2159,303 @@ void connectToWiFi() {
     }
 }
 
-String readAllSensors() {
+void wifiFormatBssid(const uint8_t* bssid, char* out) {
+    snprintf(out, 18, "%02X:%02X:%02X:%02X:%02X:%02X",
+             bssid[0], bssid[1], bssid[2], bssid[3], bssid[4], bssid[5]);
+}
+
+int wifiNetworkIndex(const String& ssid) {
+    for (int i = 0; i < wifiNetworkCount; i++) {
+        if (ssid == wifiNetworks[i].ssid) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Strongest cached BSSID, with failed attempts counted against it
+int wifiBestCandidate() {
+    int best = -1;
+    int bestScore = 0;
+    for (int i = 0; i < wifiCandidateCount; i++) {
+        int score = wifiCandidates[i].rssi - wifiCandidates[i].failures * WIFI_FAILURE_PENALTY_DB;
+        if (best < 0 || score > bestScore) {
+            best = i;
+            bestScore = score;
+        }
+    }
+    return best;
+}
+
+// Start associating with the best known BSSID, or the next SSID in turn
+// when there are no scan results yet
+void wifiBegin() {
+    wifiTarget = wifiBestCandidate();
+    wifiConnectStarted = millis();
+
+    if (wifiTarget >= 0) {
+        const WifiCandidate& candidate = wifiCandidates[wifiTarget];
+        const WifiCredential& network = wifiNetworks[candidate.network];
+        char bssid[18];
+        wifiFormatBssid(candidate.bssid, bssid);
+        Serial.printf("Connecting to WiFi: %s via %s (channel %d, %d dBm)\n",
+                      network.ssid, bssid, candidate.channel, candidate.rssi);
+        WiFi.begin(network.ssid, network.password, candidate.channel, candidate.bssid);
+    } else {
+        const WifiCredential& network = wifiNetworks[wifiNetworkCursor];
+        Serial.printf("Connecting to WiFi: %s\n", network.ssid);
+        WiFi.begin(network.ssid, network.password);
+    }
+}
+
+// Stats entry for a BSSID; a full table gives up its least-used entry
+int wifiStatsFor(const uint8_t* bssid, int network) {
+    int victim = 0;
+    for (int i = 0; i < wifiApStatsCount; i++) {
+        if (memcmp(wifiApStats[i].bssid, bssid, 6) == 0) {
+            return i;
+        }
+        if (i != wifiLinkStats && wifiApStats[i].servedMs < wifiApStats[victim].servedMs) {
+            victim = i;
+        }
+    }
+
+    int slot = wifiApStatsCount < WIFI_MAX_AP_STATS ? wifiApStatsCount++ : victim;
+    memset(&wifiApStats[slot], 0, sizeof(WifiApStats));
+    memcpy(wifiApStats[slot].bssid, bssid, 6);
+    wifiApStats[slot].network = network;
+    return slot;
+}
+
+void wifiAttemptFailed() {
+    if (wifiTarget >= 0 && wifiTarget < wifiCandidateCount) {
+        WifiCandidate& candidate = wifiCandidates[wifiTarget];
+        if (candidate.failures < 255) {
+            candidate.failures++;
+        }
+        wifiApStats[wifiStatsFor(candidate.bssid, candidate.network)].failures++;
+    } else {
+        wifiNetworkCursor = (wifiNetworkCursor + 1) % wifiNetworkCount;
+    }
+    wifiConnectStarted = 0;
+}
+
+// Keep the strongest WIFI_MAX_CANDIDATES BSSIDs of known networks
+void wifiStoreScanResults(int found) {
+    wifiCandidateCount = 0;
+    wifiTarget = -1;
+    for (int i = 0; i < found; i++) {
+        int network = wifiNetworkIndex(WiFi.SSID(i));
+        if (network < 0) {
+            continue;
+        }
+
+        int slot = wifiCandidateCount;
+        if (wifiCandidateCount == WIFI_MAX_CANDIDATES) {
+            slot = 0;
+            for (int j = 1; j < WIFI_MAX_CANDIDATES; j++) {
+                if (wifiCandidates[j].rssi < wifiCandidates[slot].rssi) {
+                    slot = j;
+                }
+            }
+            if (wifiCandidates[slot].rssi >= WiFi.RSSI(i)) {
+                continue;
+            }
+        } else {
+            wifiCandidateCount++;
+        }
+
+        WifiCandidate& candidate = wifiCandidates[slot];
+        memcpy(candidate.bssid, WiFi.BSSID(i), 6);
+        candidate.channel = WiFi.channel(i);
+        candidate.network = network;
+        candidate.rssi = constrain(WiFi.RSSI(i), -127, 0);
+        candidate.failures = 0;
+    }
+    WiFi.scanDelete();
+    wifiLastScan = millis();
+    wifiScans++;
+
+    if (config.debug_mode) {
+        Serial.printf("WiFi scan: %d networks, %d known BSSIDs\n", found, wifiCandidateCount);
+    }
+}
+
+void wifiScanNow() {
+    if (wifiScanRunning) {
+        WiFi.scanDelete();
+        wifiScanRunning = false;
+    }
+    int found = WiFi.scanNetworks(false, false, true, WIFI_SCAN_DWELL_MS);
+    if (found >= 0) {
+        wifiStoreScanResults(found);
+    }
+}
+
+void wifiOnLinkUp() {
+    wifiLinkStats = wifiStatsFor(WiFi.BSSID(), wifiNetworkIndex(WiFi.SSID()));
+    WifiApStats& stats = wifiApStats[wifiLinkStats];
+    stats.associations++;
+    stats.lastConnectMs = wifiConnectStarted != 0 ? millis() - wifiConnectStarted : 0;
+    stats.totalConnectMs += stats.lastConnectMs;
+    stats.lastRssi = WiFi.RSSI();
+    wifiLinkUpAt = millis();
+    wifiConnectStarted = 0;
+
+    // Joined blind (no cache yet): find out what else is around soon
+    wifiNextScanAt = millis() + (wifiCandidateCount == 0 ? 5000UL : WIFI_SCAN_INTERVAL_MS);
+}
+
+void wifiOnLinkDown() {
+    wifiApStats[wifiLinkStats].servedMs += millis() - wifiLinkUpAt;
+    wifiLinkStats = -1;
+    wifiConnectStarted = millis();
+    if (wifiScanRunning) {
+        WiFi.scanDelete();
+        wifiScanRunning = false;
+    }
+}
+
+// Move to a clearly stronger BSSID once the current one has gone weak
+void wifiMaybeRoam() {
+    int current = WiFi.RSSI();
+    if (current >= WIFI_ROAM_RSSI_DBM) {
+        return;
+    }
+
+    const uint8_t* connected = WiFi.BSSID();
+    int best = -1;
+    for (int i = 0; i < wifiCandidateCount; i++) {
+        if (memcmp(wifiCandidates[i].bssid, connected, 6) == 0 ||
+            wifiCandidates[i].rssi < current + WIFI_ROAM_HYSTERESIS_DB) {
+            continue;
+        }
+        if (best < 0 || wifiCandidates[i].rssi > wifiCandidates[best].rssi) {
+            best = i;
+        }
+    }
+    if (best < 0) {
+        return;
+    }
+
+    char from[18];
+    char to[18];
+    wifiFormatBssid(connected, from);
+    wifiFormatBssid(wifiCandidates[best].bssid, to);
+    Serial.printf("Roaming from %s (%d dBm) to %s (%d dBm)\n", from, current, to, wifiCandidates[best].rssi);
+
+    wifiRoams++;
+    wifiOnLinkDown();
+    WiFi.disconnect(false);
+
+    const WifiCandidate& candidate = wifiCandidates[best];
+    const WifiCredential& network = wifiNetworks[candidate.network];
+    wifiTarget = best;
+    wifiConnectStarted = millis();
+    WiFi.begin(network.ssid, network.password, candidate.channel, candidate.bssid);
+}
+
+// Network task, every pass: track link changes, run the background scan
+// and act on its results
+void wifiPoll() {
+    bool up = WiFi.status() == WL_CONNECTED;
+    if (up && wifiLinkStats < 0) {
+        wifiOnLinkUp();
+    } else if (!up && wifiLinkStats >= 0) {
+        wifiOnLinkDown();
+    }
+    if (!up) {
+        return;
+    }
+
+    if (wifiScanRunning) {
+        int found = WiFi.scanComplete();
+        if (found == WIFI_SCAN_RUNNING) {
+            return;
+        }
+        wifiScanRunning = false;
+        if (found >= 0) {
+            wifiStoreScanResults(found);
+            wifiMaybeRoam();
+        }
+        wifiNextScanAt = millis() + (WiFi.RSSI() < WIFI_ROAM_RSSI_DBM ? WIFI_ROAM_SCAN_INTERVAL_MS : WIFI_SCAN_INTERVAL_MS);
+    } else if ((long)(millis() - wifiNextScanAt) >= 0) {
+        wifiScanRunning = WiFi.scanNetworks(true, false, true, WIFI_SCAN_DWELL_MS) == WIFI_SCAN_RUNNING;
+        if (!wifiScanRunning) {
+            wifiNextScanAt = millis() + WIFI_ROAM_SCAN_INTERVAL_MS;
+        }
+    }
+}
+
+void reportWifiStats(JsonObject wifi) {
+    char bssid[18];
+    wifiFormatBssid(WiFi.BSSID(), bssid);
+    wifi["ssid"] = WiFi.SSID();
+    wifi["bssid"] = bssid;
+    wifi["channel"] = WiFi.channel();
+    wifi["roams"] = wifiRoams;
+    wifi["scans"] = wifiScans;
+    wifi["known_bssids"] = wifiCandidateCount;
+
+    if (wifiLinkStats >= 0) {
+        wifiApStats[wifiLinkStats].lastRssi = WiFi.RSSI();
+    }
+
+    JsonArray aps = wifi.createNestedArray("aps");
+    for (int i = 0; i < wifiApStatsCount; i++) {
+        const WifiApStats& stats = wifiApStats[i];
+        unsigned long servedMs = stats.servedMs + (i == wifiLinkStats ? millis() - wifiLinkUpAt : 0);
+
+        JsonObject ap = aps.createNestedObject();
+        wifiFormatBssid(stats.bssid, bssid);
+        ap["bssid"] = bssid;
+        ap["ssid"] = stats.network >= 0 ? wifiNetworks[stats.network].ssid : "";
+        ap["associations"] = stats.associations;
+        ap["failures"] = stats.failures;
+        ap["last_connect_ms"] = stats.lastConnectMs;
+        ap["avg_connect_ms"] = stats.associations > 0 ? stats.totalConnectMs / stats.associations : 0;
+        ap["connected_s"] = servedMs / 1000;
+        ap["rssi"] = stats.lastRssi;
+    }
+}
+
+// True when a reading is close enough to the last one sent to skip it
+// upstream; otherwise records it as sent
+bool telemetryWithinDeadband(int sensorIndex, float value) {
+    TelemetryDeadband& band = telemetryDeadbands[sensorIndex];
+    if (TELEMETRY_DEADBAND_PCT > 0 && band.sent && millis() - band.sentAt < TELEMETRY_MAX_SILENCE_MS) {
+        float span = sensors[sensorIndex].threshold_max - sensors[sensorIndex].threshold_min;
+        float reference = span > 0 ? span : fabsf(band.lastSent);
+        if (fabsf(value - band.lastSent) <= reference * TELEMETRY_DEADBAND_PCT / 100.0f) {
+            return true;
+        }
+    }
+
+    band.lastSent = value;
+    band.sentAt = millis();
+    band.sent = true;
+    return false;
+}
+
+// Returns the serialized telemetry in a batch-pool buffer owned by the
+// caller, or nullptr when no sensor produced a reading.
+char* readAllSensors() {
     if (config.debug_mode) {
         Serial.println("========================================");
         Serial.println("Reading sensors...");
     }
 
-    StaticJsonDocument<1024> telemetryDoc;
+#if SENSOR_ONEWIRE_ENABLED
+    oneWirePoll();
+#endif
+#if MODBUS_ENABLED
+    modbusApplyPending();
+#endif
+#if SENSOR_PULSE_ENABLED
+    pulseTake();
+#endif
+
+    PooledJsonDocument telemetryDoc(1024);
     JsonArray sensorData = telemetryDoc.createNestedArray("sensors");
 
     for (int i = 0; i < sensorCount; i++) {
@@ -469,7 +2472,25 @@ String readAllSensors() {
         float processedValue = 0;
         bool hasReading = false;
 
-        if (sensors[i].type == "light") {
+        if (sensors[i].type.startsWith("pulse_")) {
+    #if SENSOR_PULSE_ENABLED
+            // Exact per-interval figures from the hardware counter; not smoothed
+            if (pulseReading(i, rawValue)) {
+                filteredValue = rawValue;
+                processedValue = (rawValue * sensors[i].calibration_multiplier) + sensors[i].calibration_offset;
+                hasReading = true;
+            }
+    #endif
+
+        } else if (sensors[i].pinName != nullptr) {
+            // 1-Wire probe or Modbus point: the last value its bus delivered
+            if (busReading(i, rawValue)) {
+                filteredValue = applyMovingAverageFilter(i, rawValue);
+                processedValue = (filteredValue * sensors[i].calibration_multiplier) + sensors[i].calibration_offset;
+                hasReading = true;
+            }
+
+        } else if (sensors[i].type == "light") {
             rawValue = applyMedianFilter(sensors[i].pin, true);
             filteredValue = applyMovingAverageFilter(i, rawValue);
             processedValue = (filteredValue * sensors[i].calibration_multiplier) + sensors[i].calibration_offset;
@@ -544,14 +2565,26 @@ String readAllSensors() {
         }
 
         if (hasReading) {
-            JsonObject sensor = sensorData.createNestedObject();
-            sensor["pin"] = sensors[i].pin;
-            sensor["type"] = sensors[i].type;
-            sensor["name"] = sensors[i].name;
-            sensor["raw_value"] = rawValue;
-            sensor["filtered_value"] = filteredValue;
-            sensor["processed_value"] = processedValue;
-            sensor["timestamp"] = millis() / 1000;
+#if HISTORY_STORE_ENABLED
+            // History records are keyed by GPIO; probes share theirs
+            if (sensors[i].pinName == nullptr) {
+                historyRecord(sensors[i].pin, processedValue);
+            }
+#endif
+            if (!telemetryWithinDeadband(i, processedValue)) {
+                JsonObject sensor = sensorData.createNestedObject();
+                if (sensors[i].pinName != nullptr) {
+                    sensor["pin"] = sensors[i].pinName;
+                } else {
+                    sensor["pin"] = sensors[i].pin;
+                }
+                sensor["type"] = sensors[i].type;
+                sensor["name"] = sensors[i].name;
+                sensor["raw_value"] = rawValue;
+                sensor["filtered_value"] = filteredValue;
+                sensor["processed_value"] = processedValue;
+                sensor["timestamp"] = millis() / 1000;
+            }
 
             if (config.armed &&
                 (processedValue < sensors[i].threshold_min ||
@@ -577,44 +2610,37 @@ String readAllSensors() {
     }
 
     if (sensorData.size() == 0) {
-        return "";
+        return nullptr;
     }
 
-    String payload;
-    serializeJson(telemetryDoc, payload);
+    size_t length = measureJson(telemetryDoc);
+    char* payload = (char*)batchAcquire(length + 1);
+    if (payload != nullptr) {
+        serializeJson(telemetryDoc, payload, length + 1);
+    }
     return payload;
 }
 
-void sendTelemetryData(const String& payload) {
-    if (WiFi.status() != WL_CONNECTED || payload.length() == 0) {
+void sendTelemetryData(const char* payload, size_t length, unsigned long sampleAgeMs) {
+    if (WiFi.status() != WL_CONNECTED || length == 0) {
         return;
     }
 
     HTTPClient http;
-    String endpoint = String(config.server_url) + "/api/devices/" + config.device_id + "/telemetry";
-
-#if USE_HTTPS
-    if (strlen(SERVER_FINGERPRINT) > 0) {
-        secureClient.setFingerprint(SERVER_FINGERPRINT);
-    } else {
-        secureClient.setInsecure();
+    beginDeviceRequest(http, "telemetry");
+    if (sampleAgeMs >= 1000) {
+        // Buffered reading: lets the server stamp it with its sample time
+        http.addHeader("X-Sample-Age-Ms", String(sampleAgeMs));
     }
-    http.begin(secureClient, endpoint);
-#else
-    http.begin(wifiClient, endpoint);
-#endif
-
-    http.addHeader("Content-Type", "application/json");
 
     if (config.debug_mode) {
-        Serial.print("Sending telemetry to: ");
-        Serial.println(endpoint);
         Serial.print("Payload size: ");
-        Serial.print(payload.length());
+        Serial.print(length);
         Serial.println(" bytes");
     }
 
-    int httpCode = http.POST(payload);
+    int httpCode = http.POST((uint8_t*)payload, length);
+    applyBackpressure(http, httpCode, telemetryBackpressure);
 
     if (config.debug_mode) {
         Serial.print("HTTP Response Code: ");
@@ -624,9 +2650,12 @@ void sendTelemetryData(const String& payload) {
     if (httpCode != 200) {
         Serial.print("⚠️  Telemetry send failed with code: ");
         Serial.println(httpCode);
-        if (config.debug_mode && http.getString().length() > 0) {
-            Serial.print("Response: ");
-            Serial.println(http.getString());
+        if (config.debug_mode) {
+            PoolBuffer response;
+            if (readResponseBody(http, response) > 0) {
+                Serial.print("Response: ");
+                Serial.println(response.data);
+            }
         }
     } else if (config.debug_mode) {
         Serial.println("✅ Telemetry sent successfully");
@@ -646,21 +2675,9 @@ void sendHeartbeat() {
     }
 
     HTTPClient http;
-    String endpoint = String(config.server_url) + "/api/devices/" + config.device_id + "/heartbeat";
-
-#if USE_HTTPS
-    if (strlen(SERVER_FINGERPRINT) > 0) {
-        secureClient.setFingerprint(SERVER_FINGERPRINT);
-    } else {
-        secureClient.setInsecure();
-    }
-    http.begin(secureClient, endpoint);
-#else
-    http.begin(wifiClient, endpoint);
-#endif
-    http.addHeader("Content-Type", "application/json");
+    beginDeviceRequest(http, "heartbeat");
 
-    StaticJsonDocument<512> doc;
+    PooledJsonDocument doc(3072);
     doc["device_id"] = config.device_id;
     doc["device_name"] = DEVICE_NAME;
     doc["device_location"] = DEVICE_LOCATION;
@@ -672,27 +2689,61 @@ void sendHeartbeat() {
     doc["mac_address"] = WiFi.macAddress();
     doc["config_version"] = config.config_version;
     doc["sensor_count"] = sensorCount;
+    doc["sensor_config_version"] = (uint32_t)sensorConfigVersion;
 
-    String payload;
-    serializeJson(doc, payload);
+    JsonArray pools = doc.createNestedArray("buffer_pools");
+    reportBufferPool(pools, smallPool);
+    reportBufferPool(pools, largePool);
+    reportBufferPool(pools, batchPool);
+    doc["pool_heap_fallbacks"] = poolHeapFallbacks;
+#if USE_HTTPS
+    reportTlsStats(doc.createNestedObject("tls"));
+#endif
+    reportWifiStats(doc.createNestedObject("wifi"));
+#if MODBUS_ENABLED
+    reportModbusStats(doc.createNestedObject("modbus"));
+#endif
+
+    if (!bootTimings.reported) {
+        if (bootTimings.firstHeartbeatMs == 0) {
+            bootTimings.firstHeartbeatMs = millis();
+        }
+        JsonObject boot = doc.createNestedObject("boot");
+        boot["reset_reason"] = (int)esp_reset_reason();
+        boot["sensors_ready_ms"] = bootTimings.sensorsReadyMs;
+        boot["first_sample_ms"] = bootTimings.firstSampleMs;
+        boot["wifi_connected_ms"] = bootTimings.wifiConnectedMs;
+        if (bootTimings.otaCheckedMs > 0) {
+            boot["ota_checked_ms"] = bootTimings.otaCheckedMs;
+        }
+        boot["first_heartbeat_ms"] = bootTimings.firstHeartbeatMs;
+    }
 
     if (config.debug_mode) {
-        Serial.println("Sending heartbeat: " + payload);
+        Serial.print("Sending heartbeat: ");
+        serializeJson(doc, Serial);
+        Serial.println();
     }
 
-    int httpCode = http.POST(payload);
+    int httpCode = postJson(http, doc);
+    applyBackpressure(http, httpCode, alertBackpressure);
+    applyBackpressure(http, httpCode, controlBackpressure);
 
     if (httpCode > 0) {
-        String response = http.getString();
+        PoolBuffer response;
+        size_t responseLength = readResponseBody(http, response);
         if (config.debug_mode) {
             Serial.print("HTTP Response Code: ");
             Serial.println(httpCode);
             Serial.print("Heartbeat response: ");
-            Serial.println(response);
+            Serial.println(responseLength > 0 ? response.data : "");
         }
 
-        if (httpCode == 200 && response.length() > 0) {
-            parseServerResponse(response);
+        if (httpCode == 200) {
+            bootTimings.reported = true;
+        }
+        if (httpCode == 200 && responseLength > 0) {
+            parseServerResponse(response.data, responseLength);
         }
     } else {
         Serial.print("⚠️  Heartbeat failed with code: ");
@@ -715,43 +2766,30 @@ void checkForFirmwareUpdate() {
     Serial.println("Checking for firmware updates...");
 
     HTTPClient http;
-    String endpoint = String(config.server_url) + "/api/devices/" + config.device_id + "/ota-check";
-
-#if USE_HTTPS
-    if (strlen(SERVER_FINGERPRINT) > 0) {
-        secureClient.setFingerprint(SERVER_FINGERPRINT);
-    } else {
-        secureClient.setInsecure();
-    }
-    http.begin(secureClient, endpoint);
-#else
-    http.begin(wifiClient, endpoint);
-#endif
-    http.addHeader("Content-Type", "application/json");
+    beginDeviceRequest(http, "ota-check");
 
     StaticJsonDocument<256> doc;
     doc["current_version"] = FIRMWARE_VERSION;
     doc["device_type"] = "esp32";
 
-    String payload;
-    serializeJson(doc, payload);
-
-    int httpCode = http.POST(payload);
+    int httpCode = postJson(http, doc);
 
     if (httpCode == 200) {
-        String response = http.getString();
+        PoolBuffer response;
+        size_t responseLength = readResponseBody(http, response);
         StaticJsonDocument<512> responseDoc;
 
-        if (deserializeJson(responseDoc, response) == DeserializationError::Ok) {
+        if (deserializeJson(responseDoc, response.data, responseLength) == DeserializationError::Ok) {
             if (responseDoc["update_available"].as<bool>()) {
                 String firmwareUrl = responseDoc["firmware_url"].as<String>();
-                String checksum = responseDoc["checksum"].as<String>();
+                String checksum = responseDoc["checksum"] | "";
+                String signature = responseDoc["signature"] | "";
 
                 if (config.debug_mode) {
                     Serial.println("Firmware update available: " + firmwareUrl);
                 }
 
-                performOTAUpdate(firmwareUrl, checksum);
+                performOTAUpdate(firmwareUrl, checksum, signature);
             } else if (config.debug_mode) {
                 Serial.println("Firmware is up to date");
             }
@@ -765,43 +2803,35 @@ void handleOTAUpdates() {
     static unsigned long lastCheck = 0;
     const unsigned long OTA_CHECK_INTERVAL = 60000; // 60 seconds
 
-    if (!config.ota_enabled || WiFi.status() != WL_CONNECTED) {
+    if (!config.ota_enabled || WiFi.status() != WL_CONNECTED || otaJob.state != OTA_IDLE) {
         return;
     }
 
-    if (millis() - lastCheck < OTA_CHECK_INTERVAL) {
+    if (millis() - lastCheck < backpressureInterval(OTA_CHECK_INTERVAL, controlBackpressure) ||
+        backpressureHeld(controlBackpressure)) {
         return;
     }
     lastCheck = millis();
 
     HTTPClient http;
-    String endpoint = String(config.server_url) + "/api/devices/" + config.device_id + "/ota-pending";
-
-#if USE_HTTPS
-    if (strlen(SERVER_FINGERPRINT) > 0) {
-        secureClient.setFingerprint(SERVER_FINGERPRINT);
-    } else {
-        secureClient.setInsecure();
-    }
-    http.begin(secureClient, endpoint);
-#else
-    http.begin(wifiClient, endpoint);
-#endif
-    http.addHeader("Content-Type", "application/json");
+    beginDeviceRequest(http, "ota-pending");
 
     int httpCode = http.GET();
+    applyBackpressure(http, httpCode, controlBackpressure);
 
     if (httpCode == 200) {
-        String response = http.getString();
+        PoolBuffer response;
+        size_t responseLength = readResponseBody(http, response);
         StaticJsonDocument<512> doc;
 
-        if (deserializeJson(doc, response) == DeserializationError::Ok) {
+        if (deserializeJson(doc, response.data, responseLength) == DeserializationError::Ok) {
             if (doc["pending_update"].as<bool>()) {
                 String firmwareUrl = doc["firmware_url"].as<String>();
-                String checksum = doc["checksum"].as<String>();
+                String checksum = doc["checksum"] | "";
+                String signature = doc["signature"] | "";
 
                 Serial.println("Processing pending OTA update...");
-                performOTAUpdate(firmwareUrl, checksum);
+                performOTAUpdate(firmwareUrl, checksum, signature);
             }
         }
     }
@@ -809,160 +2839,310 @@ void handleOTAUpdates() {
     http.end();
 }
 
-void notifyOTAStatus(const String& status, int progress, const String& errorMessage) {
+void notifyOTAStatus(const String& status, int progress, const String& errorMessage, const OtaVerification* verification) {
     if (WiFi.status() != WL_CONNECTED) {
         return;
     }
 
     HTTPClient http;
-    String endpoint = String(config.server_url) + "/api/devices/" + config.device_id + "/ota-status";
-#if USE_HTTPS
-    if (strlen(SERVER_FINGERPRINT) > 0) {
-        secureClient.setFingerprint(SERVER_FINGERPRINT);
-    } else {
-        secureClient.setInsecure();
-    }
-    http.begin(secureClient, endpoint);
-#else
-    http.begin(wifiClient, endpoint);
-#endif
-    http.addHeader("Content-Type", "application/json");
+    beginDeviceRequest(http, "ota-status");
 
-    StaticJsonDocument<256> doc;
+    StaticJsonDocument<512> doc;
     doc["status"] = status;
     doc["progress"] = progress;
     if (errorMessage.length() > 0) {
         doc["error_message"] = errorMessage;
     }
+    if (verification != nullptr) {
+        JsonObject check = doc.createNestedObject("verification");
+        check["algorithm"] = "sha256";
+        check["digest_checked"] = verification->digestChecked;
+        check["signature_checked"] = verification->signatureChecked;
+        check["download_ms"] = verification->downloadMs;
+        check["hash_ms"] = verification->hashMs;
+        check["signature_ms"] = verification->signatureMs;
+        check["tls_handshake_ms"] = verification->tlsHandshakeMs;
+        check["tls_resumed"] = verification->tlsResumed;
+    }
 
-    String payload;
-    serializeJson(doc, payload);
-
-    http.POST(payload);
+    postJson(http, doc);
     http.end();
 }
 
-void performOTAUpdate(const String& firmwareUrl, const String& expectedChecksum) {
+// Compare a SHA-256 digest with the server's hex checksum
+bool otaDigestMatches(const unsigned char* digest, const String& expectedHex) {
+    char actualHex[65];
+    for (int i = 0; i < 32; i++) {
+        snprintf(actualHex + i * 2, 3, "%02x", digest[i]);
+    }
+    return expectedHex.equalsIgnoreCase(actualHex);
+}
+
+// Check the server's base64 DER signature over the image digest against
+// the built-in public key. Returns 0 when it verifies.
+int otaVerifySignature(const unsigned char* digest, const String& signatureBase64) {
+    unsigned char signature[OTA_SIGNATURE_MAX];
+    size_t signatureLength = 0;
+    int ret = mbedtls_base64_decode(signature, sizeof(signature), &signatureLength,
+                                    (const unsigned char*)signatureBase64.c_str(), signatureBase64.length());
+    if (ret != 0) {
+        return ret;
+    }
+
+    mbedtls_pk_context key;
+    mbedtls_pk_init(&key);
+    ret = mbedtls_pk_parse_public_key(&key, (const unsigned char*)OTA_SIGNING_PUBLIC_KEY, strlen(OTA_SIGNING_PUBLIC_KEY) + 1);
+    if (ret == 0) {
+        ret = mbedtls_pk_verify(&key, MBEDTLS_MD_SHA256, digest, 32, signature, signatureLength);
+    }
+    mbedtls_pk_free(&key);
+    return ret;
+}
+
+void otaFail(const String& reason) {
+    Serial.println("OTA failed: " + reason);
+    notifyOTAStatus("failed", 0, reason);
+    if (otaJob.state == OTA_DOWNLOADING) {
+        Update.abort();
+        mbedtls_md_free(&otaJob.sha);
+    }
+    otaHttp.end();
+    otaJob.state = OTA_IDLE;
+}
+
+// Open the image download and hand it to otaStep(); returns right away.
+// Sampling, alarms and telemetry keep running while it downloads.
+void performOTAUpdate(const String& firmwareUrl, const String& expectedChecksum, const String& signature) {
+    if (otaJob.state != OTA_IDLE) {
+        return;
+    }
     Serial.println("Starting OTA update from: " + firmwareUrl);
 
+    bool checkDigest = expectedChecksum.length() == 64;
+    bool checkSignature = strlen(OTA_SIGNING_PUBLIC_KEY) > 0 && signature.length() > 0;
+    if (OTA_REQUIRE_SIGNATURE && !checkSignature) {
+        Serial.println("OTA rejected: image is not signed");
+        notifyOTAStatus("failed", 0, "Unsigned firmware image");
+        return;
+    }
+    if (!checkDigest && expectedChecksum.length() != 32) {
+        Serial.println("WARNING: no SHA-256 checksum, OTA image is not verified");
+    }
+
     notifyOTAStatus("downloading", 0);
 
-    HTTPClient http;
 #if USE_HTTPS
-    WiFiClientSecure otaClient;
-    if (strlen(SERVER_FINGERPRINT) > 0) {
-        otaClient.setFingerprint(SERVER_FINGERPRINT);
-    } else {
-        otaClient.setInsecure();
-    }
-    if (!http.begin(otaClient, firmwareUrl)) {
-        Serial.println("Failed to initiate OTA request");
-        notifyOTAStatus("failed", 0, "Failed to initiate OTA request");
-        return;
-    }
+    // Resumes the session device requests already negotiated
+    bool started = otaHttp.begin(otaTlsClient, firmwareUrl);
 #else
-    WiFiClient otaClient;
-    if (!http.begin(otaClient, firmwareUrl)) {
-        Serial.println("Failed to initiate OTA request");
-        notifyOTAStatus("failed", 0, "Failed to initiate OTA request");
+    bool started = otaHttp.begin(otaPlainClient, firmwareUrl);
+#endif
+    if (!started) {
+        otaFail("Failed to initiate OTA request");
         return;
     }
-#endif
-
-    int httpCode = http.GET();
 
+    int httpCode = otaHttp.GET();
     if (httpCode != HTTP_CODE_OK) {
-        Serial.print("OTA HTTP request failed with code: ");
-        Serial.println(httpCode);
-        notifyOTAStatus("failed", 0, "HTTP error " + String(httpCode));
-        http.end();
+        otaFail("HTTP error " + String(httpCode));
         return;
     }
 
-    int contentLength = http.getSize();
+    otaJob.verification = {checkDigest, false, 0, 0, 0, 0, false};
+#if USE_HTTPS
+    otaJob.verification.tlsHandshakeMs = otaTlsClient.handshakeMs();
+    otaJob.verification.tlsResumed = otaTlsClient.resumed();
+#endif
+
+    int contentLength = otaHttp.getSize();
     if (contentLength <= 0) {
-        Serial.println("Invalid OTA content length");
-        notifyOTAStatus("failed", 0, "Invalid content length");
-        http.end();
+        otaFail("Invalid content length");
         return;
     }
-
     if (!Update.begin(contentLength)) {
-        Serial.println("Not enough space for OTA update");
-        notifyOTAStatus("failed", 0, "Not enough space for OTA");
-        http.end();
+        otaFail("Not enough space for OTA");
         return;
     }
-
     if (expectedChecksum.length() == 32) {
+        // Legacy MD5 checksum, checked by Update.end()
         Update.setMD5(expectedChecksum.c_str());
     }
 
-    Update.onProgress([](size_t progress, size_t total) {
-        if (total == 0) {
-            return;
+    // Hash each chunk on its way into the update partition
+    mbedtls_md_init(&otaJob.sha);
+    mbedtls_md_setup(&otaJob.sha, mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), 0);
+    mbedtls_md_starts(&otaJob.sha);
+
+    otaJob.checksum = expectedChecksum;
+    otaJob.signature = signature;
+    otaJob.checkSignature = checkSignature;
+    otaJob.contentLength = contentLength;
+    otaJob.written = 0;
+    otaJob.lastReported = 0;
+    otaJob.hashUs = 0;
+    otaJob.started = millis();
+    otaJob.lastData = otaJob.started;
+    otaJob.state = OTA_DOWNLOADING;
+}
+
+// Network task, every pass: move at most OTA_SLICE_MS worth of the image
+// into flash, never ahead of OTA_MAX_BYTES_PER_SEC. A verified image waits
+// for a quiet moment before the reboot.
+void otaStep() {
+    if (otaJob.state == OTA_READY) {
+        otaRebootWhenQuiet();
+        return;
+    }
+    if (otaJob.state != OTA_DOWNLOADING) {
+        return;
+    }
+
+    PoolBuffer chunk(POOL_LARGE_SLOT_SIZE);
+    if (chunk.data == nullptr) {
+        return;
+    }
+
+    WiFiClient* stream = otaHttp.getStreamPtr();
+    unsigned long sliceStarted = millis();
+    while (otaJob.written < otaJob.contentLength && millis() - sliceStarted < OTA_SLICE_MS) {
+        long allowed = (long)((uint64_t)(millis() - otaJob.started) * OTA_MAX_BYTES_PER_SEC / 1000) - (long)otaJob.written;
+        if (allowed <= 0) {
+            break;
+        }
+
+        if (stream->available() <= 0) {
+            if (!otaHttp.connected() || millis() - otaJob.lastData > HTTP_REQUEST_TIMEOUT_MS) {
+                otaFail("Incomplete OTA write");
+                return;
+            }
+            break;
         }
-        int percent = (progress * 100) / total;
-        static int lastReported = -1;
-        if (percent - lastReported >= 10) {
-            notifyOTAStatus("downloading", percent);
-            lastReported = percent;
+
+        size_t wanted = otaJob.contentLength - otaJob.written;
+        wanted = wanted < chunk.capacity ? wanted : chunk.capacity;
+        wanted = wanted < (size_t)allowed ? wanted : (size_t)allowed;
+        int received = stream->read((uint8_t*)chunk.data, wanted);
+        if (received <= 0) {
+            break;
+        }
+        otaJob.lastData = millis();
+
+        unsigned long hashStarted = micros();
+        mbedtls_md_update(&otaJob.sha, (const unsigned char*)chunk.data, received);
+        otaJob.hashUs += micros() - hashStarted;
+
+        if (Update.write((uint8_t*)chunk.data, received) != (size_t)received) {
+            otaFail("Flash write failed");
+            return;
         }
-    });
+        otaJob.written += received;
+    }
+
+    int percent = (otaJob.written * 100) / otaJob.contentLength;
+    if (percent - otaJob.lastReported >= 10 && percent < 100) {
+        notifyOTAStatus("downloading", percent);
+        otaJob.lastReported = percent;
+    }
 
-    WiFiClient* stream = http.getStreamPtr();
-    size_t written = Update.writeStream(*stream);
+    if (otaJob.written == otaJob.contentLength) {
+        otaFinish();
+    }
+}
 
-    if (written != (size_t)contentLength) {
-        Serial.println("OTA write incomplete");
-        notifyOTAStatus("failed", 0, "Incomplete OTA write");
+// Whole image in flash: check digest and signature, then mark it bootable
+void otaFinish() {
+    OtaVerification& verification = otaJob.verification;
+    unsigned char digest[32];
+    mbedtls_md_finish(&otaJob.sha, digest);
+    mbedtls_md_free(&otaJob.sha);
+    verification.downloadMs = millis() - otaJob.started;
+    verification.hashMs = otaJob.hashUs / 1000;
+    otaHttp.end();
+    otaJob.state = OTA_VERIFYING;
+
+    if (verification.digestChecked && !otaDigestMatches(digest, otaJob.checksum)) {
         Update.abort();
-        http.end();
+        otaFail("Checksum mismatch");
         return;
     }
 
-    if (!Update.end()) {
+    if (otaJob.checkSignature) {
+        unsigned long signatureStarted = millis();
+        int ret = otaVerifySignature(digest, otaJob.signature);
+        verification.signatureMs = millis() - signatureStarted;
+        verification.signatureChecked = true;
+        if (ret != 0) {
+            Serial.printf("OTA signature check failed (-0x%04x)\n", -ret);
+            Update.abort();
+            otaFail("Signature verification failed");
+            return;
+        }
+    }
+
+    Serial.printf("OTA image verified: %u bytes in %lu ms (SHA-256 %lu ms, signature %lu ms)\n",
+                  (unsigned)otaJob.written, verification.downloadMs, verification.hashMs, verification.signatureMs);
+
+    if (!Update.end() || !Update.isFinished()) {
         Serial.printf("OTA update failed: %d\n", Update.getError());
-        notifyOTAStatus("failed", 0, "Update end failed");
-        http.end();
+        otaFail("Update end failed");
         return;
     }
 
-    if (!Update.isFinished()) {
-        Serial.println("OTA update not finished");
-        notifyOTAStatus("failed", 0, "Update not finished");
-        http.end();
+    otaJob.state = OTA_READY;
+    otaJob.readyAt = millis();
+    notifyOTAStatus("installing", 100, "", &verification);
+    Serial.println("OTA image installed, rebooting at the next quiet moment");
+}
+
+// Quiet: no alarm for OTA_QUIET_MS, no telemetry waiting to go out and no
+// history upload queued
+bool otaQuiet() {
+    if (millis() - lastAlarmAt < OTA_QUIET_MS || uxQueueMessagesWaiting(sensorDataQueue) > 0) {
+        return false;
+    }
+#if HISTORY_STORE_ENABLED
+    if (historyUploadPending()) {
+        return false;
+    }
+#endif
+    return true;
+}
+
+void otaRebootWhenQuiet() {
+    bool overdue = millis() - otaJob.readyAt >= OTA_REBOOT_DEFER_MAX_MS;
+    if (!otaQuiet() && !overdue) {
         return;
     }
 
-    notifyOTAStatus("completed", 100);
-    Serial.println("OTA Update completed successfully");
-    http.end();
+    notifyOTAStatus("completed", 100, "", &otaJob.verification);
+    Serial.println(overdue ? "OTA reboot overdue, restarting" : "OTA Update completed successfully, restarting");
+#if HISTORY_STORE_ENABLED
+    historyFlushNow();
+#endif
+#if SENSOR_PULSE_ENABLED
+    pulseSaveTotal(pulseFold());
+#endif
     ESP.restart();
 }
 
 void sendAlarmEvent(int sensorIndex, float value) {
-    if (WiFi.status() != WL_CONNECTED) {
+    // Holds back the reboot into a downloaded OTA image
+    lastAlarmAt = millis();
+
+    if (WiFi.status() != WL_CONNECTED || backpressureHeld(alertBackpressure)) {
         return;
     }
 
     HTTPClient http;
-    String endpoint = String(config.server_url) + "/api/devices/" + config.device_id + "/alarm";
-#if USE_HTTPS
-    if (strlen(SERVER_FINGERPRINT) > 0) {
-        secureClient.setFingerprint(SERVER_FINGERPRINT);
-    } else {
-        secureClient.setInsecure();
-    }
-    http.begin(secureClient, endpoint);
-#else
-    http.begin(wifiClient, endpoint);
-#endif
-    http.addHeader("Content-Type", "application/json");
+    beginDeviceRequest(http, "alarm");
 
     StaticJsonDocument<384> doc;
     doc["device_id"] = config.device_id;
-    doc["sensor_pin"] = sensors[sensorIndex].pin;
+    if (sensors[sensorIndex].pinName != nullptr) {
+        doc["sensor_pin"] = sensors[sensorIndex].pinName;
+    } else {
+        doc["sensor_pin"] = sensors[sensorIndex].pin;
+    }
     doc["sensor_type"] = sensors[sensorIndex].type;
     doc["sensor_name"] = sensors[sensorIndex].name;
     doc["value"] = value;
@@ -976,12 +3156,9 @@ void sendAlarmEvent(int sensorIndex, float value) {
                      " - " + String(sensors[sensorIndex].threshold_max) + ")";
     doc["message"] = message;
 
-    String payload;
-    serializeJson(doc, payload);
-
     Serial.println("ALARM: " + message);
 
-    int httpCode = http.POST(payload);
+    int httpCode = postJson(http, doc);
     if (httpCode > 0) {
         Serial.println("Alarm sent successfully");
     } else {
@@ -991,18 +3168,37 @@ void sendAlarmEvent(int sensorIndex, float value) {
     http.end();
 }
 
-void parseServerResponse(const String& response) {
-    StaticJsonDocument<2048> doc;
-    DeserializationError error = deserializeJson(doc, response);
+void parseServerResponse(const char* response, size_t length) {
+    // A Modbus register map can ride along with the sensor config
+    PooledJsonDocument doc(MODBUS_ENABLED ? 4096 : 2048);
+    DeserializationError error = deserializeJson(doc, response, length);
 
     if (error) {
         Serial.println("Failed to parse server response");
         return;
     }
 
+#if HISTORY_STORE_ENABLED
+    if (doc.containsKey("server_time")) {
+        historySyncClock(doc["server_time"].as<uint64_t>());
+    }
+#endif
+
     if (doc.containsKey("config")) {
         JsonObject configObj = doc["config"];
 
+#if HISTORY_STORE_ENABLED
+        if (configObj.containsKey("history_requests")) {
+            historyQueueRequests(configObj["history_requests"].as<JsonArray>());
+        }
+#endif
+
+#if MODBUS_ENABLED
+        if (configObj.containsKey("modbus")) {
+            modbusQueueMap(configObj["modbus"].as<JsonObject>());
+        }
+#endif
+
         if (configObj.containsKey("sensors")) {
             JsonArray sensorConfigs = configObj["sensors"];
             if (sensorConfigs.size() > 0) {
@@ -1013,6 +3209,7 @@ void parseServerResponse(const String& response) {
                 updateSensorConfiguration(sensorConfigs);
                 Serial.println("========================================");
             }
+            sensorConfigVersion = configObj["sensors_version"] | 0UL;
         }
 
         if (configObj.containsKey("heartbeat_interval")) {
@@ -1063,34 +3260,45 @@ void parseServerResponse(const String& response) {
     if (doc.containsKey("ota_update")) {
         JsonObject otaInfo = doc["ota_update"];
         if (config.ota_enabled && otaInfo["version"] != FIRMWARE_VERSION) {
-            performOTAUpdate(otaInfo["url"].as<String>(), otaInfo["checksum"].as<String>());
+            performOTAUpdate(otaInfo["url"].as<String>(), otaInfo["checksum"] | "", otaInfo["signature"] | "");
         }
     }
 }
 
+// Server pin names: "GPIO34", "D4", "A0" or a bare number
+int parsePinName(const String& pinStr) {
+    if (pinStr.startsWith(ONEWIRE_PIN_PREFIX)) {
+        return -1;      // 1-Wire probe, matched by name
+    } else if (pinStr.indexOf('.') > 0) {
+        return -1;      // Modbus point ("H1.100") or pulse channel ("P27.rate"), matched by name
+    } else if (pinStr.startsWith("GPIO")) {
+        return pinStr.substring(4).toInt();
+    } else if (pinStr.startsWith("D")) {
+        return pinStr.substring(1).toInt();
+    } else if (pinStr.startsWith("A")) {
+        return A0;
+    }
+    return pinStr.toInt();
+}
+
 void updateSensorConfiguration(JsonArray sensorConfigs) {
     int updatedCount = 0;
 
+#if MODBUS_ENABLED
+    // The sensor task may be swapping in a new Modbus map
+    xSemaphoreTake(modbusLock, portMAX_DELAY);
+#endif
+
     for (int i = 0; i < sensorConfigs.size() && i < MAX_SENSORS; i++) {
         JsonObject sensorConfig = sensorConfigs[i];
 
         if (sensorConfig.containsKey("pin")) {
             String pinStr = sensorConfig["pin"].as<String>();
-            int pinNum = -1;
-
-            if (pinStr.startsWith("GPIO")) {
-                pinNum = pinStr.substring(4).toInt();
-            } else if (pinStr.startsWith("D")) {
-                pinNum = pinStr.substring(1).toInt();
-            } else if (pinStr.startsWith("A")) {
-                pinNum = A0;
-            } else {
-                pinNum = pinStr.toInt();
-            }
+            int pinNum = parsePinName(pinStr);
 
             bool found = false;
             for (int j = 0; j < sensorCount; j++) {
-                if (sensors[j].pin == pinNum) {
+                if (sensors[j].pinName != nullptr ? pinStr == sensors[j].pinName : sensors[j].pin == pinNum) {
                     found = true;
 
                     if (config.debug_mode) {
@@ -1143,7 +3351,769 @@ void updateSensorConfiguration(JsonArray sensorConfigs) {
         }
     }
 
+#if MODBUS_ENABLED
+    xSemaphoreGive(modbusLock);
+#endif
+
     Serial.print("✅ Updated ");
     Serial.print(updatedCount);
     Serial.println(" sensor(s) from server configuration");
+
+#if ULP_WATCH_ENABLED
+    // Keep the thresholds the ULP compares against in step
+    ulpPushThresholds();
+#endif
+}
+
+// ========================================
+// ULP THRESHOLD WATCH (battery nodes)
+// ========================================
+// With ULP_WATCH_ENABLED the main cores deep-sleep between uploads while the
+// ULP coprocessor samples up to ULP_MAX_CHANNELS analog (ADC1: light, gas,
+// sound) and digital (RTC GPIO: motion, magnetic, vibration) sensors every
+// ULP_SAMPLE_PERIOD_MS into an RTC-memory ring. The ULP applies each
+// channel's threshold_min/threshold_max (converted to raw units) and wakes
+// the main CPU only when a channel crosses out of range or the ring is
+// full. On wake the ring is uploaded as one NDJSON batch, a crossing is
+// raised as an alarm, and the node goes back to sleep.
+#if ULP_WATCH_ENABLED
+
+// RTC data layout (32-bit words; the ULP uses the low 16 bits)
+#define ULP_WRITE_PTR 0        // absolute word address of the next row
+#define ULP_WAKE_REASON 1
+#define ULP_WAKE_CHANNEL 2
+#define ULP_THRESHOLD_LO 4     // + channel
+#define ULP_THRESHOLD_HI 8     // + channel
+#define ULP_CHANNEL_STATE 12   // + channel, 1 while out of range
+#define ULP_BUFFER 16
+#define ULP_DATA_WORDS (ULP_BUFFER + ULP_BUFFER_ROWS * ULP_MAX_CHANNELS)
+#define ULP_PROGRAM_MAX 128
+
+#define ULP_WAKE_THRESHOLD 1
+#define ULP_WAKE_BUFFER_FULL 2
+
+RTC_SLOW_ATTR uint32_t ulpData[ULP_DATA_WORDS];
+
+// Channel map and the calibration/thresholds it was built from, so samples
+// can be converted after a wake before the server config arrives again
+struct UlpChannel {
+    int8_t sensorIndex;
+    int8_t pin;
+    bool analog;
+    uint8_t source;             // ADC1 channel or RTC IO number
+    float calibrationOffset;
+    float calibrationMultiplier;
+    float thresholdMin;
+    float thresholdMax;
+};
+
+RTC_DATA_ATTR UlpChannel ulpChannels[ULP_MAX_CHANNELS];
+RTC_DATA_ATTR uint8_t ulpChannelCount = 0;
+RTC_DATA_ATTR bool ulpArmed = false;
+
+ulp_insn_t ulpProgram[ULP_PROGRAM_MAX];
+size_t ulpProgramSize = 0;
+bool ulpWoke = false;
+bool ulpBacklogSent = false;
+bool ulpUnavailable = false;   // set once arming fails; stay awake until reboot
+
+#define ULP_EMIT(...) do { \
+    const ulp_insn_t insn_[] = { __VA_ARGS__ }; \
+    size_t count_ = sizeof(insn_) / sizeof(ulp_insn_t); \
+    if (ulpProgramSize + count_ <= ULP_PROGRAM_MAX) { \
+        memcpy(&ulpProgram[ulpProgramSize], insn_, sizeof(insn_)); \
+    } \
+    ulpProgramSize += count_; \
+} while (0)
+
+uint32_t ulpDataAddress() {
+    return ((uint32_t)ulpData - (uint32_t)RTC_SLOW_MEM) / sizeof(uint32_t);
+}
+
+// ADC1 channel for a GPIO (the ULP cannot read ADC2), -1 if none
+int ulpAdcChannel(int pin) {
+    switch (pin) {
+        case 36: return 0;
+        case 37: return 1;
+        case 38: return 2;
+        case 39: return 3;
+        case 32: return 4;
+        case 33: return 5;
+        case 34: return 6;
+        case 35: return 7;
+        default: return -1;
+    }
+}
+
+bool ulpAnalogType(const String& type) {
+    return type == "light" || type == "photodiode" || type == "gas" || type == "sound";
+}
+
+bool ulpDigitalType(const String& type) {
+    return type == "motion" || type == "magnetic" || type == "vibration";
+}
+
+// Processed-unit threshold to the raw scale the ULP samples on
+uint16_t ulpRawThreshold(int channel, float value, bool upper) {
+    const UlpChannel& ch = ulpChannels[channel];
+    float raw = ch.calibrationMultiplier != 0
+        ? (value - ch.calibrationOffset) / ch.calibrationMultiplier
+        : value;
+    float limit = ch.analog ? 4095.0f : 1.0f;
+    if (raw < 0) raw = 0;
+    if (raw > limit) raw = limit;
+    return upper ? (uint16_t)ceilf(raw) : (uint16_t)floorf(raw);
+}
+
+// Write the current thresholds into RTC memory; unset (0/0) means never wake
+void ulpPushThresholds() {
+    for (int c = 0; c < ulpChannelCount; c++) {
+        UlpChannel& ch = ulpChannels[c];
+        const SensorConfig& sensor = sensors[ch.sensorIndex];
+        ch.calibrationOffset = sensor.calibration_offset;
+        ch.calibrationMultiplier = sensor.calibration_multiplier;
+        ch.thresholdMin = sensor.threshold_min;
+        ch.thresholdMax = sensor.threshold_max;
+
+        uint16_t lo = 0;
+        uint16_t hi = 0xFFFF;
+        if (ch.thresholdMin != 0 || ch.thresholdMax != 0) {
+            uint16_t a = ulpRawThreshold(c, ch.thresholdMin, false);
+            uint16_t b = ulpRawThreshold(c, ch.thresholdMax, true);
+            // A negative multiplier swaps the raw bounds
+            lo = ch.calibrationMultiplier < 0 ? ulpRawThreshold(c, ch.thresholdMax, false) : a;
+            hi = ch.calibrationMultiplier < 0 ? ulpRawThreshold(c, ch.thresholdMin, true) : b;
+        }
+        ulpData[ULP_THRESHOLD_LO + c] = lo;
+        ulpData[ULP_THRESHOLD_HI + c] = hi;
+    }
+}
+
+// Pick the channels the ULP can watch from the enabled sensors
+void ulpConfigureChannels() {
+    ulpChannelCount = 0;
+    for (int i = 0; i < sensorCount && ulpChannelCount < ULP_MAX_CHANNELS; i++) {
+        if (!sensors[i].enabled) continue;
+
+        UlpChannel& ch = ulpChannels[ulpChannelCount];
+        int adc = ulpAdcChannel(sensors[i].pin);
+        if (ulpAnalogType(sensors[i].type) && adc >= 0) {
+            ch.analog = true;
+            ch.source = adc;
+            adc1_config_channel_atten((adc1_channel_t)adc, ADC_ATTEN_DB_11);
+        } else if (ulpDigitalType(sensors[i].type) && rtc_gpio_is_valid_gpio((gpio_num_t)sensors[i].pin)) {
+            ch.analog = false;
+            ch.source = rtc_io_number_get((gpio_num_t)sensors[i].pin);
+            rtc_gpio_init((gpio_num_t)sensors[i].pin);
+            rtc_gpio_set_direction((gpio_num_t)sensors[i].pin, RTC_GPIO_MODE_INPUT_ONLY);
+        } else {
+            continue;
+        }
+        ch.sensorIndex = i;
+        ch.pin = sensors[i].pin;
+        ulpChannelCount++;
+    }
+
+    adc1_config_width(ADC_WIDTH_BIT_12);
+    adc1_ulp_enable();
+    ulpPushThresholds();
+}
+
+// One pass: sample every channel into the current row, check its range,
+// advance the row and wake the CPU when a channel goes out of range (not
+// when it comes back in) or the ring is full
+bool ulpBuildProgram() {
+    const uint32_t base = ulpDataAddress();
+    const uint32_t bufferEnd = base + ULP_BUFFER + ULP_BUFFER_ROWS * ulpChannelCount;
+    enum { LABEL_WAKE = 1, LABEL_NOT_FULL = 2, LABEL_CHANNEL = 10 };
+
+    ulpProgramSize = 0;
+    ULP_EMIT(
+        I_MOVI(R3, base),
+        I_LD(R2, R3, ULP_WRITE_PTR)
+    );
+
+    for (int c = 0; c < ulpChannelCount; c++) {
+        const UlpChannel& ch = ulpChannels[c];
+        const int outOfRange = LABEL_CHANNEL + 2 * c;
+        const int next = outOfRange + 1;
+
+        if (ch.analog) {
+            ULP_EMIT(I_ADC(R0, 0, ch.source));
+        } else {
+            ULP_EMIT(I_RD_REG(RTC_GPIO_IN_REG, RTC_GPIO_IN_NEXT_S + ch.source, RTC_GPIO_IN_NEXT_S + ch.source));
+        }
+
+        ULP_EMIT(
+            I_ST(R0, R2, c),
+            // sample - lo underflows below the range, hi - sample above it
+            I_LD(R1, R3, ULP_THRESHOLD_LO + c),
+            I_SUBR(R1, R0, R1),
+            M_BXF(outOfRange),
+            I_LD(R1, R3, ULP_THRESHOLD_HI + c),
+            I_SUBR(R1, R1, R0),
+            M_BXF(outOfRange),
+            I_MOVI(R0, 0),
+            I_ST(R0, R3, ULP_CHANNEL_STATE + c),
+            M_BX(next),
+            M_LABEL(outOfRange),
+            // Only the transition into out-of-range wakes the CPU
+            I_LD(R0, R3, ULP_CHANNEL_STATE + c),
+            M_BGE(next, 1),
+            I_MOVI(R0, 1),
+            I_ST(R0, R3, ULP_CHANNEL_STATE + c),
+            I_MOVI(R0, c),
+            I_ST(R0, R3, ULP_WAKE_CHANNEL),
+            I_MOVI(R0, ULP_WAKE_THRESHOLD),
+            I_ST(R0, R3, ULP_WAKE_REASON),
+            M_LABEL(next)
+        );
+    }
+
+    ULP_EMIT(
+        I_ADDI(R2, R2, ulpChannelCount),
+        I_ST(R2, R3, ULP_WRITE_PTR),
+        I_MOVR(R0, R2),
+        M_BL(LABEL_NOT_FULL, bufferEnd),
+        I_MOVI(R0, ULP_WAKE_BUFFER_FULL),
+        I_ST(R0, R3, ULP_WAKE_REASON),
+        M_LABEL(LABEL_NOT_FULL),
+        I_LD(R0, R3, ULP_WAKE_REASON),
+        M_BGE(LABEL_WAKE, 1),
+        I_HALT(),
+        M_LABEL(LABEL_WAKE),
+        // Wake the CPU and stop the ULP timer until it is re-armed
+        I_WAKE(),
+        I_END(),
+        I_HALT()
+    );
+
+    if (ulpProgramSize > ULP_PROGRAM_MAX) {
+        Serial.println("ULP program too large for the configured channels");
+        return false;
+    }
+    return true;
+}
+
+// Rows recorded since the ULP was last armed
+int ulpRowCount() {
+    if (ulpChannelCount == 0) return 0;
+    uint32_t start = ulpDataAddress() + ULP_BUFFER;
+    uint32_t ptr = ulpData[ULP_WRITE_PTR] & 0xFFFF;
+    if (ptr < start) return 0;
+    int rows = (ptr - start) / ulpChannelCount;
+    return rows > ULP_BUFFER_ROWS ? ULP_BUFFER_ROWS : rows;
+}
+
+float ulpProcessedValue(int channel, uint16_t raw) {
+    const UlpChannel& ch = ulpChannels[channel];
+    return ch.analog ? raw * ch.calibrationMultiplier + ch.calibrationOffset : raw;
+}
+
+// Called from setup() before the sensors are initialised: stop the ULP
+// (a timer wake leaves it running) and hand digital pins back to GPIO
+void ulpReleasePins() {
+    if (!ulpArmed) return;
+
+    CLEAR_PERI_REG_MASK(RTC_CNTL_STATE0_REG, RTC_CNTL_ULP_CP_SLP_TIMER_EN);
+    for (int c = 0; c < ulpChannelCount; c++) {
+        if (!ulpChannels[c].analog) {
+            rtc_gpio_deinit((gpio_num_t)ulpChannels[c].pin);
+        }
+    }
+}
+
+// Called from setup() after the sensors are initialised: restore the
+// config the ULP ran with so its samples convert as they were taken
+void ulpHandleBoot() {
+    esp_sleep_wakeup_cause_t cause = esp_sleep_get_wakeup_cause();
+    if (!ulpArmed || (cause != ESP_SLEEP_WAKEUP_ULP && cause != ESP_SLEEP_WAKEUP_TIMER)) {
+        ulpArmed = false;
+        return;
+    }
+
+    ulpArmed = false;
+    ulpWoke = true;
+    for (int c = 0; c < ulpChannelCount; c++) {
+        SensorConfig& sensor = sensors[ulpChannels[c].sensorIndex];
+        sensor.calibration_offset = ulpChannels[c].calibrationOffset;
+        sensor.calibration_multiplier = ulpChannels[c].calibrationMultiplier;
+        sensor.threshold_min = ulpChannels[c].thresholdMin;
+        sensor.threshold_max = ulpChannels[c].thresholdMax;
+    }
+
+    uint32_t reason = ulpData[ULP_WAKE_REASON] & 0xFFFF;
+    Serial.printf("ULP wake: %s, %d buffered rows\n",
+                  reason == ULP_WAKE_THRESHOLD ? "threshold crossing" :
+                  reason == ULP_WAKE_BUFFER_FULL ? "buffer full" : "timer",
+                  ulpRowCount());
+}
+
+// Upload the ULP ring as NDJSON (one telemetry payload per row, with its
+// age) and raise an alarm for the channel that crossed its threshold
+void ulpUploadBacklog() {
+    ulpBacklogSent = true;
+    if (!ulpWoke) return;
+
+    const int rows = ulpRowCount();
+    const uint32_t start = ULP_BUFFER;
+    const unsigned long wokeAgoMs = millis();
+
+    for (int first = 0; first < rows; first += ULP_UPLOAD_ROWS) {
+        PoolBuffer body(POOL_LARGE_SLOT_SIZE);
+        if (body.data == nullptr) return;
+        size_t length = 0;
+
+        for (int r = first; r < rows && r < first + ULP_UPLOAD_ROWS; r++) {
+            StaticJsonDocument<768> line;
+            JsonArray values = line.createNestedArray("sensors");
+            for (int c = 0; c < ulpChannelCount; c++) {
+                uint16_t raw = ulpData[start + r * ulpChannelCount + c] & 0xFFFF;
+                const SensorConfig& sensor = sensors[ulpChannels[c].sensorIndex];
+                JsonObject value = values.createNestedObject();
+                value["pin"] = sensor.pin;
+                value["type"] = sensor.type;
+                value["name"] = sensor.name;
+                value["raw_value"] = raw;
+                value["processed_value"] = ulpProcessedValue(c, raw);
+            }
+            line["sample_age_ms"] = (unsigned long)(rows - 1 - r) * ULP_SAMPLE_PERIOD_MS + wokeAgoMs;
+
+            size_t needed = measureJson(line) + 1;
+            if (length + needed >= body.capacity) break;
+            length += serializeJson(line, body.data + length, body.capacity - length);
+            body.data[length++] = '\n';
+        }
+
+        HTTPClient http;
+        beginDeviceRequest(http, "telemetry");
+        http.addHeader("Content-Type", "application/x-ndjson");
+        int httpCode = http.POST((uint8_t*)body.data, length);
+        applyBackpressure(http, httpCode, telemetryBackpressure);
+        http.end();
+
+        if (httpCode != 200) {
+            Serial.printf("⚠️  ULP backlog upload failed with code: %d\n", httpCode);
+            break;
+        }
+    }
+
+    if ((ulpData[ULP_WAKE_REASON] & 0xFFFF) == ULP_WAKE_THRESHOLD && rows > 0 && config.armed) {
+        int c = ulpData[ULP_WAKE_CHANNEL] & 0xFFFF;
+        if (c < ulpChannelCount) {
+            uint16_t raw = ulpData[start + (rows - 1) * ulpChannelCount + c] & 0xFFFF;
+            sendAlarmEvent(ulpChannels[c].sensorIndex, ulpProcessedValue(c, raw));
+        }
+    }
+}
+
+// Network task: sleep once the wake's work is done, or after
+// ULP_MAX_AWAKE_MS regardless (e.g. no Wi-Fi)
+bool ulpReadyToSleep() {
+    if (ulpUnavailable) return false;
+    // Deep sleep would drop a half-written OTA image
+    if (otaJob.state != OTA_IDLE) return false;
+    if (millis() >= ULP_MAX_AWAKE_MS) return true;
+    return ulpBacklogSent && bootTimings.reported &&
+           uxQueueMessagesWaiting(sensorDataQueue) == 0 &&
+           millis() >= ULP_MIN_AWAKE_MS;
+}
+
+// Arming failed: give the pins back to the awake sensor code and stop
+// networkTask from retrying every pass
+void ulpGiveUp(const char* reason) {
+    Serial.printf("%s, staying awake\n", reason);
+    for (int c = 0; c < ulpChannelCount; c++) {
+        if (!ulpChannels[c].analog) {
+            rtc_gpio_deinit((gpio_num_t)ulpChannels[c].pin);
+            // setup() configured these; the magnetic reed switch uses a pull-up
+            pinMode(ulpChannels[c].pin,
+                    sensors[ulpChannels[c].sensorIndex].type == "magnetic" ? INPUT_PULLUP : INPUT);
+        }
+    }
+    ulpChannelCount = 0;
+    ulpArmed = false;
+    ulpUnavailable = true;
+}
+
+// Reset the ring, load the program and hand sampling over to the ULP
+void ulpEnterWatch() {
+    ulpConfigureChannels();
+    if (ulpChannelCount == 0 || !ulpBuildProgram()) {
+        ulpGiveUp("ULP watch unavailable");
+        return;
+    }
+
+    ulpData[ULP_WRITE_PTR] = ulpDataAddress() + ULP_BUFFER;
+    ulpData[ULP_WAKE_REASON] = 0;
+    ulpData[ULP_WAKE_CHANNEL] = 0;
+
+    size_t size = ulpProgramSize;
+    if (ulp_process_macros_and_load(0, ulpProgram, &size) != ESP_OK) {
+        ulpGiveUp("ULP program load failed");
+        return;
+    }
+
+    ulp_set_wakeup_period(0, (uint32_t)ULP_SAMPLE_PERIOD_MS * 1000UL);
+    esp_sleep_enable_ulp_wakeup();
+    if (DEEP_SLEEP_DURATION_SEC > 0) {
+        // Periodic wake keeps heartbeats (and OTA checks) going
+        esp_sleep_enable_timer_wakeup((uint64_t)DEEP_SLEEP_DURATION_SEC * 1000000ULL);
+    }
+    if (ulp_run(0) != ESP_OK) {
+        esp_sleep_disable_wakeup_source(ESP_SLEEP_WAKEUP_ULP);
+        ulpGiveUp("ULP start failed");
+        return;
+    }
+
+    ulpArmed = true;
+    Serial.printf("ULP watching %d channel(s), sleeping\n", ulpChannelCount);
+    Serial.flush();
+    WiFi.disconnect(true);
+    esp_deep_sleep_start();
+}
+
+#endif // ULP_WATCH_ENABLED
+
+// ========================================
+// HISTORY STORE AND BACKFILL
+// ========================================
+// With HISTORY_STORE_ENABLED every reading is also appended to a rolling
+// store on flash (LittleFS, one file per hour, HISTORY_RETENTION_HOURS
+// kept), so upstream telemetry can stay deadbanded (TELEMETRY_DEADBAND_PCT)
+// without losing detail. The server asks for one sensor's samples between
+// two times through the heartbeat response (config.history_requests); the
+// network task streams the range back as delta-encoded chunks, the last
+// one marked X-History-Final. Records carry wall-clock time set from the
+// heartbeat's server_time, so readings taken before the first heartbeat
+// after power-on are not stored.
+#if HISTORY_STORE_ENABLED
+
+#define HISTORY_DIR "/history"
+#define HISTORY_MAX_REQUESTS 2
+#define HISTORY_CHUNK_HEADER_SIZE 20
+#define HISTORY_CHUNK_VERSION 1
+#define HISTORY_READ_RECORDS 32
+#define HISTORY_VALID_EPOCH 1600000000UL
+
+struct __attribute__((packed)) HistoryRecord {
+    uint32_t timeS;
+    uint16_t timeMs;
+    uint8_t pin;
+    uint8_t reserved;
+    float value;
+};
+
+struct HistoryRequest {
+    uint32_t id;
+    uint8_t pin;
+    uint64_t fromMs;
+    uint64_t toMs;
+    bool active;
+};
+
+HistoryRecord historyPending[HISTORY_FLUSH_RECORDS];
+int historyPendingCount = 0;
+unsigned long historyLastFlush = 0;
+uint32_t historyCurrentHour = 0;
+SemaphoreHandle_t historyLock = NULL;
+bool historyReady = false;
+HistoryRequest historyRequests[HISTORY_MAX_REQUESTS];
+
+void historyFilePath(char* path, size_t size, uint32_t hour) {
+    snprintf(path, size, HISTORY_DIR "/%lu.bin", (unsigned long)hour);
+}
+
+// Drop hour files past retention, then the oldest ones while flash is short
+void historyPrune() {
+    uint32_t newestKept = historyCurrentHour;
+    while (true) {
+        File dir = LittleFS.open(HISTORY_DIR);
+        if (!dir) return;
+
+        uint32_t oldest = UINT32_MAX;
+        int files = 0;
+        for (File entry = dir.openNextFile(); entry; entry = dir.openNextFile()) {
+            const char* name = strrchr(entry.name(), '/');
+            uint32_t hour = strtoul(name != nullptr ? name + 1 : entry.name(), nullptr, 10);
+            if (hour > 0 && hour < oldest) oldest = hour;
+            files++;
+        }
+        dir.close();
+
+        if (files == 0 || oldest == UINT32_MAX) return;
+        bool expired = newestKept >= HISTORY_RETENTION_HOURS && oldest <= newestKept - HISTORY_RETENTION_HOURS;
+        bool lowSpace = LittleFS.totalBytes() - LittleFS.usedBytes() < HISTORY_MIN_FREE_BYTES && oldest < newestKept;
+        if (!expired && !lowSpace) return;
+
+        char path[32];
+        historyFilePath(path, sizeof(path), oldest);
+        if (!LittleFS.remove(path)) return;
+    }
+}
+
+void historyInit() {
+    historyLock = xSemaphoreCreateMutex();
+    if (!LittleFS.begin(true)) {
+        Serial.println("History store unavailable (LittleFS mount failed)");
+        return;
+    }
+    if (!LittleFS.exists(HISTORY_DIR)) {
+        LittleFS.mkdir(HISTORY_DIR);
+    }
+    historyReady = true;
+    Serial.printf("History store: %u of %u bytes used\n",
+                  (unsigned)LittleFS.usedBytes(), (unsigned)LittleFS.totalBytes());
+}
+
+// Heartbeat server_time (epoch ms); only corrects drift above 2 s
+void historySyncClock(uint64_t serverMs) {
+    struct timeval now;
+    gettimeofday(&now, nullptr);
+    int64_t localMs = (int64_t)now.tv_sec * 1000 + now.tv_usec / 1000;
+    if (llabs(localMs - (int64_t)serverMs) < 2000) return;
+
+    struct timeval set = { (time_t)(serverMs / 1000), (suseconds_t)((serverMs % 1000) * 1000) };
+    settimeofday(&set, nullptr);
+    if (config.debug_mode) {
+        Serial.printf("Clock set from server (off by %lld ms)\n", (long long)(localMs - (int64_t)serverMs));
+    }
+}
+
+// Append pending records to their hour files. Caller holds historyLock.
+void historyFlushLocked() {
+    File file;
+    uint32_t openHour = 0;
+    for (int i = 0; i < historyPendingCount; i++) {
+        uint32_t hour = historyPending[i].timeS / 3600;
+        if (!file || hour != openHour) {
+            if (file) file.close();
+            char path[32];
+            historyFilePath(path, sizeof(path), hour);
+            file = LittleFS.open(path, FILE_APPEND);
+            openHour = hour;
+            if (!file) break;
+        }
+        file.write((const uint8_t*)&historyPending[i], sizeof(HistoryRecord));
+    }
+    if (file) file.close();
+
+    historyPendingCount = 0;
+    historyLastFlush = millis();
+    if (openHour > historyCurrentHour) {
+        historyCurrentHour = openHour;
+        historyPrune();
+    }
+}
+
+// Sensor task: one reading. Writes go out in blocks of HISTORY_FLUSH_RECORDS
+// or every HISTORY_FLUSH_INTERVAL_MS to keep flash wear down.
+void historyRecord(int pin, float value) {
+    struct timeval now;
+    gettimeofday(&now, nullptr);
+    if (!historyReady || now.tv_sec < HISTORY_VALID_EPOCH) return;
+
+    xSemaphoreTake(historyLock, portMAX_DELAY);
+    HistoryRecord& record = historyPending[historyPendingCount++];
+    record.timeS = now.tv_sec;
+    record.timeMs = now.tv_usec / 1000;
+    record.pin = pin;
+    record.reserved = 0;
+    record.value = value;
+    if (historyPendingCount >= HISTORY_FLUSH_RECORDS) {
+        historyFlushLocked();
+    }
+    xSemaphoreGive(historyLock);
+}
+
+void historyMaybeFlush() {
+    if (!historyReady || historyPendingCount == 0 || millis() - historyLastFlush < HISTORY_FLUSH_INTERVAL_MS) return;
+    xSemaphoreTake(historyLock, portMAX_DELAY);
+    historyFlushLocked();
+    xSemaphoreGive(historyLock);
+}
+
+// Before a restart: nothing buffered in RAM is lost
+void historyFlushNow() {
+    if (!historyReady) return;
+    xSemaphoreTake(historyLock, portMAX_DELAY);
+    if (historyPendingCount > 0) historyFlushLocked();
+    xSemaphoreGive(historyLock);
+}
+
+bool historyUploadPending() {
+    for (int i = 0; i < HISTORY_MAX_REQUESTS; i++) {
+        if (historyRequests[i].active) return true;
+    }
+    return false;
+}
+
+// Heartbeat response: queue requests not already queued
+void historyQueueRequests(JsonArray requests) {
+    for (JsonObject request : requests) {
+        uint32_t id = request["id"] | 0;
+        if (id == 0) continue;
+
+        int slot = -1;
+        for (int i = 0; i < HISTORY_MAX_REQUESTS; i++) {
+            if (historyRequests[i].active && historyRequests[i].id == id) {
+                slot = -2;
+                break;
+            }
+            if (!historyRequests[i].active && slot == -1) slot = i;
+        }
+        if (slot < 0) continue;
+
+        historyRequests[slot].id = id;
+        historyRequests[slot].pin = parsePinName(request["pin"].as<String>());
+        historyRequests[slot].fromMs = request["from"].as<uint64_t>();
+        historyRequests[slot].toMs = request["to"].as<uint64_t>();
+        historyRequests[slot].active = true;
+    }
+}
+
+size_t historyPutVarint(uint8_t* out, uint32_t value) {
+    size_t length = 0;
+    while (value >= 0x80) {
+        out[length++] = (value & 0x7F) | 0x80;
+        value >>= 7;
+    }
+    out[length++] = value;
+    return length;
+}
+
+int32_t historyScaled(float value) {
+    float scaled = value * HISTORY_VALUE_SCALE;
+    if (scaled > 2.0e9f) return 2000000000;
+    if (scaled < -2.0e9f) return -2000000000;
+    return (int32_t)lroundf(scaled);
+}
+
+bool historyPostChunk(uint32_t requestId, const char* data, size_t length, bool final) {
+    char path[32];
+    snprintf(path, sizeof(path), "history/%lu", (unsigned long)requestId);
+
+    HTTPClient http;
+    beginDeviceRequest(http, path);
+    http.addHeader("Content-Type", "application/octet-stream");
+    if (final) {
+        http.addHeader("X-History-Final", "1");
+    }
+    int httpCode = http.POST((uint8_t*)data, length);
+    applyBackpressure(http, httpCode, telemetryBackpressure);
+    http.end();
+
+    if (httpCode != 200) {
+        Serial.printf("⚠️  History upload for request %lu failed with code: %d\n", (unsigned long)requestId, httpCode);
+    }
+    return httpCode == 200;
+}
+
+// Stream one request's range as chunks of at most one large-pool slot.
+// Records are read a block at a time so the sensor task is never held off
+// for long. Samples that step back in time (clock corrections) are skipped.
+bool historyUpload(int slot) {
+    const HistoryRequest& request = historyRequests[slot];
+    PoolBuffer chunk(POOL_LARGE_SLOT_SIZE);
+    if (chunk.data == nullptr) return false;
+
+    uint8_t* out = (uint8_t*)chunk.data;
+    size_t length = HISTORY_CHUNK_HEADER_SIZE;
+    uint16_t count = 0;
+    uint64_t lastMs = 0;
+    int32_t lastScaled = 0;
+    uint32_t sent = 0;
+
+    auto startChunk = [&](uint64_t baseMs, int32_t baseScaled) {
+        memcpy(out, "SHIS", 4);
+        out[4] = HISTORY_CHUNK_VERSION;
+        out[5] = 0;
+        uint16_t scale = HISTORY_VALUE_SCALE;
+        uint32_t baseS = baseMs / 1000;
+        uint16_t baseMsPart = baseMs % 1000;
+        memcpy(out + 6, &scale, 2);
+        memcpy(out + 8, &baseS, 4);
+        memcpy(out + 12, &baseMsPart, 2);
+        memcpy(out + 16, &baseScaled, 4);
+        length = HISTORY_CHUNK_HEADER_SIZE;
+        count = 0;
+        lastMs = baseMs;
+        lastScaled = baseScaled;
+    };
+    auto finishChunk = [&](bool final) {
+        memcpy(out + 14, &count, 2);
+        sent += count;
+        return historyPostChunk(request.id, chunk.data, length, final);
+    };
+
+    xSemaphoreTake(historyLock, portMAX_DELAY);
+    historyFlushLocked();
+    xSemaphoreGive(historyLock);
+
+    startChunk(request.fromMs, 0);
+    HistoryRecord records[HISTORY_READ_RECORDS];
+    for (uint32_t hour = request.fromMs / 3600000ULL; hour <= request.toMs / 3600000ULL; hour++) {
+        char path[32];
+        historyFilePath(path, sizeof(path), hour);
+
+        size_t position = 0;
+        while (true) {
+            xSemaphoreTake(historyLock, portMAX_DELAY);
+            size_t got = 0;
+            File file = LittleFS.open(path, FILE_READ);
+            if (file) {
+                file.seek(position);
+                got = file.read((uint8_t*)records, sizeof(records)) / sizeof(HistoryRecord);
+                file.close();
+            }
+            xSemaphoreGive(historyLock);
+            if (got == 0) break;
+            position += got * sizeof(HistoryRecord);
+
+            for (size_t i = 0; i < got; i++) {
+                const HistoryRecord& record = records[i];
+                uint64_t timeMs = (uint64_t)record.timeS * 1000 + record.timeMs;
+                if (record.pin != request.pin || timeMs < request.fromMs || timeMs > request.toMs) continue;
+
+                int32_t scaled = historyScaled(record.value);
+                if (count == 0) {
+                    startChunk(timeMs, scaled);
+                } else if (timeMs < lastMs) {
+                    continue;
+                }
+
+                if (length + 10 > chunk.capacity || count == UINT16_MAX) {
+                    if (!finishChunk(false)) return false;
+                    startChunk(timeMs, scaled);
+                }
+
+                int32_t delta = scaled - lastScaled;
+                length += historyPutVarint(out + length, (uint32_t)(timeMs - lastMs));
+                length += historyPutVarint(out + length, ((uint32_t)delta << 1) ^ (uint32_t)(delta >> 31));
+                lastMs = timeMs;
+                lastScaled = scaled;
+                count++;
+            }
+        }
+        vTaskDelay(1);
+    }
+
+    if (!finishChunk(true)) return false;
+    Serial.printf("History request %lu: %lu samples uploaded\n", (unsigned long)request.id, (unsigned long)sent);
+    return true;
+}
+
+// Network task: answer one queued request per pass. A failed upload is
+// dropped; the server hands the request out again.
+void historyServeRequests() {
+    if (!historyReady || backpressureHeld(telemetryBackpressure)) return;
+    for (int i = 0; i < HISTORY_MAX_REQUESTS; i++) {
+        if (historyRequests[i].active) {
+            historyUpload(i);
+            historyRequests[i].active = false;
+            return;
+        }
+    }
 }
+
+#endif // HISTORY_STORE_ENABLED
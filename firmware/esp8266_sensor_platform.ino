@@ -1,10 +1,16 @@
 #include "device_config.h"
+
+// Per-device token sent as X-API-Key (older config headers may omit it)
+#ifndef SERVER_API_KEY
+#define SERVER_API_KEY ""
+#endif
 #include <ESP8266WiFi.h>
 #include <ESP8266HTTPClient.h>
 #include <ESP8266httpUpdate.h>
 #include <ArduinoJson.h>
 #include <WiFiClientSecure.h>
 #include <EEPROM.h>
+#include <Ticker.h>
 #include <cstring>
 
 #define OTA_CONFIG_CHUNK "~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~"
@@ -32,6 +38,159 @@ const char OTA_CONFIG_PLACEHOLDER[] =
 #include <Ultrasonic.h>
 #endif
 
+// ========================================
+// 1-WIRE TEMPERATURE PROBES
+// ========================================
+// Any number of DS18B20s can share SENSOR_ONEWIRE_PIN. They are found by a
+// ROM search at boot and each becomes its own "temperature" sensor,
+// reported under a pin name taken from its ROM code ("OW" + 8 hex digits),
+// so the server keeps one sensor per probe. A single skip-ROM Convert T
+// starts every probe at once and the results are collected on a later
+// sensor pass once the conversion time has passed: N probes cost one
+// conversion (750 ms at 12 bits) instead of N, and nothing waits on the bus.
+#ifndef SENSOR_ONEWIRE_ENABLED
+#define SENSOR_ONEWIRE_ENABLED false
+#endif
+#ifndef SENSOR_ONEWIRE_PIN
+#define SENSOR_ONEWIRE_PIN D1
+#endif
+#ifndef ONEWIRE_MAX_PROBES
+#define ONEWIRE_MAX_PROBES 8
+#endif
+#ifndef ONEWIRE_RESOLUTION_BITS
+#define ONEWIRE_RESOLUTION_BITS 12
+#endif
+#ifndef PROBE_THRESHOLD_MIN
+#define PROBE_THRESHOLD_MIN -10.0
+#endif
+#ifndef PROBE_THRESHOLD_MAX
+#define PROBE_THRESHOLD_MAX 40.0
+#endif
+#define ONEWIRE_PIN_PREFIX "OW"
+#define ONEWIRE_CONVERSION_MS (750UL >> (12 - ONEWIRE_RESOLUTION_BITS))
+#define DS18B20_FAMILY_CODE 0x28
+#define DS18B20_CONVERT_T 0x44
+#define DS18B20_READ_SCRATCHPAD 0xBE
+#define DS18B20_WRITE_SCRATCHPAD 0x4E
+
+#if SENSOR_ONEWIRE_ENABLED
+#include <OneWire.h>
+#endif
+
+struct OneWireProbe
+{
+    uint8_t rom[8];
+    char pinName[11]; // ONEWIRE_PIN_PREFIX + low four serial bytes in hex
+    int sensorIndex;
+    float celsius;
+    bool valid;
+};
+
+// ========================================
+// MODBUS RTU
+// ========================================
+// Meters and PLC sensors on an RS-485 bus, read over SoftwareSerial by the
+// non-blocking master in modbus_rtu.h. The register map comes from the
+// server with the heartbeat response (config.modbus) whenever its version
+// differs from the one this device reported. Each point becomes a sensor
+// after the native ones, reported under a pin name ("H1.100": holding
+// register 100 of slave 1, "I" for input registers) and run through the
+// same filter and threshold path. The loop polls the master on every pass
+// and only naps 1 ms while a cycle is on the bus. SoftwareSerial sends a
+// request bit by bit (about 8 ms at 9600 baud); replies are collected by
+// its RX interrupt, so a slow loop pass delays a cycle but loses nothing.
+#ifndef MODBUS_ENABLED
+#define MODBUS_ENABLED false
+#endif
+#ifndef MODBUS_RX_PIN
+#define MODBUS_RX_PIN D5
+#endif
+#ifndef MODBUS_TX_PIN
+#define MODBUS_TX_PIN D6
+#endif
+#ifndef MODBUS_DE_PIN
+#define MODBUS_DE_PIN D0
+#endif
+#ifndef MODBUS_BAUD
+#define MODBUS_BAUD 9600
+#endif
+#ifndef MODBUS_RESPONSE_TIMEOUT_MS
+#define MODBUS_RESPONSE_TIMEOUT_MS 200
+#endif
+#ifndef MODBUS_POLL_INTERVAL_MS
+#define MODBUS_POLL_INTERVAL_MS SENSOR_READ_INTERVAL_MS
+#endif
+#ifndef MODBUS_MAX_POINTS
+#define MODBUS_MAX_POINTS 8 // keeps the map in the heartbeat response small
+#endif
+#define MODBUS_PIN_NAME_SIZE 11
+
+#if MODBUS_ENABLED
+#include <SoftwareSerial.h>
+#include "modbus_rtu.h"
+
+// SoftwareSerial plus a driver-enable GPIO (DE and /RE tied together)
+class SoftwareSerialModbusPort : public ModbusPort
+{
+public:
+    SoftwareSerialModbusPort(SoftwareSerial &serial, int dePin) : serial(serial), dePin(dePin) {}
+
+    int available() override { return serial.available(); }
+    int read() override { return serial.read(); }
+    size_t write(const uint8_t *data, size_t length) override { return serial.write(data, length); }
+    void setTransmit(bool transmit) override { digitalWrite(dePin, transmit ? HIGH : LOW); }
+
+private:
+    SoftwareSerial &serial;
+    int dePin;
+};
+#endif
+
+// ========================================
+// PULSE COUNTER
+// ========================================
+// S0 / open-collector outputs of energy, water and gas meters on
+// SENSOR_PULSE_PIN. The ESP8266 has no counter peripheral, so a falling-edge
+// interrupt counts pulses, ignoring edges within PULSE_FILTER_US of the last
+// counted one (raise it to a few ms for bouncing reed contacts). Each
+// telemetry send reports three sensors: pulses since the previous send
+// ("P13.count"), the rate over that interval in units per hour (".rate")
+// and the running total in units (".total"), a unit being PULSES_PER_UNIT
+// pulses (the meter constant, e.g. 1000 imp/kWh). The total is kept in
+// EEPROM next to the device config; it is written every
+// PULSE_SAVE_INTERVAL_MS while it changes and before a planned restart, so
+// a power cut loses at most that window.
+#ifndef SENSOR_PULSE_ENABLED
+#define SENSOR_PULSE_ENABLED false
+#endif
+#ifndef SENSOR_PULSE_PIN
+#define SENSOR_PULSE_PIN D7
+#endif
+#ifndef PULSES_PER_UNIT
+#define PULSES_PER_UNIT 1000.0
+#endif
+#ifndef PULSE_FILTER_US
+#define PULSE_FILTER_US 10
+#endif
+#ifndef PULSE_SAVE_INTERVAL_MS
+#define PULSE_SAVE_INTERVAL_MS 600000UL
+#endif
+#ifndef PULSE_RATE_THRESHOLD_MIN
+#define PULSE_RATE_THRESHOLD_MIN 0
+#endif
+#ifndef PULSE_RATE_THRESHOLD_MAX
+#define PULSE_RATE_THRESHOLD_MAX 100000
+#endif
+#define PULSE_EEPROM_ADDR 512        // after DeviceConfig
+#define PULSE_STORE_MAGIC 0x504C5331 // "PLS1"
+#define PULSE_PIN_NAME_SIZE 11
+
+struct PulseStore
+{
+    uint32_t magic;
+    uint64_t pulses;
+};
+
 // Configuration structure
 struct DeviceConfig
 {
@@ -47,7 +206,7 @@ struct DeviceConfig
 };
 
 // Sensor definitions
-#define MAX_SENSORS 8
+#define MAX_SENSORS 16
 #define FILTER_WINDOW_SIZE 10 // Moving average window size
 
 struct SensorConfig
@@ -60,6 +219,7 @@ struct SensorConfig
     bool enabled;
     float threshold_min;
     float threshold_max;
+    const char *pinName; // reported instead of pin when set (1-Wire probes, Modbus points, pulse channels)
 };
 
 // Sensor filtering data structures
@@ -79,6 +239,9 @@ SensorFilter sensorFilters[MAX_SENSORS];
 DeviceConfig config;
 SensorConfig sensors[MAX_SENSORS];
 int sensorCount = 0;
+// Version of the server's sensor list last applied (config.sensors_version);
+// 0 makes the next heartbeat response carry the full list
+uint32_t sensorConfigVersion = 0;
 unsigned long lastHeartbeat = 0;
 unsigned long lastSensorRead = 0;
 unsigned long lastTelemetrySend = 0;
@@ -100,6 +263,488 @@ struct ThresholdState
 };
 ThresholdState thresholdStates[MAX_SENSORS];
 
+// ========================================
+// FAST BOOT
+// ========================================
+// Sensors are read from the first loop pass; Wi-Fi connects in the
+// background and the OTA check and first heartbeat run once the link is up.
+// Telemetry due while the link is down is kept in a small static backlog
+// (oldest dropped first) and sent with its sample age after connecting.
+#ifndef TELEMETRY_BACKLOG_SLOTS
+#define TELEMETRY_BACKLOG_SLOTS 4
+#endif
+#ifndef TELEMETRY_BACKLOG_SLOT_SIZE
+#define TELEMETRY_BACKLOG_SLOT_SIZE 512
+#endif
+#ifndef WIFI_RESTART_AFTER_MS
+#define WIFI_RESTART_AFTER_MS 600000UL
+#endif
+
+// Boot-phase timings (ms since reset), reported once in the first heartbeat
+struct BootTimings
+{
+    unsigned long sensorsReadyMs;
+    unsigned long firstSampleMs;
+    unsigned long wifiConnectedMs;
+    unsigned long otaCheckedMs;
+    unsigned long firstHeartbeatMs;
+    bool reported;
+};
+BootTimings bootTimings = {0, 0, 0, 0, 0, false};
+bool networkBootDone = false;
+unsigned long wifiDownSince = 0;
+
+struct BacklogEntry
+{
+    char payload[TELEMETRY_BACKLOG_SLOT_SIZE];
+    size_t length;
+    unsigned long sampledAt;
+};
+BacklogEntry telemetryBacklog[TELEMETRY_BACKLOG_SLOTS];
+uint8_t backlogHead = 0;
+uint8_t backlogCount = 0;
+
+// ========================================
+// SERVER BACKPRESSURE
+// ========================================
+// The server keeps a token bucket per device and message class. Responses
+// carry X-Device-Backoff-Ms (the request spacing to keep for that class)
+// once a bucket runs low; 429/503 also carry Retry-After. Requests of a
+// class are spaced and held accordingly instead of retried blindly.
+#ifndef MAX_BACKOFF_MS
+#define MAX_BACKOFF_MS 300000UL
+#endif
+#ifndef OTA_POLL_INTERVAL_MS
+#define OTA_POLL_INTERVAL_MS 60000UL
+#endif
+
+struct Backpressure
+{
+    unsigned long intervalMs; // spacing requested by the server, 0 = none
+    unsigned long holdUntil;  // no requests of this class before this time
+    bool held;
+};
+
+Backpressure telemetryBackpressure = {0, 0, false};
+Backpressure alertBackpressure = {0, 0, false};
+Backpressure controlBackpressure = {0, 0, false};
+
+const char *BACKPRESSURE_HEADERS[] = {"X-Device-Backoff-Ms", "Retry-After"};
+
+// ========================================
+// BACKGROUND OTA
+// ========================================
+// Firmware images are pulled from loop() a slice at a time instead of in
+// one blocking call: each pass writes at most OTA_SLICE_MS worth, never
+// faster than OTA_MAX_BYTES_PER_SEC, so sampling, threshold alerts and
+// telemetry keep their cadence through a download. The reboot into the new
+// image waits until no sensor is past a threshold, nothing is backlogged
+// and no capture is in flight, or at most OTA_REBOOT_DEFER_MAX_MS.
+#ifndef OTA_MAX_BYTES_PER_SEC
+#define OTA_MAX_BYTES_PER_SEC 16384
+#endif
+#ifndef OTA_SLICE_MS
+#define OTA_SLICE_MS 50
+#endif
+#ifndef OTA_QUIET_MS
+#define OTA_QUIET_MS 60000UL
+#endif
+#ifndef OTA_REBOOT_DEFER_MAX_MS
+#define OTA_REBOOT_DEFER_MAX_MS 1800000UL
+#endif
+#ifndef OTA_STALL_TIMEOUT_MS
+#define OTA_STALL_TIMEOUT_MS 10000UL
+#endif
+
+enum OtaState : uint8_t
+{
+    OTA_IDLE,
+    OTA_DOWNLOADING,
+    OTA_READY // image written and checked, waiting for a quiet reboot
+};
+
+struct OtaJob
+{
+    OtaState state;
+    size_t contentLength;
+    size_t written;
+    int lastReported;
+    unsigned long started;
+    unsigned long lastData;
+    unsigned long readyAt;
+};
+
+OtaJob otaJob = {OTA_IDLE, 0, 0, 0, 0, 0, 0};
+HTTPClient otaHttp;
+WiFiClient otaClient;
+unsigned long lastAlarmAt = 0;
+
+// ========================================
+// TRIGGER CAPTURE
+// ========================================
+// Capturable sensors (A0 and the digital ones) are sampled into a ring at
+// CAPTURE_RATE_HZ by a Ticker, well above the telemetry rate. A threshold
+// crossing marks the trigger: sampling carries on for CAPTURE_POST_MS, then
+// the channel freezes holding CAPTURE_PRE_MS before the trigger and
+// CAPTURE_POST_MS after it. The window is uploaded as a binary blob
+// attached to the alert the crossing raised, and the channel re-arms.
+#ifndef CAPTURE_ENABLED
+#define CAPTURE_ENABLED true
+#endif
+#ifndef CAPTURE_RATE_HZ
+#define CAPTURE_RATE_HZ 50
+#endif
+#ifndef CAPTURE_PRE_MS
+#define CAPTURE_PRE_MS 2000
+#endif
+#ifndef CAPTURE_POST_MS
+#define CAPTURE_POST_MS 2000
+#endif
+#ifndef CAPTURE_MAX_CHANNELS
+#define CAPTURE_MAX_CHANNELS 2
+#endif
+#define CAPTURE_PRE_SAMPLES (CAPTURE_PRE_MS * CAPTURE_RATE_HZ / 1000)
+#define CAPTURE_POST_SAMPLES (CAPTURE_POST_MS * CAPTURE_RATE_HZ / 1000)
+#define CAPTURE_SAMPLES (CAPTURE_PRE_SAMPLES + CAPTURE_POST_SAMPLES)
+#define CAPTURE_HEADER_SIZE 28
+#define CAPTURE_FORMAT_VERSION 1
+#define CAPTURE_MAX_UPLOAD_ATTEMPTS 3
+
+enum CaptureState : uint8_t
+{
+    CAPTURE_ARMED,  // ring running, waiting for a trigger
+    CAPTURE_POST,   // triggered, recording the post-trigger window
+    CAPTURE_FROZEN  // window complete, waiting for upload
+};
+
+struct CaptureChannel
+{
+    int sensorIndex;
+    bool analog;
+    CaptureState state;
+    uint16_t writeIndex;
+    uint16_t filled;        // samples in the ring, up to CAPTURE_SAMPLES
+    uint16_t postRemaining; // post-trigger samples still to record
+    unsigned long triggeredAt;
+    uint32_t alertId;       // alert the window belongs to, 0 = not known yet
+    uint8_t uploadAttempts;
+    int16_t samples[CAPTURE_SAMPLES];
+};
+
+#if CAPTURE_ENABLED
+CaptureChannel captureChannels[CAPTURE_MAX_CHANNELS];
+uint8_t captureChannelCount = 0;
+Ticker captureTicker;
+#endif
+
+// ========================================
+// BUFFER POOLS
+// ========================================
+// HTTP payloads, response bodies and JSON documents are carved out of
+// fixed slabs allocated once at boot instead of being created and freed
+// on every request, which fragments the small ESP8266 heap. Exhausted
+// pools fall back to the heap and are counted.
+#ifndef POOL_SMALL_SLOT_SIZE
+#define POOL_SMALL_SLOT_SIZE 512
+#endif
+#ifndef POOL_SMALL_SLOTS
+#define POOL_SMALL_SLOTS 4
+#endif
+#ifndef POOL_LARGE_SLOT_SIZE
+#define POOL_LARGE_SLOT_SIZE 2048
+#endif
+#ifndef POOL_LARGE_SLOTS
+#define POOL_LARGE_SLOTS 2
+#endif
+#define POOL_MAX_SLOTS 32
+#define ENDPOINT_BUFFER_SIZE 224
+
+struct BufferPool
+{
+    const char *name;
+    uint8_t *slab;
+    size_t slotSize;
+    uint8_t slotCount;
+    uint32_t freeMask; // bit i set = slot i free
+    uint8_t inUse;
+    uint8_t highWater;
+    uint32_t exhausted; // acquisitions that found no free slot
+};
+
+BufferPool smallPool = {"small"};
+BufferPool largePool = {"large"};
+uint32_t poolHeapFallbacks = 0;
+
+bool initBufferPool(BufferPool &pool, size_t slotSize, uint8_t slotCount)
+{
+    pool.slotSize = slotSize;
+    pool.slotCount = slotCount > POOL_MAX_SLOTS ? POOL_MAX_SLOTS : slotCount;
+    pool.slab = (uint8_t *)malloc(pool.slotSize * pool.slotCount);
+
+    if (pool.slab == nullptr)
+    {
+        Serial.printf("⚠️  Failed to allocate %s buffer pool\n", pool.name);
+        pool.slotCount = 0;
+        pool.freeMask = 0;
+        return false;
+    }
+
+    pool.freeMask = pool.slotCount == 32 ? 0xFFFFFFFFUL : ((1UL << pool.slotCount) - 1);
+    Serial.printf("Buffer pool %s: %u x %u bytes\n", pool.name, pool.slotCount, pool.slotSize);
+    return true;
+}
+
+void initBufferPools()
+{
+    initBufferPool(smallPool, POOL_SMALL_SLOT_SIZE, POOL_SMALL_SLOTS);
+    initBufferPool(largePool, POOL_LARGE_SLOT_SIZE, POOL_LARGE_SLOTS);
+}
+
+void *poolAcquire(BufferPool &pool)
+{
+    if (pool.freeMask == 0)
+    {
+        pool.exhausted++;
+        return nullptr;
+    }
+
+    int index = __builtin_ctz(pool.freeMask);
+    pool.freeMask &= ~(1UL << index);
+    pool.inUse++;
+    if (pool.inUse > pool.highWater)
+    {
+        pool.highWater = pool.inUse;
+    }
+    return pool.slab + (size_t)index * pool.slotSize;
+}
+
+bool poolOwns(const BufferPool &pool, const void *ptr)
+{
+    const uint8_t *p = (const uint8_t *)ptr;
+    return pool.slab != nullptr && p >= pool.slab && p < pool.slab + pool.slotSize * pool.slotCount;
+}
+
+bool poolRelease(BufferPool &pool, void *ptr)
+{
+    if (!poolOwns(pool, ptr))
+    {
+        return false;
+    }
+    int index = ((uint8_t *)ptr - pool.slab) / pool.slotSize;
+    pool.freeMask |= (1UL << index);
+    pool.inUse--;
+    return true;
+}
+
+// Smallest tier that fits, heap as a last resort
+void *bufferAcquire(size_t size)
+{
+    void *ptr = nullptr;
+    if (size <= smallPool.slotSize)
+    {
+        ptr = poolAcquire(smallPool);
+    }
+    if (ptr == nullptr && size <= largePool.slotSize)
+    {
+        ptr = poolAcquire(largePool);
+    }
+    if (ptr == nullptr)
+    {
+        poolHeapFallbacks++;
+        ptr = malloc(size);
+    }
+    return ptr;
+}
+
+size_t bufferCapacity(const void *ptr)
+{
+    if (poolOwns(smallPool, ptr))
+        return smallPool.slotSize;
+    if (poolOwns(largePool, ptr))
+        return largePool.slotSize;
+    return 0;
+}
+
+void bufferRelease(void *ptr)
+{
+    if (ptr == nullptr)
+    {
+        return;
+    }
+    if (!poolRelease(smallPool, ptr) && !poolRelease(largePool, ptr))
+    {
+        free(ptr);
+    }
+}
+
+// ArduinoJson allocator so documents live in pool slots
+struct PoolJsonAllocator
+{
+    void *allocate(size_t size)
+    {
+        return bufferAcquire(size);
+    }
+
+    void deallocate(void *ptr)
+    {
+        bufferRelease(ptr);
+    }
+
+    void *reallocate(void *ptr, size_t newSize)
+    {
+        size_t capacity = bufferCapacity(ptr);
+        if (capacity == 0)
+        {
+            return realloc(ptr, newSize);
+        }
+        return newSize <= capacity ? ptr : nullptr;
+    }
+};
+
+typedef BasicJsonDocument<PoolJsonAllocator> PooledJsonDocument;
+
+// Scoped pool buffer, released when it goes out of scope
+class PoolBuffer
+{
+public:
+    PoolBuffer() : data(nullptr), capacity(0) {}
+    explicit PoolBuffer(size_t size) : PoolBuffer() { acquire(size); }
+    ~PoolBuffer() { bufferRelease(data); }
+
+    bool acquire(size_t size)
+    {
+        bufferRelease(data);
+        data = (char *)bufferAcquire(size);
+        capacity = data != nullptr ? size : 0;
+        return data != nullptr;
+    }
+
+    char *data;
+    size_t capacity;
+
+private:
+    PoolBuffer(const PoolBuffer &);
+    PoolBuffer &operator=(const PoolBuffer &);
+};
+
+void reportBufferPool(JsonArray pools, const BufferPool &pool)
+{
+    JsonObject entry = pools.createNestedObject();
+    entry["name"] = pool.name;
+    entry["slot_size"] = pool.slotSize;
+    entry["slots"] = pool.slotCount;
+    entry["in_use"] = pool.inUse;
+    entry["high_water"] = pool.highWater;
+    entry["exhausted"] = pool.exhausted;
+}
+
+bool backpressureHeld(Backpressure &bp)
+{
+    if (bp.held && (long)(millis() - bp.holdUntil) >= 0)
+    {
+        bp.held = false;
+    }
+    return bp.held;
+}
+
+unsigned long backpressureInterval(unsigned long baseMs, const Backpressure &bp)
+{
+    return bp.intervalMs > baseMs ? bp.intervalMs : baseMs;
+}
+
+void applyBackpressure(HTTPClient &http, int httpCode, Backpressure &bp)
+{
+    long hintMs = http.header("X-Device-Backoff-Ms").toInt();
+    bp.intervalMs = hintMs > 0 ? (unsigned long)hintMs : 0;
+    if (bp.intervalMs > MAX_BACKOFF_MS)
+    {
+        bp.intervalMs = MAX_BACKOFF_MS;
+    }
+
+    if (httpCode == 429 || httpCode == 503)
+    {
+        unsigned long holdMs = (unsigned long)http.header("Retry-After").toInt() * 1000UL;
+        if (holdMs < bp.intervalMs)
+            holdMs = bp.intervalMs;
+        if (holdMs < 1000UL)
+            holdMs = 1000UL;
+        if (holdMs > MAX_BACKOFF_MS)
+            holdMs = MAX_BACKOFF_MS;
+        bp.holdUntil = millis() + holdMs;
+        bp.held = true;
+        Serial.print("Server backpressure: holding for ");
+        Serial.print(holdMs);
+        Serial.println(" ms");
+    }
+}
+
+// Start a request to /api/devices/<id>/<path> without building String URLs
+bool beginDeviceRequest(HTTPClient &http, const char *path)
+{
+    char endpoint[ENDPOINT_BUFFER_SIZE];
+    snprintf(endpoint, sizeof(endpoint), "%s/api/devices/%s/%s", config.server_url, config.device_id, path);
+
+#if USE_HTTPS
+    if (strlen(SERVER_FINGERPRINT) > 0)
+    {
+        secureClient.setFingerprint(SERVER_FINGERPRINT);
+    }
+    else
+    {
+        secureClient.setInsecure();
+    }
+    bool started = http.begin(secureClient, endpoint);
+#else
+    bool started = http.begin(wifiClient, endpoint);
+#endif
+    if (started)
+    {
+        http.addHeader("Content-Type", "application/json");
+        if (strlen(SERVER_API_KEY) > 0) {
+            http.addHeader("X-API-Key", SERVER_API_KEY);
+        }
+        http.collectHeaders(BACKPRESSURE_HEADERS, 2);
+    }
+    return started;
+}
+
+int postJson(HTTPClient &http, const JsonDocument &doc)
+{
+    size_t length = measureJson(doc);
+    PoolBuffer payload(length + 1);
+    if (payload.data == nullptr)
+    {
+        return HTTPC_ERROR_TOO_LESS_RAM;
+    }
+    serializeJson(doc, payload.data, payload.capacity);
+    return http.POST((uint8_t *)payload.data, length);
+}
+
+// Read the response body into a pool buffer. Express sends Content-Length
+// for JSON bodies; anything chunked goes through getString() instead.
+size_t readResponseBody(HTTPClient &http, PoolBuffer &body)
+{
+    int size = http.getSize();
+    if (size < 0)
+    {
+        String response = http.getString();
+        if (!body.acquire(response.length() + 1))
+        {
+            return 0;
+        }
+        memcpy(body.data, response.c_str(), response.length() + 1);
+        return response.length();
+    }
+
+    if (!body.acquire(size + 1))
+    {
+        return 0;
+    }
+    size_t received = http.getStreamPtr()->readBytes(body.data, size);
+    body.data[received] = '\0';
+    return received;
+}
+
 // Hardware instances (initialize based on configuration)
 #if SENSOR_DHT_ENABLED
 DHT *dht = nullptr;
@@ -109,31 +754,97 @@ DHT *dht = nullptr;
 Ultrasonic *ultrasonic = nullptr;
 #endif
 
+#if SENSOR_ONEWIRE_ENABLED
+OneWire *oneWire = nullptr;
+OneWireProbe oneWireProbes[ONEWIRE_MAX_PROBES];
+uint8_t oneWireProbeCount = 0;
+unsigned long oneWireConvertStartedAt = 0;
+#endif
+
+#if MODBUS_ENABLED
+SoftwareSerial modbusSerial;
+SoftwareSerialModbusPort modbusPort(modbusSerial, MODBUS_DE_PIN);
+ModbusMaster modbus(modbusPort);
+ModbusPoint modbusPoints[MODBUS_MAX_POINTS];
+char modbusPinNames[MODBUS_MAX_POINTS][MODBUS_PIN_NAME_SIZE];
+uint8_t modbusPointCount = 0;
+int modbusFirstSensor = 0;     // sensors[] index of the first point
+uint32_t modbusMapVersion = 0; // 0 until the server sends a map
+unsigned long modbusCycleStartedAt = 0;
+#endif
+
+#if SENSOR_PULSE_ENABLED
+volatile uint32_t pulseIsrCount = 0;
+volatile uint32_t pulseIsrLastUs = 0;
+uint32_t pulseFoldedCount = 0;
+uint64_t pulseTotal = 0;
+char pulsePinNames[3][PULSE_PIN_NAME_SIZE];
+int pulseFirstSensor = 0; // sensors[] index of the count sensor
+uint64_t pulseReportedTotal = 0;
+unsigned long pulseReportedAt = 0;
+uint64_t pulseSavedTotal = 0;
+unsigned long pulseSavedAt = 0;
+float pulseValues[3] = {0, 0, 0}; // count, rate, total
+#endif
+
 // Forward declarations
 void loadConfiguration();
 void saveConfiguration();
 void initializeSensors();
-void connectToWiFi();
+void startWiFi();
+void onNetworkUp();
 void checkForFirmwareUpdate();
 void sendHeartbeat();
 void handleOTAUpdates();
 void readAndProcessSensors(bool sendTelemetry = false);
 void sendTelemetryData(const JsonDocument &telemetryDoc);
-void parseServerResponse(const String &response);
+void sendTelemetryPayload(const char *payload, size_t length, unsigned long sampleAgeMs);
+void backlogTelemetry(const JsonDocument &telemetryDoc);
+void parseServerResponse(const char *response, size_t length);
 void updateSensorConfiguration(JsonArray sensorConfigs);
 void performOTAUpdate(const String &firmwareUrl, const String &expectedChecksum);
+void otaStep();
+void otaRebootWhenQuiet();
 void notifyOTAStatus(const String &status, int progress, const String &errorMessage = "");
 void printSensorValuesToConsole();
 void sendAlarmEvent(int sensorIndex, float value);
-void sendImmediateThresholdAlert(int sensorIndex, float value, const String &alertType);
+uint32_t sendImmediateThresholdAlert(int sensorIndex, float value, const String &alertType);
+#if SENSOR_ONEWIRE_ENABLED
+void oneWireInit();
+void oneWirePoll();
+bool oneWireReading(int sensorIndex, float &celsius);
+#endif
+#if MODBUS_ENABLED
+void modbusInit();
+void modbusPoll();
+void modbusApplyMap(JsonObject map);
+bool modbusReading(int sensorIndex, float &value);
+void reportModbusStats(JsonObject bus);
+#endif
+#if SENSOR_PULSE_ENABLED
+void pulseInit();
+uint64_t pulseFold();
+void pulseTake(bool closeInterval);
+bool pulseReading(int sensorIndex, float &value);
+void pulseSaveTotal(uint64_t pulses);
+#endif
+bool busReading(int sensorIndex, float &value);
+#if CAPTURE_ENABLED
+void captureInit();
+void captureTrigger(int sensorIndex);
+void captureAttach(int sensorIndex, uint32_t alertId);
+void captureUploadReady();
+#endif
 
 void setup()
 {
     Serial.begin(115200);
-    delay(1000);
 
     Serial.println("Starting Enhanced ESP8266 Sensor Platform...");
 
+    // Carve out network/JSON buffers before anything else touches the heap
+    initBufferPools();
+
     // Initialize EEPROM for configuration storage
     EEPROM.begin(1024);
 
@@ -142,34 +853,67 @@ void setup()
 
     // Initialize sensors based on configuration
     initializeSensors();
+#if CAPTURE_ENABLED
+    captureInit();
+#endif
+    bootTimings.sensorsReadyMs = millis();
 
-    // Connect to WiFi
-    connectToWiFi();
-
-    // Check for firmware updates if enabled
-    if (config.ota_enabled)
-    {
-        checkForFirmwareUpdate();
-    }
-
-    // Send initial heartbeat with device info
-    sendHeartbeat();
+    // Connect to WiFi without waiting for it; sampling starts right away
+    startWiFi();
 }
 
 void loop()
 {
+    // Read sensors at fast interval (1 second for real-time threshold monitoring),
+    // whether or not the link is up
+    if (millis() - lastSensorRead >= SENSOR_READ_INTERVAL_MS)
+    {
+        // Read sensors and check thresholds, but DON'T send telemetry yet
+        bool shouldSendTelemetry = (millis() - lastTelemetrySend >= backpressureInterval(TELEMETRY_SEND_INTERVAL_MS, telemetryBackpressure)) &&
+                                   !backpressureHeld(telemetryBackpressure);
+        readAndProcessSensors(shouldSendTelemetry);
+        lastSensorRead = millis();
+        if (bootTimings.firstSampleMs == 0)
+        {
+            bootTimings.firstSampleMs = lastSensorRead;
+        }
+
+        // Update telemetry timestamp only if we actually sent it
+        if (shouldSendTelemetry)
+        {
+            lastTelemetrySend = millis();
+        }
+    }
+
+    // Print sensor values to console every 5 seconds for debugging
+    if (millis() - lastConsoleOutput >= CONSOLE_OUTPUT_INTERVAL)
+    {
+        printSensorValuesToConsole();
+        lastConsoleOutput = millis();
+    }
+
     // Check WiFi connection every 15 seconds
     if (millis() - lastWiFiCheck >= WIFI_RECONNECT_INTERVAL)
     {
         if (WiFi.status() != WL_CONNECTED)
         {
-            Serial.println("========================================");
-            Serial.println("WiFi disconnected! Attempting reconnection...");
-            Serial.println("========================================");
-            connectToWiFi();
+            if (wifiDownSince == 0)
+            {
+                wifiDownSince = millis();
+            }
+            else if (millis() - wifiDownSince >= WIFI_RESTART_AFTER_MS)
+            {
+                Serial.println("WiFi down too long - restarting");
+#if SENSOR_PULSE_ENABLED
+                pulseSaveTotal(pulseFold());
+#endif
+                ESP.restart();
+            }
+            Serial.println("WiFi not connected, waiting for reconnection...");
         }
         else
         {
+            wifiDownSince = 0;
             if (config.debug_mode)
             {
                 Serial.println("WiFi status check: Connected");
@@ -184,47 +928,46 @@ void loop()
     // Only perform network operations if WiFi is connected
     if (WiFi.status() == WL_CONNECTED)
     {
-        // Read sensors at fast interval (1 second for real-time threshold monitoring)
-        if (millis() - lastSensorRead >= SENSOR_READ_INTERVAL_MS)
+        if (!networkBootDone)
         {
-            // Read sensors and check thresholds, but DON'T send telemetry yet
-            bool shouldSendTelemetry = (millis() - lastTelemetrySend >= TELEMETRY_SEND_INTERVAL_MS);
-            readAndProcessSensors(shouldSendTelemetry);
-            lastSensorRead = millis();
-
-            // Update telemetry timestamp only if we actually sent it
-            if (shouldSendTelemetry)
-            {
-                lastTelemetrySend = millis();
-            }
+            onNetworkUp();
         }
 
-        // Print sensor values to console every 5 seconds for debugging
-        if (millis() - lastConsoleOutput >= CONSOLE_OUTPUT_INTERVAL)
+        // Send telemetry buffered while the link was down, oldest first
+        if (backlogCount > 0 && !backpressureHeld(telemetryBackpressure))
         {
-            printSensorValuesToConsole();
-            lastConsoleOutput = millis();
+            BacklogEntry &entry = telemetryBacklog[backlogHead];
+            sendTelemetryPayload(entry.payload, entry.length, millis() - entry.sampledAt);
+            backlogHead = (backlogHead + 1) % TELEMETRY_BACKLOG_SLOTS;
+            backlogCount--;
         }
 
         // Send heartbeat at configured interval
-        if (millis() - lastHeartbeat >= (config.heartbeat_interval * 1000))
+        if (millis() - lastHeartbeat >= backpressureInterval(config.heartbeat_interval * 1000UL, controlBackpressure) &&
+            !backpressureHeld(controlBackpressure))
         {
             sendHeartbeat();
         }
 
+#if CAPTURE_ENABLED
+        // Upload completed trigger windows
+        captureUploadReady();
+#endif
+
         // Handle any pending OTA updates
         handleOTAUpdates();
     }
-    else
-    {
-        // Log warning if disconnected for too long
-        if (config.debug_mode && (millis() - lastWiFiCheck) % 30000 < 1000)
-        {
-            Serial.println("WARNING: WiFi still disconnected, waiting for reconnection...");
-        }
-    }
 
+    // Background OTA download, or the reboot into a finished image
+    otaStep();
+
+#if MODBUS_ENABLED
+    modbusPoll();
+    // Come straight back while a request or reply is on the bus
+    delay(modbus.busy() ? 1 : 100);
+#else
     delay(100); // Reduced delay for faster response
+#endif
 }
 
 void loadConfiguration()
@@ -371,11 +1114,360 @@ void initializeSensors()
     }
 #endif
 
+// Pulse-output meter: count, rate and total
+#if SENSOR_PULSE_ENABLED
+    pulseInit();
+#endif
+
+// DS18B20 probes on the 1-Wire bus, one sensor each
+#if SENSOR_ONEWIRE_ENABLED
+    oneWireInit();
+#endif
+
+// Modbus points follow once the server sends a register map
+#if MODBUS_ENABLED
+    modbusInit();
+#endif
+
     Serial.print("✅ Total sensors initialized: ");
     Serial.println(sensorCount);
     Serial.println("========================================");
 }
 
+#if SENSOR_ONEWIRE_ENABLED
+// Boot: find every DS18B20 on the bus, register each as a sensor and set
+// the resolution on all of them with one skip-ROM scratchpad write
+void oneWireInit()
+{
+    oneWire = new OneWire(SENSOR_ONEWIRE_PIN);
+    oneWireProbeCount = 0;
+
+    uint8_t rom[8];
+    oneWire->reset_search();
+    while (oneWireProbeCount < ONEWIRE_MAX_PROBES && sensorCount < MAX_SENSORS && oneWire->search(rom))
+    {
+        if (OneWire::crc8(rom, 7) != rom[7] || rom[0] != DS18B20_FAMILY_CODE)
+        {
+            continue;
+        }
+
+        OneWireProbe &probe = oneWireProbes[oneWireProbeCount++];
+        memcpy(probe.rom, rom, sizeof(rom));
+        snprintf(probe.pinName, sizeof(probe.pinName), ONEWIRE_PIN_PREFIX "%02X%02X%02X%02X", rom[4], rom[3], rom[2], rom[1]);
+        probe.sensorIndex = sensorCount;
+        probe.valid = false;
+
+        sensors[sensorCount] = {SENSOR_ONEWIRE_PIN, "temperature", String("Probe ") + (probe.pinName + 2), 0, 1, true, PROBE_THRESHOLD_MIN, PROBE_THRESHOLD_MAX, probe.pinName};
+        sensorCount++;
+    }
+
+    if (oneWireProbeCount == 0)
+    {
+        Serial.println("No DS18B20 probes found on pin " + String(SENSOR_ONEWIRE_PIN));
+        return;
+    }
+
+    // TH/TL alarm registers are unused; config byte holds R1:R0
+    oneWire->reset();
+    oneWire->skip();
+    oneWire->write(DS18B20_WRITE_SCRATCHPAD);
+    oneWire->write(0x7F);
+    oneWire->write(0x80);
+    oneWire->write(((ONEWIRE_RESOLUTION_BITS - 9) << 5) | 0x1F);
+
+    oneWire->reset();
+    oneWire->skip();
+    oneWire->write(DS18B20_CONVERT_T);
+    oneWireConvertStartedAt = millis();
+
+    Serial.print(oneWireProbeCount);
+    Serial.println(" DS18B20 probe(s) on pin " + String(SENSOR_ONEWIRE_PIN));
+}
+
+// Every sensor pass: once the running conversion has had its time, read
+// each probe's scratchpad and start the next conversion on all of them
+void oneWirePoll()
+{
+    if (oneWireProbeCount == 0 || millis() - oneWireConvertStartedAt < ONEWIRE_CONVERSION_MS)
+    {
+        return;
+    }
+
+    for (uint8_t p = 0; p < oneWireProbeCount; p++)
+    {
+        OneWireProbe &probe = oneWireProbes[p];
+        probe.valid = false;
+        if (!oneWire->reset())
+        {
+            continue; // nothing answered the reset pulse
+        }
+        oneWire->select(probe.rom);
+        oneWire->write(DS18B20_READ_SCRATCHPAD);
+
+        uint8_t scratchpad[9];
+        oneWire->read_bytes(scratchpad, sizeof(scratchpad));
+        // A shorted bus reads all zeros, which passes the CRC; the config
+        // byte's low five bits always read back as ones
+        if (OneWire::crc8(scratchpad, 8) != scratchpad[8] || (scratchpad[4] & 0x1F) != 0x1F)
+        {
+            continue;
+        }
+
+        // Bits below the configured resolution are undefined
+        int16_t raw = (int16_t)((scratchpad[1] << 8) | scratchpad[0]);
+        raw &= ~((1 << (12 - ONEWIRE_RESOLUTION_BITS)) - 1);
+        probe.celsius = raw / 16.0f;
+        probe.valid = true;
+    }
+
+    oneWire->reset();
+    oneWire->skip();
+    oneWire->write(DS18B20_CONVERT_T);
+    oneWireConvertStartedAt = millis();
+}
+
+// Latest completed conversion for a probe-backed sensor
+bool oneWireReading(int sensorIndex, float &celsius)
+{
+    for (uint8_t p = 0; p < oneWireProbeCount; p++)
+    {
+        if (oneWireProbes[p].sensorIndex == sensorIndex)
+        {
+            celsius = oneWireProbes[p].celsius;
+            return oneWireProbes[p].valid;
+        }
+    }
+    return false;
+}
+#endif
+
+#if MODBUS_ENABLED
+void modbusInit()
+{
+    modbusFirstSensor = sensorCount;
+
+    pinMode(MODBUS_DE_PIN, OUTPUT);
+    digitalWrite(MODBUS_DE_PIN, LOW);
+    // Big enough for the longest reply (125 registers)
+    modbusSerial.begin(MODBUS_BAUD, SWSERIAL_8N1, MODBUS_RX_PIN, MODBUS_TX_PIN, false, MODBUS_FRAME_SIZE);
+    modbus.begin(MODBUS_BAUD, MODBUS_RESPONSE_TIMEOUT_MS * 1000UL);
+
+    Serial.println("Modbus RTU at " + String(MODBUS_BAUD) + " baud, waiting for a register map");
+}
+
+// Starts a read of every batch each MODBUS_POLL_INTERVAL_MS and moves the
+// current one along
+void modbusPoll()
+{
+    if (modbusPointCount > 0 && !modbus.busy() &&
+        millis() - modbusCycleStartedAt >= MODBUS_POLL_INTERVAL_MS)
+    {
+        modbus.startCycle();
+        modbusCycleStartedAt = millis();
+    }
+    modbus.poll(micros());
+}
+
+// Replace the Modbus sensors with the map from a heartbeat response
+void modbusApplyMap(JsonObject map)
+{
+    uint32_t version = map["version"] | 0UL;
+    if (version == modbusMapVersion || !map.containsKey("points"))
+    {
+        return;
+    }
+
+    sensorCount = modbusFirstSensor;
+    modbusPointCount = 0;
+    for (JsonObject entry : map["points"].as<JsonArray>())
+    {
+        const char *pin = entry["pin"] | "";
+        int type = modbusParseType(entry["type"] | "");
+        if (modbusPointCount >= MODBUS_MAX_POINTS || sensorCount >= MAX_SENSORS || type < 0 ||
+            pin[0] == '\0' || strlen(pin) >= MODBUS_PIN_NAME_SIZE)
+        {
+            continue;
+        }
+
+        ModbusPoint &point = modbusPoints[modbusPointCount];
+        point.slave = entry["slave"] | 1;
+        point.function = entry["function"] | MODBUS_READ_HOLDING_REGISTERS;
+        point.address = entry["address"] | 0;
+        point.type = type;
+        point.scale = entry["scale"] | 1.0f;
+        snprintf(modbusPinNames[modbusPointCount], MODBUS_PIN_NAME_SIZE, "%s", pin);
+
+        sensors[sensorCount] = {-1, entry["sensor_type"] | "pressure", String("Modbus ") + pin, 0, 1, true,
+                                entry["threshold_min"] | 0.0f, entry["threshold_max"] | 0.0f,
+                                modbusPinNames[modbusPointCount]};
+        sensorFilters[sensorCount].initialized = false;
+        thresholdStates[sensorCount] = {false, false, 0};
+        sensorCount++;
+        modbusPointCount++;
+    }
+
+    uint8_t requests = modbus.setPoints(modbusPoints, modbusPointCount);
+    modbusCycleStartedAt = millis() - MODBUS_POLL_INTERVAL_MS;
+    modbusMapVersion = version;
+    // The new points take their settings from the sensor list; fetch it again
+    sensorConfigVersion = 0;
+
+    Serial.print("Modbus map ");
+    Serial.print(modbusMapVersion);
+    Serial.print(": ");
+    Serial.print(modbusPointCount);
+    Serial.print(" point(s), ");
+    Serial.print(requests);
+    Serial.println(" request(s) per cycle");
+}
+
+// Last decoded value for a Modbus-backed sensor
+bool modbusReading(int sensorIndex, float &value)
+{
+    int k = sensorIndex - modbusFirstSensor;
+    if (k < 0 || k >= modbusPointCount)
+    {
+        return false;
+    }
+    value = modbusPoints[k].value;
+    return modbusPoints[k].valid;
+}
+
+void reportModbusStats(JsonObject bus)
+{
+    const ModbusStats &stats = modbus.stats();
+    bus["version"] = modbusMapVersion;
+    bus["points"] = modbusPointCount;
+    bus["requests"] = stats.requests;
+    bus["responses"] = stats.responses;
+    bus["timeouts"] = stats.timeouts;
+    bus["crc_errors"] = stats.crcErrors;
+    bus["exceptions"] = stats.exceptions;
+}
+#endif
+
+#if SENSOR_PULSE_ENABLED
+void IRAM_ATTR pulseIsr()
+{
+    uint32_t now = micros();
+    if (now - pulseIsrLastUs >= PULSE_FILTER_US)
+    {
+        pulseIsrCount++;
+        pulseIsrLastUs = now;
+    }
+}
+
+// Boot: restore the saved total, attach the interrupt and register the
+// three pulse sensors
+void pulseInit()
+{
+    PulseStore store;
+    EEPROM.get(PULSE_EEPROM_ADDR, store);
+    pulseTotal = store.magic == PULSE_STORE_MAGIC ? store.pulses : 0;
+    pulseReportedTotal = pulseTotal;
+    pulseSavedTotal = pulseTotal;
+    pulseReportedAt = millis();
+    pulseSavedAt = millis();
+    pulseValues[2] = pulseTotal / PULSES_PER_UNIT;
+
+    pinMode(SENSOR_PULSE_PIN, INPUT_PULLUP);
+    attachInterrupt(digitalPinToInterrupt(SENSOR_PULSE_PIN), pulseIsr, FALLING);
+
+    snprintf(pulsePinNames[0], PULSE_PIN_NAME_SIZE, "P%d.count", SENSOR_PULSE_PIN);
+    snprintf(pulsePinNames[1], PULSE_PIN_NAME_SIZE, "P%d.rate", SENSOR_PULSE_PIN);
+    snprintf(pulsePinNames[2], PULSE_PIN_NAME_SIZE, "P%d.total", SENSOR_PULSE_PIN);
+    pulseFirstSensor = sensorCount;
+    sensors[sensorCount++] = {SENSOR_PULSE_PIN, "pulse_count", "Pulse Count", 0, 1, true, 0, 1e9, pulsePinNames[0]};
+    sensors[sensorCount++] = {SENSOR_PULSE_PIN, "pulse_rate", "Pulse Rate", 0, 1, true, PULSE_RATE_THRESHOLD_MIN, PULSE_RATE_THRESHOLD_MAX, pulsePinNames[1]};
+    sensors[sensorCount++] = {SENSOR_PULSE_PIN, "pulse_total", "Pulse Total", 0, 1, true, 0, 1e9, pulsePinNames[2]};
+
+    Serial.print("Pulse counter on pin ");
+    Serial.print(SENSOR_PULSE_PIN);
+    Serial.print(", total ");
+    Serial.println(pulseValues[2], 3);
+}
+
+// Add the interrupt's count since the last call to the 64-bit total
+uint64_t pulseFold()
+{
+    noInterrupts();
+    uint32_t count = pulseIsrCount;
+    interrupts();
+    pulseTotal += (uint32_t)(count - pulseFoldedCount);
+    pulseFoldedCount = count;
+    return pulseTotal;
+}
+
+// Every sensor pass: update the total, and close the count/rate interval
+// when telemetry goes out; save the total when due
+void pulseTake(bool closeInterval)
+{
+    uint64_t total = pulseFold();
+    unsigned long now = millis();
+    pulseValues[2] = total / PULSES_PER_UNIT;
+
+    if (closeInterval)
+    {
+        uint64_t pulses = total - pulseReportedTotal;
+        float hours = (now - pulseReportedAt) / 3600000.0f;
+        pulseValues[0] = (float)pulses;
+        pulseValues[1] = hours > 0 ? (float)(pulses / PULSES_PER_UNIT / hours) : 0;
+        pulseReportedTotal = total;
+        pulseReportedAt = now;
+    }
+
+    if (total != pulseSavedTotal && now - pulseSavedAt >= PULSE_SAVE_INTERVAL_MS)
+    {
+        pulseSaveTotal(total);
+    }
+}
+
+bool pulseReading(int sensorIndex, float &value)
+{
+    int k = sensorIndex - pulseFirstSensor;
+    if (k < 0 || k > 2)
+    {
+        return false;
+    }
+    value = pulseValues[k];
+    return true;
+}
+
+void pulseSaveTotal(uint64_t pulses)
+{
+    PulseStore store = {PULSE_STORE_MAGIC, pulses};
+    EEPROM.put(PULSE_EEPROM_ADDR, store);
+    EEPROM.commit();
+    pulseSavedTotal = pulses;
+    pulseSavedAt = millis();
+}
+#endif
+
+// Latest value for a sensor read in the background (1-Wire probe, Modbus
+// point or pulse channel)
+bool busReading(int sensorIndex, float &value)
+{
+#if SENSOR_PULSE_ENABLED
+    if (pulseReading(sensorIndex, value))
+    {
+        return true;
+    }
+#endif
+#if SENSOR_ONEWIRE_ENABLED
+    if (oneWireReading(sensorIndex, value))
+    {
+        return true;
+    }
+#endif
+#if MODBUS_ENABLED
+    if (modbusReading(sensorIndex, value))
+    {
+        return true;
+    }
+#endif
+    return false;
+}
+
 /**
  * Initialize sensor filter for moving average
  */
@@ -475,7 +1567,14 @@ void readAndProcessSensors(bool sendTelemetry)
         Serial.println("Reading sensors and sending telemetry...");
     }
 
-    StaticJsonDocument<1024> telemetryDoc;
+#if SENSOR_ONEWIRE_ENABLED
+    oneWirePoll();
+#endif
+#if SENSOR_PULSE_ENABLED
+    pulseTake(sendTelemetry);
+#endif
+
+    PooledJsonDocument telemetryDoc(1024);
     JsonArray sensorData = telemetryDoc.createNestedArray("sensors");
 
     for (int i = 0; i < sensorCount; i++)
@@ -496,7 +1595,29 @@ void readAndProcessSensors(bool sendTelemetry)
         bool hasReading = false;
 
         // Read sensor based on type with median filtering for analog sensors
-        if (sensors[i].type == "light")
+        if (sensors[i].type.startsWith("pulse_"))
+        {
+#if SENSOR_PULSE_ENABLED
+            // Exact per-interval figures from the counter; not smoothed
+            if (pulseReading(i, rawValue))
+            {
+                filteredValue = rawValue;
+                processedValue = (rawValue * sensors[i].calibration_multiplier) + sensors[i].calibration_offset;
+                hasReading = true;
+            }
+#endif
+        }
+        else if (sensors[i].pinName != nullptr)
+        {
+            // 1-Wire probe or Modbus point: the last value its bus delivered
+            if (busReading(i, rawValue))
+            {
+                filteredValue = applyMovingAverageFilter(i, rawValue);
+                processedValue = (filteredValue * sensors[i].calibration_multiplier) + sensors[i].calibration_offset;
+                hasReading = true;
+            }
+        }
+        else if (sensors[i].type == "light")
         {
             rawValue = applyMedianFilter(sensors[i].pin, true);
             filteredValue = applyMovingAverageFilter(i, rawValue);
@@ -589,7 +1710,11 @@ void readAndProcessSensors(bool sendTelemetry)
         {
             JsonObject sensor = sensorData.createNestedObject();
             // Send pin as string for analog pins (A0), numeric for digital pins
-            if (sensors[i].pin == A0)
+            if (sensors[i].pinName != nullptr)
+            {
+                sensor["pin"] = sensors[i].pinName;
+            }
+            else if (sensors[i].pin == A0)
             {
                 sensor["pin"] = "A0";
             }
@@ -642,7 +1767,12 @@ void readAndProcessSensors(bool sendTelemetry)
                 {
                     Serial.println("!!! THRESHOLD CROSSED: " + sensors[i].name + " " + alertType + " !!!");
                 }
+#if CAPTURE_ENABLED
+                captureTrigger(i);
+                captureAttach(i, sendImmediateThresholdAlert(i, processedValue, alertType));
+#else
                 sendImmediateThresholdAlert(i, processedValue, alertType);
+#endif
             }
 #endif
 
@@ -667,7 +1797,14 @@ void readAndProcessSensors(bool sendTelemetry)
             Serial.print(sensorData.size());
             Serial.println(" sensors");
         }
-        sendTelemetryData(telemetryDoc);
+        if (WiFi.status() == WL_CONNECTED)
+        {
+            sendTelemetryData(telemetryDoc);
+        }
+        else
+        {
+            backlogTelemetry(telemetryDoc);
+        }
     }
     else if (config.debug_mode && !sendTelemetry)
     {
@@ -689,41 +1826,36 @@ void readAndProcessSensors(bool sendTelemetry)
 
 void sendTelemetryData(const JsonDocument &telemetryDoc)
 {
-    HTTPClient http;
-    String endpoint = String(config.server_url) + "/api/devices/" + config.device_id + "/telemetry";
-
-    if (config.debug_mode)
+    size_t length = measureJson(telemetryDoc);
+    PoolBuffer payload(length + 1);
+    if (payload.data == nullptr)
     {
-        Serial.print("Sending telemetry to: ");
-        Serial.println(endpoint);
+        Serial.println("⚠️  Telemetry send failed: out of buffers");
+        return;
     }
+    serializeJson(telemetryDoc, payload.data, payload.capacity);
+    sendTelemetryPayload(payload.data, length, 0);
+}
 
-#if USE_HTTPS
-    if (strlen(SERVER_FINGERPRINT) > 0)
+void sendTelemetryPayload(const char *payload, size_t length, unsigned long sampleAgeMs)
+{
+    HTTPClient http;
+    beginDeviceRequest(http, "telemetry");
+    if (sampleAgeMs >= 1000)
     {
-        secureClient.setFingerprint(SERVER_FINGERPRINT);
+        // Buffered reading: lets the server stamp it with its sample time
+        http.addHeader("X-Sample-Age-Ms", String(sampleAgeMs));
     }
-    else
-    {
-        secureClient.setInsecure();
-    }
-    http.begin(secureClient, endpoint);
-#else
-    http.begin(wifiClient, endpoint);
-#endif
-    http.addHeader("Content-Type", "application/json");
-
-    String payload;
-    serializeJson(telemetryDoc, payload);
 
     if (config.debug_mode)
     {
         Serial.print("Payload size: ");
-        Serial.print(payload.length());
+        Serial.print(length);
         Serial.println(" bytes");
     }
 
-    int httpCode = http.POST(payload);
+    int httpCode = http.POST((uint8_t *)payload, length);
+    applyBackpressure(http, httpCode, telemetryBackpressure);
 
     if (config.debug_mode)
     {
@@ -735,10 +1867,14 @@ void sendTelemetryData(const JsonDocument &telemetryDoc)
     {
         Serial.print("⚠️  Telemetry send failed with code: ");
         Serial.println(httpCode);
-        if (config.debug_mode && http.getString().length() > 0)
+        if (config.debug_mode)
         {
-            Serial.print("Response: ");
-            Serial.println(http.getString());
+            PoolBuffer response;
+            if (readResponseBody(http, response) > 0)
+            {
+                Serial.print("Response: ");
+                Serial.println(response.data);
+            }
         }
     }
     else if (config.debug_mode)
@@ -749,6 +1885,26 @@ void sendTelemetryData(const JsonDocument &telemetryDoc)
     http.end();
 }
 
+// Keep a reading taken while the link is down; a full backlog drops its oldest entry
+void backlogTelemetry(const JsonDocument &telemetryDoc)
+{
+    if (measureJson(telemetryDoc) >= TELEMETRY_BACKLOG_SLOT_SIZE)
+    {
+        return;
+    }
+
+    if (backlogCount == TELEMETRY_BACKLOG_SLOTS)
+    {
+        backlogHead = (backlogHead + 1) % TELEMETRY_BACKLOG_SLOTS;
+        backlogCount--;
+    }
+
+    BacklogEntry &entry = telemetryBacklog[(backlogHead + backlogCount) % TELEMETRY_BACKLOG_SLOTS];
+    entry.length = serializeJson(telemetryDoc, entry.payload, sizeof(entry.payload));
+    entry.sampledAt = millis();
+    backlogCount++;
+}
+
 void sendHeartbeat()
 {
     if (config.debug_mode)
@@ -758,23 +1914,9 @@ void sendHeartbeat()
     }
 
     HTTPClient http;
-    String endpoint = String(config.server_url) + "/api/devices/" + config.device_id + "/heartbeat";
-#if USE_HTTPS
-    if (strlen(SERVER_FINGERPRINT) > 0)
-    {
-        secureClient.setFingerprint(SERVER_FINGERPRINT);
-    }
-    else
-    {
-        secureClient.setInsecure();
-    }
-    http.begin(secureClient, endpoint);
-#else
-    http.begin(wifiClient, endpoint);
-#endif
-    http.addHeader("Content-Type", "application/json");
+    beginDeviceRequest(http, "heartbeat");
 
-    StaticJsonDocument<512> doc;
+    PooledJsonDocument doc(1024);
     doc["device_id"] = config.device_id;
     doc["device_name"] = DEVICE_NAME;
     doc["device_location"] = DEVICE_LOCATION;
@@ -786,30 +1928,66 @@ void sendHeartbeat()
     doc["mac_address"] = WiFi.macAddress();
     doc["config_version"] = config.config_version;
     doc["sensor_count"] = sensorCount;
+    doc["sensor_config_version"] = sensorConfigVersion;
+
+    JsonArray pools = doc.createNestedArray("buffer_pools");
+    reportBufferPool(pools, smallPool);
+    reportBufferPool(pools, largePool);
+    doc["pool_heap_fallbacks"] = poolHeapFallbacks;
+#if MODBUS_ENABLED
+    reportModbusStats(doc.createNestedObject("modbus"));
+#endif
 
-    String payload;
-    serializeJson(doc, payload);
+    if (!bootTimings.reported)
+    {
+        if (bootTimings.firstHeartbeatMs == 0)
+        {
+            bootTimings.firstHeartbeatMs = millis();
+        }
+        JsonObject boot = doc.createNestedObject("boot");
+        boot["reset_reason"] = ESP.getResetReason();
+        boot["sensors_ready_ms"] = bootTimings.sensorsReadyMs;
+        boot["first_sample_ms"] = bootTimings.firstSampleMs;
+        boot["wifi_connected_ms"] = bootTimings.wifiConnectedMs;
+        if (bootTimings.otaCheckedMs > 0)
+        {
+            boot["ota_checked_ms"] = bootTimings.otaCheckedMs;
+        }
+        boot["first_heartbeat_ms"] = bootTimings.firstHeartbeatMs;
+    }
 
     if (config.debug_mode)
     {
-        Serial.println("Sending heartbeat: " + payload);
+        Serial.print("Sending heartbeat: ");
+        serializeJson(doc, Serial);
+        Serial.println();
     }
 
-    int httpCode = http.POST(payload);
+    int httpCode = postJson(http, doc);
+    applyBackpressure(http, httpCode, controlBackpressure);
 
     if (httpCode > 0)
     {
-        String response = http.getString();
+        PoolBuffer response;
+        size_t responseLength = readResponseBody(http, response);
         if (config.debug_mode)
         {
             Serial.print("HTTP Response Code: ");
             Serial.println(httpCode);
             Serial.print("Heartbeat response: ");
-            Serial.println(response);
+            Serial.println(responseLength > 0 ? response.data : "");
+        }
+
+        if (httpCode == 200)
+        {
+            bootTimings.reported = true;
         }
 
         // Parse response for configuration updates
-        parseServerResponse(response);
+        if (responseLength > 0)
+        {
+            parseServerResponse(response.data, responseLength);
+        }
     }
     else
     {
@@ -826,10 +2004,12 @@ void sendHeartbeat()
     }
 }
 
-void parseServerResponse(const String &response)
+void parseServerResponse(const char *response, size_t length)
 {
-    StaticJsonDocument<2048> doc; // Increased size for sensor config
-    DeserializationError error = deserializeJson(doc, response);
+    // Large pool slot, sized for sensor config; a Modbus map (sent only when
+    // it changes) spills into the heap
+    PooledJsonDocument doc(MODBUS_ENABLED ? 3072 : 2048);
+    DeserializationError error = deserializeJson(doc, response, length);
 
     if (error)
     {
@@ -842,6 +2022,14 @@ void parseServerResponse(const String &response)
     {
         JsonObject configObj = doc["config"];
 
+#if MODBUS_ENABLED
+        // Before the sensor config, so it can already match the new points
+        if (configObj.containsKey("modbus"))
+        {
+            modbusApplyMap(configObj["modbus"].as<JsonObject>());
+        }
+#endif
+
         // Update sensor configuration from heartbeat response
         if (configObj.containsKey("sensors"))
         {
@@ -855,6 +2043,7 @@ void parseServerResponse(const String &response)
                 updateSensorConfiguration(sensorConfigs);
                 Serial.println("========================================");
             }
+            sensorConfigVersion = configObj["sensors_version"] | 0UL;
         }
 
         // Update other device configs if present
@@ -943,6 +2132,14 @@ void updateSensorConfiguration(JsonArray sensorConfigs)
             {
                 pinNum = pinStr.substring(1).toInt();
             }
+            else if (pinStr.startsWith(ONEWIRE_PIN_PREFIX))
+            {
+                pinNum = -1; // 1-Wire probe, matched by name below
+            }
+            else if (pinStr.indexOf('.') > 0)
+            {
+                pinNum = -1; // Modbus point ("H1.100") or pulse channel ("P13.rate"), matched by name below
+            }
             else if (pinStr.startsWith("A"))
             {
                 pinNum = A0; // Analog pin
@@ -956,7 +2153,7 @@ void updateSensorConfiguration(JsonArray sensorConfigs)
             bool found = false;
             for (int j = 0; j < sensorCount; j++)
             {
-                if (sensors[j].pin == pinNum)
+                if (sensors[j].pinName != nullptr ? pinStr == sensors[j].pinName : sensors[j].pin == pinNum)
                 {
                     found = true;
 
@@ -1025,69 +2222,201 @@ void updateSensorConfiguration(JsonArray sensorConfigs)
     Serial.println(" sensor(s) from server configuration");
 }
 
+void otaFail(const String &reason)
+{
+    Serial.println("OTA failed: " + reason);
+    notifyOTAStatus("failed", 0, reason);
+    if (otaJob.state == OTA_DOWNLOADING)
+    {
+        // Unfinished: end() discards the partial image
+        Update.end();
+    }
+    otaHttp.end();
+    otaJob.state = OTA_IDLE;
+}
+
+// Open the image download and hand it to otaStep(); returns right away
 void performOTAUpdate(const String &firmwareUrl, const String &expectedChecksum)
 {
+    if (otaJob.state != OTA_IDLE)
+    {
+        return;
+    }
     Serial.println("Starting OTA update from: " + firmwareUrl);
 
     // Notify server that OTA is starting
     notifyOTAStatus("downloading", 0);
 
-    WiFiClient otaClient;
-    ESPhttpUpdate.setLedPin(LED_BUILTIN, LOW);
+    if (!otaHttp.begin(otaClient, firmwareUrl))
+    {
+        otaFail("Failed to initiate OTA request");
+        return;
+    }
+
+    int httpCode = otaHttp.GET();
+    if (httpCode != HTTP_CODE_OK)
+    {
+        otaFail("HTTP error " + String(httpCode));
+        return;
+    }
+
+    int contentLength = otaHttp.getSize();
+    if (contentLength <= 0)
+    {
+        otaFail("Invalid content length");
+        return;
+    }
+    if (!Update.begin(contentLength))
+    {
+        otaFail("Not enough space for OTA");
+        return;
+    }
+    if (expectedChecksum.length() == 32)
+    {
+        // MD5 of the image, checked by Update.end()
+        Update.setMD5(expectedChecksum.c_str());
+    }
+
+    otaJob.contentLength = contentLength;
+    otaJob.written = 0;
+    otaJob.lastReported = 0;
+    otaJob.started = millis();
+    otaJob.lastData = otaJob.started;
+    otaJob.state = OTA_DOWNLOADING;
+}
+
+// Every loop pass: move at most OTA_SLICE_MS worth of the image into flash,
+// never ahead of OTA_MAX_BYTES_PER_SEC. A finished image waits for a quiet
+// moment before the reboot.
+void otaStep()
+{
+    if (otaJob.state == OTA_READY)
+    {
+        otaRebootWhenQuiet();
+        return;
+    }
+    if (otaJob.state != OTA_DOWNLOADING)
+    {
+        return;
+    }
+
+    PoolBuffer chunk(POOL_LARGE_SLOT_SIZE);
+    if (chunk.data == nullptr)
+    {
+        return;
+    }
+
+    WiFiClient *stream = otaHttp.getStreamPtr();
+    unsigned long sliceStarted = millis();
+    while (otaJob.written < otaJob.contentLength && millis() - sliceStarted < OTA_SLICE_MS)
+    {
+        long allowed = (long)((uint64_t)(millis() - otaJob.started) * OTA_MAX_BYTES_PER_SEC / 1000) - (long)otaJob.written;
+        if (allowed <= 0)
+        {
+            break;
+        }
 
-    // Set progress callback
-    ESPhttpUpdate.onProgress([&](int cur, int total)
-                             {
-        int progress = (cur * 100) / total;
-        Serial.printf("OTA Progress: %d%%\n", progress);
+        if (stream->available() <= 0)
+        {
+            if (!otaHttp.connected() || millis() - otaJob.lastData > OTA_STALL_TIMEOUT_MS)
+            {
+                otaFail("Incomplete OTA write");
+                return;
+            }
+            break;
+        }
 
-        // Update server every 10%
-        static int lastReported = -1;
-        if (progress - lastReported >= 10) {
-            notifyOTAStatus("downloading", progress);
-            lastReported = progress;
-        } });
+        size_t wanted = otaJob.contentLength - otaJob.written;
+        wanted = wanted < chunk.capacity ? wanted : chunk.capacity;
+        wanted = wanted < (size_t)allowed ? wanted : (size_t)allowed;
+        int received = stream->read((uint8_t *)chunk.data, wanted);
+        if (received <= 0)
+        {
+            break;
+        }
+        otaJob.lastData = millis();
 
-    t_httpUpdate_return ret = ESPhttpUpdate.update(otaClient, firmwareUrl);
+        if (Update.write((uint8_t *)chunk.data, received) != (size_t)received)
+        {
+            otaFail("Flash write failed: " + Update.getErrorString());
+            return;
+        }
+        otaJob.written += received;
+    }
 
-    switch (ret)
+    int percent = (otaJob.written * 100) / otaJob.contentLength;
+    if (percent - otaJob.lastReported >= 10 && percent < 100)
     {
-    case HTTP_UPDATE_FAILED:
-        Serial.println("OTA Update failed: " + ESPhttpUpdate.getLastErrorString());
-        notifyOTAStatus("failed", 0, ESPhttpUpdate.getLastErrorString());
-        break;
+        Serial.printf("OTA Progress: %d%%\n", percent);
+        notifyOTAStatus("downloading", percent);
+        otaJob.lastReported = percent;
+    }
 
-    case HTTP_UPDATE_NO_UPDATES:
-        Serial.println("No OTA updates available");
-        notifyOTAStatus("completed", 100);
-        break;
+    if (otaJob.written == otaJob.contentLength)
+    {
+        otaHttp.end();
+        if (!Update.end())
+        {
+            otaJob.state = OTA_IDLE;
+            Serial.println("OTA Update failed: " + Update.getErrorString());
+            notifyOTAStatus("failed", 0, Update.getErrorString());
+            return;
+        }
 
-    case HTTP_UPDATE_OK:
-        Serial.println("OTA Update completed successfully");
-        notifyOTAStatus("completed", 100);
-        ESP.restart();
-        break;
+        otaJob.state = OTA_READY;
+        otaJob.readyAt = millis();
+        notifyOTAStatus("installing", 100);
+        Serial.printf("OTA image written in %lu ms, rebooting at the next quiet moment\n", millis() - otaJob.started);
     }
 }
 
-void notifyOTAStatus(const String &status, int progress, const String &errorMessage)
+// Quiet: no alert for OTA_QUIET_MS, every sensor back inside its thresholds,
+// no backlogged telemetry and no capture window being recorded or uploaded
+bool otaQuiet()
 {
-    HTTPClient http;
-    String endpoint = String(config.server_url) + "/api/devices/" + config.device_id + "/ota-status";
-#if USE_HTTPS
-    if (strlen(SERVER_FINGERPRINT) > 0)
+    if (millis() - lastAlarmAt < OTA_QUIET_MS || backlogCount > 0)
     {
-        secureClient.setFingerprint(SERVER_FINGERPRINT);
+        return false;
     }
-    else
+    for (int i = 0; i < MAX_SENSORS; i++)
     {
-        secureClient.setInsecure();
+        if (thresholdStates[i].wasAboveMax || thresholdStates[i].wasBelowMin)
+        {
+            return false;
+        }
     }
-    http.begin(secureClient, endpoint);
-#else
-    http.begin(wifiClient, endpoint);
+#if CAPTURE_ENABLED
+    for (uint8_t c = 0; c < captureChannelCount; c++)
+    {
+        if (captureChannels[c].state != CAPTURE_ARMED)
+        {
+            return false;
+        }
+    }
+#endif
+    return true;
+}
+
+void otaRebootWhenQuiet()
+{
+    bool overdue = millis() - otaJob.readyAt >= OTA_REBOOT_DEFER_MAX_MS;
+    if (!otaQuiet() && !overdue)
+    {
+        return;
+    }
+
+    notifyOTAStatus("completed", 100);
+    Serial.println(overdue ? "OTA reboot overdue, restarting" : "OTA Update completed successfully, restarting");
+#if SENSOR_PULSE_ENABLED
+    pulseSaveTotal(pulseFold());
 #endif
-    http.addHeader("Content-Type", "application/json");
+    ESP.restart();
+}
+
+void notifyOTAStatus(const String &status, int progress, const String &errorMessage)
+{
+    HTTPClient http;
+    beginDeviceRequest(http, "ota-status");
 
     StaticJsonDocument<256> doc;
     doc["status"] = status;
@@ -1097,10 +2426,7 @@ void notifyOTAStatus(const String &status, int progress, const String &errorMess
         doc["error_message"] = errorMessage;
     }
 
-    String payload;
-    serializeJson(doc, payload);
-
-    http.POST(payload);
+    postJson(http, doc);
     http.end();
 }
 
@@ -1133,7 +2459,16 @@ void printSensorValuesToConsole()
         String unit = "";
 
         // Read sensor based on type
-        if (sensors[i].type == "light" || sensors[i].type == "photodiode")
+        if (sensors[i].pinName != nullptr)
+        {
+            if (busReading(i, rawValue))
+            {
+                processedValue = (rawValue * sensors[i].calibration_multiplier) + sensors[i].calibration_offset;
+                hasReading = true;
+                unit = sensors[i].type == "temperature" ? "°C" : "";
+            }
+        }
+        else if (sensors[i].type == "light" || sensors[i].type == "photodiode")
         {
             rawValue = analogRead(sensors[i].pin);
             processedValue = (rawValue * sensors[i].calibration_multiplier) + sensors[i].calibration_offset;
@@ -1183,7 +2518,7 @@ void printSensorValuesToConsole()
             output += "🔹 ";
             output += sensors[i].name;
             output += " (Pin ";
-            output += (sensors[i].pin == A0) ? "A0" : String(sensors[i].pin);
+            output += sensors[i].pinName != nullptr ? String(sensors[i].pinName) : (sensors[i].pin == A0) ? "A0" : String(sensors[i].pin);
             output += ")\n";
             output += "Raw: ";
             output += String(rawValue, 2);
@@ -1214,26 +2549,25 @@ void printSensorValuesToConsole()
 
 void sendAlarmEvent(int sensorIndex, float value)
 {
+    lastAlarmAt = millis();
+    if (WiFi.status() != WL_CONNECTED || backpressureHeld(alertBackpressure))
+    {
+        return;
+    }
+
     HTTPClient http;
-    String endpoint = String(config.server_url) + "/api/devices/" + config.device_id + "/alarm";
-#if USE_HTTPS
-    if (strlen(SERVER_FINGERPRINT) > 0)
+    beginDeviceRequest(http, "alarm");
+
+    StaticJsonDocument<512> doc;
+    doc["device_id"] = config.device_id;
+    if (sensors[sensorIndex].pinName != nullptr)
     {
-        secureClient.setFingerprint(SERVER_FINGERPRINT);
+        doc["sensor_pin"] = sensors[sensorIndex].pinName;
     }
     else
     {
-        secureClient.setInsecure();
+        doc["sensor_pin"] = sensors[sensorIndex].pin;
     }
-    http.begin(secureClient, endpoint);
-#else
-    http.begin(wifiClient, endpoint);
-#endif
-    http.addHeader("Content-Type", "application/json");
-
-    StaticJsonDocument<512> doc;
-    doc["device_id"] = config.device_id;
-    doc["sensor_pin"] = sensors[sensorIndex].pin;
     doc["sensor_type"] = sensors[sensorIndex].type;
     doc["sensor_name"] = sensors[sensorIndex].name;
     doc["value"] = value;
@@ -1247,12 +2581,10 @@ void sendAlarmEvent(int sensorIndex, float value)
                      " - " + String(sensors[sensorIndex].threshold_max) + ")";
     doc["message"] = message;
 
-    String payload;
-    serializeJson(doc, payload);
-
     Serial.println("ALARM: " + message);
 
-    int httpCode = http.POST(payload);
+    int httpCode = postJson(http, doc);
+    applyBackpressure(http, httpCode, alertBackpressure);
     if (httpCode > 0)
     {
         Serial.println("Alarm sent successfully");
@@ -1265,28 +2597,28 @@ void sendAlarmEvent(int sensorIndex, float value)
     http.end();
 }
 
-void sendImmediateThresholdAlert(int sensorIndex, float value, const String &alertType)
+// Returns the id of the alert the server created, 0 if none
+uint32_t sendImmediateThresholdAlert(int sensorIndex, float value, const String &alertType)
 {
+    // Holds back the reboot into a downloaded OTA image
+    lastAlarmAt = millis();
+    if (WiFi.status() != WL_CONNECTED || backpressureHeld(alertBackpressure))
+    {
+        return 0;
+    }
+
     HTTPClient http;
-    String endpoint = String(config.server_url) + "/api/devices/" + config.device_id + "/threshold-alert";
+    beginDeviceRequest(http, "threshold-alert");
 
-#if USE_HTTPS
-    if (strlen(SERVER_FINGERPRINT) > 0)
+    StaticJsonDocument<512> doc;
+    if (sensors[sensorIndex].pinName != nullptr)
     {
-        secureClient.setFingerprint(SERVER_FINGERPRINT);
+        doc["sensor_pin"] = sensors[sensorIndex].pinName;
     }
     else
     {
-        secureClient.setInsecure();
+        doc["sensor_pin"] = sensors[sensorIndex].pin;
     }
-    http.begin(secureClient, endpoint);
-#else
-    http.begin(wifiClient, endpoint);
-#endif
-    http.addHeader("Content-Type", "application/json");
-
-    StaticJsonDocument<512> doc;
-    doc["sensor_pin"] = sensors[sensorIndex].pin;
     doc["sensor_type"] = sensors[sensorIndex].type;
     doc["sensor_name"] = sensors[sensorIndex].name;
     doc["value"] = value;
@@ -1295,17 +2627,17 @@ void sendImmediateThresholdAlert(int sensorIndex, float value, const String &ale
     doc["alert_type"] = alertType; // "above_max" or "below_min"
     doc["timestamp"] = millis() / 1000;
 
-    String payload;
-    serializeJson(doc, payload);
-
     if (config.debug_mode)
     {
         Serial.println("Sending immediate threshold alert:");
-        Serial.println(payload);
+        serializeJson(doc, Serial);
+        Serial.println();
     }
 
-    int httpCode = http.POST(payload);
+    int httpCode = postJson(http, doc);
+    applyBackpressure(http, httpCode, alertBackpressure);
 
+    uint32_t alertId = 0;
     if (httpCode > 0)
     {
         if (config.debug_mode)
@@ -1313,6 +2645,16 @@ void sendImmediateThresholdAlert(int sensorIndex, float value, const String &ale
             Serial.print("Threshold alert sent - Response code: ");
             Serial.println(httpCode);
         }
+        if (httpCode == 200)
+        {
+            PoolBuffer response;
+            size_t responseLength = readResponseBody(http, response);
+            StaticJsonDocument<256> responseDoc;
+            if (responseLength > 0 && deserializeJson(responseDoc, response.data, responseLength) == DeserializationError::Ok)
+            {
+                alertId = responseDoc["alert_id"] | 0;
+            }
+        }
     }
     else
     {
@@ -1324,78 +2666,63 @@ void sendImmediateThresholdAlert(int sensorIndex, float value, const String &ale
     }
 
     http.end();
+    return alertId;
 }
 
-void connectToWiFi()
+// Start connecting and return; loop() picks the link up when it is ready
+void startWiFi()
 {
+    WiFi.mode(WIFI_STA);
+    WiFi.setAutoReconnect(true);
     WiFi.begin(config.wifi_ssid, config.wifi_password);
-    Serial.print("Connecting to WiFi");
+    Serial.println("Connecting to WiFi: " + String(config.wifi_ssid));
+}
 
-    int attempts = 0;
-    while (WiFi.status() != WL_CONNECTED && attempts < 30)
-    {
-        delay(1000);
-        Serial.print(".");
-        attempts++;
-    }
+// First link-up after boot: OTA check, then the heartbeat carrying the boot timings
+void onNetworkUp()
+{
+    networkBootDone = true;
+    bootTimings.wifiConnectedMs = millis();
 
-    if (WiFi.status() == WL_CONNECTED)
-    {
-        Serial.println();
-        Serial.println("========================================");
-        Serial.println("     WiFi Connection Established");
-        Serial.println("========================================");
-        Serial.println("WiFi Network: " + String(config.wifi_ssid));
-        Serial.println("Local IP:     " + WiFi.localIP().toString());
-        Serial.println("MAC Address:  " + WiFi.macAddress());
-        Serial.println("Firmware Ver: " + String(FIRMWARE_VERSION));
-        Serial.println("Device ID:    " + String(DEVICE_ID));
-        Serial.println("Server URL:   " + String(config.server_url));
-        Serial.println("========================================");
-    }
-    else
+    Serial.println("========================================");
+    Serial.println("     WiFi Connection Established");
+    Serial.println("========================================");
+    Serial.println("WiFi Network: " + String(config.wifi_ssid));
+    Serial.println("Local IP:     " + WiFi.localIP().toString());
+    Serial.println("MAC Address:  " + WiFi.macAddress());
+    Serial.println("Firmware Ver: " + String(FIRMWARE_VERSION));
+    Serial.println("Device ID:    " + String(DEVICE_ID));
+    Serial.println("Server URL:   " + String(config.server_url));
+    Serial.println("Connected:    " + String(bootTimings.wifiConnectedMs) + " ms after boot");
+    Serial.println("========================================");
+
+    if (config.ota_enabled)
     {
-        Serial.println();
-        Serial.println("Failed to connect to WiFi - restarting");
-        delay(5000);
-        ESP.restart();
+        checkForFirmwareUpdate();
+        bootTimings.otaCheckedMs = millis();
     }
+
+    sendHeartbeat();
 }
 
 void checkForFirmwareUpdate()
 {
     HTTPClient http;
-    String endpoint = String(config.server_url) + "/api/devices/" + config.device_id + "/ota-check";
-#if USE_HTTPS
-    if (strlen(SERVER_FINGERPRINT) > 0)
-    {
-        secureClient.setFingerprint(SERVER_FINGERPRINT);
-    }
-    else
-    {
-        secureClient.setInsecure();
-    }
-    http.begin(secureClient, endpoint);
-#else
-    http.begin(wifiClient, endpoint);
-#endif
-    http.addHeader("Content-Type", "application/json");
+    beginDeviceRequest(http, "ota-check");
 
     StaticJsonDocument<256> doc;
     doc["current_version"] = FIRMWARE_VERSION;
     doc["device_type"] = "esp8266";
 
-    String payload;
-    serializeJson(doc, payload);
-
-    int httpCode = http.POST(payload);
+    int httpCode = postJson(http, doc);
 
     if (httpCode == 200)
     {
-        String response = http.getString();
+        PoolBuffer response;
+        size_t responseLength = readResponseBody(http, response);
         StaticJsonDocument<512> responseDoc;
 
-        if (deserializeJson(responseDoc, response) == DeserializationError::Ok)
+        if (deserializeJson(responseDoc, response.data, responseLength) == DeserializationError::Ok)
         {
             if (responseDoc["update_available"].as<bool>())
             {
@@ -1421,32 +2748,33 @@ void checkForFirmwareUpdate()
 
 void handleOTAUpdates()
 {
-    // Check for pending OTA updates in Redis cache
-    HTTPClient http;
-    String endpoint = String(config.server_url) + "/api/devices/" + config.device_id + "/ota-pending";
-#if USE_HTTPS
-    if (strlen(SERVER_FINGERPRINT) > 0)
+    // Poll for pending OTA updates at a fixed interval, not every loop pass
+    static unsigned long lastCheck = 0;
+    if (lastCheck != 0 &&
+        millis() - lastCheck < backpressureInterval(OTA_POLL_INTERVAL_MS, controlBackpressure))
     {
-        secureClient.setFingerprint(SERVER_FINGERPRINT);
+        return;
     }
-    else
+    if (backpressureHeld(controlBackpressure) || otaJob.state != OTA_IDLE)
     {
-        secureClient.setInsecure();
+        return;
     }
-    http.begin(secureClient, endpoint);
-#else
-    http.begin(wifiClient, endpoint);
-#endif
-    http.addHeader("Content-Type", "application/json");
+    lastCheck = millis();
+
+    // Check for pending OTA updates in Redis cache
+    HTTPClient http;
+    beginDeviceRequest(http, "ota-pending");
 
     int httpCode = http.GET();
+    applyBackpressure(http, httpCode, controlBackpressure);
 
     if (httpCode == 200)
     {
-        String response = http.getString();
+        PoolBuffer response;
+        size_t responseLength = readResponseBody(http, response);
         StaticJsonDocument<512> doc;
 
-        if (deserializeJson(doc, response) == DeserializationError::Ok)
+        if (deserializeJson(doc, response.data, responseLength) == DeserializationError::Ok)
         {
             if (doc["pending_update"].as<bool>())
             {
@@ -1461,3 +2789,201 @@ void handleOTAUpdates()
 
     http.end();
 }
+
+#if CAPTURE_ENABLED
+// Ticker callback: one raw sample per running channel
+void captureSample()
+{
+    for (uint8_t c = 0; c < captureChannelCount; c++)
+    {
+        CaptureChannel &channel = captureChannels[c];
+        if (channel.state == CAPTURE_FROZEN)
+        {
+            continue;
+        }
+
+        int pin = sensors[channel.sensorIndex].pin;
+        channel.samples[channel.writeIndex] = channel.analog ? analogRead(pin) : digitalRead(pin);
+        channel.writeIndex = (channel.writeIndex + 1) % CAPTURE_SAMPLES;
+        if (channel.filled < CAPTURE_SAMPLES)
+        {
+            channel.filled++;
+        }
+
+        if (channel.state == CAPTURE_POST && --channel.postRemaining == 0)
+        {
+            channel.state = CAPTURE_FROZEN;
+        }
+    }
+}
+
+void captureRearm(CaptureChannel &channel)
+{
+    channel.state = CAPTURE_ARMED;
+    channel.writeIndex = 0;
+    channel.filled = 0;
+    channel.alertId = 0;
+    channel.uploadAttempts = 0;
+}
+
+CaptureChannel *captureChannelFor(int sensorIndex)
+{
+    for (uint8_t c = 0; c < captureChannelCount; c++)
+    {
+        if (captureChannels[c].sensorIndex == sensorIndex)
+        {
+            return &captureChannels[c];
+        }
+    }
+    return nullptr;
+}
+
+// Pick the first capturable sensors: A0 types and plain digital inputs.
+// DHT and ultrasonic reads are too slow for the capture rate.
+void captureInit()
+{
+    captureChannelCount = 0;
+    for (int i = 0; i < sensorCount && captureChannelCount < CAPTURE_MAX_CHANNELS; i++)
+    {
+        const String &type = sensors[i].type;
+        bool analog = type == "light" || type == "photodiode" || type == "sound" || type == "gas";
+        bool digital = type == "motion" || type == "magnetic" || type == "vibration";
+        if (!sensors[i].enabled || (!analog && !digital))
+        {
+            continue;
+        }
+
+        CaptureChannel &channel = captureChannels[captureChannelCount++];
+        channel.sensorIndex = i;
+        channel.analog = analog;
+        captureRearm(channel);
+    }
+
+    if (captureChannelCount > 0)
+    {
+        captureTicker.attach_ms(1000 / CAPTURE_RATE_HZ, captureSample);
+        Serial.print("Trigger capture on ");
+        Serial.print(captureChannelCount);
+        Serial.print(" sensor(s) at ");
+        Serial.print(CAPTURE_RATE_HZ);
+        Serial.println(" Hz");
+    }
+}
+
+// Threshold crossed: record the post-trigger window, then freeze
+void captureTrigger(int sensorIndex)
+{
+    CaptureChannel *channel = captureChannelFor(sensorIndex);
+    if (channel == nullptr || channel->state != CAPTURE_ARMED)
+    {
+        return;
+    }
+    channel->state = CAPTURE_POST;
+    channel->postRemaining = CAPTURE_POST_SAMPLES;
+    channel->triggeredAt = millis();
+    channel->alertId = 0;
+}
+
+// The alert for a trigger is known (or was not created): keep or drop the window
+void captureAttach(int sensorIndex, uint32_t alertId)
+{
+    CaptureChannel *channel = captureChannelFor(sensorIndex);
+    if (channel == nullptr || channel->state == CAPTURE_ARMED || channel->alertId != 0)
+    {
+        return;
+    }
+    if (alertId == 0)
+    {
+        // Offline, held back or suppressed by the server: nothing to attach to
+        captureRearm(*channel);
+        return;
+    }
+    channel->alertId = alertId;
+}
+
+// Blob layout (little-endian, the ESP8266's native order):
+//   0  "SCAP"            4  version u8        5  flags u8 (bit 0 = analog)
+//   6  rate_hz u16       8  pre_samples u16  10  post_samples u16
+//  12  cal_multiplier f32  16  cal_offset f32
+//  20  pin u8, 3 reserved  24  trigger_age_ms u32
+//  28  int16 raw samples, oldest first; the trigger is sample pre_samples
+size_t captureEncode(const CaptureChannel &channel, uint8_t *out)
+{
+    uint16_t rate = CAPTURE_RATE_HZ;
+    uint16_t post = CAPTURE_POST_SAMPLES;
+    uint16_t pre = channel.filled - post;
+    float multiplier = sensors[channel.sensorIndex].calibration_multiplier;
+    float offset = sensors[channel.sensorIndex].calibration_offset;
+    uint32_t triggerAge = millis() - channel.triggeredAt;
+
+    memcpy(out, "SCAP", 4);
+    out[4] = CAPTURE_FORMAT_VERSION;
+    out[5] = channel.analog ? 1 : 0;
+    memcpy(out + 6, &rate, 2);
+    memcpy(out + 8, &pre, 2);
+    memcpy(out + 10, &post, 2);
+    memcpy(out + 12, &multiplier, 4);
+    memcpy(out + 16, &offset, 4);
+    out[20] = (uint8_t)sensors[channel.sensorIndex].pin;
+    out[21] = out[22] = out[23] = 0;
+    memcpy(out + 24, &triggerAge, 4);
+
+    // Oldest sample first: the ring start once it has wrapped
+    uint16_t start = channel.filled < CAPTURE_SAMPLES ? 0 : channel.writeIndex;
+    int16_t *samples = (int16_t *)(out + CAPTURE_HEADER_SIZE);
+    for (uint16_t n = 0; n < channel.filled; n++)
+    {
+        int16_t sample = channel.samples[(start + n) % CAPTURE_SAMPLES];
+        memcpy(samples + n, &sample, 2);
+    }
+    return CAPTURE_HEADER_SIZE + channel.filled * 2;
+}
+
+// Upload one frozen window per call, POST /api/devices/<id>/alerts/<alert>/capture
+void captureUploadReady()
+{
+    if (backpressureHeld(alertBackpressure))
+    {
+        return;
+    }
+
+    for (uint8_t c = 0; c < captureChannelCount; c++)
+    {
+        CaptureChannel &channel = captureChannels[c];
+        if (channel.state != CAPTURE_FROZEN || channel.alertId == 0)
+        {
+            continue;
+        }
+
+        PoolBuffer blob(CAPTURE_HEADER_SIZE + CAPTURE_SAMPLES * 2);
+        if (blob.data == nullptr)
+        {
+            return;
+        }
+        size_t length = captureEncode(channel, (uint8_t *)blob.data);
+
+        char path[48];
+        snprintf(path, sizeof(path), "alerts/%lu/capture", (unsigned long)channel.alertId);
+        HTTPClient http;
+        beginDeviceRequest(http, path);
+        http.addHeader("Content-Type", "application/octet-stream");
+        int httpCode = http.POST((uint8_t *)blob.data, length);
+        applyBackpressure(http, httpCode, alertBackpressure);
+        http.end();
+
+        bool retry = httpCode <= 0 || httpCode == 429 || httpCode >= 500;
+        if (!retry || ++channel.uploadAttempts >= CAPTURE_MAX_UPLOAD_ATTEMPTS)
+        {
+            if (config.debug_mode || retry)
+            {
+                Serial.print("Trigger capture for alert ");
+                Serial.print(channel.alertId);
+                Serial.print(retry ? " dropped after retries: " : " uploaded: ");
+                Serial.println(httpCode);
+            }
+            captureRearm(channel);
+        }
+        return;
+    }
+}
+#endif
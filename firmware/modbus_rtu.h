@@ -0,0 +1,369 @@
+// Modbus RTU master for the ESP8266/ESP32 sketches.
+//
+// Plain C++ with no Arduino dependency, so the same code runs on the host
+// against a simulated slave (see test/modbus_rtu_host_test.cpp). The sketch
+// supplies a ModbusPort (UART bytes plus the RS-485 driver-enable line) and
+// calls poll() with a microsecond clock as often as it can; nothing here
+// ever waits.
+//
+// The register map is a flat array of points. setPoints() sorts them by
+// slave, function and address and coalesces neighbouring registers into
+// one read of up to 125 registers, so a meter exposing a dozen values costs
+// one request instead of twelve. A cycle sends every batch back to back,
+// keeping the 3.5-character silence the RTU spec requires between frames,
+// and moves on to the next slave as soon as a reply completes or times out.
+
+#ifndef MODBUS_RTU_H
+#define MODBUS_RTU_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifndef MODBUS_MAX_POINTS
+#define MODBUS_MAX_POINTS 16
+#endif
+// Unmapped registers a batch may read over to join two points. Some
+// devices answer reads that touch unmapped registers with an exception,
+// so the default only joins points that are directly adjacent.
+#ifndef MODBUS_MAX_GAP_REGISTERS
+#define MODBUS_MAX_GAP_REGISTERS 0
+#endif
+#define MODBUS_MAX_READ_REGISTERS 125
+#define MODBUS_FRAME_SIZE 256
+
+#define MODBUS_READ_HOLDING_REGISTERS 3
+#define MODBUS_READ_INPUT_REGISTERS 4
+
+// Multi-word types are big-endian (high word first) unless swapped
+enum ModbusDataType : uint8_t {
+    MODBUS_U16,
+    MODBUS_I16,
+    MODBUS_U32,
+    MODBUS_I32,
+    MODBUS_F32,
+    MODBUS_U32_SWAPPED,
+    MODBUS_I32_SWAPPED,
+    MODBUS_F32_SWAPPED
+};
+
+struct ModbusPoint {
+    uint8_t slave;
+    uint8_t function;       // MODBUS_READ_HOLDING_REGISTERS or MODBUS_READ_INPUT_REGISTERS
+    uint16_t address;       // 0-based register address as sent on the wire
+    uint8_t type;           // ModbusDataType
+    float scale;
+    float value;            // last decoded value times scale
+    bool valid;             // false until read, and after a failed read
+};
+
+struct ModbusStats {
+    uint32_t requests;
+    uint32_t responses;
+    uint32_t timeouts;
+    uint32_t crcErrors;     // bad CRC or malformed reply
+    uint32_t exceptions;
+};
+
+class ModbusPort {
+public:
+    virtual ~ModbusPort() {}
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual size_t write(const uint8_t* data, size_t length) = 0;
+    // RS-485 driver enable; a no-op for auto-direction transceivers
+    virtual void setTransmit(bool transmit) = 0;
+};
+
+inline uint8_t modbusTypeWords(uint8_t type) {
+    return type == MODBUS_U16 || type == MODBUS_I16 ? 1 : 2;
+}
+
+// Server config names: u16 i16 u32 i32 f32, with an "s" suffix for
+// word-swapped 32-bit values. Returns -1 for anything else.
+inline int modbusParseType(const char* name) {
+    static const char* const names[] = {"u16", "i16", "u32", "i32", "f32", "u32s", "i32s", "f32s"};
+    for (uint8_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        if (name != nullptr && strcmp(name, names[i]) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+inline uint16_t modbusCrc16(const uint8_t* data, size_t length) {
+    uint16_t crc = 0xFFFF;
+    for (size_t i = 0; i < length; i++) {
+        crc ^= data[i];
+        for (uint8_t bit = 0; bit < 8; bit++) {
+            crc = (crc & 1) ? (crc >> 1) ^ 0xA001 : crc >> 1;
+        }
+    }
+    return crc;
+}
+
+class ModbusMaster {
+public:
+    explicit ModbusMaster(ModbusPort& port) : port(port) {
+        begin(9600, 200000);
+        setPoints(nullptr, 0);
+    }
+
+    // RTU timing: 11 bits per character; above 19200 baud the spec fixes
+    // the inter-frame silence at 1.75 ms
+    void begin(uint32_t baud, uint32_t responseTimeoutUs) {
+        charUs = 11000000UL / baud;
+        silenceUs = baud > 19200 ? 1750 : (charUs * 7) / 2;
+        timeoutUs = responseTimeoutUs;
+    }
+
+    // Points stay where the caller put them and are updated in place.
+    // Returns the number of requests one cycle takes.
+    uint8_t setPoints(ModbusPoint* mapPoints, uint8_t count) {
+        points = mapPoints;
+        pointCount = count < MODBUS_MAX_POINTS ? count : MODBUS_MAX_POINTS;
+        batchCount = 0;
+        cycleActive = false;
+        state = IDLE;
+
+        for (uint8_t i = 0; i < pointCount; i++) {
+            points[i].valid = false;
+            uint8_t j = i;
+            while (j > 0 && pointBefore(i, order[j - 1])) {
+                order[j] = order[j - 1];
+                j--;
+            }
+            order[j] = i;
+        }
+
+        uint16_t batchEnd = 0;
+        for (uint8_t k = 0; k < pointCount; k++) {
+            const ModbusPoint& point = points[order[k]];
+            uint16_t pointEnd = point.address + modbusTypeWords(point.type);
+            Batch* batch = batchCount > 0 ? &batches[batchCount - 1] : nullptr;
+            bool joins = batch != nullptr &&
+                         batch->slave == point.slave &&
+                         batch->function == point.function &&
+                         point.address <= batchEnd + MODBUS_MAX_GAP_REGISTERS &&
+                         (uint32_t)(pointEnd > batchEnd ? pointEnd : batchEnd) - batch->start <= MODBUS_MAX_READ_REGISTERS;
+            if (!joins) {
+                batch = &batches[batchCount++];
+                batch->slave = point.slave;
+                batch->function = point.function;
+                batch->start = point.address;
+                batch->firstOrder = k;
+                batchEnd = point.address;
+            }
+            if (pointEnd > batchEnd) {
+                batchEnd = pointEnd;
+            }
+            batch->count = batchEnd - batch->start;
+            batch->endOrder = k + 1;
+        }
+        return batchCount;
+    }
+
+    // Queue one read of every batch; ignored while a cycle is running
+    void startCycle() {
+        if (cycleActive || batchCount == 0) {
+            return;
+        }
+        cycleActive = true;
+        current = 0;
+        state = GAP;
+    }
+
+    bool busy() const {
+        return cycleActive;
+    }
+
+    const ModbusStats& stats() const {
+        return counters;
+    }
+
+    void poll(uint32_t nowUs) {
+        switch (state) {
+        case IDLE:
+            return;
+
+        case GAP:
+            if (nowUs - lastActivityUs >= silenceUs) {
+                send(nowUs);
+            }
+            return;
+
+        case DRAIN:
+            // Keep the driver on until the last stop bit has left the UART
+            if (nowUs - txStartUs >= txTimeUs) {
+                // Nothing is flushed here: a slave may already be answering
+                // if this poll came late. Tie RE to DE so the transceiver
+                // does not echo the request back.
+                port.setTransmit(false);
+                rxLength = 0;
+                waitStartUs = nowUs;
+                state = RECEIVE;
+            }
+            return;
+
+        case RECEIVE:
+            while (port.available() > 0 && rxLength < MODBUS_FRAME_SIZE) {
+                frame[rxLength++] = (uint8_t)port.read();
+                lastByteUs = nowUs;
+            }
+            if (rxLength >= 2 && (frame[1] & 0x80)) {
+                expected = 5;
+            }
+            if (rxLength >= expected || (rxLength > 0 && nowUs - lastByteUs >= silenceUs)) {
+                complete(nowUs);
+            } else if (rxLength == 0 && nowUs - waitStartUs >= timeoutUs) {
+                counters.timeouts++;
+                finishBatch(false, nowUs);
+            }
+            return;
+        }
+    }
+
+private:
+    struct Batch {
+        uint8_t slave;
+        uint8_t function;
+        uint16_t start;
+        uint16_t count;
+        uint8_t firstOrder;     // range in order[]
+        uint8_t endOrder;
+    };
+
+    enum State : uint8_t {
+        IDLE,
+        GAP,        // waiting out the inter-frame silence
+        DRAIN,      // request still shifting out
+        RECEIVE
+    };
+
+    bool pointBefore(uint8_t a, uint8_t b) const {
+        const ModbusPoint& pa = points[a];
+        const ModbusPoint& pb = points[b];
+        if (pa.slave != pb.slave) return pa.slave < pb.slave;
+        if (pa.function != pb.function) return pa.function < pb.function;
+        return pa.address < pb.address;
+    }
+
+    void send(uint32_t nowUs) {
+        const Batch& batch = batches[current];
+        uint8_t request[8] = {
+            batch.slave, batch.function,
+            (uint8_t)(batch.start >> 8), (uint8_t)batch.start,
+            (uint8_t)(batch.count >> 8), (uint8_t)batch.count
+        };
+        uint16_t crc = modbusCrc16(request, 6);
+        request[6] = crc & 0xFF;
+        request[7] = crc >> 8;
+
+        while (port.available() > 0) {
+            port.read();    // late bytes from an earlier reply
+        }
+        port.setTransmit(true);
+        port.write(request, sizeof(request));
+        counters.requests++;
+
+        expected = 5 + batch.count * 2;
+        txStartUs = nowUs;
+        txTimeUs = (sizeof(request) + 1) * charUs;
+        state = DRAIN;
+    }
+
+    void complete(uint32_t nowUs) {
+        const Batch& batch = batches[current];
+        bool crcOk = rxLength >= 5 &&
+                     modbusCrc16(frame, rxLength - 2) == (uint16_t)(frame[rxLength - 2] | (frame[rxLength - 1] << 8));
+
+        if (crcOk && frame[0] == batch.slave && frame[1] == (batch.function | 0x80)) {
+            counters.exceptions++;
+            finishBatch(false, nowUs);
+        } else if (crcOk && frame[0] == batch.slave && frame[1] == batch.function &&
+                   rxLength == expected && frame[2] == batch.count * 2) {
+            counters.responses++;
+            decode(batch);
+            finishBatch(true, nowUs);
+        } else {
+            counters.crcErrors++;
+            finishBatch(false, nowUs);
+        }
+    }
+
+    void decode(const Batch& batch) {
+        for (uint8_t k = batch.firstOrder; k < batch.endOrder; k++) {
+            ModbusPoint& point = points[order[k]];
+            const uint8_t* data = frame + 3 + (point.address - batch.start) * 2;
+            uint16_t first = (data[0] << 8) | data[1];
+            uint32_t raw = first;
+            if (modbusTypeWords(point.type) == 2) {
+                uint16_t second = (data[2] << 8) | data[3];
+                bool swapped = point.type >= MODBUS_U32_SWAPPED;
+                raw = swapped ? ((uint32_t)second << 16) | first : ((uint32_t)first << 16) | second;
+            }
+
+            float value;
+            switch (point.type) {
+            case MODBUS_I16:
+                value = (int16_t)raw;
+                break;
+            case MODBUS_I32:
+            case MODBUS_I32_SWAPPED:
+                value = (int32_t)raw;
+                break;
+            case MODBUS_F32:
+            case MODBUS_F32_SWAPPED:
+                memcpy(&value, &raw, sizeof(value));
+                break;
+            default:
+                value = raw;
+                break;
+            }
+            point.value = value * point.scale;
+            point.valid = true;
+        }
+    }
+
+    void finishBatch(bool ok, uint32_t nowUs) {
+        const Batch& batch = batches[current];
+        if (!ok) {
+            for (uint8_t k = batch.firstOrder; k < batch.endOrder; k++) {
+                points[order[k]].valid = false;
+            }
+        }
+        lastActivityUs = rxLength > 0 ? lastByteUs : nowUs;
+        if (++current >= batchCount) {
+            cycleActive = false;
+            state = IDLE;
+        } else {
+            state = GAP;
+        }
+    }
+
+    ModbusPort& port;
+    ModbusPoint* points = nullptr;
+    uint8_t pointCount = 0;
+    uint8_t order[MODBUS_MAX_POINTS];       // point indices by slave, function, address
+    Batch batches[MODBUS_MAX_POINTS];
+    uint8_t batchCount = 0;
+    uint8_t current = 0;
+    bool cycleActive = false;
+    State state = IDLE;
+
+    uint32_t charUs = 0;
+    uint32_t silenceUs = 0;
+    uint32_t timeoutUs = 0;
+    uint32_t lastActivityUs = 0;
+    uint32_t txStartUs = 0;
+    uint32_t txTimeUs = 0;
+    uint32_t waitStartUs = 0;
+    uint32_t lastByteUs = 0;
+
+    uint8_t frame[MODBUS_FRAME_SIZE];
+    size_t rxLength = 0;
+    size_t expected = 0;
+    ModbusStats counters = {0, 0, 0, 0, 0};
+};
+
+#endif // MODBUS_RTU_H
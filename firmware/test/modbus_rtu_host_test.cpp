@@ -0,0 +1,288 @@
+// Host test for modbus_rtu.h: the master runs against a simulated RTU slave
+// on the other end of a pseudo-terminal, the same way it talks to a UART.
+//
+//   g++ -std=c++11 -Wall -I.. modbus_rtu_host_test.cpp -o modbus_rtu_host_test -pthread
+//   ./modbus_rtu_host_test
+
+#define MODBUS_MAX_POINTS 64
+#include "modbus_rtu.h"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/ioctl.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+static int failures = 0;
+
+#define CHECK(cond)                                                     \
+    do {                                                                \
+        if (!(cond)) {                                                  \
+            fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #cond); \
+            failures++;                                                 \
+        }                                                               \
+    } while (0)
+
+static uint32_t nowUs() {
+    using namespace std::chrono;
+    return (uint32_t)duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+static void makeRaw(int fd) {
+    struct termios tio;
+    tcgetattr(fd, &tio);
+    cfmakeraw(&tio);
+    tcsetattr(fd, TCSANOW, &tio);
+}
+
+// Master side of the pty as a UART
+class PtyPort : public ModbusPort {
+public:
+    explicit PtyPort(int fd) : fd(fd) {}
+
+    int available() override {
+        int pending = 0;
+        ioctl(fd, FIONREAD, &pending);
+        return pending;
+    }
+
+    int read() override {
+        uint8_t byte;
+        return ::read(fd, &byte, 1) == 1 ? byte : -1;
+    }
+
+    size_t write(const uint8_t* data, size_t length) override {
+        ssize_t written = ::write(fd, data, length);
+        return written > 0 ? (size_t)written : 0;
+    }
+
+    void setTransmit(bool transmit) override {
+        if (transmit) transmitCount++;
+    }
+
+    int fd;
+    int transmitCount = 0;
+};
+
+struct SeenRequest {
+    uint8_t slave;
+    uint8_t function;
+    uint16_t start;
+    uint16_t count;
+    uint32_t receivedUs;
+};
+
+// Slave 1: holding registers, slave 2: input and holding registers,
+// slave 3 rejects address 500, slave 4 corrupts its CRC, nothing answers
+// for any other slave
+class SimulatedSlaves {
+public:
+    explicit SimulatedSlaves(int fd) : fd(fd) {}
+
+    void run() {
+        std::vector<uint8_t> buffer;
+        while (!stop) {
+            struct pollfd pfd = {fd, POLLIN, 0};
+            if (poll(&pfd, 1, 5) <= 0) continue;
+            uint8_t chunk[64];
+            ssize_t n = ::read(fd, chunk, sizeof(chunk));
+            if (n <= 0) continue;
+            buffer.insert(buffer.end(), chunk, chunk + n);
+            while (buffer.size() >= 8) {
+                handle(buffer.data());
+                buffer.erase(buffer.begin(), buffer.begin() + 8);
+            }
+        }
+    }
+
+    std::vector<SeenRequest> requests() {
+        std::lock_guard<std::mutex> guard(lock);
+        return seen;
+    }
+
+    std::atomic<bool> stop{false};
+
+private:
+    static bool registerValue(uint8_t slave, uint8_t function, uint16_t address, uint16_t& value) {
+        if (slave == 1 && function == 3) {
+            switch (address) {
+            case 0: value = 1234; return true;
+            case 1: value = 0xFFFE; return true;            // -2 as i16
+            case 2: value = 0x41AC; return true;            // 21.5f, high word
+            case 3: value = 0x0000; return true;
+            case 10: value = 0x0001; return true;           // 100000 as u32
+            case 11: value = 0x86A0; return true;
+            case 12: value = 0x0000; return true;           // 21.5f word-swapped
+            case 13: value = 0x41AC; return true;
+            }
+        }
+        if (slave == 2 && function == 4 && address == 5) { value = 42; return true; }
+        if (slave == 2 && function == 3 && address == 5) { value = 7; return true; }
+        if (slave == 3 && address < 100) { value = address; return true; }
+        if (slave == 4) { value = 1; return true; }
+        return false;
+    }
+
+    void handle(const uint8_t* request) {
+        uint16_t crc = modbusCrc16(request, 6);
+        if (request[6] != (crc & 0xFF) || request[7] != (crc >> 8)) return;
+
+        SeenRequest r = {request[0], request[1],
+                         (uint16_t)((request[2] << 8) | request[3]),
+                         (uint16_t)((request[4] << 8) | request[5]), nowUs()};
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            seen.push_back(r);
+        }
+        if (r.slave > 4) return;    // nobody home
+
+        std::vector<uint8_t> reply = {r.slave, r.function, (uint8_t)(r.count * 2)};
+        for (uint16_t i = 0; i < r.count; i++) {
+            uint16_t value;
+            if (!registerValue(r.slave, r.function, r.start + i, value)) {
+                reply = {r.slave, (uint8_t)(r.function | 0x80), 0x02};   // illegal data address
+                break;
+            }
+            reply.push_back(value >> 8);
+            reply.push_back(value & 0xFF);
+        }
+        crc = modbusCrc16(reply.data(), reply.size());
+        reply.push_back(crc & 0xFF);
+        reply.push_back(r.slave == 4 ? ~(crc >> 8) : crc >> 8);
+
+        // A real slave only sees the end of a request after 3.5 characters
+        // of silence; the pty delivers it instantly
+        usleep(1750);
+        ssize_t written = ::write(fd, reply.data(), reply.size());
+        (void)written;
+    }
+
+    int fd;
+    std::mutex lock;
+    std::vector<SeenRequest> seen;
+};
+
+static void runCycle(ModbusMaster& master) {
+    master.startCycle();
+    uint32_t started = nowUs();
+    while (master.busy() && nowUs() - started < 5000000) {
+        master.poll(nowUs());
+        usleep(100);
+    }
+    CHECK(!master.busy());
+}
+
+static ModbusPoint point(uint8_t slave, uint8_t function, uint16_t address, uint8_t type, float scale = 1) {
+    ModbusPoint p = {slave, function, address, type, scale, 0, false};
+    return p;
+}
+
+int main() {
+    int masterFd = posix_openpt(O_RDWR | O_NOCTTY);
+    if (masterFd < 0 || grantpt(masterFd) != 0 || unlockpt(masterFd) != 0) {
+        perror("pty");
+        return 2;
+    }
+    int slaveFd = open(ptsname(masterFd), O_RDWR | O_NOCTTY);
+    if (slaveFd < 0) {
+        perror("pty slave");
+        return 2;
+    }
+    makeRaw(masterFd);
+    makeRaw(slaveFd);
+
+    SimulatedSlaves slaves(slaveFd);
+    std::thread slaveThread(&SimulatedSlaves::run, &slaves);
+
+    PtyPort port(masterFd);
+    ModbusMaster master(port);
+    master.begin(115200, 50000);
+
+    // Deliberately out of order: setPoints() sorts and coalesces
+    ModbusPoint points[] = {
+        point(1, 3, 10, MODBUS_U32),
+        point(2, 4, 5, MODBUS_U16),
+        point(1, 3, 2, MODBUS_F32),
+        point(1, 3, 0, MODBUS_U16, 0.1f),
+        point(1, 3, 1, MODBUS_I16),
+        point(2, 3, 5, MODBUS_U16),
+        point(1, 3, 12, MODBUS_F32_SWAPPED),
+        point(3, 3, 500, MODBUS_U16),
+        point(9, 3, 0, MODBUS_U16),
+        point(4, 3, 0, MODBUS_U16),
+        point(3, 3, 7, MODBUS_U16),
+    };
+    const uint8_t count = sizeof(points) / sizeof(points[0]);
+
+    // slave 1: 0-3 and 10-13 are adjacent -> 0..13 would need the gap 4-9,
+    // so two batches; slave 2: FC3 and FC4; slave 3: 7 and 500; 4; 9
+    uint8_t batches = master.setPoints(points, count);
+    CHECK(batches == 8);
+
+    runCycle(master);
+
+    std::vector<SeenRequest> seen = slaves.requests();
+    CHECK(seen.size() == 8);
+    CHECK(seen.size() >= 2 && seen[0].slave == 1 && seen[0].start == 0 && seen[0].count == 4);
+    CHECK(seen.size() >= 2 && seen[1].slave == 1 && seen[1].start == 10 && seen[1].count == 4);
+
+    CHECK(points[3].valid && points[3].value > 123.39f && points[3].value < 123.41f);
+    CHECK(points[4].valid && points[4].value == -2);
+    CHECK(points[2].valid && points[2].value == 21.5f);
+    CHECK(points[0].valid && points[0].value == 100000);
+    CHECK(points[6].valid && points[6].value == 21.5f);
+    CHECK(points[1].valid && points[1].value == 42);
+    CHECK(points[5].valid && points[5].value == 7);
+    CHECK(points[10].valid && points[10].value == 7);
+
+    // Exception, timeout and bad CRC fail only their own batch
+    CHECK(!points[7].valid);
+    CHECK(!points[8].valid);
+    CHECK(!points[9].valid);
+    CHECK(master.stats().exceptions == 1);
+    CHECK(master.stats().timeouts == 1);
+    CHECK(master.stats().crcErrors == 1);
+    CHECK(master.stats().responses == 5);
+    CHECK(port.transmitCount == 8);
+
+    // Each request starts at least 3.5 characters (1.75 ms above 19200
+    // baud) after the previous frame on the bus ended
+    for (size_t i = 1; i < seen.size(); i++) {
+        CHECK(seen[i].receivedUs - seen[i - 1].receivedUs >= 1750);
+    }
+
+    // A second cycle reuses the plan
+    runCycle(master);
+    CHECK(slaves.requests().size() == 16);
+    CHECK(master.stats().requests == 16);
+
+    // A gap splits a batch, and so does running past 125 registers
+    ModbusPoint gap[] = {point(1, 3, 0, MODBUS_U16), point(1, 3, 2, MODBUS_U16)};
+    CHECK(master.setPoints(gap, 2) == 2);
+    ModbusPoint run[MODBUS_MAX_POINTS];
+    for (uint8_t i = 0; i < MODBUS_MAX_POINTS; i++) {
+        run[i] = point(1, 3, i * 2, MODBUS_F32);
+    }
+    CHECK(master.setPoints(run, 62) == 1);
+    CHECK(master.setPoints(run, 63) == 2);
+
+    slaves.stop = true;
+    slaveThread.join();
+    close(slaveFd);
+    close(masterFd);
+
+    if (failures > 0) {
+        fprintf(stderr, "%d check(s) failed\n", failures);
+        return 1;
+    }
+    printf("modbus_rtu host test passed\n");
+    return 0;
+}
@@ -4,6 +4,9 @@ import { Calendar, Download, Settings } from 'lucide-react';
 import { apiService } from '../services/api';
 import { useTranslation } from 'react-i18next';
 
+// Upper bound on points per chart; the backend downsamples to this
+const MAX_CHART_POINTS = 1500;
+
 const computeStats = (series) => {
     const values = series
         .map(point => point.value)
@@ -95,7 +98,8 @@ function HistoricalChart({ deviceId, sensorPin, sensorName, sensorUnit }) {
                 sensorPin,
                 startDate.toISOString(),
                 endDate.toISOString(),
-                timeRange === '7d' || timeRange === '30d' ? 'hourly' : aggregation
+                timeRange === '7d' || timeRange === '30d' ? 'hourly' : aggregation,
+                MAX_CHART_POINTS
             );
 
             const rawPoints = Array.isArray(response)
@@ -124,10 +124,16 @@ export const apiService = {
 
     // Telemetry
     getLatestTelemetry: (deviceId) => apiClient.get(`/devices/${deviceId}/telemetry/latest`),
-    getHistoricalTelemetry: (deviceId, sensorPin, startDate, endDate, aggregation = 'raw') =>
+    getHistoricalTelemetry: (deviceId, sensorPin, startDate, endDate, aggregation = 'raw', maxPoints = null) =>
         apiClient
             .get(`/devices/${deviceId}/telemetry/history`, {
-                params: { sensor_pin: sensorPin, start_date: startDate, end_date: endDate, aggregation }
+                params: {
+                    sensor_pin: sensorPin,
+                    start_date: startDate,
+                    end_date: endDate,
+                    aggregation,
+                    ...(maxPoints ? { max_points: maxPoints } : {})
+                }
             })
             .then((data) => data?.telemetry || data?.history || data || []),
     getTelemetryStats: (deviceId, timeRange = '24h') =>
@@ -263,9 +269,9 @@ export const apiService = {
     updatePlatform: () => apiClient.post('/system/update'),
 
     // Export data
-    exportTelemetryData: (deviceId, startDate, endDate, format = 'csv') =>
-        apiClient.get(`/devices/${deviceId}/telemetry/export`, {
-            params: { start_date: startDate, end_date: endDate, format },
+    exportTelemetryData: (deviceId, startDate, endDate, format = 'csv', gzip = false) =>
+        apiClient.get(`/telemetry/devices/${deviceId}/export`, {
+            params: { start_time: startDate, end_time: endDate, format, gzip },
             responseType: 'blob'
         }),
 
@@ -118,6 +118,13 @@ class WebSocketService {
             this.notifyLocal(`device:${data.device_id}:telemetry`, data);
         });
 
+        // Coalesced frame: latest value per sensor since the previous frame
+        this.socket.on('telemetry_batch', (batch) => {
+            for (const update of batch.updates || []) {
+                this.notifyLocal(`device:${batch.device_id}:telemetry`, update);
+            }
+        });
+
         this.socket.on('device_status_update', (data) => {
             this.notifyLocal(`device:${data.device_id}:updated`, data);
         });